@@ -0,0 +1,393 @@
+/* Copyright (C) 2026  AbdAllah MEZITI
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+   USA. 
+*/
+#include <hwcore/atomic.h>
+#include <hwcore/cpuid.h>
+#include <hwcore/i8254.h>
+#include <hwcore/idt.h>
+#include <hwcore/irq.h>
+#include <hwcore/paging.h>
+#include <os/physmem.h>
+#include <os/kmem_vmm.h>
+
+#include "apic.h"
+
+
+/** IA32_APIC_BASE MSR: physical address of the local APIC registers */
+#define APIC_MSR_BASE         0x1b
+#define APIC_MSR_BASE_ENABLE  (1 << 11)
+
+/** Default physical address of the IOAPIC registers */
+#define IOAPIC_PADDR          0xfec00000
+
+/* Local APIC registers (offsets in the local APIC page) */
+#define LAPIC_ID              0x020
+#define LAPIC_TPR             0x080
+#define LAPIC_EOI             0x0b0
+#define LAPIC_SVR             0x0f0
+#define LAPIC_ICR_LOW         0x300
+#define LAPIC_ICR_HIGH        0x310
+#define LAPIC_LVT_TIMER       0x320
+#define LAPIC_LVT_LINT0       0x350
+#define LAPIC_LVT_ERROR       0x370
+#define LAPIC_TIMER_ICR       0x380
+#define LAPIC_TIMER_CCR       0x390
+#define LAPIC_TIMER_DCR       0x3e0
+
+#define LAPIC_SVR_ENABLE      (1 << 8)
+#define LAPIC_LVT_MASKED      (1 << 16)
+#define LAPIC_TIMER_PERIODIC  (1 << 17)
+#define LAPIC_TIMER_DIV_16    0x3
+
+/* Interrupt command register (see Intel x86 doc vol 3 section 10.6.1) */
+#define LAPIC_ICR_INIT        (5 << 8)
+#define LAPIC_ICR_STARTUP     (6 << 8)
+#define LAPIC_ICR_BUSY        (1 << 12)
+#define LAPIC_ICR_ASSERT      (1 << 14)
+#define LAPIC_ICR_ALL_BUT_SELF (3 << 18)
+
+/* IOAPIC registers (indirect access through REGSEL/WIN) */
+#define IOAPIC_REGSEL         0x00
+#define IOAPIC_WIN            0x10
+#define IOAPIC_REG_VER        0x01
+#define IOAPIC_REG_REDTBL(pin) (0x10 + 2*(pin))
+
+#define IOAPIC_REDIR_MASKED   (1 << 16)
+
+/** Duration of the local APIC timer calibration (in microseconds) */
+#define APIC_CALIBRATION_USEC 10000
+
+
+/** Virtual addresses where the local APIC and IOAPIC are mapped */
+static sos_vaddr_t lapic_vaddr, ioapic_vaddr;
+
+/** Number of IOAPIC redirection entries */
+static sos_ui32_t ioapic_nb_pins;
+
+/** Frequency of the local APIC timer count (bus clock / 16) */
+static sos_ui32_t lapic_timer_hz;
+
+/** Initial count of the periodic local APIC timer, 0 when stopped */
+static sos_ui32_t lapic_timer_count;
+
+sos_vaddr_t sos_apic_eoi_register;
+
+/* Defined in irq_wrappers.S */
+extern void sos_apic_spurious_wrapper(void);
+
+
+#define rdmsr(msr,lo,hi) \
+  asm volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr))
+#define wrmsr(msr,lo,hi) \
+  asm volatile("wrmsr" :: "a"(lo), "d"(hi), "c"(msr))
+
+
+static inline sos_ui32_t lapic_read(sos_ui32_t reg)
+{
+  return *(volatile sos_ui32_t*)(lapic_vaddr + reg);
+}
+
+static inline void lapic_write(sos_ui32_t reg, sos_ui32_t value)
+{
+  *(volatile sos_ui32_t*)(lapic_vaddr + reg) = value;
+}
+
+static inline sos_ui32_t ioapic_read(sos_ui32_t reg)
+{
+  *(volatile sos_ui32_t*)(ioapic_vaddr + IOAPIC_REGSEL) = reg;
+  return *(volatile sos_ui32_t*)(ioapic_vaddr + IOAPIC_WIN);
+}
+
+static inline void ioapic_write(sos_ui32_t reg, sos_ui32_t value)
+{
+  *(volatile sos_ui32_t*)(ioapic_vaddr + IOAPIC_REGSEL) = reg;
+  *(volatile sos_ui32_t*)(ioapic_vaddr + IOAPIC_WIN) = value;
+}
+
+
+/**
+ * Helper function to send an IPI and wait for the local APIC to
+ * accept it
+ */
+static void lapic_send_ipi(sos_ui32_t dest_apic_id, sos_ui32_t command)
+{
+  lapic_write(LAPIC_ICR_HIGH, dest_apic_id << 24);
+  lapic_write(LAPIC_ICR_LOW, command);
+  while (lapic_read(LAPIC_ICR_LOW) & LAPIC_ICR_BUSY)
+    sos_cpu_relax();
+}
+
+
+/**
+ * Helper function to enable the local APIC of the current CPU: accept
+ * all the interrupts, ignore the 8259 virtual wire and the APIC
+ * errors, and software-enable it
+ */
+static void lapic_cpu_enable(sos_ui32_t lvt_timer)
+{
+  sos_ui32_t msr_lo, msr_hi;
+
+  rdmsr(APIC_MSR_BASE, msr_lo, msr_hi);
+  wrmsr(APIC_MSR_BASE, msr_lo | APIC_MSR_BASE_ENABLE, msr_hi);
+
+  lapic_write(LAPIC_TPR, 0);
+  lapic_write(LAPIC_LVT_LINT0, LAPIC_LVT_MASKED);
+  lapic_write(LAPIC_LVT_ERROR, LAPIC_LVT_MASKED);
+  lapic_write(LAPIC_LVT_TIMER, lvt_timer);
+  lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | SOS_APIC_SPURIOUS_VECTOR);
+}
+
+
+/**
+ * Helper function to map a page of device registers in kernel space
+ *
+ * @return the virtual address of the page, or 0 upon failure
+ */
+static sos_vaddr_t map_device_page(sos_paddr_t paddr)
+{
+  sos_vaddr_t vaddr = sos_kmem_vmm_alloc(1, 0);
+  if (! vaddr)
+    return (sos_vaddr_t)NULL;
+
+  if (SOS_OK != sos_paging_map(paddr, vaddr, FALSE,
+			       SOS_VM_MAP_PROT_READ
+			       | SOS_VM_MAP_PROT_WRITE
+			       | SOS_VM_MAP_NOCACHE))
+    {
+      sos_kmem_vmm_free(vaddr);
+      return (sos_vaddr_t)NULL;
+    }
+
+  return vaddr;
+}
+
+
+/**
+ * Helper function to release the pages mapped by map_device_page()
+ */
+static void unmap_device_pages(void)
+{
+  if (lapic_vaddr)
+    sos_kmem_vmm_free(lapic_vaddr);
+  if (ioapic_vaddr)
+    sos_kmem_vmm_free(ioapic_vaddr);
+  lapic_vaddr = ioapic_vaddr = (sos_vaddr_t)NULL;
+}
+
+
+sos_ret_t sos_apic_subsystem_setup(void)
+{
+  sos_ui32_t msr_lo, msr_hi, pin, lapic_id, count;
+  sos_ui32_t saved_lint0, saved_svr;
+
+  lapic_timer_count = 0;
+  sos_apic_eoi_register = (sos_vaddr_t)NULL;
+  if (! sos_cpuid_has_features_edx(SOS_CPUID_FEAT_EDX_APIC
+				   | SOS_CPUID_FEAT_EDX_MSR))
+    return -SOS_ENOSUP;
+
+  /* Map the registers of the local APIC and of the IOAPIC */
+  rdmsr(APIC_MSR_BASE, msr_lo, msr_hi);
+  lapic_vaddr  = map_device_page(SOS_PAGE_ALIGN_INF(msr_lo));
+  ioapic_vaddr = map_device_page(IOAPIC_PADDR);
+  if (!lapic_vaddr || !ioapic_vaddr)
+    {
+      unmap_device_pages();
+      return -SOS_ENOMEM;
+    }
+
+  /* Enable the local APIC, with its timer masked. Keep the
+     configuration of the 8259 virtual wire, restored when the APIC
+     cannot be used */
+  wrmsr(APIC_MSR_BASE, msr_lo | APIC_MSR_BASE_ENABLE, msr_hi);
+  saved_lint0 = lapic_read(LAPIC_LVT_LINT0);
+  saved_svr   = lapic_read(LAPIC_SVR);
+  sos_idt_set_handler(SOS_APIC_SPURIOUS_VECTOR,
+		      (sos_vaddr_t) sos_apic_spurious_wrapper,
+		      0 /* CPL0 routine */);
+  lapic_cpu_enable(LAPIC_LVT_MASKED | (SOS_IRQ_BASE + SOS_IRQ_TIMER));
+
+  /* Calibrate the local APIC timer: count down from the maximum value
+     during a known delay measured by the 82c54 */
+  lapic_write(LAPIC_TIMER_DCR, LAPIC_TIMER_DIV_16);
+  lapic_write(LAPIC_TIMER_ICR, 0xffffffff);
+  sos_i8254_udelay(APIC_CALIBRATION_USEC);
+  count = 0xffffffff - lapic_read(LAPIC_TIMER_CCR);
+  lapic_write(LAPIC_TIMER_ICR, 0);
+
+  lapic_timer_hz = count * (1000000 / APIC_CALIBRATION_USEC);
+  if (! lapic_timer_hz)
+    {
+      /* The IRQs keep coming from the 8259 through LINT0 */
+      lapic_write(LAPIC_LVT_LINT0, saved_lint0);
+      lapic_write(LAPIC_SVR, saved_svr);
+      wrmsr(APIC_MSR_BASE, msr_lo, msr_hi);
+      unmap_device_pages();
+      return -SOS_EFATAL;
+    }
+
+  /* Route all the IOAPIC pins to this CPU with the same vectors as
+     the 8259 (fixed delivery, edge-triggered, active high), but keep
+     them masked: waiting for a correct handler */
+  lapic_id = lapic_read(LAPIC_ID) >> 24;
+  ioapic_nb_pins = ((ioapic_read(IOAPIC_REG_VER) >> 16) & 0xff) + 1;
+  for (pin = 0 ; pin < ioapic_nb_pins ; pin ++)
+    {
+      ioapic_write(IOAPIC_REG_REDTBL(pin) + 1, lapic_id << 24);
+      ioapic_write(IOAPIC_REG_REDTBL(pin),
+		   IOAPIC_REDIR_MASKED | ((SOS_IRQ_BASE + pin) & 0xff));
+    }
+
+  /* From now on, the IRQ wrappers acknowledge the local APIC */
+  sos_apic_eoi_register = lapic_vaddr + LAPIC_EOI;
+  return SOS_OK;
+}
+
+
+sos_bool_t sos_apic_is_present(void)
+{
+  return (sos_apic_eoi_register != (sos_vaddr_t)NULL);
+}
+
+
+sos_ret_t sos_apic_enable_irq_line(int numirq)
+{
+  if ((numirq < 0) || (numirq >= SOS_IRQ_NUM))
+    return -SOS_EINVAL;
+
+  if (numirq == SOS_IRQ_TIMER)
+    lapic_write(LAPIC_LVT_TIMER,
+		lapic_read(LAPIC_LVT_TIMER) & ~LAPIC_LVT_MASKED);
+  else if (numirq < ioapic_nb_pins)
+    ioapic_write(IOAPIC_REG_REDTBL(numirq),
+		 ioapic_read(IOAPIC_REG_REDTBL(numirq))
+		 & ~IOAPIC_REDIR_MASKED);
+  else
+    return -SOS_EINVAL;
+
+  return SOS_OK;
+}
+
+
+sos_ret_t sos_apic_disable_irq_line(int numirq)
+{
+  if ((numirq < 0) || (numirq >= SOS_IRQ_NUM))
+    return -SOS_EINVAL;
+
+  if (numirq == SOS_IRQ_TIMER)
+    lapic_write(LAPIC_LVT_TIMER,
+		lapic_read(LAPIC_LVT_TIMER) | LAPIC_LVT_MASKED);
+  else if (numirq < ioapic_nb_pins)
+    ioapic_write(IOAPIC_REG_REDTBL(numirq),
+		 ioapic_read(IOAPIC_REG_REDTBL(numirq))
+		 | IOAPIC_REDIR_MASKED);
+  else
+    return -SOS_EINVAL;
+
+  return SOS_OK;
+}
+
+
+sos_ret_t sos_apic_timer_set_frequency(unsigned int freq)
+{
+  sos_ui32_t count;
+
+  if (! sos_apic_is_present())
+    return -SOS_ENOSUP;
+  if (freq <= 0)
+    return -SOS_EINVAL;
+
+  count = lapic_timer_hz / freq;
+  if (count <= 0)
+    return -SOS_EINVAL;
+
+  /* Periodic mode, keeping the mask as set by the IRQ subsystem */
+  lapic_write(LAPIC_LVT_TIMER,
+	      (lapic_read(LAPIC_LVT_TIMER) & LAPIC_LVT_MASKED)
+	      | LAPIC_TIMER_PERIODIC
+	      | (SOS_IRQ_BASE + SOS_IRQ_TIMER));
+  lapic_write(LAPIC_TIMER_DCR, LAPIC_TIMER_DIV_16);
+  lapic_write(LAPIC_TIMER_ICR, count);
+  lapic_timer_count = count;
+
+  return SOS_OK;
+}
+
+
+sos_ui32_t sos_apic_get_id(void)
+{
+  return lapic_read(LAPIC_ID) >> 24;
+}
+
+
+void sos_apic_send_ipi_all_but_self(sos_ui32_t vector)
+{
+  lapic_send_ipi(0, LAPIC_ICR_ALL_BUT_SELF | LAPIC_ICR_ASSERT | vector);
+}
+
+
+void sos_apic_eoi(void)
+{
+  lapic_write(LAPIC_EOI, 0);
+}
+
+
+sos_ret_t sos_apic_cpu_setup(void)
+{
+  if (! sos_apic_is_present())
+    return -SOS_ENOSUP;
+
+  /* All the local APICs are at the same physical address, hence at
+     the same virtual address */
+  if (lapic_timer_count > 0)
+    {
+      lapic_cpu_enable(LAPIC_TIMER_PERIODIC | (SOS_IRQ_BASE + SOS_IRQ_TIMER));
+      lapic_write(LAPIC_TIMER_DCR, LAPIC_TIMER_DIV_16);
+      lapic_write(LAPIC_TIMER_ICR, lapic_timer_count);
+    }
+  else
+    lapic_cpu_enable(LAPIC_LVT_MASKED | (SOS_IRQ_BASE + SOS_IRQ_TIMER));
+
+  return SOS_OK;
+}
+
+
+sos_ret_t sos_apic_start_aps(sos_paddr_t trampoline_paddr)
+{
+  sos_ui32_t vector = trampoline_paddr >> SOS_PAGE_SHIFT;
+
+  if (! sos_apic_is_present())
+    return -SOS_ENOSUP;
+  if ((trampoline_paddr & (SOS_PAGE_SIZE - 1))
+      || (trampoline_paddr >= 0x100000))
+    return -SOS_EINVAL;
+
+  /* INIT-SIPI-SIPI sequence, see Intel x86 doc vol 3 section 8.4.4.1 */
+  lapic_send_ipi(0, LAPIC_ICR_ALL_BUT_SELF | LAPIC_ICR_ASSERT
+		    | LAPIC_ICR_INIT);
+  sos_i8254_udelay(10000);
+
+  lapic_send_ipi(0, LAPIC_ICR_ALL_BUT_SELF | LAPIC_ICR_ASSERT
+		    | LAPIC_ICR_STARTUP | vector);
+  sos_i8254_udelay(200);
+
+  lapic_send_ipi(0, LAPIC_ICR_ALL_BUT_SELF | LAPIC_ICR_ASSERT
+		    | LAPIC_ICR_STARTUP | vector);
+  sos_i8254_udelay(200);
+
+  return SOS_OK;
+}
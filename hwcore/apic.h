@@ -0,0 +1,117 @@
+/* Copyright (C) 2026  AbdAllah MEZITI
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+   USA. 
+*/
+#ifndef _SOS_APIC_H_
+#define _SOS_APIC_H_
+
+/**
+ * @file apic.h
+ *
+ * Local APIC (xAPIC mode) and IOAPIC interrupt controllers. When
+ * available, they replace the 8259 PIC (which is then fully masked)
+ * to deliver the IRQs, and the local APIC timer replaces the 82c54 to
+ * raise the timer IRQ. See Intel x86 doc vol 3 chapter 10, and the
+ * Intel 82093AA IOAPIC datasheet.
+ *
+ * The IRQ levels keep their ISA numbering (see irq.h): they are
+ * delivered with the same vectors as through the 8259.
+ *
+ * @note The ACPI MADT is not parsed: the IOAPIC is expected at its
+ * default address, with the usual PC (and QEMU) routing of the ISA
+ * IRQs (IRQ0 on pin 2, the others identity-mapped). Should only be
+ * used by irq.c and smp.c.
+ */
+
+#include <os/types.h>
+#include <os/errno.h>
+
+
+/** Vector of the spurious interrupts of the local APIC */
+#define SOS_APIC_SPURIOUS_VECTOR 0xff
+
+/** Vector of the TLB shootdown IPIs (see smp.h) */
+#define SOS_APIC_TLB_VECTOR      0xfd
+
+
+/**
+ * Map the local APIC and IOAPIC registers, enable the local APIC,
+ * mask all the IOAPIC entries and calibrate the local APIC timer
+ * against the 82c54. MUST be called after the kernel virtual memory
+ * allocator is set up, with IRQs disabled.
+ *
+ * @return -SOS_ENOSUP when the CPU has no local APIC
+ */
+sos_ret_t sos_apic_subsystem_setup(void);
+
+
+/**
+ * @return TRUE when sos_apic_subsystem_setup() succeeded
+ */
+sos_bool_t sos_apic_is_present(void);
+
+
+/** Unmask the given IRQ line (the local APIC timer for the timer IRQ) */
+sos_ret_t sos_apic_enable_irq_line(int numirq);
+
+/** Mask the given IRQ line (the local APIC timer for the timer IRQ) */
+sos_ret_t sos_apic_disable_irq_line(int numirq);
+
+
+/**
+ * Configure the local APIC timer to raise the timer IRQ on a
+ * periodic basis, as given by the freq parameter.
+ */
+sos_ret_t sos_apic_timer_set_frequency(unsigned int freq);
+
+
+/** @return the local APIC identifier of the current CPU */
+sos_ui32_t sos_apic_get_id(void);
+
+
+/** Send an IPI with the given vector to all the other CPUs */
+void sos_apic_send_ipi_all_but_self(sos_ui32_t vector);
+
+
+/** Signal the end of the interrupt being serviced by the current CPU */
+void sos_apic_eoi(void);
+
+
+/**
+ * Enable the local APIC of the current application processor, with
+ * its timer configured as on the boot CPU. To be called by each
+ * application processor once the boot CPU set up the APIC subsystem.
+ */
+sos_ret_t sos_apic_cpu_setup(void);
+
+
+/**
+ * Broadcast the INIT-SIPI-SIPI sequence to all the other CPUs: they
+ * start executing the real-mode code at the given physical
+ * address. MUST be called with IRQs disabled.
+ *
+ * @param trampoline_paddr Page-aligned address below 1MB
+ */
+sos_ret_t sos_apic_start_aps(sos_paddr_t trampoline_paddr);
+
+
+/**
+ * Address of the EOI register of the local APIC, or 0 when the
+ * local APIC is not used. Shared with irq_wrappers.S
+ */
+extern sos_vaddr_t sos_apic_eoi_register;
+
+#endif /* _SOS_APIC_H_ */
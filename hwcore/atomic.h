@@ -0,0 +1,113 @@
+/* Copyright (C) 2026  AbdAllah MEZITI
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+   USA. 
+*/
+#ifndef _SOS_ATOMIC_H_
+#define _SOS_ATOMIC_H_
+
+/**
+ * @file atomic.h
+ *
+ * Atomic operations on 32bits words, and memory barriers, for x86
+ * SMP. The read-modify-write operations use the "lock" prefix: they
+ * are atomic with respect to the other CPUs, and are full memory
+ * barriers.
+ *
+ * @see Intel x86 doc vol 3, section 8.1 (locked atomic operations)
+ * and 8.2 (memory ordering)
+ */
+
+#include <os/types.h>
+
+
+/** Prevent the compiler from moving memory accesses across it */
+#define sos_barrier() asm volatile("" ::: "memory")
+
+/** Full memory barrier. "lock addl" works on all the IA-32 CPUs,
+    unlike mfence (SSE2) */
+#define sos_mb()      asm volatile("lock; addl $0,(%%esp)" ::: "memory")
+
+/** Read barrier: x86 does not reorder loads with other loads */
+#define sos_rmb()     sos_barrier()
+
+/** Write barrier: x86 does not reorder stores with other stores */
+#define sos_wmb()     sos_barrier()
+
+/** To be used in busy-wait loops: relax the CPU (and its sibling
+    hyperthread) */
+#define sos_cpu_relax() asm volatile("pause" ::: "memory")
+
+
+/** Atomically store val in *ptr. @return the previous value */
+static inline sos_ui32_t sos_atomic_xchg(volatile sos_ui32_t *ptr,
+					 sos_ui32_t val)
+{
+  asm volatile("xchgl %0, %1" /* Implicitly locked */
+	       : "+r"(val), "+m"(*ptr)
+	       :: "memory");
+  return val;
+}
+
+
+/**
+ * Atomically store new_val in *ptr if *ptr == old_val
+ *
+ * @return the previous value of *ptr: the operation succeeded iff it
+ * is old_val
+ */
+static inline sos_ui32_t sos_atomic_cmpxchg(volatile sos_ui32_t *ptr,
+					    sos_ui32_t old_val,
+					    sos_ui32_t new_val)
+{
+  sos_ui32_t prev;
+  asm volatile("lock; cmpxchgl %2, %1"
+	       : "=a"(prev), "+m"(*ptr)
+	       : "r"(new_val), "0"(old_val)
+	       : "memory");
+  return prev;
+}
+
+
+/** Atomically add inc to *ptr. @return the previous value */
+static inline sos_ui32_t sos_atomic_xadd(volatile sos_ui32_t *ptr,
+					 sos_si32_t inc)
+{
+  sos_ui32_t prev = inc;
+  asm volatile("lock; xaddl %0, %1"
+	       : "+r"(prev), "+m"(*ptr)
+	       :: "memory");
+  return prev;
+}
+
+
+/** Atomically increment *ptr */
+static inline void sos_atomic_inc(volatile sos_ui32_t *ptr)
+{
+  asm volatile("lock; incl %0" : "+m"(*ptr) :: "memory");
+}
+
+
+/** Atomically decrement *ptr. @return TRUE when it reached 0 */
+static inline sos_bool_t sos_atomic_dec_and_test(volatile sos_ui32_t *ptr)
+{
+  unsigned char is_zero;
+  asm volatile("lock; decl %0; sete %1"
+	       : "+m"(*ptr), "=qm"(is_zero)
+	       :: "memory");
+  return is_zero ? TRUE : FALSE;
+}
+
+#endif /* _SOS_ATOMIC_H_ */
@@ -97,6 +97,27 @@ struct sos_cpu_kstate
 } __attribute__((packed));
 
 
+/**
+ * Structure of the context of a kernel thread saved by
+ * sos_cpu_kstate_switch(): the callee-saved registers and eflags, as
+ * pushed by cpu_context_switch.S, and the address to return to
+ *
+ * @note IMPORTANT: This definition MUST be consistent with
+ * cpu_context_switch.S
+ */
+struct sos_cpu_kstate_lean
+{
+  /* (Lower addresses) */
+  sos_ui32_t  ebx;
+  sos_ui32_t  esi;
+  sos_ui32_t  edi;
+  sos_ui32_t  ebp;
+  sos_ui32_t  eflags;
+  sos_vaddr_t eip;
+  /* (Higher addresses) */
+} __attribute__((packed));
+
+
 /**
  * THE main operation of a kernel thread. This routine calls the
  * kernel thread function start_func and calls exit_func when
@@ -130,7 +151,7 @@ sos_ret_t sos_cpu_kstate_init(struct sos_cpu_state **ctxt,
 			      sos_ui32_t  exit_arg)
 {
   /* We are initializing a Kernel thread's context */
-  struct sos_cpu_kstate *kctxt;
+  struct sos_cpu_kstate_lean *kctxt;
 
   /* This is a critical internal function, so that it is assumed that
      the caller knows what he does: we legitimally assume that values
@@ -180,29 +201,20 @@ sos_ret_t sos_cpu_kstate_init(struct sos_cpu_state **ctxt,
 
   /* Compute the base address of the structure, which must be located
      below the previous elements */
-  tmp_vaddr  = ((sos_vaddr_t)stack) - sizeof(struct sos_cpu_kstate);
-  kctxt = (struct sos_cpu_kstate*)tmp_vaddr;
+  tmp_vaddr  = ((sos_vaddr_t)stack) - sizeof(struct sos_cpu_kstate_lean);
+  kctxt = (struct sos_cpu_kstate_lean*)tmp_vaddr;
 
   /* Initialize the CPU context structure */
-  memset(kctxt, 0x0, sizeof(struct sos_cpu_kstate));
+  memset(kctxt, 0x0, sizeof(struct sos_cpu_kstate_lean));
 
   /* Tell the CPU context structure that the first instruction to
-     execute will be that of the core_routine() function */
-  kctxt->regs.eip = (sos_ui32_t)core_routine;
-
-  /* Setup the segment registers */
-  kctxt->regs.cs
-    = SOS_BUILD_SEGMENT_REG_VALUE(0, FALSE, SOS_SEG_KCODE); /* Code */
-  kctxt->regs.ds
-    = SOS_BUILD_SEGMENT_REG_VALUE(0, FALSE, SOS_SEG_KDATA); /* Data */
-  kctxt->regs.es
-    = SOS_BUILD_SEGMENT_REG_VALUE(0, FALSE, SOS_SEG_KDATA); /* Data */
-  kctxt->regs.cpl0_ss
-    = SOS_BUILD_SEGMENT_REG_VALUE(0, FALSE, SOS_SEG_KDATA); /* Stack */
-  /* fs and gs unused for the moment. */
+     execute will be that of the core_routine() function: the ret of
+     sos_cpu_kstate_switch() jumps there. The segment registers are
+     those of the kernel, which the lean switch leaves untouched */
+  kctxt->eip = (sos_ui32_t)core_routine;
 
   /* The newly created context is initially interruptible */
-  kctxt->regs.eflags = (1 << 9); /* set IF bit */
+  kctxt->eflags = (1 << 9); /* set IF bit */
 
   /* Finally, update the generic kernel/user thread context */
   *ctxt = (struct sos_cpu_state*) kctxt;
@@ -238,7 +250,7 @@ sos_cpu_state_detect_kernel_stack_overflow(const struct sos_cpu_state *ctxt,
      context of a user thread). Here we make sure that this stack
      pointer is within the allowed stack area */
   SOS_ASSERT_FATAL(((sos_vaddr_t)ctxt) >= stack_bottom);
-  SOS_ASSERT_FATAL(((sos_vaddr_t)ctxt) + sizeof(struct sos_cpu_kstate)
+  SOS_ASSERT_FATAL(((sos_vaddr_t)ctxt) + sizeof(struct sos_cpu_kstate_lean)
 		   <= stack_bottom + stack_size);
 
   /* Check that the bottom of the stack has not been altered */
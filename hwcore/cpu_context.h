@@ -83,6 +83,9 @@ typedef void (sos_cpu_kstate_function_arg1_t(sos_ui32_t arg1));
  * @param exit_arg The argument passed to the function exit_func.
  *
  * @note the newly created context is INTERRUPTIBLE by default !
+ *
+ * @note the newly created context is a lean one, to be restored by
+ * sos_cpu_kstate_switch() or sos_cpu_kstate_exit_to()
  */
 sos_ret_t sos_cpu_kstate_init(struct sos_cpu_state **kctxt,
 			      sos_cpu_kstate_function_arg1_t *start_func,
@@ -127,6 +130,32 @@ sos_cpu_context_exit_to(struct sos_cpu_state *switch_to_ctxt,
 			sos_cpu_kstate_function_arg1_t *reclaiming_func,
 			sos_ui32_t reclaiming_arg) __attribute__((noreturn));
 
+
+/**
+ * Lean version of sos_cpu_context_switch() for the switches between
+ * two KERNEL threads: only the callee-saved registers, eflags and the
+ * return address are saved, the segment registers are left untouched
+ * and the context is resumed with a ret instead of an iret.
+ *
+ * @note The contexts saved by sos_cpu_kstate_switch() and initialized
+ * by sos_cpu_kstate_init() can ONLY be restored by
+ * sos_cpu_kstate_switch() or sos_cpu_kstate_exit_to(). The full frame
+ * functions above remain for the contexts that need it (user
+ * threads).
+ */
+void sos_cpu_kstate_switch(struct sos_cpu_state **from_ctxt,
+			   struct sos_cpu_state *to_ctxt);
+
+
+/**
+ * Lean version of sos_cpu_context_exit_to() (see
+ * sos_cpu_kstate_switch())
+ */
+void
+sos_cpu_kstate_exit_to(struct sos_cpu_state *switch_to_ctxt,
+		       sos_cpu_kstate_function_arg1_t *reclaiming_func,
+		       sos_ui32_t reclaiming_arg) __attribute__((noreturn));
+
 /* =======================================================================
  * Public Accessor functions
  */
@@ -0,0 +1,65 @@
+/* Copyright (C) 2026  AbdAllah MEZITI
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+   USA. 
+*/
+#ifndef _SOS_CPUID_H_
+#define _SOS_CPUID_H_
+
+/**
+ * @file cpuid.h
+ *
+ * Intel-specific CPU identification and feature detection.
+ */
+
+#include <os/types.h>
+
+
+/** Feature flags returned in EDX by the CPUID leaf 1 */
+#define SOS_CPUID_FEAT_EDX_TSC   (1 << 4)
+#define SOS_CPUID_FEAT_EDX_MSR   (1 << 5)
+#define SOS_CPUID_FEAT_EDX_APIC  (1 << 9)
+#define SOS_CPUID_FEAT_EDX_FXSR  (1 << 24)
+#define SOS_CPUID_FEAT_EDX_SSE   (1 << 25)
+#define SOS_CPUID_FEAT_EDX_SSE2  (1 << 26)
+
+
+/**
+ * Execute the CPUID instruction for the given leaf
+ */
+static inline void sos_cpuid(sos_ui32_t leaf,
+			     /* out */sos_ui32_t *eax,
+			     /* out */sos_ui32_t *ebx,
+			     /* out */sos_ui32_t *ecx,
+			     /* out */sos_ui32_t *edx)
+{
+  asm volatile ("cpuid"
+		: "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+		: "a"(leaf), "c"(0));
+}
+
+
+/**
+ * @return TRUE when all the given SOS_CPUID_FEAT_EDX_* features are
+ * supported by the CPU
+ */
+static inline sos_bool_t sos_cpuid_has_features_edx(sos_ui32_t features)
+{
+  sos_ui32_t eax, ebx, ecx, edx;
+  sos_cpuid(1, & eax, & ebx, & ecx, & edx);
+  return ((edx & features) == features);
+}
+
+#endif /* _SOS_CPUID_H_ */
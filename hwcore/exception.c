@@ -18,6 +18,10 @@
 */
 #include "idt.h"
 #include "irq.h"
+#include "gdt.h"
+#include "segment.h"
+#include "smp.h"
+#include "fpu.h"
 
 #include <os/assert.h>
 #include "exception.h"
@@ -78,6 +82,16 @@ static void sos_generic_ex(int exid, const struct sos_cpu_state *ctxt)
 }
 
 
+/* Device not available: first FPU instruction of a thread since it
+   got the CPU (see fpu.h) */
+static void device_not_available_ex(int exid,
+				    const struct sos_cpu_state *ctxt)
+{
+  if (SOS_OK != sos_fpu_device_not_available())
+    sos_generic_ex(exid, ctxt);
+}
+
+
 sos_ret_t sos_exception_subsystem_setup(void)
 {
   sos_ret_t retval;
@@ -96,6 +110,11 @@ sos_ret_t sos_exception_subsystem_setup(void)
 	return retval;
     }
 
+  retval = sos_exception_set_routine(SOS_EXCEPT_DEVICE_NOT_AVAILABLE,
+				     device_not_available_ex);
+  if (SOS_OK != retval)
+    return retval;
+
   /* We indicate that the double fault exception handler is defined,
      and give its address. this handler is a do-nothing handler (see
      exception_wrappers.S), and it can NOT be overriden by the
@@ -106,6 +125,47 @@ sos_ret_t sos_exception_subsystem_setup(void)
 }
 
 
+/**
+ * Routine of the double fault task of each CPU (see gdt.h). It runs
+ * on its own stack, so that it works even when the double fault is
+ * due to an overflow of the kernel stack: the processor could not
+ * push the frame of the first exception on it.
+ */
+static void double_fault_task(void) __attribute__((noreturn));
+static void double_fault_task(void)
+{
+  sos_vaddr_t eip, esp;
+
+  sos_gdt_get_interrupted_task(sos_smp_get_cpu_id(), & eip, & esp);
+  sos_display_fatal_error("Double fault in Kernel at instruction 0x%x"
+			  " with esp=0x%x (kernel stack overflow ?)",
+			  (unsigned)eip, (unsigned)esp);
+  for (;;)
+    asm volatile ("cli ; hlt");
+}
+
+
+sos_ret_t sos_exception_cpu_setup_double_fault_task(void)
+{
+  sos_ret_t retval;
+  sos_ui32_t flags;
+
+  retval = sos_gdt_cpu_setup_double_fault_task(sos_smp_get_cpu_id(),
+					       (sos_vaddr_t)double_fault_task);
+  if (SOS_OK != retval)
+    return retval;
+
+  /* The IDT is shared: the selector designates the TSS of the CPU
+     taking the double fault */
+  sos_disable_IRQs(flags);
+  retval = sos_idt_set_task_gate(SOS_EXCEPT_BASE + SOS_EXCEPT_DOUBLE_FAULT,
+				 SOS_BUILD_SEGMENT_REG_VALUE(0, FALSE,
+							     SOS_SEG_DF_TSS));
+  sos_restore_IRQs(flags);
+  return retval;
+}
+
+
 sos_ret_t sos_exception_set_routine(int exception_number,
 				    sos_exception_handler_t routine)
 {
@@ -78,6 +78,14 @@ sos_ret_t sos_exception_set_routine(int exception_number,
 				    sos_exception_handler_t routine);
 sos_exception_handler_t sos_exception_get_routine(int exception_number);
 
+/**
+ * Handle the double faults of the current CPU in a separate hardware
+ * task with its own stack, instead of the default handler (see
+ * exception_wrappers.S) that needs a valid stack to start. To be
+ * called by each CPU once paging is enabled.
+ */
+sos_ret_t sos_exception_cpu_setup_double_fault_task(void);
+
 const char * sos_exception_get_name(int exception_number);
 #endif /* ! ASM_SOURCE */
 
@@ -0,0 +1,240 @@
+/* Copyright (C) 2026  AbdAllah MEZITI
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+   USA. 
+*/
+#include <os/assert.h>
+#include <os/macros.h>
+#include <hwcore/cpuid.h>
+#include <hwcore/irq.h>
+#include <hwcore/smp.h>
+
+#include "fpu.h"
+
+
+/* Control register flags, see Intel x86 doc vol 3 section 2.5 */
+#define FPU_CR0_MP         (1 << 1)  /**< Monitor coprocessor */
+#define FPU_CR0_EM         (1 << 2)  /**< Emulation */
+#define FPU_CR0_TS         (1 << 3)  /**< Task switched */
+#define FPU_CR0_NE         (1 << 5)  /**< Native FPU errors */
+#define FPU_CR4_OSFXSR     (1 << 9)  /**< FXSAVE/FXRSTOR and SSE */
+#define FPU_CR4_OSXMMEXCPT (1 << 10) /**< SSE exceptions */
+
+/** Default value of MXCSR: all the SSE exceptions masked */
+#define FPU_MXCSR_DEFAULT  0x1f80
+
+
+/** TRUE when the FPU contexts are switched (FXSAVE available) */
+static sos_bool_t fpu_lazy;
+
+/** TRUE when the CPUs have SSE, SSE2 */
+static sos_bool_t fpu_sse, fpu_sse2;
+
+
+static inline sos_ui32_t fpu_get_cr0(void)
+{
+  sos_ui32_t cr0;
+  asm volatile ("movl %%cr0, %0" : "=r"(cr0));
+  return cr0;
+}
+
+
+/** Make the next FPU instruction raise #NM */
+static inline void fpu_set_ts(void)
+{
+  asm volatile ("movl %%cr0, %%eax\n\t"
+		"orl  %0, %%eax\n\t"
+		"movl %%eax, %%cr0"
+		: : "i"(FPU_CR0_TS) : "eax", "memory");
+}
+
+
+static inline void fpu_clear_ts(void)
+{
+  asm volatile ("clts" : : : "memory");
+}
+
+
+static inline void *fpu_fxsave_area(struct sos_fpu_state *fpu_state)
+{
+  return (void*)SOS_ALIGN_SUP(fpu_state->fxsave_area, 16);
+}
+
+
+static inline void fpu_save(struct sos_fpu_state *fpu_state)
+{
+  asm volatile ("fxsave (%0)" : : "r"(fpu_fxsave_area(fpu_state))
+		: "memory");
+  fpu_state->saved = TRUE;
+}
+
+
+static inline void fpu_restore(struct sos_fpu_state *fpu_state)
+{
+  asm volatile ("fxrstor (%0)" : : "r"(fpu_fxsave_area(fpu_state))
+		: "memory");
+}
+
+
+/** Load the state of the FPU after reset */
+static inline void fpu_reset(void)
+{
+  sos_ui32_t mxcsr = FPU_MXCSR_DEFAULT;
+
+  asm volatile ("fninit" : : : "memory");
+  if (fpu_sse)
+    asm volatile ("ldmxcsr %0" : : "m"(mxcsr));
+}
+
+
+sos_ret_t sos_fpu_subsystem_setup(void)
+{
+  fpu_lazy = sos_cpuid_has_features_edx(SOS_CPUID_FEAT_EDX_FXSR);
+  fpu_sse  = fpu_lazy
+    && sos_cpuid_has_features_edx(SOS_CPUID_FEAT_EDX_SSE);
+  fpu_sse2 = fpu_sse
+    && sos_cpuid_has_features_edx(SOS_CPUID_FEAT_EDX_SSE2);
+
+  return sos_fpu_cpu_setup();
+}
+
+
+sos_ret_t sos_fpu_cpu_setup(void)
+{
+  sos_ui32_t cr;
+
+  sos_cpu_local()->fpu_state          = NULL;
+  sos_cpu_local()->fpu_kernel_section = FALSE;
+  if (! fpu_lazy)
+    return -SOS_ENOSUP;
+
+  /* Native x87, whose instructions fault when TS is set */
+  cr = fpu_get_cr0();
+  cr = (cr | FPU_CR0_MP | FPU_CR0_NE) & ~(FPU_CR0_EM | FPU_CR0_TS);
+  asm volatile ("movl %0, %%cr0" : : "r"(cr));
+
+  asm volatile ("movl %%cr4, %0" : "=r"(cr));
+  cr |= FPU_CR4_OSFXSR;
+  if (fpu_sse)
+    cr |= FPU_CR4_OSXMMEXCPT;
+  asm volatile ("movl %0, %%cr4" : : "r"(cr));
+
+  fpu_reset();
+
+  /* Nobody owns the FPU */
+  fpu_set_ts();
+  return SOS_OK;
+}
+
+
+void sos_fpu_state_init(struct sos_fpu_state *fpu_state)
+{
+  fpu_state->saved = FALSE;
+}
+
+
+void sos_fpu_switch(struct sos_fpu_state *from,
+		    struct sos_fpu_state *to)
+{
+  if (fpu_lazy && ! (fpu_get_cr0() & FPU_CR0_TS))
+    {
+      /* The FPU was used since the previous switch */
+      if (from)
+	fpu_save(from);
+      fpu_set_ts();
+    }
+
+  sos_cpu_local()->fpu_state = to;
+}
+
+
+sos_ret_t sos_fpu_device_not_available(void)
+{
+  struct sos_fpu_state *fpu_state;
+  sos_ui32_t flags;
+
+  if (! fpu_lazy)
+    return -SOS_ENOSUP;
+
+  sos_disable_IRQs(flags);
+  fpu_clear_ts();
+
+  fpu_state = sos_cpu_local()->fpu_state;
+  if (fpu_state && fpu_state->saved)
+    fpu_restore(fpu_state);
+  else
+    fpu_reset();
+  sos_restore_IRQs(flags);
+
+  return SOS_OK;
+}
+
+
+sos_ret_t sos_kernel_fpu_begin(void)
+{
+  struct sos_cpu_local *cpu;
+  sos_ui32_t flags;
+
+  if (! fpu_sse)
+    return -SOS_ENOSUP;
+
+  sos_disable_IRQs(flags);
+  cpu = sos_cpu_local();
+  if (cpu->fpu_kernel_section)
+    {
+      sos_restore_IRQs(flags);
+      return -SOS_EBUSY;
+    }
+
+  if (! (fpu_get_cr0() & FPU_CR0_TS))
+    {
+      /* The current thread is using the FPU */
+      if (cpu->fpu_state)
+	fpu_save(cpu->fpu_state);
+    }
+  else
+    fpu_clear_ts();
+
+  cpu->fpu_kernel_section   = TRUE;
+  cpu->fpu_kernel_irq_flags = flags;
+  return SOS_OK;
+}
+
+
+void sos_kernel_fpu_end(void)
+{
+  struct sos_cpu_local *cpu = sos_cpu_local();
+  sos_ui32_t flags;
+
+  SOS_ASSERT_FATAL(cpu->fpu_kernel_section);
+  flags = cpu->fpu_kernel_irq_flags;
+  cpu->fpu_kernel_section = FALSE;
+
+  /* The next FPU instruction of the thread restores its context */
+  fpu_set_ts();
+  sos_restore_IRQs(flags);
+}
+
+
+sos_bool_t sos_fpu_has_sse(void)
+{
+  return fpu_sse;
+}
+
+
+sos_bool_t sos_fpu_has_sse2(void)
+{
+  return fpu_sse2;
+}
@@ -0,0 +1,127 @@
+/* Copyright (C) 2026  AbdAllah MEZITI
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+   USA. 
+*/
+#ifndef _SOS_FPU_H_
+#define _SOS_FPU_H_
+
+/**
+ * @file fpu.h
+ *
+ * Lazy switching of the x87/SSE context of the threads. At each
+ * context switch, the CR0.TS flag is set: the first FPU/SSE
+ * instruction of the next thread raises a "device not available"
+ * exception (see exception.c), which clears the flag and restores the
+ * context of the thread (FXRSTOR), or initializes a fresh one the
+ * first time. The context is saved (FXSAVE) on the next switch only
+ * when the thread actually used the FPU meanwhile: the threads that
+ * never use it cost nothing but the TS flag. As the context is saved
+ * on every switch after use, a thread may migrate to another CPU.
+ *
+ * Kernel code may use the SSE registers in short sections enclosed
+ * by sos_kernel_fpu_begin()/sos_kernel_fpu_end(), even in IRQ
+ * handlers.
+ *
+ * Without FXSAVE/FXRSTOR (CPUs older than the Pentium II), nothing is
+ * switched and the FPU MUST NOT be used.
+ */
+
+#include <os/types.h>
+#include <os/errno.h>
+
+
+/** Size of the FXSAVE area */
+#define SOS_FPU_FXSAVE_SIZE 512
+
+
+/** The saved x87/SSE context of a thread. Don't access its fields
+    directly */
+struct sos_fpu_state
+{
+  /** The FXSAVE area, which must be 16-bytes aligned: it starts at
+      the first aligned byte */
+  sos_ui8_t fxsave_area[SOS_FPU_FXSAVE_SIZE + 15];
+
+  /** FALSE as long as the context was never saved */
+  sos_bool_t saved;
+};
+
+
+/**
+ * Detect the FPU features and set up the FPU of the boot CPU. MUST be
+ * called before the thread subsystem is set up.
+ */
+sos_ret_t sos_fpu_subsystem_setup(void);
+
+
+/**
+ * Set up the FPU of the current AP, once sos_fpu_subsystem_setup()
+ * has been called by the boot CPU
+ */
+sos_ret_t sos_fpu_cpu_setup(void);
+
+
+/** Initialize the FPU context of a new thread: it is fresh until the
+    thread uses the FPU */
+void sos_fpu_state_init(struct sos_fpu_state *fpu_state);
+
+
+/**
+ * Called right before a context switch, with the IRQs disabled:
+ * save the context of the FPU in from when it was used since the
+ * previous switch, and arm the lazy restore of to.
+ *
+ * @param from The FPU context of the thread losing the CPU, NULL when
+ * there is none
+ */
+void sos_fpu_switch(struct sos_fpu_state *from,
+		    struct sos_fpu_state *to);
+
+
+/**
+ * Handler of the "device not available" exception: give the FPU to
+ * the current thread
+ *
+ * @return -SOS_ENOSUP when the FPU contexts are not switched
+ */
+sos_ret_t sos_fpu_device_not_available(void);
+
+
+/**
+ * Start a short kernel section using the SSE registers: the context
+ * of the current thread is saved when needed, and the IRQs are
+ * disabled until sos_kernel_fpu_end(). The section MUST NOT block
+ * nor yield. The FPU registers hold unspecified values on entry.
+ *
+ * @return -SOS_ENOSUP when the CPU has no SSE, -SOS_EBUSY when
+ * already inside a section (they may not be nested): the FPU MUST
+ * then not be used, and sos_kernel_fpu_end() not be called
+ */
+sos_ret_t sos_kernel_fpu_begin(void);
+
+
+/** End a section started with sos_kernel_fpu_begin() */
+void sos_kernel_fpu_end(void);
+
+
+/** @return TRUE when sos_kernel_fpu_begin() can succeed */
+sos_bool_t sos_fpu_has_sse(void);
+
+/** @return TRUE when the SSE2 instructions may also be used inside
+    the sections */
+sos_bool_t sos_fpu_has_sse2(void);
+
+#endif /* _SOS_FPU_H_ */
@@ -16,7 +16,10 @@
    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
    USA. 
 */
+#include <lib/klibc.h>
+
 #include "segment.h"
+#include "smp.h"
 
 #include "gdt.h"
 
@@ -109,13 +112,87 @@ struct x86_gdt_register {
   })
 
 
-/** The actual GDT */
+/**
+ * Helper macro that builds a descriptor for a byte-granular segment
+ * starting at the given linear address. Used for the per-CPU data
+ * segment (is_system = 0, type = data RW) and for the TSS
+ * (is_system = 1, type = 32bits available TSS, see Intel x86 vol 3
+ * section 6.2.2)
+ */
+#define BUILD_GDTE_AT(base,size,is_system,type)                  \
+  ((struct x86_segment_descriptor) {                            \
+      .limit_15_0=            ((size) - 1) & 0xffff,            \
+      .base_paged_addr_15_0=  (base) & 0xffff,                  \
+      .base_paged_addr_23_16= ((base) >> 16) & 0xff,            \
+      .segment_type=          (type),                           \
+      .descriptor_type=       ((is_system)?0:1),                \
+      .dpl=                   0,                                \
+      .present=               1,                                \
+      .limit_19_16=           (((size) - 1) >> 16) & 0xf,       \
+      .custom=                0,                                \
+      .op_size=               1,                                \
+      .granularity=           0,  /* limit is in bytes */       \
+      .base_paged_addr_31_24= ((base) >> 24) & 0xff             \
+  })
+
+
+/**
+ * The structure of a 32bits task state segment. SOS does not use
+ * hardware task switching: the TSS is only needed because the CPU
+ * requires a valid task register.
+ *
+ * @see Intel x86 doc vol 3, section 6.2.1, figure 6-2
+ */
+struct x86_tss
+{
+  sos_ui16_t back_link, reserved0;
+  sos_ui32_t esp0;
+  sos_ui16_t ss0, reserved1;
+  sos_ui32_t esp1;
+  sos_ui16_t ss1, reserved2;
+  sos_ui32_t esp2;
+  sos_ui16_t ss2, reserved3;
+  sos_ui32_t cr3, eip, eflags;
+  sos_ui32_t eax, ecx, edx, ebx, esp, ebp, esi, edi;
+  sos_ui16_t es, reserved4;
+  sos_ui16_t cs, reserved5;
+  sos_ui16_t ss, reserved6;
+  sos_ui16_t ds, reserved7;
+  sos_ui16_t fs, reserved8;
+  sos_ui16_t gs, reserved9;
+  sos_ui16_t ldt, reserved10;
+  sos_ui16_t debug_trap_flag;
+  sos_ui16_t iomap_base_addr;
+} __attribute__((packed, aligned(128)));
+
+
+/** The boot GDT, shared by all the CPUs until they load their own */
 static struct x86_segment_descriptor gdt[] = {
   [SOS_SEG_NULL]  = (struct x86_segment_descriptor){ 0, },
   [SOS_SEG_KCODE] = BUILD_GDTE(0, 1),
   [SOS_SEG_KDATA] = BUILD_GDTE(0, 0),
 };
 
+
+/**
+ * The GDT of each CPU: the same flat segments as the boot GDT, plus
+ * the per-CPU data segment and the TSS of the CPU. All the CPUs use
+ * the same selector values, so that a segment register saved on a
+ * CPU can be restored on another one.
+ */
+static struct x86_segment_descriptor cpu_gdt[SOS_SMP_MAX_CPUS][SOS_SEG_DF_TSS+1];
+
+/** The TSS of each CPU */
+static struct x86_tss cpu_tss[SOS_SMP_MAX_CPUS];
+
+/** The TSS of the double fault task of each CPU */
+static struct x86_tss cpu_df_tss[SOS_SMP_MAX_CPUS];
+
+/** The stack of the double fault task of each CPU */
+static sos_ui32_t cpu_df_stack[SOS_SMP_MAX_CPUS][SOS_GDT_DF_STACK_SIZE
+						 / sizeof(sos_ui32_t)];
+
+
 sos_ret_t sos_gdt_subsystem_setup(void)
 {
   struct x86_gdt_register gdtr;
@@ -148,3 +225,104 @@ sos_ret_t sos_gdt_subsystem_setup(void)
 
   return SOS_OK;
 }
+
+
+sos_ret_t sos_gdt_cpu_setup(sos_ui32_t cpu_id,
+			    sos_vaddr_t cpu_local_base,
+			    sos_size_t cpu_local_size)
+{
+  struct x86_gdt_register gdtr;
+  struct x86_segment_descriptor *this_gdt;
+  struct x86_tss *this_tss;
+
+  if ((cpu_id >= SOS_SMP_MAX_CPUS) || (cpu_local_size <= 0))
+    return -SOS_EINVAL;
+
+  this_gdt = cpu_gdt[cpu_id];
+  this_tss = & cpu_tss[cpu_id];
+
+  memset(this_tss, 0x0, sizeof(*this_tss));
+  this_tss->ss0             = SOS_BUILD_SEGMENT_REG_VALUE(0, FALSE,
+							  SOS_SEG_KDATA);
+  this_tss->iomap_base_addr = sizeof(*this_tss); /* No I/O bitmap */
+
+  this_gdt[SOS_SEG_NULL]  = gdt[SOS_SEG_NULL];
+  this_gdt[SOS_SEG_KCODE] = gdt[SOS_SEG_KCODE];
+  this_gdt[SOS_SEG_KDATA] = gdt[SOS_SEG_KDATA];
+  this_gdt[SOS_SEG_KCPU]  = BUILD_GDTE_AT(cpu_local_base, cpu_local_size,
+					  0, 0x3 /* Data RW, accessed */);
+  this_gdt[SOS_SEG_TSS]   = BUILD_GDTE_AT((sos_ui32_t)this_tss,
+					  sizeof(*this_tss),
+					  1, 0x9 /* 32bits TSS, available */);
+
+  gdtr.base_addr = (sos_ui32_t) this_gdt;
+  gdtr.limit     = sizeof(cpu_gdt[0]) - 1;
+
+  /* The flat segments are the same as in the boot GDT: only the
+     per-CPU segment register (%gs) and the task register have to be
+     reloaded */
+  asm volatile ("lgdt %0          \n\
+                 movw %1, %%ax    \n\
+                 movw %%ax,  %%gs \n\
+                 movw %2, %%ax    \n\
+                 ltr  %%ax"
+		:
+		:"m"(gdtr),
+		 "i"(SOS_BUILD_SEGMENT_REG_VALUE(0, FALSE, SOS_SEG_KCPU)),
+		 "i"(SOS_BUILD_SEGMENT_REG_VALUE(0, FALSE, SOS_SEG_TSS))
+		:"memory","eax");
+
+  return SOS_OK;
+}
+
+
+sos_ret_t sos_gdt_cpu_setup_double_fault_task(sos_ui32_t cpu_id,
+					      sos_vaddr_t task_entry)
+{
+  struct x86_tss *df_tss;
+  sos_ui32_t cr3;
+
+  if ((cpu_id >= SOS_SMP_MAX_CPUS) || (task_entry == (sos_vaddr_t)NULL))
+    return -SOS_EINVAL;
+
+  df_tss = & cpu_df_tss[cpu_id];
+  asm volatile ("movl %%cr3, %0":"=r"(cr3));
+
+  /* The task starts with interrupts disabled, on its own stack, with
+     the flat kernel segments and the per-CPU segment of the CPU */
+  memset(df_tss, 0x0, sizeof(*df_tss));
+  df_tss->cr3    = cr3;
+  df_tss->eip    = task_entry;
+  df_tss->eflags = 0x2; /* Reserved bit 1, IF cleared */
+  df_tss->esp    = (sos_ui32_t) & cpu_df_stack[cpu_id][SOS_GDT_DF_STACK_SIZE
+						       / sizeof(sos_ui32_t)];
+  df_tss->cs     = SOS_BUILD_SEGMENT_REG_VALUE(0, FALSE, SOS_SEG_KCODE);
+  df_tss->ss     = SOS_BUILD_SEGMENT_REG_VALUE(0, FALSE, SOS_SEG_KDATA);
+  df_tss->ds     = df_tss->ss;
+  df_tss->es     = df_tss->ss;
+  df_tss->fs     = df_tss->ss;
+  df_tss->gs     = SOS_BUILD_SEGMENT_REG_VALUE(0, FALSE, SOS_SEG_KCPU);
+  df_tss->ss0    = df_tss->ss;
+  df_tss->iomap_base_addr = sizeof(*df_tss); /* No I/O bitmap */
+
+  /* The GDT limit already covers this entry: no need to reload it */
+  cpu_gdt[cpu_id][SOS_SEG_DF_TSS]
+    = BUILD_GDTE_AT((sos_ui32_t)df_tss, sizeof(*df_tss),
+		    1, 0x9 /* 32bits TSS, available */);
+
+  return SOS_OK;
+}
+
+
+sos_ret_t sos_gdt_get_interrupted_task(sos_ui32_t cpu_id,
+				       sos_vaddr_t *eip,
+				       sos_vaddr_t *esp)
+{
+  if (cpu_id >= SOS_SMP_MAX_CPUS)
+    return -SOS_EINVAL;
+
+  /* Saved by the processor upon the switch to the double fault task */
+  *eip = cpu_tss[cpu_id].eip;
+  *esp = cpu_tss[cpu_id].esp;
+  return SOS_OK;
+}
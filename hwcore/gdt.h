@@ -39,4 +39,49 @@
  */
 sos_ret_t sos_gdt_subsystem_setup(void);
 
+
+/**
+ * Load the GDT of the given CPU on the current CPU: the flat kernel
+ * segments, a data segment covering the per-CPU area of the CPU
+ * (loaded in %gs) and the TSS of the CPU (loaded in the task
+ * register).
+ *
+ * @param cpu_id The logical identifier of the current CPU (see smp.h)
+ * @param cpu_local_base/size The location of its per-CPU area
+ */
+sos_ret_t sos_gdt_cpu_setup(sos_ui32_t cpu_id,
+			    sos_vaddr_t cpu_local_base,
+			    sos_size_t cpu_local_size);
+
+/**
+ * The size of the stack of the double fault task of each CPU
+ */
+#define SOS_GDT_DF_STACK_SIZE 2048
+
+
+/**
+ * Setup the hardware task of the given CPU that handles the double
+ * faults (see exception.h): a TSS with its own stack, referenced by
+ * the SOS_SEG_DF_TSS entry of the GDT of the CPU. A task gate is the
+ * only way to get a valid stack when the double fault comes from an
+ * overflow of the kernel stack.
+ *
+ * @param task_entry The (noreturn) routine of the task. It runs with
+ * interrupts disabled.
+ *
+ * @note The task is given the current page directory: paging must
+ * be enabled
+ */
+sos_ret_t sos_gdt_cpu_setup_double_fault_task(sos_ui32_t cpu_id,
+					      sos_vaddr_t task_entry);
+
+
+/**
+ * Retrieve the instruction and stack pointers of the code
+ * interrupted on the given CPU by a switch to its double fault task
+ */
+sos_ret_t sos_gdt_get_interrupted_task(sos_ui32_t cpu_id,
+				       sos_vaddr_t *eip,
+				       sos_vaddr_t *esp);
+
 #endif /* _SOS_GDT_H_ */
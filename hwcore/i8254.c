@@ -17,6 +17,7 @@
    USA. 
 */
 #include <hwcore/ioports.h>
+#include <hwcore/tsc.h>
 
 #include "i8254.h"
 
@@ -29,6 +30,13 @@
 #define I8254_TIMER2  0x42
 #define I8254_CONTROL 0x43
 
+/* Port B of the 8255 PPI: gate of timer2 (bit 0), speaker enable (bit
+   1), and output of timer2 (bit 5) */
+#define I8254_PORT_B  0x61
+
+/** Duration of the TSC calibration (in microseconds) */
+#define I8254_CALIBRATION_USEC 50000
+
 /**
  * Configure the first timer of the 82c54 chip as a rate generator,
  * which will raise an IRQ0 on a regular periodic basis, as given by
@@ -78,3 +86,62 @@ sos_ret_t sos_i8254_set_frequency(unsigned int freq)
 
   return SOS_OK;
 }
+
+
+sos_ret_t sos_i8254_udelay(unsigned int usec)
+{
+  unsigned int nb_tick;
+  unsigned char port_b;
+
+  /* Longer delays do not fit in the counter anyway (~55ms): reject
+     them before the computation below overflows 32 bits */
+  if (usec > 1000000)
+    return -SOS_EINVAL;
+
+  /* Compute counter value, rounded up */
+  nb_tick = (usec * (I8254_MAX_FREQ / 1000) + 999) / 1000;
+  if ((nb_tick <= 0) || (nb_tick > 65535))
+    return -SOS_EINVAL;
+
+  /* Enable the gate of timer2, and disconnect it from the speaker */
+  port_b = inb(I8254_PORT_B);
+  outb((port_b & ~0x02) | 0x01, I8254_PORT_B);
+
+  /* We want to configure timer2 (-> 0x80), we send both LSB+MSB
+     (-> 0x30), and we configure it in mode 0, ie as a one-shot
+     "interrupt on terminal count" (-> 0x0) ==> 0xb0 */
+  outb(0xb0, I8254_CONTROL);
+  outb((nb_tick & 0xFF), I8254_TIMER2);
+  outb((nb_tick >> 8) & 0xFF, I8254_TIMER2);
+
+  /* Timer2 output goes high when the count reaches 0 */
+  while (! (inb(I8254_PORT_B) & 0x20))
+    continue;
+
+  /* Restore the speaker configuration */
+  outb(port_b, I8254_PORT_B);
+
+  return SOS_OK;
+}
+
+
+sos_ret_t sos_i8254_calibrate_tsc(/* out */sos_ui32_t *tsc_khz)
+{
+  sos_ui64_t tsc_start, tsc_end;
+  sos_ret_t retval;
+
+  tsc_start = sos_tsc_read();
+  retval = sos_i8254_udelay(I8254_CALIBRATION_USEC);
+  tsc_end = sos_tsc_read();
+  if (SOS_OK != retval)
+    return retval;
+
+  /* The number of cycles elapsed in 50ms fits in 32 bits up to
+     ~85GHz */
+  *tsc_khz = ((sos_ui32_t)(tsc_end - tsc_start))
+	     / (I8254_CALIBRATION_USEC / 1000);
+  if (*tsc_khz == 0)
+    return -SOS_EFATAL;
+
+  return SOS_OK;
+}
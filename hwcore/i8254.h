@@ -16,9 +16,10 @@
    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
    USA. 
 */
-#ifndef _SOS_i8259_H_
-#define _SOS_i8259_H_
+#ifndef _SOS_i8254_H_
+#define _SOS_i8254_H_
 
+#include <os/types.h>
 #include <os/errno.h>
 
 /**
@@ -33,4 +34,24 @@
 /** Change timer interrupt (IRQ 0) frequency */
 sos_ret_t sos_i8254_set_frequency(unsigned int freq);
 
-#endif /* _SOS_i8259_H_ */
+
+/**
+ * Busy-wait for the given delay, using the third (speaker) timer of
+ * the 82c54 in one-shot mode. Does not rely on the IRQs, so that it
+ * can be used at boot to calibrate the other time sources.
+ *
+ * @param usec The delay in microseconds, at most 54925us (ie 65535
+ * ticks of the 82c54 clock)
+ */
+sos_ret_t sos_i8254_udelay(unsigned int usec);
+
+
+/**
+ * Measure the frequency of the CPU time-stamp counter against the
+ * 82c54 clock. MUST be called with IRQs disabled.
+ *
+ * @param tsc_khz (out) The TSC frequency, in kHz
+ */
+sos_ret_t sos_i8254_calibrate_tsc(/* out */sos_ui32_t *tsc_khz);
+
+#endif /* _SOS_i8254_H_ */
@@ -72,7 +72,6 @@ static struct x86_idt_entry    idt[SOS_IDTE_NUM];
 
 sos_ret_t sos_idt_subsystem_setup()
 {
-  struct x86_idt_register idtr;
   int i;
 
   for (i = 0 ;
@@ -94,6 +93,14 @@ sos_ret_t sos_idt_subsystem_setup()
       sos_idt_set_handler(i, (sos_vaddr_t)NULL, 0/* Don't care */);
     }
 
+  return sos_idt_cpu_setup();
+}
+
+
+sos_ret_t sos_idt_cpu_setup()
+{
+  struct x86_idt_register idtr;
+
   /*
    * Setup the IDT register, see Intel x86 doc vol 3, section 5.8.
    */
@@ -143,6 +150,29 @@ sos_ret_t sos_idt_set_handler(int index,
 }
 
 
+sos_ret_t sos_idt_set_task_gate(int index,
+				sos_ui16_t tss_selector)
+{
+  struct x86_idt_entry *idte;
+
+  if ((index < 0) || (index >= SOS_IDTE_NUM))
+    return -SOS_EINVAL;
+
+  /* Task gate, see figure 5-2 in Intel x86 doc, vol 3: the offset is
+     unused, the processor switches to the task of the given TSS */
+  idte = idt + index;
+  idte->offset_low  = 0;
+  idte->offset_high = 0;
+  idte->seg_sel     = tss_selector;
+  idte->type        = 0x5; /* Task gate (101b) */
+  idte->op_size     = 0;
+  idte->dpl         = 0;
+  idte->present     = 1;
+
+  return SOS_OK;
+}
+
+
 sos_ret_t sos_idt_get_handler(int index,
 			      sos_vaddr_t *handler_address,
 			      int *lowest_priviledge)
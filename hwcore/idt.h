@@ -59,6 +59,10 @@
     "not present". */
 sos_ret_t sos_idt_subsystem_setup(void);
 
+/** Load the (shared) IDT on the current CPU. Already done for the
+    boot CPU by sos_idt_subsystem_setup() */
+sos_ret_t sos_idt_cpu_setup(void);
+
 /**
  * Enable the IDT entry if handler_address != NULL, with the given
  * lowest_priviledge.\ Disable the IDT entry when handler_address ==
@@ -72,6 +76,19 @@ sos_ret_t sos_idt_set_handler(int index,
 			      int lowest_priviledge /* 0..3 */);
 
 
+/**
+ * Turn the IDT entry into a task gate: the processor switches to the
+ * hardware task described by the TSS of the given GDT selector
+ * instead of calling a handler on the current stack. Since the
+ * selector is resolved in the GDT of the CPU, each CPU gets its own
+ * task.
+ *
+ * @note IRQ Unsafe
+ */
+sos_ret_t sos_idt_set_task_gate(int index,
+				sos_ui16_t tss_selector);
+
+
 /**
  * @note IRQ Unsafe
  *
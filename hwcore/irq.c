@@ -18,6 +18,12 @@
 */
 #include "idt.h"
 #include "i8259.h"
+#include "apic.h"
+#include "smp.h"
+
+#include <lib/klibc.h>
+#include <os/thread.h>
+#include <os/kwaitq.h>
 
 #include "irq.h"
 
@@ -27,27 +33,209 @@ extern sos_vaddr_t sos_irq_wrapper_array[SOS_IRQ_NUM];
 /* arrays of IRQ handlers, shared with irq_wrappers.S */
 sos_irq_handler_t sos_irq_handler_array[SOS_IRQ_NUM] = { NULL, };
 
-/** Number of interrupt handlers that are currently executing */
-sos_ui32_t sos_irq_nested_level_counter;
+/** TRUE when the IRQ lines are routed through the APIC instead of the
+    8259 */
+static sos_bool_t irq_through_apic;
+
+
+/**
+ * The priority of the threads running the threaded handlers: above
+ * all the other threads (see sched.h)
+ */
+#define SOS_IRQ_THREAD_PRIORITY SOS_SCHED_PRIO_HIGHEST
+
+
+/**
+ * The threaded handler of each IRQ line (see SOS_IRQ_THREADED).
+ * Protected by the BKL and by disabling the IRQs.
+ */
+static struct irq_thread
+{
+  /** The handler run by the thread, NULL when the line is not
+      threaded */
+  sos_irq_handler_t handler;
+
+  /** Created at the first registration of a threaded handler for the
+      line, never deleted */
+  struct sos_thread *thread;
+
+  /** Where the thread waits for the IRQs */
+  struct sos_kwaitq kwaitq;
+
+  /** Number of IRQs since the thread last looked */
+  sos_ui32_t nb_pending;
+} irq_threads[SOS_IRQ_NUM];
 
 sos_ret_t sos_irq_subsystem_setup(void)
 {
-  sos_irq_nested_level_counter = 0;
+  sos_cpu_local()->irq_nested_level = 0;
+  irq_through_apic = FALSE;
+#ifdef SOS_IRQ_TRACE
+  sos_irq_trace_subsystem_setup();
+#endif
   return sos_i8259_subsystem_setup();
 }
 
 
+sos_ret_t sos_irq_switch_to_apic(void)
+{
+  sos_ret_t retval;
+  sos_ui32_t flags;
+  int irq_level;
+
+  sos_disable_IRQs(flags);
+
+  retval = sos_apic_subsystem_setup();
+  if (SOS_OK == retval)
+    {
+      /* Move the enabled IRQ lines from the 8259 to the APIC. The
+	 8259 remains fully masked */
+      for (irq_level = 0 ; irq_level < SOS_IRQ_NUM ; irq_level ++)
+	{
+	  sos_i8259_disable_irq_line(irq_level);
+	  if (sos_irq_handler_array[irq_level] != NULL)
+	    sos_apic_enable_irq_line(irq_level);
+	}
+      irq_through_apic = TRUE;
+    }
+
+  sos_restore_IRQs(flags);
+  return retval;
+}
+
+
+/**
+ * Helper function to mask/unmask the IRQ line, on the PIC or the
+ * APIC. Called with IRQs disabled.
+ */
+static void irq_line_set_enabled(int irq_level, sos_bool_t enabled)
+{
+  if (irq_through_apic)
+    {
+      if (enabled)
+	sos_apic_enable_irq_line(irq_level);
+      else
+	sos_apic_disable_irq_line(irq_level);
+    }
+  else if (enabled)
+    sos_i8259_enable_irq_line(irq_level);
+  else
+    sos_i8259_disable_irq_line(irq_level);
+}
+
+
+/**
+ * The hard IRQ handler of the threaded lines: mask the line until the
+ * thread ran the handler, and wake the thread up
+ */
+static void irq_threaded_hard_handler(int irq_level)
+{
+  struct irq_thread *it = & irq_threads[irq_level];
+
+  irq_line_set_enabled(irq_level, FALSE);
+  it->nb_pending ++;
+  sos_kwaitq_wakeup(& it->kwaitq, SOS_KWQ_WAKEUP_ALL, SOS_OK);
+}
+
+
+/**
+ * The loop of the thread of a threaded line
+ */
+static void irq_thread_loop(void *arg)
+{
+  struct irq_thread *it = (struct irq_thread*) arg;
+  int irq_level = it - irq_threads;
+  sos_irq_handler_t handler;
+  sos_ui32_t flags;
+
+  while (1)
+    {
+      sos_disable_IRQs(flags);
+      while (0 == it->nb_pending)
+	sos_kwaitq_wait(& it->kwaitq, NULL);
+      it->nb_pending = 0;
+      handler = it->handler;
+      sos_restore_IRQs(flags);
+
+      /* Outside of the IRQ context: the handler may block */
+      if (handler)
+	handler(irq_level);
+
+      /* Let the next IRQs in, unless the handler was unregistered
+	 meanwhile */
+      sos_disable_IRQs(flags);
+      if (it->handler)
+	irq_line_set_enabled(irq_level, TRUE);
+      sos_restore_IRQs(flags);
+    }
+}
+
+
+/**
+ * Helper function to create the thread of a threaded line, if not
+ * already done
+ */
+static sos_ret_t irq_thread_create(int irq_level)
+{
+  struct irq_thread *it = & irq_threads[irq_level];
+  char name[SOS_THR_MAX_NAMELEN];
+  sos_ret_t retval;
+
+  if (it->thread)
+    return SOS_OK;
+
+  retval = sos_kwaitq_init(& it->kwaitq, "irq_thread");
+  if (SOS_OK != retval)
+    return retval;
+
+  snprintf(name, sizeof(name), "[irq%d]", irq_level);
+  it->thread = sos_create_kernel_thread(name, irq_thread_loop, it);
+  if (! it->thread)
+    {
+      sos_kwaitq_dispose(& it->kwaitq);
+      return -SOS_ENOMEM;
+    }
+
+  return sos_thread_set_priority(it->thread, SOS_IRQ_THREAD_PRIORITY);
+}
+
+
 sos_ret_t sos_irq_set_routine(int irq_level,
 			      sos_irq_handler_t routine)
+{
+  return sos_irq_set_routine_flags(irq_level, routine, 0);
+}
+
+
+sos_ret_t sos_irq_set_routine_flags(int irq_level,
+				    sos_irq_handler_t routine,
+				    sos_ui32_t irq_flags)
 {
   sos_ret_t retval;
   sos_ui32_t flags;
   
   if ((irq_level < 0) || (irq_level >= SOS_IRQ_NUM))
     return -SOS_EINVAL;
+
+  /* The thread is created with the IRQs enabled */
+  if ((routine != NULL) && (irq_flags & SOS_IRQ_THREADED))
+    {
+      retval = irq_thread_create(irq_level);
+      if (SOS_OK != retval)
+	return retval;
+    }
   
   sos_disable_IRQs(flags);
 
+  /* The hard IRQ handler of a threaded line only wakes its thread */
+  if ((routine != NULL) && (irq_flags & SOS_IRQ_THREADED))
+    {
+      irq_threads[irq_level].handler = routine;
+      routine = irq_threaded_hard_handler;
+    }
+  else
+    irq_threads[irq_level].handler = NULL;
+
   retval = SOS_OK;
 
   /* Set the irq routine to be called by the IRQ wrapper */
@@ -73,12 +261,13 @@ sos_ret_t sos_irq_set_routine(int irq_level,
 			      0  /* Don't care */);
     }
 
-  /* Update the PIC only if an IRQ handler has been set */
-  if (sos_irq_handler_array[irq_level] != NULL)
-    sos_i8259_enable_irq_line(irq_level);
-  else
-    sos_i8259_disable_irq_line(irq_level);
-    
+  /* A problem occured */
+  if (sos_irq_handler_array[irq_level] == NULL)
+    irq_threads[irq_level].handler = NULL;
+
+  /* Update the PIC (or APIC) only if an IRQ handler has been set */
+  irq_line_set_enabled(irq_level, sos_irq_handler_array[irq_level] != NULL);
+
   sos_restore_IRQs(flags);
   return retval;
 }
@@ -90,12 +279,15 @@ sos_irq_handler_t sos_irq_get_routine(int irq_level)
     return NULL;
   
   /* Expected to be atomic */
+  if (irq_threads[irq_level].handler)
+    return irq_threads[irq_level].handler;
   return sos_irq_handler_array[irq_level];
 }
 
 
 sos_ui32_t sos_irq_get_nested_level()
 {
-  /* No need to disable interrupts here */
-  return sos_irq_nested_level_counter;
+  /* No need to disable interrupts here: the per-CPU counter is
+     balanced by any IRQ handler that could interrupt us */
+  return sos_cpu_local()->irq_nested_level;
 }
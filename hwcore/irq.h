@@ -27,16 +27,31 @@
 
 #include <os/errno.h>
 #include "cpu_context.h"
+#include "smp.h"
+#include "irq_trace.h"
 
 #define sos_save_flags(flags) \
   asm volatile("pushfl ; popl %0":"=g"(flags)::"memory")
 #define sos_restore_flags(flags) \
   asm volatile("push %0; popfl"::"g"(flags):"memory")
 
+#ifndef SOS_IRQ_TRACE
 #define sos_disable_IRQs(flags)    \
   ({ sos_save_flags(flags); asm("cli\n"); })
 #define sos_restore_IRQs(flags)    \
   sos_restore_flags(flags)
+#else
+/* Stamp the sections where the IRQs get disabled (see irq_trace.h) */
+#define SOS_IRQ_TRACE_EFLAGS_IF (1 << 9)
+#define sos_disable_IRQs(flags)    \
+  ({ sos_save_flags(flags); asm("cli\n");                       \
+     if ((flags) & SOS_IRQ_TRACE_EFLAGS_IF)                      \
+       sos_irq_trace_irqs_off(__FILE__, __LINE__); })
+#define sos_restore_IRQs(flags)    \
+  ({ if ((flags) & SOS_IRQ_TRACE_EFLAGS_IF)                      \
+       sos_irq_trace_irqs_on();                                 \
+     sos_restore_flags(flags); })
+#endif
 
 /* Usual IRQ levels */
 #define SOS_IRQ_TIMER         0
@@ -62,6 +77,17 @@ typedef void (*sos_irq_handler_t)(int irq_level);
 /** Setup the PIC */
 sos_ret_t sos_irq_setup(void);
 
+/**
+ * Route the IRQ lines through the local APIC and the IOAPIC instead of
+ * the 8259 PIC (which is then fully masked), when the CPU has a local
+ * APIC. The timer IRQ is then raised by the local APIC timer, which
+ * must be configured with sos_apic_timer_set_frequency(). MUST be
+ * called after the kernel virtual memory allocator is set up.
+ *
+ * @return -SOS_ENOSUP when there is no APIC: the 8259 is still used
+ */
+sos_ret_t sos_irq_switch_to_apic(void);
+
 /**
  * If the routine is not NULL, the IDT is setup to call an IRQ
  * wrapper upon interrupt, which in turn will call the routine, and
@@ -71,20 +97,41 @@ sos_ret_t sos_irq_setup(void);
 sos_ret_t sos_irq_set_routine(int irq_level,
 			      sos_irq_handler_t routine);
 
+
+/**
+ * Flag for sos_irq_set_routine_flags(): the routine is run by a
+ * dedicated kernel thread of the highest priority instead of the IRQ
+ * handler, so that it may block. The IRQ handler only masks the line
+ * and wakes the thread up; the thread unmasks the line once the
+ * routine returned. The IRQs raised meanwhile on the line are
+ * coalesced.
+ */
+#define SOS_IRQ_THREADED (1<<0)
+
+/**
+ * Same as sos_irq_set_routine(), with SOS_IRQ_* flags. A threaded
+ * routine may only be set once the thread subsystem is set up.
+ */
+sos_ret_t sos_irq_set_routine_flags(int irq_level,
+				    sos_irq_handler_t routine,
+				    sos_ui32_t irq_flags);
+
 sos_irq_handler_t sos_irq_get_routine(int irq_level);
 
 
 /**
- * Tell how many nested IRQ handler have been fired
+ * Tell how many nested IRQ handler have been fired on the current CPU
  */
 sos_ui32_t sos_irq_get_nested_level();
 
 
 /**
- * Return TRUE when we are currently executing in interrupt context
+ * Return TRUE when we are currently executing in interrupt context:
+ * in an IRQ handler or in the deferred interrupt work run on exit
+ * from the outermost one (see os/softirq.h)
  */
 #define sos_servicing_irq() \
-  (sos_irq_get_nested_level() > 0)
+  ((sos_irq_get_nested_level() > 0) || sos_cpu_local()->softirq_active)
 
 
 #endif /* _SOS_HWINTR_H_ */
@@ -0,0 +1,289 @@
+/* Copyright (C) 2026  AbdAllah MEZITI
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+   USA. 
+*/
+#include <lib/klibc.h>
+#include <lib/stdio.h>
+
+#include "idt.h"
+#include "smp.h"
+#include "tsc.h"
+
+#include "irq_trace.h"
+
+#ifdef SOS_IRQ_TRACE
+
+/** Deepest IRQ nesting level traced: the 16 lines, plus one */
+#define IRQ_TRACE_MAX_NESTING (SOS_IRQ_NUM + 1)
+
+
+/** The durations of the handlers of an IRQ line */
+struct irq_trace_line
+{
+  sos_count_t nb_handled;
+  sos_ui64_t  total_cycles;
+  sos_ui64_t  max_cycles;
+  sos_count_t histogram[SOS_IRQ_TRACE_NB_BUCKETS];
+};
+
+
+/** An IRQ-off section, identified by where the IRQs got disabled */
+struct irq_trace_section
+{
+  const char *file;  /**< NULL: unused entry */
+  int         line;
+  sos_ui64_t  max_cycles;
+  sos_count_t nb_times;
+};
+
+
+/** What is recorded on each CPU, only updated by the CPU itself with
+    the IRQs disabled */
+static struct irq_trace_cpu
+{
+  /** When the handler of each nesting level was entered */
+  sos_ui64_t handler_enter_tsc[IRQ_TRACE_MAX_NESTING];
+
+  struct irq_trace_line lines[SOS_IRQ_NUM];
+
+  /** The IRQ-off section in progress: 0 when none */
+  sos_ui64_t  irqs_off_tsc;
+  const char *irqs_off_file;
+  int         irqs_off_line;
+
+  /** The longest IRQ-off sections, longest first */
+  struct irq_trace_section worst[SOS_IRQ_TRACE_NB_WORST];
+} irq_trace_cpus[SOS_SMP_MAX_CPUS];
+
+
+/** FALSE until the per-CPU area of the boot CPU is usable */
+static sos_bool_t irq_trace_active;
+
+
+void sos_irq_trace_subsystem_setup(void)
+{
+  sos_irq_trace_reset();
+  irq_trace_active = TRUE;
+}
+
+
+/** Index of the histogram bucket of the given duration */
+static int irq_trace_bucket(sos_ui64_t cycles)
+{
+  int bucket = 0;
+
+  cycles >>= SOS_IRQ_TRACE_MIN_SHIFT;
+  while ((cycles > 0) && (bucket < SOS_IRQ_TRACE_NB_BUCKETS - 1))
+    {
+      cycles >>= 1;
+      bucket ++;
+    }
+
+  return bucket;
+}
+
+
+void sos_irq_trace_handler_enter(int irq_level)
+{
+  struct irq_trace_cpu *tc;
+  sos_ui32_t nesting;
+
+  if (! irq_trace_active)
+    return;
+
+  tc      = & irq_trace_cpus[sos_cpu_local()->cpu_id];
+  nesting = sos_cpu_local()->irq_nested_level;
+
+  /* The IRQs were enabled when this IRQ was raised: an IRQ-off
+     section still in progress was left with a bare "sti" */
+  if (nesting == 1)
+    tc->irqs_off_tsc = 0;
+
+  if (nesting < IRQ_TRACE_MAX_NESTING)
+    tc->handler_enter_tsc[nesting] = sos_tsc_read();
+}
+
+
+void sos_irq_trace_handler_exit(int irq_level)
+{
+  struct irq_trace_cpu *tc;
+  struct irq_trace_line *tl;
+  sos_ui32_t nesting;
+  sos_ui64_t cycles;
+
+  if (! irq_trace_active)
+    return;
+
+  tc      = & irq_trace_cpus[sos_cpu_local()->cpu_id];
+  nesting = sos_cpu_local()->irq_nested_level;
+  if ((nesting >= IRQ_TRACE_MAX_NESTING)
+      || (tc->handler_enter_tsc[nesting] == 0))
+    return;
+
+  cycles = sos_tsc_read() - tc->handler_enter_tsc[nesting];
+  tc->handler_enter_tsc[nesting] = 0;
+
+  tl = & tc->lines[irq_level];
+  tl->nb_handled ++;
+  tl->total_cycles += cycles;
+  if (cycles > tl->max_cycles)
+    tl->max_cycles = cycles;
+  tl->histogram[irq_trace_bucket(cycles)] ++;
+}
+
+
+void sos_irq_trace_irqs_off(const char *file, int line)
+{
+  struct irq_trace_cpu *tc;
+
+  if (! irq_trace_active)
+    return;
+
+  tc = & irq_trace_cpus[sos_cpu_local()->cpu_id];
+  tc->irqs_off_tsc  = sos_tsc_read();
+  tc->irqs_off_file = file;
+  tc->irqs_off_line = line;
+}
+
+
+void sos_irq_trace_irqs_on(void)
+{
+  struct irq_trace_cpu *tc;
+  struct irq_trace_section section;
+  sos_ui64_t cycles;
+  int i, slot;
+
+  if (! irq_trace_active)
+    return;
+
+  tc = & irq_trace_cpus[sos_cpu_local()->cpu_id];
+  if (tc->irqs_off_tsc == 0)
+    return;
+
+  cycles = sos_tsc_read() - tc->irqs_off_tsc;
+  tc->irqs_off_tsc = 0;
+
+  /* Look for the entry of the call site, or else for the slot it
+     would take among the longest sections */
+  for (slot = 0 ; slot < SOS_IRQ_TRACE_NB_WORST ; slot ++)
+    if ((tc->worst[slot].file == tc->irqs_off_file)
+	&& (tc->worst[slot].line == tc->irqs_off_line))
+      break;
+
+  if (slot < SOS_IRQ_TRACE_NB_WORST)
+    {
+      tc->worst[slot].nb_times ++;
+      if (cycles <= tc->worst[slot].max_cycles)
+	return;
+      section = tc->worst[slot];
+    }
+  else
+    {
+      slot = SOS_IRQ_TRACE_NB_WORST - 1;
+      if ((tc->worst[slot].file != NULL)
+	  && (cycles <= tc->worst[slot].max_cycles))
+	return;
+      section.file     = tc->irqs_off_file;
+      section.line     = tc->irqs_off_line;
+      section.nb_times = 1;
+    }
+  section.max_cycles = cycles;
+
+  /* Move the section up to keep the table sorted */
+  for (i = slot ;
+       (i > 0)
+	 && ((tc->worst[i-1].file == NULL)
+	     || (tc->worst[i-1].max_cycles < cycles)) ;
+       i --)
+    tc->worst[i] = tc->worst[i-1];
+  tc->worst[i] = section;
+}
+
+
+void sos_irq_trace_reset(void)
+{
+  memset(irq_trace_cpus, 0x0, sizeof(irq_trace_cpus));
+}
+
+
+void sos_irq_trace_dump(void)
+{
+  struct irq_trace_line line;
+  struct irq_trace_section worst[SOS_IRQ_TRACE_NB_WORST];
+  int cpu, irq, i, j;
+
+  printf("IRQ handler durations:\n");
+  for (irq = 0 ; irq < SOS_IRQ_NUM ; irq ++)
+    {
+      memset(& line, 0x0, sizeof(line));
+      for (cpu = 0 ; cpu < SOS_SMP_MAX_CPUS ; cpu ++)
+	{
+	  struct irq_trace_line *tl = & irq_trace_cpus[cpu].lines[irq];
+	  line.nb_handled   += tl->nb_handled;
+	  line.total_cycles += tl->total_cycles;
+	  if (tl->max_cycles > line.max_cycles)
+	    line.max_cycles = tl->max_cycles;
+	  for (i = 0 ; i < SOS_IRQ_TRACE_NB_BUCKETS ; i ++)
+	    line.histogram[i] += tl->histogram[i];
+	}
+
+      if (line.nb_handled == 0)
+	continue;
+
+      printf(" IRQ %d: %u handled, avg %u us, max %u us\n",
+	     irq, line.nb_handled,
+	     sos_tsc_cycles_to_us(sos_tsc_udiv64(line.total_cycles,
+						 line.nb_handled, NULL)),
+	     sos_tsc_cycles_to_us(line.max_cycles));
+      for (i = 0 ; i < SOS_IRQ_TRACE_NB_BUCKETS ; i ++)
+	if (line.histogram[i] > 0)
+	  printf("   %s2^%d cycles: %u\n",
+		 (i < SOS_IRQ_TRACE_NB_BUCKETS - 1)?"<":">=",
+		 (i < SOS_IRQ_TRACE_NB_BUCKETS - 1)?
+		   SOS_IRQ_TRACE_MIN_SHIFT + i
+		   : SOS_IRQ_TRACE_MIN_SHIFT + i - 1,
+		 line.histogram[i]);
+    }
+
+  /* Merge the longest sections of all the CPUs */
+  memset(worst, 0x0, sizeof(worst));
+  for (cpu = 0 ; cpu < SOS_SMP_MAX_CPUS ; cpu ++)
+    for (j = 0 ; j < SOS_IRQ_TRACE_NB_WORST ; j ++)
+      {
+	struct irq_trace_section *ts = & irq_trace_cpus[cpu].worst[j];
+	if (ts->file == NULL)
+	  break;
+
+	for (i = SOS_IRQ_TRACE_NB_WORST - 1 ;
+	     (i >= 0)
+	       && ((worst[i].file == NULL)
+		   || (worst[i].max_cycles < ts->max_cycles)) ;
+	     i --)
+	  if (i < SOS_IRQ_TRACE_NB_WORST - 1)
+	    worst[i+1] = worst[i];
+	if (i < SOS_IRQ_TRACE_NB_WORST - 1)
+	  worst[i+1] = *ts;
+      }
+
+  printf("Longest IRQ-off sections:\n");
+  for (i = 0 ; (i < SOS_IRQ_TRACE_NB_WORST) && (worst[i].file != NULL) ; i ++)
+    printf(" %s:%d: max %u us (%u times)\n",
+	   worst[i].file, worst[i].line,
+	   sos_tsc_cycles_to_us(worst[i].max_cycles),
+	   worst[i].nb_times);
+}
+
+#endif /* SOS_IRQ_TRACE */
@@ -0,0 +1,93 @@
+/* Copyright (C) 2026  AbdAllah MEZITI
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+   USA. 
+*/
+#ifndef _SOS_IRQ_TRACE_H_
+#define _SOS_IRQ_TRACE_H_
+
+/**
+ * @file irq_trace.h
+ *
+ * IRQ latency tracing. When SOS_IRQ_TRACE is defined:
+ *  - the IRQ wrappers (see irq_wrappers.S) stamp the entry and exit of
+ *    each IRQ handler with the TSC, and a log2 histogram of the
+ *    handler durations is kept for each IRQ line
+ *  - sos_disable_IRQs() and sos_restore_IRQs() (see irq.h) stamp the
+ *    sections where they disable the IRQs, and the longest ones are
+ *    recorded with the file and line that disabled the IRQs.
+ *
+ * Only the outermost sos_disable_IRQs() of a section (the one that
+ * found the IRQs enabled) opens it, and only the sos_restore_IRQs()
+ * that re-enables them closes it. A section where the IRQs were
+ * re-enabled with a bare "sti" (eg by the idle thread) is discarded
+ * by the next IRQ. The sections where the IRQs are disabled by the
+ * hardware (the IRQ handlers themselves) are measured by the
+ * histograms.
+ *
+ * The data is kept per CPU, and merged by sos_irq_trace_dump()
+ * without synchronization: the dump is only approximate while the
+ * other CPUs run.
+ *
+ * When SOS_IRQ_TRACE is not defined, nothing of this is compiled in.
+ */
+
+/* Uncomment to trace the IRQ latencies */
+/* #define SOS_IRQ_TRACE */
+
+
+#if defined(SOS_IRQ_TRACE) && !defined(ASM_SOURCE)
+
+#include <os/types.h>
+
+/** Number of buckets of the histograms: bucket 0 counts the handlers
+    shorter than 2^SOS_IRQ_TRACE_MIN_SHIFT cycles, bucket i>0 those
+    between 2^(SOS_IRQ_TRACE_MIN_SHIFT+i-1) and
+    2^(SOS_IRQ_TRACE_MIN_SHIFT+i) cycles, the last bucket also counts
+    all the longer ones */
+#define SOS_IRQ_TRACE_NB_BUCKETS 16
+#define SOS_IRQ_TRACE_MIN_SHIFT  8
+
+/** Number of longest IRQ-off sections recorded per CPU */
+#define SOS_IRQ_TRACE_NB_WORST   8
+
+
+/** Start tracing: called by sos_irq_subsystem_setup() once the per-CPU
+    area of the boot CPU is usable */
+void sos_irq_trace_subsystem_setup(void);
+
+
+/** Called by the IRQ wrappers with the IRQs disabled, around the IRQ
+    handler */
+void sos_irq_trace_handler_enter(int irq_level);
+void sos_irq_trace_handler_exit(int irq_level);
+
+
+/** Called by sos_disable_IRQs() when it found the IRQs enabled */
+void sos_irq_trace_irqs_off(const char *file, int line);
+
+/** Called by sos_restore_IRQs() before it re-enables the IRQs */
+void sos_irq_trace_irqs_on(void);
+
+
+/** Forget everything recorded so far, on all the CPUs */
+void sos_irq_trace_reset(void);
+
+/** Print the histograms and the longest IRQ-off sections */
+void sos_irq_trace_dump(void);
+
+#endif /* SOS_IRQ_TRACE && ! ASM_SOURCE */
+
+#endif /* _SOS_IRQ_TRACE_H_ */
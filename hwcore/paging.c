@@ -18,6 +18,8 @@
 #include <os/physmem.h>
 #include <lib/klibc.h>
 #include <os/assert.h>
+#include <hwcore/irq.h>
+#include <hwcore/smp.h>
 
 #include "paging.h"
 
@@ -268,6 +270,7 @@ sos_ret_t sos_paging_map(sos_paddr_t ppage_paddr,
      address */
   unsigned index_in_pd = virt_to_pd_index(vpage_vaddr);
   unsigned index_in_pt = virt_to_pt_index(vpage_vaddr);
+  sos_paddr_t old_ppage_paddr = (sos_paddr_t)NULL;
   
   /* Get the PD of the current context */
   struct x86_pde *pd = (struct x86_pde*)
@@ -317,14 +320,16 @@ sos_ret_t sos_paging_map(sos_paddr_t ppage_paddr,
     sos_physmem_ref_physpage_at(pd[index_in_pd].pt_paddr << 12);
   
   /* Otherwise, that means that a physical page is implicitely
-     unmapped */
+     unmapped: it is released once no CPU caches its mapping */
   else
-    sos_physmem_unref_physpage(pt[index_in_pt].paddr << 12);
+    old_ppage_paddr = pt[index_in_pt].paddr << 12;
 
   /* Map the page in the page table */
   pt[index_in_pt].present = TRUE;
   pt[index_in_pt].write   = (flags & SOS_VM_MAP_PROT_WRITE)?1:0;
   pt[index_in_pt].user    = (is_user_page)?1:0;
+  pt[index_in_pt].write_through  = (flags & SOS_VM_MAP_NOCACHE)?1:0;
+  pt[index_in_pt].cache_disabled = (flags & SOS_VM_MAP_NOCACHE)?1:0;
   pt[index_in_pt].paddr   = ppage_paddr >> 12;
   sos_physmem_ref_physpage_at(ppage_paddr);
 
@@ -335,6 +340,13 @@ sos_ret_t sos_paging_map(sos_paddr_t ppage_paddr,
   /* Invalidate TLB for the page we just added */
   invlpg(vpage_vaddr);
 
+  /* The other CPUs may still cache the mapping we replaced */
+  if (old_ppage_paddr)
+    {
+      sos_smp_tlb_shootdown();
+      sos_physmem_unref_physpage(old_ppage_paddr);
+    }
+
   return SOS_OK;
 }
 
@@ -342,6 +354,8 @@ sos_ret_t sos_paging_map(sos_paddr_t ppage_paddr,
 sos_ret_t sos_paging_unmap(sos_vaddr_t vpage_vaddr)
 {
   sos_ret_t pt_unref_retval;
+  sos_paddr_t ppage_paddr, pt_paddr;
+  sos_ui32_t flags;
 
   /* Get the page directory entry and table entry index for this
      address */
@@ -368,17 +382,19 @@ sos_ret_t sos_paging_unmap(sos_vaddr_t vpage_vaddr)
       && (vpage_vaddr < SOS_PAGING_MIRROR_VADDR + SOS_PAGING_MIRROR_SIZE))
     return -SOS_EINVAL;
 
-  /* Reclaim the physical page */
-  sos_physmem_unref_physpage(pt[index_in_pt].paddr << 12);
-
-  /* Unmap the page in the page table */
+  /* Unmap the page in the page table. The physical page is reclaimed
+     once no CPU caches its mapping anymore */
+  ppage_paddr = pt[index_in_pt].paddr << 12;
   memset(pt + index_in_pt, 0x0, sizeof(struct x86_pte));
 
   /* Invalidate TLB for the page we just unmapped */
   invlpg(vpage_vaddr);
 
-  /* Reclaim this entry in the PT, which may free the PT */
-  pt_unref_retval = sos_physmem_unref_physpage(pd[index_in_pd].pt_paddr << 12);
+  /* Reclaim this entry in the PT, which may free the PT. No IRQ
+     handler may allocate the PT before we take it back below */
+  pt_paddr = pd[index_in_pd].pt_paddr << 12;
+  sos_disable_IRQs(flags);
+  pt_unref_retval = sos_physmem_unref_physpage(pt_paddr);
   SOS_ASSERT_FATAL(pt_unref_retval >= 0);
   if (pt_unref_retval == TRUE)
     /* If the PT is now completely unused... */
@@ -397,7 +413,17 @@ sos_ret_t sos_paging_unmap(sos_vaddr_t vpage_vaddr)
       
       /* Update the TLB */
       invlpg(pt);
+
+      /* The other CPUs may still walk the PT: keep it until then */
+      sos_physmem_ref_physpage_at(pt_paddr);
     }
+  sos_restore_IRQs(flags);
+
+  /* Flush the other CPUs before reusing the pages */
+  sos_smp_tlb_shootdown();
+  sos_physmem_unref_physpage(ppage_paddr);
+  if (pt_unref_retval == TRUE)
+    sos_physmem_unref_physpage(pt_paddr);
 
   return SOS_OK;  
 }
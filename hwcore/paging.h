@@ -63,6 +63,10 @@
 #define SOS_VM_MAP_PROT_WRITE (1<<1)
 /* EXEC not supported */
 
+/** Disable the CPU caches for the page (memory-mapped device
+    registers) */
+#define SOS_VM_MAP_NOCACHE    (1<<30)
+
 /** Mapping a page may involve an physical page allocation (for a new
     PT), hence may potentially block */
 #define SOS_VM_MAP_ATOMIC     (1<<31)
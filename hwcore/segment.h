@@ -39,6 +39,11 @@
 #define SOS_SEG_NULL  0 /* NULL segment, unused by the procesor */
 #define SOS_SEG_KCODE 1 /* Kernel code segment */
 #define SOS_SEG_KDATA 2 /* Kernel data segment */
+#define SOS_SEG_KCPU  3 /* Per-CPU data area of the current CPU (%gs),
+			   see smp.h */
+#define SOS_SEG_TSS   4 /* Task state segment of the current CPU */
+#define SOS_SEG_DF_TSS 5 /* Task state segment of the double fault
+			    handler of the current CPU, see gdt.h */
 
 
 #ifndef ASM_SOURCE
@@ -0,0 +1,305 @@
+/* Copyright (C) 2026  AbdAllah MEZITI
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+   USA. 
+*/
+#include <lib/klibc.h>
+#include <hwcore/apic.h>
+#include <hwcore/atomic.h>
+#include <hwcore/gdt.h>
+#include <hwcore/exception.h>
+#include <hwcore/fpu.h>
+#include <hwcore/i8254.h>
+#include <hwcore/idt.h>
+#include <hwcore/irq.h>
+#include <hwcore/paging.h>
+#include <os/physmem.h>
+#include <os/kmem_vmm.h>
+#include <os/kmalloc.h>
+#include <os/assert.h>
+#include <os/bkl.h>
+
+#include "smp.h"
+
+
+/** The per-CPU areas */
+static struct sos_cpu_local cpu_local_area[SOS_SMP_MAX_CPUS];
+
+/** Number of CPUs online */
+static volatile sos_ui32_t smp_nb_cpus;
+
+/** Function called by the APs once set up */
+static sos_smp_ap_entry_t *smp_ap_entry;
+
+/** Maximum time to wait for the APs to answer the SIPI (in us) */
+#define SMP_AP_STARTUP_USEC 100000
+
+/** Generation of the last TLB shootdown requested */
+static volatile sos_ui32_t smp_tlb_gen;
+
+/* Defined in irq_wrappers.S */
+extern void sos_smp_tlb_ipi_wrapper(void);
+
+/** Called by sos_smp_tlb_ipi_wrapper */
+void sos_smp_tlb_ipi_handler(void);
+
+
+/*
+ * Shared with smp_trampoline.S
+ */
+
+/** Real-mode trampoline, copied to a page below 1MB */
+extern char sos_smp_trampoline_start[], sos_smp_trampoline_end[];
+
+/** GDT register loaded by the trampoline, in the trampoline itself */
+extern char sos_smp_trampoline_gdtr[];
+
+/** Page directory loaded by the APs */
+sos_ui32_t sos_smp_ap_cr3;
+
+/** Next logical CPU identifier, atomically incremented by each AP */
+volatile sos_ui32_t sos_smp_ap_next_cpu_id;
+
+/** Top of the boot stack of each AP, indexed by logical CPU id */
+sos_vaddr_t sos_smp_ap_stack_top[SOS_SMP_MAX_CPUS];
+
+/** C entry point of the APs, called by the trampoline */
+void sos_smp_ap_main(sos_ui32_t cpu_id);
+
+
+/**
+ * Helper function to initialize a per-CPU area and load the GDT of
+ * the current CPU
+ */
+static sos_ret_t cpu_local_setup(sos_ui32_t cpu_id)
+{
+  struct sos_cpu_local *cpu = & cpu_local_area[cpu_id];
+
+  memset(cpu, 0x0, sizeof(*cpu));
+  cpu->self   = cpu;
+  cpu->cpu_id = cpu_id;
+  return sos_gdt_cpu_setup(cpu_id, (sos_vaddr_t)cpu, sizeof(*cpu));
+}
+
+
+sos_ret_t sos_smp_subsystem_setup(void)
+{
+  sos_ret_t retval;
+
+  retval = cpu_local_setup(SOS_SMP_BOOT_CPU);
+  if (SOS_OK != retval)
+    return retval;
+
+  smp_nb_cpus = 1;
+  return SOS_OK;
+}
+
+
+sos_ui32_t sos_smp_get_nb_cpus(void)
+{
+  return smp_nb_cpus;
+}
+
+
+sos_bool_t sos_smp_is_running(const struct sos_thread *thr)
+{
+  sos_ui32_t cpu_id;
+
+  for (cpu_id = 0 ; cpu_id < smp_nb_cpus ; cpu_id ++)
+    {
+      /* Updated by the other CPUs behind our back */
+      if (*(struct sos_thread * volatile *)
+	  & cpu_local_area[cpu_id].current_thread == thr)
+	return TRUE;
+    }
+
+  return FALSE;
+}
+
+
+void sos_smp_ap_main(sos_ui32_t cpu_id)
+{
+  sos_vaddr_t stack_top = sos_smp_ap_stack_top[cpu_id];
+
+  SOS_ASSERT_FATAL(SOS_OK == cpu_local_setup(cpu_id));
+  SOS_ASSERT_FATAL(SOS_OK == sos_idt_cpu_setup());
+  SOS_ASSERT_FATAL(SOS_OK == sos_exception_cpu_setup_double_fault_task());
+  SOS_ASSERT_FATAL(SOS_OK == sos_apic_cpu_setup());
+  sos_fpu_cpu_setup();
+  sos_cpu_local()->apic_id = sos_apic_get_id();
+
+  /* Our TLB holds nothing older than the page directory we just
+     loaded */
+  sos_cpu_local()->tlb_gen_done = smp_tlb_gen;
+
+  /* Tell the boot CPU we are ready */
+  sos_atomic_inc(& smp_nb_cpus);
+
+  smp_ap_entry(stack_top - SOS_SMP_AP_STACK_SIZE, SOS_SMP_AP_STACK_SIZE);
+  SOS_FATAL_ERROR("AP %d: entry function returned", (int)cpu_id);
+}
+
+
+sos_ret_t sos_smp_start_aps(sos_smp_ap_entry_t *ap_entry)
+{
+  sos_paddr_t trampoline_paddr;
+  sos_vaddr_t trampoline_vaddr;
+  struct { sos_ui16_t limit; sos_ui32_t base; } __attribute__((packed)) gdtr;
+  sos_ui32_t cpu_id, nb_started, usec;
+  sos_ret_t retval;
+
+  if (! sos_apic_is_present())
+    return -SOS_ENOSUP;
+  cpu_local_area[SOS_SMP_BOOT_CPU].apic_id = sos_apic_get_id();
+
+  /* Allocate the boot stacks of the APs */
+  for (cpu_id = 1 ; cpu_id < SOS_SMP_MAX_CPUS ; cpu_id ++)
+    {
+      sos_vaddr_t stack = sos_kmalloc(SOS_SMP_AP_STACK_SIZE, 0);
+      if (! stack)
+	return -SOS_ENOMEM;
+      sos_smp_ap_stack_top[cpu_id] = stack + SOS_SMP_AP_STACK_SIZE;
+    }
+
+  /* Find a free page below 1MB for the trampoline: the SIPI vector
+     is the page number */
+  for (trampoline_paddr = SOS_PAGE_SIZE ;
+       trampoline_paddr < BIOS_N_VIDEO_START ;
+       trampoline_paddr += SOS_PAGE_SIZE)
+    {
+      retval = sos_physmem_ref_physpage_at(trampoline_paddr);
+      if (FALSE == retval)
+	break; /* The page was free: it is ours now */
+      else if (TRUE == retval)
+	sos_physmem_unref_physpage(trampoline_paddr);
+    }
+  if (trampoline_paddr >= BIOS_N_VIDEO_START)
+    return -SOS_ENOMEM;
+
+  /* Copy the trampoline, along with the address of the boot GDT,
+     through a temporary mapping */
+  trampoline_vaddr = sos_kmem_vmm_alloc(1, 0);
+  if (! trampoline_vaddr)
+    {
+      sos_physmem_unref_physpage(trampoline_paddr);
+      return -SOS_ENOMEM;
+    }
+  retval = sos_paging_map(trampoline_paddr, trampoline_vaddr, FALSE,
+			  SOS_VM_MAP_PROT_READ | SOS_VM_MAP_PROT_WRITE);
+  if (SOS_OK != retval)
+    {
+      sos_kmem_vmm_free(trampoline_vaddr);
+      sos_physmem_unref_physpage(trampoline_paddr);
+      return retval;
+    }
+
+  asm volatile("sgdt %0" : "=m"(gdtr));
+  memcpy((void*)trampoline_vaddr, sos_smp_trampoline_start,
+	 sos_smp_trampoline_end - sos_smp_trampoline_start);
+  memcpy((void*)(trampoline_vaddr
+		 + (sos_smp_trampoline_gdtr - sos_smp_trampoline_start)),
+	 & gdtr, sizeof(gdtr));
+
+  asm volatile("movl %%cr3, %0" : "=r"(sos_smp_ap_cr3));
+  sos_smp_ap_next_cpu_id = 1;
+  smp_ap_entry           = ap_entry;
+
+  /* The APs take part in the TLB shootdowns once online */
+  retval = sos_idt_set_handler(SOS_APIC_TLB_VECTOR,
+			       (sos_vaddr_t)sos_smp_tlb_ipi_wrapper, 0);
+  if (SOS_OK != retval)
+    {
+      sos_kmem_vmm_free(trampoline_vaddr);
+      sos_physmem_unref_physpage(trampoline_paddr);
+      return retval;
+    }
+
+  /* Start the APs and wait for them */
+  retval = sos_apic_start_aps(trampoline_paddr);
+  for (usec = 0 ;
+       (SOS_OK == retval) && (usec < SMP_AP_STARTUP_USEC) ;
+       usec += 10000)
+    sos_i8254_udelay(10000);
+
+  /* The APs that got a CPU id will complete their setup. The late
+     ones will get an invalid CPU id, and halt */
+  nb_started = sos_atomic_xchg(& sos_smp_ap_next_cpu_id, SOS_SMP_MAX_CPUS);
+  if (nb_started > SOS_SMP_MAX_CPUS)
+    nb_started = SOS_SMP_MAX_CPUS;
+  while (smp_nb_cpus < nb_started)
+    sos_cpu_relax();
+
+  /* The trampoline is not needed anymore */
+  sos_kmem_vmm_free(trampoline_vaddr);
+  sos_physmem_unref_physpage(trampoline_paddr);
+
+  /* Release the stacks of the missing CPUs */
+  for (cpu_id = nb_started ; cpu_id < SOS_SMP_MAX_CPUS ; cpu_id ++)
+    {
+      sos_kfree(sos_smp_ap_stack_top[cpu_id] - SOS_SMP_AP_STACK_SIZE);
+      sos_smp_ap_stack_top[cpu_id] = (sos_vaddr_t)NULL;
+    }
+
+  return retval;
+}
+
+
+void sos_smp_tlb_poll(void)
+{
+  struct sos_cpu_local *cpu = sos_cpu_local();
+  sos_ui32_t gen = smp_tlb_gen;
+
+  if (cpu->tlb_gen_done == gen)
+    return;
+
+  /* No global pages: reloading cr3 flushes the whole TLB */
+  asm volatile ("movl %%cr3, %%eax\n\t"
+		"movl %%eax, %%cr3" : : : "eax", "memory");
+  cpu->tlb_gen_done = gen;
+}
+
+
+void sos_smp_tlb_ipi_handler(void)
+{
+  sos_smp_tlb_poll();
+  sos_apic_eoi();
+}
+
+
+void sos_smp_tlb_shootdown(void)
+{
+  sos_ui32_t flags, gen, cpu_id;
+
+  if (smp_nb_cpus <= 1)
+    return;
+  SOS_ASSERT_FATAL(sos_bkl_is_held());
+
+  /* Our own TLB was flushed by the caller, and the previous
+     shootdowns waited for us */
+  sos_disable_IRQs(flags);
+  gen = smp_tlb_gen + 1;
+  smp_tlb_gen = gen;
+  sos_cpu_local()->tlb_gen_done = gen;
+
+  sos_apic_send_ipi_all_but_self(SOS_APIC_TLB_VECTOR);
+  for (cpu_id = 0 ; cpu_id < smp_nb_cpus ; cpu_id ++)
+    {
+      struct sos_cpu_local *cpu = & cpu_local_area[cpu_id];
+      while ((sos_si32_t)(cpu->tlb_gen_done - gen) < 0)
+	sos_cpu_relax();
+    }
+
+  sos_restore_IRQs(flags);
+}
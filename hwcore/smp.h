@@ -0,0 +1,193 @@
+/* Copyright (C) 2026  AbdAllah MEZITI
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+   USA. 
+*/
+#ifndef _SOS_SMP_H_
+#define _SOS_SMP_H_
+
+/**
+ * @file smp.h
+ *
+ * Multiprocessor support: start-up of the application processors
+ * (APs) and per-CPU data.
+ *
+ * Each CPU owns a per-CPU area (struct sos_cpu_local), reached
+ * through the %gs segment register: the KCPU segment of the GDT of
+ * each CPU covers the area of this CPU (see gdt.h). The selector
+ * value is the same on all the CPUs, so that %gs may be saved in a
+ * thread context on a CPU and restored on another one.
+ *
+ * The APs are started with a broadcast INIT-SIPI-SIPI sequence (see
+ * apic.h): the ACPI MADT and the MP tables are not parsed, all the
+ * CPUs that answer are used, up to SOS_SMP_MAX_CPUS.
+ */
+
+/** Maximum number of CPUs handled by the kernel */
+#define SOS_SMP_MAX_CPUS 8
+
+/** Logical identifier of the boot CPU */
+#define SOS_SMP_BOOT_CPU 0
+
+/** Offset of the irq_nested_level field in struct sos_cpu_local
+    (used by irq_wrappers.S) */
+#define SOS_CPU_LOCAL_IRQ_NESTED_LEVEL_OFFSET 4
+
+/** Size of the boot stack of each AP, which then becomes the stack
+    of the idle thread of the AP */
+#define SOS_SMP_AP_STACK_SIZE (2*4096)
+
+
+#ifndef ASM_SOURCE
+
+#include <os/types.h>
+#include <os/errno.h>
+
+struct sos_fpu_state;
+
+/** Data private to each CPU */
+struct sos_cpu_local
+{
+  /** Address of this structure (offset 0): see sos_cpu_local() */
+  struct sos_cpu_local *self;
+
+  /** Nesting level of the IRQ handlers (offset 4): see irq.h */
+  sos_ui32_t irq_nested_level;
+
+  /** Logical identifier of the CPU, 0..SOS_SMP_MAX_CPUS-1 */
+  sos_ui32_t cpu_id;
+
+  /** Local APIC identifier of the CPU */
+  sos_ui32_t apic_id;
+
+  /** Last TLB shootdown generation handled by this CPU (see
+      sos_smp_tlb_shootdown()) */
+  volatile sos_ui32_t tlb_gen_done;
+
+  /** The thread currently running on this CPU (see thread.c) */
+  struct sos_thread *current_thread;
+
+  /** The idle thread of this CPU (see sched.c) */
+  struct sos_thread *idle_thread;
+
+  /** Nesting level of the RCU read-side critical sections (see
+      os/rcu.h) */
+  sos_ui32_t rcu_nesting;
+
+  /** Softirqs raised on this CPU, not run yet (see os/softirq.h) */
+  sos_ui32_t softirq_pending;
+
+  /** TRUE while this CPU runs its softirqs */
+  sos_bool_t softirq_active;
+
+  /** The FPU context of the current thread (see fpu.h) */
+  struct sos_fpu_state *fpu_state;
+
+  /** TRUE inside sos_kernel_fpu_begin()/end(), with the IRQ flags
+      to restore at the end */
+  sos_bool_t fpu_kernel_section;
+  sos_ui32_t fpu_kernel_irq_flags;
+};
+
+
+/**
+ * @return the per-CPU area of the current CPU
+ *
+ * @note volatile, because the result changes when a thread migrates
+ * to another CPU at a context switch
+ */
+static inline struct sos_cpu_local *sos_cpu_local(void)
+{
+  struct sos_cpu_local *cpu;
+  asm volatile("movl %%gs:0, %0" : "=r"(cpu));
+  return cpu;
+}
+
+
+/** @return the logical identifier of the current CPU */
+static inline sos_ui32_t sos_smp_get_cpu_id(void)
+{
+  return sos_cpu_local()->cpu_id;
+}
+
+
+/**
+ * Set up the per-CPU area of the boot CPU and load its per-CPU
+ * GDT. MUST be called right after sos_gdt_subsystem_setup(), before
+ * the IRQs are set up.
+ */
+sos_ret_t sos_smp_subsystem_setup(void);
+
+
+/**
+ * Function executed by each AP once its GDT, IDT and local APIC are
+ * set up, on a boot stack of SOS_SMP_AP_STACK_SIZE bytes, with the
+ * IRQs disabled. MUST NOT return.
+ */
+typedef void (sos_smp_ap_entry_t)(sos_vaddr_t stack_base,
+				  sos_size_t stack_size);
+
+
+/**
+ * Start all the application processors, and wait for them to be set
+ * up. Each AP then calls ap_entry. MUST be called with the IRQs
+ * disabled, once the APIC subsystem and the kernel allocators are
+ * set up.
+ *
+ * @return -SOS_ENOSUP when there is no local APIC
+ */
+sos_ret_t sos_smp_start_aps(sos_smp_ap_entry_t *ap_entry);
+
+
+/** @return the number of CPUs online */
+sos_ui32_t sos_smp_get_nb_cpus(void);
+
+
+/**
+ * @return TRUE when the given thread is the current thread of one of
+ * the CPUs. The thread structure is not dereferenced, so that this
+ * may be called on a thread that is being deleted
+ *
+ * @note NOT protected against the other CPUs: the result may already
+ * be wrong on return
+ */
+sos_bool_t sos_smp_is_running(const struct sos_thread *thr);
+
+
+/**
+ * Flush the TLB of all the other CPUs online, and wait for them to be
+ * done: to be called once a kernel mapping was removed or changed
+ * (and flushed from the local TLB), before the virtual page or the
+ * physical page it mapped is reused. Does nothing while a single CPU
+ * is online. MUST be called with the BKL held, which serializes the
+ * shootdowns.
+ *
+ * The other CPUs flush their whole TLB from an IPI. The CPUs waiting
+ * for a spinlock (hence for the BKL) with the IRQs disabled flush it
+ * from their waiting loop (see sos_smp_tlb_poll()), so that they do
+ * not deadlock with us.
+ */
+void sos_smp_tlb_shootdown(void);
+
+
+/**
+ * Flush the TLB of the current CPU if a shootdown is pending. Called
+ * by the busy-waiting loops that run with the IRQs disabled.
+ */
+void sos_smp_tlb_poll(void);
+
+#endif /* ! ASM_SOURCE */
+
+#endif /* _SOS_SMP_H_ */
@@ -0,0 +1,118 @@
+/* Copyright (C) 2026  AbdAllah MEZITI
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+   USA. 
+*/
+#include <hwcore/tsc.h>
+#include <lib/stdio.h>
+
+#include "spinlock.h"
+
+
+#ifdef SOS_SPINLOCK_STATS
+
+/** Maximum number of spinlocks whose statistics are recorded */
+#define SPIN_STATS_MAX_LOCKS 64
+
+/** The locks initialized with sos_spin_init(), and the lock
+    protecting this array */
+static struct sos_spinlock *spin_stats_locks[SPIN_STATS_MAX_LOCKS];
+static sos_ui32_t spin_stats_nb_locks;
+static struct sos_spinlock spin_stats_registry
+  = SOS_SPINLOCK_INITIALIZER("spin_stats");
+
+
+void _sos_spin_stats_acquired(struct sos_spinlock *lock,
+			      sos_bool_t contended)
+{
+  lock->nb_acquired ++;
+  if (contended)
+    lock->nb_contended ++;
+  lock->acquired_tsc = sos_tsc_read();
+}
+
+
+void _sos_spin_stats_release(struct sos_spinlock *lock)
+{
+  sos_ui64_t hold_cycles = sos_tsc_read() - lock->acquired_tsc;
+
+  lock->total_hold_cycles += hold_cycles;
+  if (hold_cycles > lock->max_hold_cycles)
+    lock->max_hold_cycles = hold_cycles;
+}
+
+
+void sos_spin_stats_dump(void)
+{
+  sos_ui32_t flags, i;
+
+  sos_spin_lock_irqsave(& spin_stats_registry, flags);
+  printf("spinlock         acquired contended  avg(ns)  max(ns)\n");
+  for (i = 0 ; i < spin_stats_nb_locks ; i ++)
+    {
+      struct sos_spinlock *lock = spin_stats_locks[i];
+      sos_ui64_t avg_cycles = 0;
+
+      if (lock->nb_acquired > 0)
+	avg_cycles = sos_tsc_udiv64(lock->total_hold_cycles,
+				    lock->nb_acquired, NULL);
+
+      printf("%s %d %d %d %d\n", lock->name,
+	     lock->nb_acquired, lock->nb_contended,
+	     (sos_ui32_t)sos_tsc_cycles_to_ns(avg_cycles),
+	     (sos_ui32_t)sos_tsc_cycles_to_ns(lock->max_hold_cycles));
+    }
+  sos_spin_unlock_irqrestore(& spin_stats_registry, flags);
+}
+
+#endif /* SOS_SPINLOCK_STATS */
+
+
+void sos_spin_init(struct sos_spinlock *lock, const char *name)
+{
+  *lock = (struct sos_spinlock) SOS_SPINLOCK_INITIALIZER(name);
+
+#ifdef SOS_LOCKDEP
+  lock->lockdep_class = sos_lockdep_get_class(name, SOS_LOCKDEP_SPIN);
+#endif
+
+#ifdef SOS_SPINLOCK_STATS
+  {
+    sos_ui32_t flags;
+
+    sos_spin_lock_irqsave(& spin_stats_registry, flags);
+    if (spin_stats_nb_locks < SPIN_STATS_MAX_LOCKS)
+      spin_stats_locks[spin_stats_nb_locks ++] = lock;
+    sos_spin_unlock_irqrestore(& spin_stats_registry, flags);
+  }
+#endif
+}
+
+
+void sos_spin_dispose(struct sos_spinlock *lock)
+{
+#ifdef SOS_SPINLOCK_STATS
+  sos_ui32_t flags, i;
+
+  sos_spin_lock_irqsave(& spin_stats_registry, flags);
+  for (i = 0 ; i < spin_stats_nb_locks ; i ++)
+    if (spin_stats_locks[i] == lock)
+      {
+	spin_stats_locks[i] = spin_stats_locks[-- spin_stats_nb_locks];
+	break;
+      }
+  sos_spin_unlock_irqrestore(& spin_stats_registry, flags);
+#endif
+}
@@ -0,0 +1,186 @@
+/* Copyright (C) 2026  AbdAllah MEZITI
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+   USA. 
+*/
+#ifndef _SOS_SPINLOCK_H_
+#define _SOS_SPINLOCK_H_
+
+/**
+ * @file spinlock.h
+ *
+ * Ticket spinlocks: a CPU takes the next ticket, then busy-waits
+ * until its ticket is served. The CPUs get the lock in FIFO order.
+ *
+ * A spinlock is NOT recursive, and MUST be held for a short time
+ * only: the holder must not block nor yield. A lock also taken by IRQ
+ * handlers MUST always be taken with the IRQs disabled on the current
+ * CPU (sos_spin_lock_irqsave()), otherwise an IRQ handler would spin
+ * forever behind the interrupted holder.
+ *
+ * When SOS_SPINLOCK_STATS is defined, each lock initialized with
+ * sos_spin_init() records how long it is held (in TSC cycles) and how
+ * often it is contended: see sos_spin_stats_dump(). When SOS_LOCKDEP
+ * is defined, these locks are validated by the lock validator (see
+ * lockdep.h).
+ */
+
+#include <os/types.h>
+#include <os/errno.h>
+#include <hwcore/atomic.h>
+#include <hwcore/irq.h>
+#include <hwcore/smp.h>
+#include <os/lockdep.h>
+
+/* Uncomment to record the lock hold times */
+/* #define SOS_SPINLOCK_STATS */
+
+
+/** A ticket spinlock. Don't access its fields directly */
+struct sos_spinlock
+{
+  volatile sos_ui32_t next_ticket;
+  volatile sos_ui32_t now_serving;
+  const char *name;
+
+#ifdef SOS_SPINLOCK_STATS
+  sos_ui64_t  acquired_tsc;      /**< When the holder got the lock */
+  sos_ui64_t  total_hold_cycles;
+  sos_ui64_t  max_hold_cycles;
+  sos_count_t nb_acquired;
+  sos_count_t nb_contended;      /**< Acquisitions that had to wait */
+#endif
+
+#ifdef SOS_LOCKDEP
+  sos_lockdep_class_t lockdep_class; /**< 0: not validated */
+#endif
+};
+
+
+/** Static initializer of an unlocked spinlock */
+#define SOS_SPINLOCK_INITIALIZER(lock_name) \
+  { .next_ticket = 0, .now_serving = 0, .name = (lock_name) }
+
+
+/**
+ * Initialize an unlocked spinlock, and register it for the lock
+ * statistics (when enabled)
+ *
+ * @param name For debugging purpose only (NOT copied)
+ */
+void sos_spin_init(struct sos_spinlock *lock, const char *name);
+
+
+/** Unregister a lock initialized with sos_spin_init() before its
+    memory is released */
+void sos_spin_dispose(struct sos_spinlock *lock);
+
+
+#ifdef SOS_SPINLOCK_STATS
+void _sos_spin_stats_acquired(struct sos_spinlock *lock,
+			      sos_bool_t contended);
+void _sos_spin_stats_release(struct sos_spinlock *lock);
+
+/** Print the statistics of all the spinlocks initialized with
+    sos_spin_init() */
+void sos_spin_stats_dump(void);
+#else
+# define _sos_spin_stats_acquired(lock,contended) ({ (void)(contended); })
+# define _sos_spin_stats_release(lock) ({ /* nop */ })
+#endif
+
+#ifdef SOS_LOCKDEP
+# define _sos_spin_lockdep_acquire(lock,flags) \
+  sos_lockdep_acquire((lock)->lockdep_class, flags)
+# define _sos_spin_lockdep_release(lock) \
+  sos_lockdep_release((lock)->lockdep_class)
+#else
+# define _sos_spin_lockdep_acquire(lock,flags) ({ /* nop */ })
+# define _sos_spin_lockdep_release(lock) ({ /* nop */ })
+#endif
+
+
+/** Take the lock, busy-waiting while another CPU holds it */
+static inline void sos_spin_lock(struct sos_spinlock *lock)
+{
+  sos_ui32_t ticket;
+  sos_bool_t contended = FALSE;
+
+  _sos_spin_lockdep_acquire(lock, 0);
+  ticket = sos_atomic_xadd(& lock->next_ticket, 1);
+
+  while (lock->now_serving != ticket)
+    {
+      contended = TRUE;
+
+      /* The holder may be waiting for us to flush our TLB */
+      sos_smp_tlb_poll();
+      sos_cpu_relax();
+    }
+
+  _sos_spin_stats_acquired(lock, contended);
+}
+
+
+/** Take the lock if it is free. @return TRUE when the lock is taken */
+static inline sos_bool_t sos_spin_trylock(struct sos_spinlock *lock)
+{
+  sos_ui32_t ticket = lock->now_serving;
+
+  if (sos_atomic_cmpxchg(& lock->next_ticket, ticket, ticket + 1)
+      != ticket)
+    return FALSE;
+
+  _sos_spin_lockdep_acquire(lock, SOS_LOCKDEP_TRY);
+  _sos_spin_stats_acquired(lock, FALSE);
+  return TRUE;
+}
+
+
+/** Release the lock, which MUST be held by the current CPU */
+static inline void sos_spin_unlock(struct sos_spinlock *lock)
+{
+  _sos_spin_stats_release(lock);
+  _sos_spin_lockdep_release(lock);
+
+  /* Only the holder updates now_serving: an ordered store is enough */
+  sos_barrier();
+  lock->now_serving = lock->now_serving + 1;
+}
+
+
+/** @return TRUE when the lock is held by some CPU */
+static inline sos_bool_t sos_spin_is_locked(struct sos_spinlock *lock)
+{
+  return (lock->next_ticket != lock->now_serving);
+}
+
+
+/** @return TRUE when some CPU waits for the lock */
+static inline sos_bool_t sos_spin_is_contended(struct sos_spinlock *lock)
+{
+  return (lock->next_ticket - lock->now_serving > 1);
+}
+
+
+/** Disable the IRQs on the current CPU, then take the lock */
+#define sos_spin_lock_irqsave(lock,flags) \
+  ({ sos_disable_IRQs(flags); sos_spin_lock(lock); })
+
+/** Release the lock, then restore the IRQs of the current CPU */
+#define sos_spin_unlock_irqrestore(lock,flags) \
+  ({ sos_spin_unlock(lock); sos_restore_IRQs(flags); })
+
+#endif /* _SOS_SPINLOCK_H_ */
@@ -0,0 +1,99 @@
+/* Copyright (C) 2026  AbdAllah MEZITI
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+   USA. 
+*/
+
+#include <hwcore/cpuid.h>
+#include <hwcore/i8254.h>
+
+#include "tsc.h"
+
+
+/** TSC frequency (kHz), 0 when no usable TSC */
+static sos_ui32_t tsc_khz;
+
+
+sos_ret_t sos_tsc_subsystem_setup(void)
+{
+  sos_ret_t retval;
+
+  tsc_khz = 0;
+  if (! sos_cpuid_has_features_edx(SOS_CPUID_FEAT_EDX_TSC))
+    return -SOS_ENOSUP;
+
+  retval = sos_i8254_calibrate_tsc(& tsc_khz);
+  if (SOS_OK != retval)
+    tsc_khz = 0;
+
+  return retval;
+}
+
+
+sos_ui32_t sos_tsc_get_khz(void)
+{
+  return tsc_khz;
+}
+
+
+sos_ui64_t sos_tsc_udiv64(sos_ui64_t dividend, sos_ui32_t divisor,
+			  /* out */sos_ui32_t *remainder)
+{
+  sos_ui32_t hi = dividend >> 32, lo = dividend, q_hi, q_lo, rem;
+
+  /* Long division in 2 steps, so that each "divl" quotient fits in 32
+     bits: first the high dword... */
+  q_hi = hi / divisor;
+  rem  = hi % divisor;
+
+  /* ... then (remainder:low dword), with remainder < divisor */
+  asm ("divl %4"
+       : "=a"(q_lo), "=d"(rem)
+       : "0"(lo), "1"(rem), "rm"(divisor));
+
+  if (remainder)
+    *remainder = rem;
+  return (((sos_ui64_t)q_hi) << 32) | q_lo;
+}
+
+
+sos_ui64_t sos_tsc_cycles_to_ns(sos_ui64_t cycles)
+{
+  sos_ui64_t ms;
+  sos_ui32_t rem;
+
+  if (! tsc_khz)
+    return 0;
+
+  /* cycles * 1e6 / khz would overflow after a few hours worth of
+     cycles: convert the ms and the remaining cycles separately */
+  ms = sos_tsc_udiv64(cycles, tsc_khz, & rem);
+  return ms * 1000000ULL
+    + sos_tsc_udiv64(((sos_ui64_t)rem) * 1000000ULL, tsc_khz, NULL);
+}
+
+
+sos_ui32_t sos_tsc_cycles_to_us(sos_ui64_t cycles)
+{
+  sos_ui64_t us;
+
+  if (! tsc_khz)
+    return 0;
+
+  us = sos_tsc_udiv64(sos_tsc_cycles_to_ns(cycles), 1000, NULL);
+  if (us > 0xffffffffULL)
+    return 0xffffffffUL;
+  return us;
+}
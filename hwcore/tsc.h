@@ -0,0 +1,81 @@
+/* Copyright (C) 2026  AbdAllah MEZITI
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+   USA. 
+*/
+#ifndef _SOS_TSC_H_
+#define _SOS_TSC_H_
+
+/**
+ * @file tsc.h
+ *
+ * CPU time-stamp counter (TSC): a cycle counter, calibrated at boot
+ * against the 82c54 clock. To be used for fine-grained time
+ * measurements (benchmarks, latencies, interpolation between 2 timer
+ * ticks).
+ */
+
+#include <os/types.h>
+#include <os/errno.h>
+
+
+/**
+ * Check that the CPU has a TSC, and measure its frequency. MUST be
+ * called with IRQs disabled.
+ */
+sos_ret_t sos_tsc_subsystem_setup(void);
+
+
+/**
+ * Read the current value of the cycle counter
+ */
+static inline sos_ui64_t sos_tsc_read(void)
+{
+  sos_ui64_t cycles;
+  asm volatile ("rdtsc" : "=A"(cycles));
+  return cycles;
+}
+
+
+/**
+ * @return The TSC frequency in kHz, or 0 when there is no usable TSC
+ */
+sos_ui32_t sos_tsc_get_khz(void);
+
+
+/**
+ * Convert a number of TSC cycles into nanoseconds. Returns 0 when
+ * there is no usable TSC.
+ */
+sos_ui64_t sos_tsc_cycles_to_ns(sos_ui64_t cycles);
+
+
+/**
+ * Convert a number of TSC cycles into microseconds (saturates to
+ * 2^32-1, ie ~71 minutes). Returns 0 when there is no usable TSC.
+ */
+sos_ui32_t sos_tsc_cycles_to_us(sos_ui64_t cycles);
+
+
+/**
+ * Divide a 64 bits unsigned integer by a 32 bits one (the compiler
+ * would otherwise need the libgcc routines)
+ *
+ * @param remainder (out) When not NULL, the remainder of the division
+ */
+sos_ui64_t sos_tsc_udiv64(sos_ui64_t dividend, sos_ui32_t divisor,
+			  /* out */sos_ui32_t *remainder);
+
+#endif /* _SOS_TSC_H_ */
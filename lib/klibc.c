@@ -17,37 +17,295 @@
    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
    USA. 
 */
+#include <hwcore/fpu.h>
+
 #include "klibc.h"
 
-/* For an optimized version, see BSD sources ;) */
+/*
+ * The mem*() functions work on 32-bit words, or on 16-byte blocks
+ * with SSE2 (inside sos_kernel_fpu_begin()/end(), see hwcore/fpu.h)
+ * for the large buffers. The destination is aligned first; the
+ * source may remain unaligned.
+ *
+ * The xmm registers are not declared as clobbered: the kernel is
+ * compiled without SSE, gcc never allocates them.
+ */
+
+/** Below this size, the bytes are handled one at a time */
+#define KLIBC_WORD_MIN_SIZE 16
+
+/** From this size on, the SSE2 path is worth entering a kernel FPU
+    section */
+#define KLIBC_SSE_MIN_SIZE  512
+
+/** Maximum size handled in a single kernel FPU section, which
+    disables the IRQs */
+#define KLIBC_SSE_CHUNK     4096
+
+/** A word that may alias any other type */
+typedef sos_ui32_t __attribute__((may_alias)) klibc_word_t;
+
+
+static inline void klibc_movsb(char **dst, const char **src,
+			       sos_size_t n)
+{
+  asm volatile ("rep movsb"
+		: "+D"(*dst), "+S"(*src), "+c"(n) : : "memory");
+}
+
+
+static inline void klibc_movsl(char **dst, const char **src,
+			       sos_size_t nwords)
+{
+  asm volatile ("rep movsl"
+		: "+D"(*dst), "+S"(*src), "+c"(nwords) : : "memory");
+}
+
+
+static inline void klibc_stosb(char **dst, sos_ui32_t c, sos_size_t n)
+{
+  asm volatile ("rep stosb"
+		: "+D"(*dst), "+c"(n) : "a"(c) : "memory");
+}
+
+
+static inline void klibc_stosl(char **dst, sos_ui32_t word,
+			       sos_size_t nwords)
+{
+  asm volatile ("rep stosl"
+		: "+D"(*dst), "+c"(nwords) : "a"(word) : "memory");
+}
+
+
+/**
+ * Copy the 64-byte blocks of size with SSE2, once dst is 16-byte
+ * aligned
+ *
+ * @return the number of bytes copied, 0 when SSE2 cannot be used
+ */
+static sos_size_t klibc_sse_memcpy(char *dst, const char *src,
+				   sos_size_t size)
+{
+  sos_size_t done = 0;
+
+  while (size - done >= 64)
+    {
+      sos_size_t chunk = size - done;
+      if (chunk > KLIBC_SSE_CHUNK)
+	chunk = KLIBC_SSE_CHUNK;
+      chunk &= ~63;
+
+      if (SOS_OK != sos_kernel_fpu_begin())
+	break;
+      for ( ; chunk > 0 ; chunk -= 64, done += 64)
+	asm volatile ("movdqu   (%0), %%xmm0\n\t"
+		      "movdqu 16(%0), %%xmm1\n\t"
+		      "movdqu 32(%0), %%xmm2\n\t"
+		      "movdqu 48(%0), %%xmm3\n\t"
+		      "movdqa %%xmm0,   (%1)\n\t"
+		      "movdqa %%xmm1, 16(%1)\n\t"
+		      "movdqa %%xmm2, 32(%1)\n\t"
+		      "movdqa %%xmm3, 48(%1)"
+		      : : "r"(src + done), "r"(dst + done)
+		      : "memory");
+      sos_kernel_fpu_end();
+    }
+
+  return done;
+}
+
+
 void *memcpy(void *dst0, const void *src0, register unsigned int size)
 {
-  char *dst;
-  const char *src;
-  for (dst = (char*)dst0, src = (const char*)src0 ;
-       size > 0 ;
-       dst++, src++, size--)
-    *dst = *src;
+  char *dst = (char*)dst0;
+  const char *src = (const char*)src0;
+
+  if (size >= KLIBC_WORD_MIN_SIZE)
+    {
+      /* Align the destination */
+      sos_size_t head = (-(sos_ui32_t)dst) & 3;
+
+      if ((size >= KLIBC_SSE_MIN_SIZE) && sos_fpu_has_sse2())
+	{
+	  sos_size_t done;
+
+	  head = (-(sos_ui32_t)dst) & 15;
+	  klibc_movsb(& dst, & src, head);
+	  size -= head;
+
+	  done = klibc_sse_memcpy(dst, src, size);
+	  dst  += done;
+	  src  += done;
+	  size -= done;
+	  head  = 0;
+	}
+
+      klibc_movsb(& dst, & src, head);
+      size -= head;
+      klibc_movsl(& dst, & src, size >> 2);
+      size &= 3;
+    }
+
+  klibc_movsb(& dst, & src, size);
+  return dst0;
+}
+
+
+void *memmove(void *dst0, const void *src0, register unsigned int size)
+{
+  char *dst = (char*)dst0;
+  const char *src = (const char*)src0;
+
+  /* memcpy() copies forward, and loads each block before storing it:
+     it is correct when the destination is below the source */
+  if ((dst <= src) || (dst >= src + size))
+    return memcpy(dst0, src0, size);
+
+  /* Copy backward from the last byte. The IRQ and exception wrappers
+     clear DF for their handlers, and iret restores it */
+  dst += size - 1;
+  src += size - 1;
+  asm volatile ("std ; rep movsb ; cld"
+		: "+D"(dst), "+S"(src), "+c"(size) : : "memory");
   return dst0;
 }
 
-/* ditto */
+
+/**
+ * Fill the 64-byte blocks of length with the byte replicated in word
+ * with SSE2, once dst is 16-byte aligned
+ *
+ * @return the number of bytes set, 0 when SSE2 cannot be used
+ */
+static sos_size_t klibc_sse_memset(char *dst, sos_ui32_t word,
+				   sos_size_t length)
+{
+  sos_ui32_t pattern[4] = { word, word, word, word };
+  sos_size_t done = 0;
+
+  while (length - done >= 64)
+    {
+      sos_size_t chunk = length - done;
+      if (chunk > KLIBC_SSE_CHUNK)
+	chunk = KLIBC_SSE_CHUNK;
+      chunk &= ~63;
+
+      if (SOS_OK != sos_kernel_fpu_begin())
+	break;
+      asm volatile ("movdqu (%0), %%xmm0"
+		    : : "r"(pattern) : "memory");
+      for ( ; chunk > 0 ; chunk -= 64, done += 64)
+	asm volatile ("movdqa %%xmm0,   (%0)\n\t"
+		      "movdqa %%xmm0, 16(%0)\n\t"
+		      "movdqa %%xmm0, 32(%0)\n\t"
+		      "movdqa %%xmm0, 48(%0)"
+		      : : "r"(dst + done) : "memory");
+      sos_kernel_fpu_end();
+    }
+
+  return done;
+}
+
+
 void *memset(void *dst0, register int c, register unsigned int length)
 {
-  char *dst;
-  for (dst = (char*) dst0 ;
-       length > 0 ;
-       dst++, length --)
-    *dst = (char)c;
+  char *dst = (char*)dst0;
+  sos_ui32_t word = ((sos_ui8_t)c) * 0x01010101U;
+
+  if (length >= KLIBC_WORD_MIN_SIZE)
+    {
+      /* Align the destination */
+      sos_size_t head = (-(sos_ui32_t)dst) & 3;
+
+      if ((length >= KLIBC_SSE_MIN_SIZE) && sos_fpu_has_sse2())
+	{
+	  sos_size_t done;
+
+	  head = (-(sos_ui32_t)dst) & 15;
+	  klibc_stosb(& dst, word, head);
+	  length -= head;
+
+	  done    = klibc_sse_memset(dst, word, length);
+	  dst    += done;
+	  length -= done;
+	  head    = 0;
+	}
+
+      klibc_stosb(& dst, word, head);
+      length -= head;
+      klibc_stosl(& dst, word, length >> 2);
+      length &= 3;
+    }
+
+  klibc_stosb(& dst, word, length);
   return dst0;
 }
 
+
+/**
+ * Skip the identical 16-byte blocks at the start of s1 and s2 with
+ * SSE2
+ *
+ * @return the number of identical bytes skipped, a multiple of 16
+ */
+static sos_size_t klibc_sse_memcmp(const char *s1, const char *s2,
+				   sos_size_t len)
+{
+  sos_size_t done = 0;
+
+  while (len - done >= 16)
+    {
+      sos_size_t chunk = len - done;
+      sos_ui32_t mask  = 0xffff;
+      if (chunk > KLIBC_SSE_CHUNK)
+	chunk = KLIBC_SSE_CHUNK;
+      chunk &= ~15;
+
+      if (SOS_OK != sos_kernel_fpu_begin())
+	break;
+      for ( ; chunk > 0 ; chunk -= 16, done += 16)
+	{
+	  asm volatile ("movdqu (%1), %%xmm0\n\t"
+			"movdqu (%2), %%xmm1\n\t"
+			"pcmpeqb %%xmm1, %%xmm0\n\t"
+			"pmovmskb %%xmm0, %0"
+			: "=r"(mask) : "r"(s1 + done), "r"(s2 + done)
+			: "memory");
+	  if (mask != 0xffff)
+	    break;
+	}
+      sos_kernel_fpu_end();
+
+      if (mask != 0xffff)
+	break;
+    }
+
+  return done;
+}
+
+
 int memcmp(const void *s1, const void *s2, sos_size_t len)
 {
-  const unsigned char *c1, *c2;
-  unsigned int i;
- 
-  for (i = 0, c1 = s1, c2 = s2; i < len; i++, c1++, c2++)
+  const unsigned char *c1 = s1, *c2 = s2;
+
+  if ((len >= KLIBC_SSE_MIN_SIZE) && sos_fpu_has_sse2())
+    {
+      sos_size_t done = klibc_sse_memcmp((const char*)c1,
+					 (const char*)c2, len);
+      c1  += done;
+      c2  += done;
+      len -= done;
+    }
+
+  /* Skip the identical words, the first different byte is then in
+     the next word */
+  for ( ; len >= sizeof(klibc_word_t) ;
+	len -= sizeof(klibc_word_t),
+	  c1 += sizeof(klibc_word_t), c2 += sizeof(klibc_word_t))
+    if (*(const klibc_word_t*)c1 != *(const klibc_word_t*)c2)
+      break;
+
+  for ( ; len > 0 ; len--, c1++, c2++)
     {
       if(*c1 != *c2)
         return *c1 - *c2;
@@ -57,22 +315,52 @@ int memcmp(const void *s1, const void *s2, sos_size_t len)
 }
 
 
+/*
+ * The str*() functions scan 32-bit words once the source is aligned:
+ * an aligned word never straddles 2 pages, so that the bytes read
+ * past the end of a string are always on a mapped page.
+ */
+
+/** Non-zero when one of the bytes of the word is 0 */
+#define KLIBC_HAS_ZERO_BYTE(w) \
+  (((w) - 0x01010101U) & ~(w) & 0x80808080U)
+
+#define KLIBC_IS_WORD_ALIGNED(p) \
+  (0 == (((sos_ui32_t)(p)) & (sizeof(klibc_word_t) - 1)))
+
+
 unsigned int strlen(register const char *str)
 {
-  unsigned int retval = 0;
-  
-  while (*str++)
-    retval++;
-  
-  return retval;
+  const char *sc = str;
+
+  for ( ; ! KLIBC_IS_WORD_ALIGNED(sc) ; sc++)
+    if (*sc == '\0')
+      return sc - str;
+
+  while (! KLIBC_HAS_ZERO_BYTE(*(const klibc_word_t*)sc))
+    sc += sizeof(klibc_word_t);
+
+  for ( ; *sc != '\0' ; sc++)
+    continue;
+
+  return sc - str;
 }
 
 
 unsigned int strnlen(const char * s, sos_size_t count)
 {
-  const char *sc;
-  
-  for (sc = s; count-- && *sc != '\0'; ++sc)
+  const char *sc = s;
+
+  for ( ; count > 0 && ! KLIBC_IS_WORD_ALIGNED(sc) ; sc++, count--)
+    if (*sc == '\0')
+      return sc - s;
+
+  for ( ; count >= sizeof(klibc_word_t)
+	  && ! KLIBC_HAS_ZERO_BYTE(*(const klibc_word_t*)sc) ;
+	sc += sizeof(klibc_word_t), count -= sizeof(klibc_word_t))
+    continue;
+
+  for ( ; count-- && *sc != '\0'; ++sc)
     /* nothing */continue;
 
   return sc - s;
@@ -85,8 +373,24 @@ char *strzcpy(register char *dst, register const char *src, register int len)
 
   if (len <= 0)
     return dst;
-  
-  for (i = 0; i < len; i++)
+
+  /* Align the source, the destination may remain unaligned */
+  for (i = 0 ; i < len && ! KLIBC_IS_WORD_ALIGNED(src + i) ; i++)
+    {
+      dst[i] = src[i];
+      if(src[i] == '\0')
+        return dst;
+    }
+
+  for ( ; len - i >= (int)sizeof(klibc_word_t) ; i += sizeof(klibc_word_t))
+    {
+      klibc_word_t w = *(const klibc_word_t*)(src + i);
+      if (KLIBC_HAS_ZERO_BYTE(w))
+	break;
+      *(klibc_word_t*)(dst + i) = w;
+    }
+
+  for ( ; i < len ; i++)
     {
       dst[i] = src[i];
       if(src[i] == '\0')
@@ -117,6 +421,19 @@ char *strzcat (char *dest, const char *src, sos_size_t n)
 
 int strcmp(register const char *s1, register const char *s2)
 {
+  /* Skip the identical words when both strings are aligned alike */
+  if (KLIBC_IS_WORD_ALIGNED((sos_ui32_t)s1 - (sos_ui32_t)s2))
+    {
+      for ( ; ! KLIBC_IS_WORD_ALIGNED(s1) ; s1++, s2++)
+	if ((*s1 != *s2) || (*s1 == '\0'))
+	  return (*(const unsigned char *)s1 - *(const unsigned char *)s2);
+
+      for ( ; (*(const klibc_word_t*)s1 == *(const klibc_word_t*)s2)
+	      && ! KLIBC_HAS_ZERO_BYTE(*(const klibc_word_t*)s1) ;
+	    s1 += sizeof(klibc_word_t), s2 += sizeof(klibc_word_t))
+	continue;
+    }
+
   while (*s1 == *s2++)
     if (*s1++ == 0)
       return (0);
@@ -128,6 +445,27 @@ int strcmp(register const char *s1, register const char *s2)
 int strncmp(register const char *s1, register const char *s2, register int len)
 {
   char c1 = '\0', c2 = '\0';
+
+  /* Skip the identical words when both strings are aligned alike */
+  if (KLIBC_IS_WORD_ALIGNED((sos_ui32_t)s1 - (sos_ui32_t)s2))
+    {
+      for ( ; len > 0 && ! KLIBC_IS_WORD_ALIGNED(s1) ; len--)
+	{
+	  c1 = (unsigned char) *s1++;
+	  c2 = (unsigned char) *s2++;
+	  if (c1 == '\0' || c1 != c2)
+	    return c1 - c2;
+	}
+
+      for ( ; (len >= (int)sizeof(klibc_word_t))
+	      && (*(const klibc_word_t*)s1 == *(const klibc_word_t*)s2)
+	      && ! KLIBC_HAS_ZERO_BYTE(*(const klibc_word_t*)s1) ;
+	    len -= sizeof(klibc_word_t))
+	{
+	  s1 += sizeof(klibc_word_t);
+	  s2 += sizeof(klibc_word_t);
+	}
+    }
   
   while (len > 0)
     {
@@ -32,6 +32,7 @@
 
 void *memcpy(void *dst, const void *src, register unsigned int size ) ;
 void *memset(void *dst, register int c, register unsigned int length ) ;
+void *memmove(void *dst, const void *src, register unsigned int size ) ;
 int memcmp(const void *s1, const void *s2, sos_size_t n);
 
 unsigned int strlen( register const char *str) ;
@@ -96,4 +97,13 @@ unsigned long int random (void);
 /* Set random seed (MT unsafe) */
 void srandom (unsigned long int seed);
 
+
+/**
+ * Check the mem*() and str*() functions against plain byte loops,
+ * for the sizes and alignments where their word and SSE2 paths
+ * differ. Stops the kernel with a fatal error on the first wrong
+ * result. Called at boot, once the FPU is set up
+ */
+void sos_klibc_selftest(void);
+
 #endif /* _SOS_KLIBC_H_ */
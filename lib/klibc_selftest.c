@@ -0,0 +1,294 @@
+/* Copyright (C) 2026  AbdAllah MEZITI
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+   USA.
+*/
+
+#include <os/assert.h>
+
+#include "klibc.h"
+
+/*
+ * The klibc functions handle the heads and tails of the buffers (or
+ * strings), the words and the SSE2 blocks differently: they are
+ * checked at boot against plain byte loops, which are the reference.
+ * The byte loops go through volatile pointers, so that gcc does not
+ * turn them into calls to the functions they check.
+ */
+
+/** Number of bytes checked after the written area, which must not be
+    modified */
+#define SELFTEST_GUARD    32
+
+/** Largest size checked, at offsets 0..15 */
+#define SELFTEST_MEM_MAX  600
+
+/** Size of the buffers of the mem*() checks */
+#define SELFTEST_MEM_LEN  (16 + SELFTEST_MEM_MAX + SELFTEST_GUARD)
+
+static char selftest_src[SELFTEST_MEM_LEN];
+static char selftest_dst[SELFTEST_MEM_LEN];
+static char selftest_ref[SELFTEST_MEM_LEN];
+static char selftest_tmp[SELFTEST_MEM_MAX];
+
+
+static void selftest_byte_cpy(void *dst, const void *src, sos_size_t n)
+{
+  volatile char *d = dst;
+  const volatile char *s = src;
+  for ( ; n > 0 ; n--)
+    *d++ = *s++;
+}
+
+static void selftest_byte_set(void *dst, int c, sos_size_t n)
+{
+  volatile char *d = dst;
+  for ( ; n > 0 ; n--)
+    *d++ = (char)c;
+}
+
+static int selftest_byte_cmp(const void *s1, const void *s2, sos_size_t n)
+{
+  const volatile unsigned char *c1 = s1, *c2 = s2;
+  for ( ; n > 0 ; n--, c1++, c2++)
+    if (*c1 != *c2)
+      return *c1 - *c2;
+  return 0;
+}
+
+static unsigned int selftest_byte_len(const char *str)
+{
+  const volatile char *s = str;
+  unsigned int retval = 0;
+  while (*s++)
+    retval++;
+  return retval;
+}
+
+static unsigned int selftest_byte_nlen(const char *str, sos_size_t count)
+{
+  const volatile char *s = str;
+  unsigned int retval = 0;
+  for ( ; count-- && *s != '\0' ; s++)
+    retval++;
+  return retval;
+}
+
+static int selftest_byte_strcmp(const char *str1, const char *str2)
+{
+  const volatile char *s1 = str1, *s2 = str2;
+  while (*s1 == *s2++)
+    if (*s1++ == 0)
+      return 0;
+  return (*(const volatile unsigned char *)s1
+	  - *(const volatile unsigned char *)(s2 - 1));
+}
+
+static int selftest_byte_strncmp(const char *str1, const char *str2, int len)
+{
+  const volatile char *s1 = str1, *s2 = str2;
+  char c1 = '\0', c2 = '\0';
+  while (len > 0)
+    {
+      c1 = (unsigned char) *s1++;
+      c2 = (unsigned char) *s2++;
+      if (c1 == '\0' || c1 != c2)
+	return c1 - c2;
+      len--;
+    }
+  return c1 - c2;
+}
+
+static void selftest_byte_zcpy(char *dst, const char *src, int len)
+{
+  volatile char *d = dst;
+  int i;
+  for (i = 0 ; i < len ; i++)
+    {
+      d[i] = src[i];
+      if (src[i] == '\0')
+	return;
+    }
+  d[len-1] = '\0';
+}
+
+/** @return the sign of a comparison result */
+static int selftest_sign(int cmp)
+{
+  return (cmp > 0) - (cmp < 0);
+}
+
+/** @return the next size to check: 0..70 (head, words and tail),
+    then 511..600 (around the SSE2 threshold) */
+static sos_size_t selftest_next_size(sos_size_t size)
+{
+  return (size == 70)? 511 : size + 1;
+}
+
+
+/**
+ * Check memcpy(), memmove(), memset() and memcmp(), for all the
+ * src/dst offsets 0..15. The guard bytes after the written area are compared too, so
+ * that a write beyond it is caught
+ */
+static void selftest_mem(void)
+{
+  char *src = selftest_src, *dst = selftest_dst, *ref = selftest_ref;
+  char *tmp = selftest_tmp;
+  sos_size_t size, len, mlen, i;
+  int soff, doff, pos;
+
+  for (i = 0 ; i < SELFTEST_MEM_LEN ; i ++)
+    src[i] = (char)(i*7 + 1);
+
+  for (size = 0 ; size <= SELFTEST_MEM_MAX ; size = selftest_next_size(size))
+    for (doff = 0 ; doff < 16 ; doff ++)
+      {
+	/* Only the area and its guard bytes are filled and compared */
+	len = doff + size + SELFTEST_GUARD;
+
+	/* memset(): only the low byte of c is used */
+	selftest_byte_set(dst, 0xa5, len);
+	selftest_byte_set(ref, 0xa5, len);
+	SOS_ASSERT_FATAL(memset(dst + doff, 0x100 | size, size) == dst + doff);
+	selftest_byte_set(ref + doff, 0x100 | size, size);
+	SOS_ASSERT_FATAL(0 == selftest_byte_cmp(dst, ref, len));
+
+	for (soff = 0 ; soff < 16 ; soff ++)
+	  {
+	    /* memcpy() */
+	    selftest_byte_set(dst, 0xa5, len);
+	    selftest_byte_set(ref, 0xa5, len);
+	    SOS_ASSERT_FATAL(memcpy(dst + doff, src + soff, size) == dst + doff);
+	    selftest_byte_cpy(ref + doff, src + soff, size);
+	    SOS_ASSERT_FATAL(0 == selftest_byte_cmp(dst, ref, len));
+
+	    /* memcmp() on equal areas, then with the first difference at
+	       the start, middle or end of the area, above or below (a
+	       later difference the other way must not matter) */
+	    SOS_ASSERT_FATAL(0 == memcmp(dst + doff, src + soff, size));
+	    for (pos = 0 ; (pos < 3) && (size > 0) ; pos ++)
+	      {
+		sos_size_t at = (pos == 0)? 0 : ((pos == 1)? size/2 : size-1);
+
+		selftest_byte_cpy(dst + doff, src + soff, size);
+		dst[doff + size - 1] ^= 0x01;
+		dst[doff + at] = src[soff + at] ^ ((doff & 1)? 0x80 : 0x01);
+		SOS_ASSERT_FATAL(selftest_sign(memcmp(dst + doff, src + soff,
+						      size))
+				 == selftest_sign(selftest_byte_cmp(dst + doff,
+								    src + soff,
+								    size)));
+		SOS_ASSERT_FATAL(0 != memcmp(dst + doff, src + soff, size));
+	      }
+
+	    /* memmove() inside the same buffer, overlapping both ways */
+	    mlen = ((soff > doff)? soff : doff) + size + SELFTEST_GUARD;
+	    selftest_byte_cpy(dst, src, mlen);
+	    selftest_byte_cpy(ref, src, mlen);
+	    SOS_ASSERT_FATAL(memmove(dst + doff, dst + soff, size) == dst + doff);
+	    selftest_byte_cpy(tmp, ref + soff, size);
+	    selftest_byte_cpy(ref + doff, tmp, size);
+	    SOS_ASSERT_FATAL(0 == selftest_byte_cmp(dst, ref, mlen));
+	  }
+      }
+}
+
+
+/** Longest string checked, several words long */
+#define SELFTEST_STR_MAX  40
+
+/**
+ * Check strlen(), strnlen(), strcmp(), strncmp() and strzcpy(): the
+ * terminating NUL lands in every byte lane of a word, the strings
+ * start at all the offsets 0..7, with bytes whose high bit is set
+ * (which must not be taken for a NUL)
+ */
+static void selftest_str(void)
+{
+  char *b1 = selftest_src, *b2 = selftest_ref;
+  char *dst = selftest_dst, *ref = selftest_dst + 2*SELFTEST_STR_MAX;
+  int len, off1, off2, pos, n, i;
+
+  for (len = 0 ; len < SELFTEST_STR_MAX ; len ++)
+    for (off1 = 0 ; off1 < 8 ; off1 ++)
+      {
+	char *s1 = b1 + off1;
+
+	/* Non-NUL characters after the NUL too */
+	for (i = 0 ; i < 2*SELFTEST_STR_MAX - off1 ; i ++)
+	  s1[i] = (char)(1 + (i*37 + len) % 255);
+	s1[len] = '\0';
+
+	SOS_ASSERT_FATAL(strlen(s1) == selftest_byte_len(s1));
+	for (n = 0 ; n <= len + 2 ; n ++)
+	  SOS_ASSERT_FATAL(strnlen(s1, n) == selftest_byte_nlen(s1, n));
+
+	/* strzcpy() truncates to n-1 characters and always ends the
+	   string, without writing beyond dst[n-1] */
+	for (n = 1 ; n <= len + 2 ; n ++)
+	  {
+	    selftest_byte_set(dst, 0xa5, 2*SELFTEST_STR_MAX);
+	    selftest_byte_set(ref, 0xa5, 2*SELFTEST_STR_MAX);
+	    SOS_ASSERT_FATAL(strzcpy(dst + off1/2, s1, n) == dst + off1/2);
+	    selftest_byte_zcpy(ref + off1/2, s1, n);
+	    SOS_ASSERT_FATAL(0 == selftest_byte_cmp(dst, ref,
+						    2*SELFTEST_STR_MAX));
+	    if (n <= len)
+	      SOS_ASSERT_FATAL(dst[off1/2 + n - 1] == '\0');
+	  }
+
+	for (off2 = 0 ; off2 < 8 ; off2 ++)
+	  {
+	    char *s2 = b2 + off2;
+
+	    selftest_byte_cpy(s2, s1, len + 1);
+	    SOS_ASSERT_FATAL(0 == strcmp(s1, s2));
+	    SOS_ASSERT_FATAL(0 == strncmp(s1, s2, len + 1));
+
+	    /* A difference above or below at each position, or s2
+	       shorter than s1 */
+	    for (pos = 0 ; pos < len ; pos ++)
+	      for (i = 0 ; i < 3 ; i ++)
+		{
+		  selftest_byte_cpy(s2, s1, len + 1);
+		  if (i == 2)
+		    s2[pos] = '\0';
+		  else
+		    s2[pos] = s1[pos] ^ ((i == 0)? 0x80 : 0x01);
+		  if ((s2[pos] == '\0') && (i != 2))
+		    continue;
+
+		  SOS_ASSERT_FATAL(selftest_sign(strcmp(s1, s2))
+				   == selftest_sign(selftest_byte_strcmp(s1, s2)));
+		  SOS_ASSERT_FATAL(selftest_sign(strcmp(s2, s1))
+				   == selftest_sign(selftest_byte_strcmp(s2, s1)));
+		  SOS_ASSERT_FATAL(0 != strcmp(s1, s2));
+		  for (n = pos ; n <= pos + 1 ; n ++)
+		    SOS_ASSERT_FATAL(selftest_sign(strncmp(s1, s2, n))
+				     == selftest_sign(selftest_byte_strncmp(s1,
+									    s2,
+									    n)));
+		}
+	  }
+      }
+}
+
+
+void sos_klibc_selftest(void)
+{
+  selftest_mem();
+  selftest_str();
+}
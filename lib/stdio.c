@@ -1,3 +1,8 @@
+#include <hwcore/irq.h>
+#include <hwcore/smp.h>
+#include <hwcore/spinlock.h>
+
+#include "klibc.h"
 #include "stdio.h"
 
 /* Variables.  */
@@ -8,20 +13,154 @@ static int ypos;
 /* Point to the video memory.  */
 static volatile unsigned char *video;
 
+/* Once the console is buffered, serializes the updates of the screen
+   and of XPOS and YPOS.  Not registered with sos_spin_init (): the
+   lock statistics and the lock validator print with printf.  */
+static struct sos_spinlock console_lock = SOS_SPINLOCK_INITIALIZER ("console");
+
+/* Non-zero once console_buffering_setup () has been called.  */
+static int console_buffered;
+
+/* Non-zero once console_panic () has been called: the lock may be
+   held by a CPU that will never release it.  */
+static volatile int console_panicking;
+
+/* The line being written by printf and putchar on each CPU, in thread
+   context (0) and in interrupt context (1): it is written on the
+   screen as a whole, at the end of the line.  */
+static struct console_line
+{
+  int len;
+  char chars[COLUMNS];
+} console_lines[SOS_SMP_MAX_CPUS][2];
+
+/* Take the console lock, when the console is buffered and no fatal
+   error occurred.  LOCKED tells console_unlock_irqrestore whether it
+   was taken.  */
+#define console_lock_irqsave(flags, locked)		\
+  ({ (locked) = console_buffered && ! console_panicking;	\
+     if (locked)					\
+       sos_spin_lock_irqsave (&console_lock, flags); })
+#define console_unlock_irqrestore(flags, locked)	\
+  ({ if (locked)					\
+       sos_spin_unlock_irqrestore (&console_lock, flags); })
+
 
 /* Clear the screen and initialize VIDEO, XPOS and YPOS.  */
 void
 cls (void)
 {
-  int i;
+  sos_ui32_t flags = 0;
+  int locked;
+
+  console_lock_irqsave (flags, locked);
 
   video = (unsigned char *) VIDEO;
-  
-  for (i = 0; i < COLUMNS * LINES * 2; i++)
-    *(video + i) = 0;
+  memset ((void *) video, 0, COLUMNS * LINES * 2);
 
   xpos = 0;
   ypos = 0;
+
+  console_unlock_irqrestore (flags, locked);
+}
+
+
+/* Scroll the screen up by one line.  */
+static void
+console_scroll (void)
+{
+  memmove ((void *) video, (void *) (video + COLUMNS * 2),
+	   (LINES - 1) * COLUMNS * 2);
+  memset ((void *) (video + (LINES - 1) * COLUMNS * 2), 0, COLUMNS * 2);
+}
+
+
+/* Move the cursor to the next line, scrolling at the bottom of the
+   screen.  */
+static void
+console_newline (void)
+{
+  xpos = 0;
+  if (ypos < LINES - 1)
+    ypos++;
+  else
+    console_scroll ();
+}
+
+
+/* Write the N characters of CHARS at the cursor, one run of video
+   cells per screen line.  */
+static void
+console_write (const char *chars, int n)
+{
+  while (n > 0)
+    {
+      volatile unsigned short *cell;
+      int i, run = COLUMNS - xpos;
+
+      if (run > n)
+	run = n;
+
+      cell = (volatile unsigned short *) video + xpos + ypos * COLUMNS;
+      for (i = 0; i < run; i++)
+	cell[i] = (ATTRIBUTE << 8) | (unsigned char) chars[i];
+
+      chars += run;
+      n -= run;
+      xpos += run;
+      if (xpos >= COLUMNS)
+	console_newline ();
+    }
+}
+
+
+/* Write LINE on the screen, followed by a new line if NEWLINE, and
+   empty it.  Called with the IRQs disabled.  */
+static void
+console_flush_line (struct console_line *line, int newline)
+{
+  sos_spin_lock (&console_lock);
+  console_write (line->chars, line->len);
+  if (newline)
+    console_newline ();
+  sos_spin_unlock (&console_lock);
+
+  line->len = 0;
+}
+
+
+/* Buffer the output of printf and putchar.  */
+void
+console_buffering_setup (void)
+{
+  memset (console_lines, 0, sizeof (console_lines));
+  console_buffered = 1;
+}
+
+
+/* Stop buffering and write the screen without the console lock.  */
+void
+console_panic (void)
+{
+  console_panicking = 1;
+}
+
+
+/* Write the unterminated line of the current thread.  */
+void
+console_flush (void)
+{
+  struct console_line *line;
+  sos_ui32_t flags;
+
+  if (! console_buffered || console_panicking)
+    return;
+
+  sos_disable_IRQs (flags);
+  line = &console_lines[sos_smp_get_cpu_id ()][0];
+  if (line->len > 0)
+    console_flush_line (line, 0);
+  sos_restore_IRQs (flags);
 }
 
 /* Convert the integer D to a string and save the string in BUF. If
@@ -70,26 +209,37 @@ itoa (char *buf, int base, int d)
     }
 }
 
-/* Put the character C on the screen.  */
+/* Put the character C on the screen: in the line of the current
+   CPU once the console is buffered.  */
 void
 putchar (int c)
 {
-  if (c == '\n' || c == '\r')
+  struct console_line *line;
+  char ch = c;
+  sos_ui32_t flags;
+
+  if (! console_buffered || console_panicking)
     {
-    newline:
-      xpos = 0;
-      ypos++;
-      if (ypos >= LINES)
-	ypos = 0;
+      if (c == '\n' || c == '\r')
+	console_newline ();
+      else
+	console_write (&ch, 1);
       return;
     }
 
-  *(video + (xpos + ypos * COLUMNS) * 2) = c & 0xFF;
-  *(video + (xpos + ypos * COLUMNS) * 2 + 1) = ATTRIBUTE;
+  sos_disable_IRQs (flags);
+  line = &console_lines[sos_smp_get_cpu_id ()][sos_servicing_irq () ? 1 : 0];
+
+  if (c == '\n' || c == '\r')
+    console_flush_line (line, 1);
+  else
+    {
+      line->chars[line->len++] = ch;
+      if (line->len >= COLUMNS)
+	console_flush_line (line, 0);
+    }
 
-  xpos++;
-  if (xpos >= COLUMNS)
-    goto newline;
+  sos_restore_IRQs (flags);
 }
 
 /* Format a string and print it on the screen, just like the libc
@@ -157,31 +307,39 @@ printf (const char *format, ...)
 }
 
 
-/* Put the character C on the screen.  */
-void
-os_putchar (int yp, int xp, unsigned char attribute, int c)
+/* Put the character C with ATTRIBUTE at line *YP, column *XP of the
+   screen, and advance *YP and *XP.  Does not move the cursor of
+   printf.  */
+static void
+console_put_at (int *yp, int *xp, unsigned char attribute, int c)
 {
-/* Save the X position.  */
-  /*static int */ xpos=xp;
-/* Save the Y position.  */
-  /*static int */ ypos=yp;
-
-  if (c == '\n' || c == '\r')
+  if (c != '\n' && c != '\r')
     {
-    newline:
-      xpos = 0;
-      ypos++;
-      if (ypos >= LINES)
-	ypos = 0;
-      return;
+      *(video + (*xp + *yp * COLUMNS) * 2) = c & 0xFF;
+      *(video + (*xp + *yp * COLUMNS) * 2 + 1) = attribute;
+
+      (*xp)++;
+      if (*xp < COLUMNS)
+	return;
     }
 
-  *(video + (xpos + ypos * COLUMNS) * 2) = c & 0xFF;
-  *(video + (xpos + ypos * COLUMNS) * 2 + 1) = attribute;
+  *xp = 0;
+  (*yp)++;
+  if (*yp >= LINES)
+    *yp = 0;
+}
 
-  xpos++;
-  if (xpos >= COLUMNS)
-    goto newline;
+
+/* Put the character C on the screen.  */
+void
+os_putchar (int yp, int xp, unsigned char attribute, int c)
+{
+  sos_ui32_t flags = 0;
+  int locked;
+
+  console_lock_irqsave (flags, locked);
+  console_put_at (&yp, &xp, attribute, c);
+  console_unlock_irqrestore (flags, locked);
 }
 
 
@@ -193,18 +351,17 @@ os_printf (int yp, int xp, unsigned char attribute, const char *format, ...)
   char **arg = (char **) &format;
   int c;
   char buf[20];
+  sos_ui32_t flags = 0;
+  int locked;
 
-/* Save the X position.  */
-  /*static int */ xpos=xp;
-/* Save the Y position.  */
-  /*static int */ ypos=yp;
+  console_lock_irqsave (flags, locked);
 
   arg++;
   
   while ((c = *format++) != 0)
     {
       if (c != '%')
-	os_putchar (ypos, xpos, attribute, c);//putchar (c);
+	console_put_at (&yp, &xp, attribute, c);
       else
 	{
 	  char *p, *p2;
@@ -241,17 +398,19 @@ os_printf (int yp, int xp, unsigned char attribute, const char *format, ...)
 	    string:
 	      for (p2 = p; *p2; p2++);
 	      for (; p2 < p + pad; p2++)
-		os_putchar (ypos, xpos, attribute, (pad0 ? '0' : ' '));//putchar (pad0 ? '0' : ' ');
+		console_put_at (&yp, &xp, attribute, (pad0 ? '0' : ' '));
 	      while (*p)
-		os_putchar (ypos, xpos, attribute, *p++);//putchar (*p++);
+		console_put_at (&yp, &xp, attribute, *p++);
 	      break;
 
 	    default:
-	      os_putchar (ypos, xpos, attribute, *((int *) arg++));//putchar (*((int *) arg++));
+	      console_put_at (&yp, &xp, attribute, *((int *) arg++));
 	      break;
 	    }
 	}
     }
+
+  console_unlock_irqrestore (flags, locked);
 }
 
 
@@ -16,5 +16,18 @@ void itoa (char *buf, int base, int d);
 void putchar (int c);
 void printf (const char *format, ...);
 
+/* Once the per-CPU area is set up, buffer the output of printf and
+   putchar in a line per CPU, written on the screen as a whole under
+   the console lock at the end of the line.  */
+void console_buffering_setup (void);
+/* Write the unterminated line of the current thread: called at each
+   context switch, so that the lines of 2 threads are not mixed.  */
+void console_flush (void);
+/* On a fatal error, stop buffering the output and bypass the console
+   lock, which may be held by a CPU that will never release it (the
+   current one, for example): the output of the other CPUs may then
+   be mixed.  */
+void console_panic (void);
+
 void os_putchar (int yp, int xp, unsigned char attribute, int c);
 void os_printf (int yp, int xp, unsigned char attribute, const char *format, ...);
@@ -17,6 +17,7 @@
 */
 
 #include <lib/klibc.h>
+#include <lib/stdio.h>
 //#include <drivers/bochs.h>
 #include <lib/x86_videomem.h>
 
@@ -38,6 +39,8 @@ void sos_display_fatal_error(const char *format, /* args */...)
   sos_x86_videomem_putstring(23, 0,
 			     SOS_X86_VIDEO_BG_BLACK
 			     | SOS_X86_VIDEO_FG_LTRED , buff);*/
+  /* Do not wait for the console lock */
+  console_panic();
   printf("%s\n",buff);
   os_printf (23, 0, SOS_X86_VIDEO_BG_BLACK | SOS_X86_VIDEO_FG_LTRED, "%s", buff);
 
@@ -0,0 +1,1513 @@
+/* Copyright (C) 2026  AbdAllah MEZITI
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+   USA. 
+*/
+
+#include <os/assert.h>
+#include <os/kmalloc.h>
+#include <os/thread.h>
+#include <os/time.h>
+#include <os/ksynch.h>
+#include <os/bkl.h>
+#include <os/rcu.h>
+#include <os/workqueue.h>
+#include <os/softirq.h>
+#include <os/kmem_slab.h>
+#include <hwcore/idt.h>
+#include <hwcore/irq.h>
+#include <hwcore/smp.h>
+#include <hwcore/tsc.h>
+#include <hwcore/fpu.h>
+#include <lib/klibc.h>
+#include <lib/stdio.h>
+
+#include "bench.h"
+
+
+/* ======================================================================
+ * Timeout actions: NB_SLEEPERS concurrent sleepers. A sleeper is
+ * modelled by its bare timeout action (which is what
+ * sos_thread_sleep() registers), so that the benchmark does not need
+ * as many kernel stacks.
+ */
+#define BENCH_TMO_NB_SLEEPERS  10000
+
+/** Number of timeout actions fired so far */
+static volatile sos_count_t bench_tmo_nb_fired;
+
+/** Timeout routine of the sleepers: mark the action as fired */
+static void bench_tmo_routine(struct sos_timeout_action *act)
+{
+  act->routine_data = act;
+  bench_tmo_nb_fired ++;
+}
+
+static void bench_timeout_actions()
+{
+  struct sos_timeout_action *acts;
+  struct sos_time t_start, t_end, delay;
+  sos_count_t nb_removed, nb_registered, nb_ops;
+  sos_ui64_t tsc_start;
+  sos_ui32_t flags;
+  int i;
+
+  acts = (struct sos_timeout_action*)
+    sos_kmalloc(BENCH_TMO_NB_SLEEPERS * sizeof(struct sos_timeout_action), 0);
+  SOS_ASSERT_FATAL(acts != NULL);
+
+  /* Register all the sleepers, with delays between 10ms and 5s */
+  bench_tmo_nb_fired = 0;
+  tsc_start = sos_tsc_read();
+  for (i = 0 ; i < BENCH_TMO_NB_SLEEPERS ; i ++)
+    {
+      delay = (struct sos_time){ .sec = random() % 5,
+				 .nanosec = 10000000UL * (1 + random() % 99) };
+
+      sos_time_init_action(& acts[i]);
+      SOS_ASSERT_FATAL(SOS_OK
+		       == sos_time_register_action_relative(& acts[i], & delay,
+							    bench_tmo_routine,
+							    NULL));
+    }
+  printf("tmo: %d sleepers registered in %dus\n",
+	 BENCH_TMO_NB_SLEEPERS,
+	 sos_tsc_cycles_to_us(sos_tsc_read() - tsc_start));
+
+  /* Measure the steady state: how many remove + add pairs during 100
+     ticks, while the wheel holds all the other sleepers */
+  nb_ops = 0;
+  sos_time_get_now(& t_start);
+  do
+    {
+      i = random() % BENCH_TMO_NB_SLEEPERS;
+      sos_disable_IRQs(flags);
+      if (NULL == acts[i].routine_data)
+	{
+	  /* Still waiting: push it back a little further */
+	  delay = (struct sos_time){ .sec = 1 + random() % 4, .nanosec = 0 };
+	  sos_time_unregister_action(& acts[i]);
+	  sos_time_register_action_relative(& acts[i], & delay,
+					    bench_tmo_routine, NULL);
+	  nb_ops ++;
+	}
+      sos_restore_IRQs(flags);
+
+      sos_time_get_now(& t_end);
+      sos_time_dec(& t_end, & t_start);
+    }
+  while (t_end.sec < 1);
+  printf("tmo: %d remove+add per second with %d sleepers\n",
+	 nb_ops, BENCH_TMO_NB_SLEEPERS);
+
+  /* Remove one sleeper out of 4 */
+  nb_removed = 0;
+  for (i = 0 ; i < BENCH_TMO_NB_SLEEPERS ; i += 4)
+    {
+      sos_disable_IRQs(flags);
+      if (NULL == acts[i].routine_data)
+	{
+	  sos_time_unregister_action(& acts[i]);
+	  nb_removed ++;
+	}
+      sos_restore_IRQs(flags);
+    }
+
+  /* Wait for all the others to be fired */
+  nb_registered = BENCH_TMO_NB_SLEEPERS - nb_removed;
+  while (bench_tmo_nb_fired < nb_registered)
+    {
+      delay = (struct sos_time){ .sec = 0, .nanosec = 100000000UL };
+      sos_thread_sleep(& delay);
+    }
+  printf("tmo: %d sleepers fired, %d removed\n",
+	 bench_tmo_nb_fired, nb_removed);
+
+  sos_kfree((sos_vaddr_t)acts);
+}
+
+
+/* ======================================================================
+ * Timer softirq: a burst of timeout actions due on the same tick. The
+ * actions used to be called from the timer IRQ handler, all of them
+ * with the IRQs disabled: they now run in the timer softirq, which
+ * enables the IRQs between two actions.
+ */
+#define BENCH_TSIRQ_NB_ACTIONS  1000
+#define BENCH_TSIRQ_WORK_LOOPS  50
+
+/** Number of timeout actions of the burst fired so far */
+static volatile sos_count_t bench_tsirq_nb_fired;
+
+/** Keeps the work of the actions from being optimized away */
+static volatile sos_ui32_t bench_tsirq_sink;
+
+static void bench_tsirq_routine(struct sos_timeout_action *act)
+{
+  sos_ui32_t x = (sos_ui32_t)act;
+  int i;
+
+  for (i = 0 ; i < BENCH_TSIRQ_WORK_LOOPS ; i ++)
+    x = x * 1103515245 + 12345;
+  bench_tsirq_sink += x;
+  bench_tsirq_nb_fired ++;
+}
+
+static void bench_timer_softirq()
+{
+  struct sos_timeout_action *acts;
+  struct sos_softirq_stats sirq_start, sirq_end;
+  struct sos_time_stats tmo_start, tmo_end;
+  struct sos_time delay;
+  sos_ui32_t flags;
+  int i;
+
+  acts = (struct sos_timeout_action*)
+    sos_kmalloc(BENCH_TSIRQ_NB_ACTIONS * sizeof(struct sos_timeout_action),
+		0);
+  SOS_ASSERT_FATAL(acts != NULL);
+
+  SOS_ASSERT_FATAL(SOS_OK == sos_softirq_get_stats(SOS_SOFTIRQ_TIMER,
+						   & sirq_start));
+  SOS_ASSERT_FATAL(SOS_OK == sos_time_get_stats(& tmo_start));
+
+  /* All the actions in the same wheel bucket */
+  bench_tsirq_nb_fired = 0;
+  delay = (struct sos_time){ .sec = 0, .nanosec = 100000000UL };
+  sos_disable_IRQs(flags);
+  for (i = 0 ; i < BENCH_TSIRQ_NB_ACTIONS ; i ++)
+    {
+      sos_time_init_action(& acts[i]);
+      SOS_ASSERT_FATAL(SOS_OK
+		       == sos_time_register_action_relative(& acts[i], & delay,
+							    bench_tsirq_routine,
+							    NULL));
+    }
+  sos_restore_IRQs(flags);
+
+  while (bench_tsirq_nb_fired < BENCH_TSIRQ_NB_ACTIONS)
+    {
+      delay = (struct sos_time){ .sec = 0, .nanosec = 50000000UL };
+      sos_thread_sleep(& delay);
+    }
+
+  SOS_ASSERT_FATAL(SOS_OK == sos_softirq_get_stats(SOS_SOFTIRQ_TIMER,
+						   & sirq_end));
+  SOS_ASSERT_FATAL(SOS_OK == sos_time_get_stats(& tmo_end));
+  sos_kfree((sos_vaddr_t)acts);
+
+  printf("tsirq: %d actions on a tick, longest timer softirq %d cycles"
+	 " (%d runs)\n",
+	 BENCH_TSIRQ_NB_ACTIONS, (sos_ui32_t)sirq_end.max_cycles,
+	 sirq_end.nb_runs - sirq_start.nb_runs);
+  printf("tsirq: longest IRQs-off section %d cycles (one action),"
+	 " was the whole softirq\n",
+	 (sos_ui32_t)tmo_end.max_action_cycles);
+}
+
+
+/* ======================================================================
+ * Scheduler throughput: NB_THREADS threads each run NB_ROUNDS rounds
+ * of pure computation (without the big kernel lock) followed by a
+ * yield, first on the boot CPU only, then on all the CPUs.
+ */
+#define BENCH_SCHED_NB_THREADS  32
+#define BENCH_SCHED_NB_ROUNDS   50
+#define BENCH_SCHED_WORK_LOOPS  20000
+
+/** Signaled by each worker when it is done */
+static struct sos_ksema bench_sched_done;
+
+/** Result of the computations, so that they are not optimized out */
+static volatile sos_ui32_t bench_sched_sink;
+
+static void bench_sched_worker(void *unused)
+{
+  sos_ui32_t x;
+  int i, j;
+
+  for (i = 0 ; i < BENCH_SCHED_NB_ROUNDS ; i ++)
+    {
+      /* Pure computation: the other CPUs may run the kernel
+	 meanwhile */
+      sos_bkl_unlock();
+      for (j = 0, x = i ; j < BENCH_SCHED_WORK_LOOPS ; j ++)
+	x = x * 1103515245 + 12345;
+      sos_bkl_lock();
+
+      bench_sched_sink += x;
+      sos_thread_yield();
+    }
+
+  sos_ksema_up(& bench_sched_done);
+}
+
+/** @return the duration of the run (in microseconds) */
+static sos_ui32_t bench_sched_run(sos_ui32_t cpu_mask)
+{
+  struct sos_thread *thr;
+  sos_ui64_t tsc_start;
+  int i;
+
+  SOS_ASSERT_FATAL(SOS_OK == sos_ksema_init(& bench_sched_done,
+					    "bench_sched", 0));
+
+  tsc_start = sos_tsc_read();
+  for (i = 0 ; i < BENCH_SCHED_NB_THREADS ; i ++)
+    {
+      thr = sos_create_kernel_thread("bench_sched", bench_sched_worker, NULL);
+      SOS_ASSERT_FATAL(thr != NULL);
+      SOS_ASSERT_FATAL(SOS_OK == sos_thread_set_cpu_affinity(thr, cpu_mask));
+    }
+
+  for (i = 0 ; i < BENCH_SCHED_NB_THREADS ; i ++)
+    sos_ksema_down(& bench_sched_done, NULL);
+
+  SOS_ASSERT_FATAL(SOS_OK == sos_ksema_dispose(& bench_sched_done));
+  return sos_tsc_cycles_to_us(sos_tsc_read() - tsc_start);
+}
+
+static void bench_sched_throughput()
+{
+  struct sos_sched_stats stats;
+  sos_ui32_t us_one, us_all;
+
+  us_one = bench_sched_run(SOS_SCHED_CPU(SOS_SMP_BOOT_CPU));
+  us_all = bench_sched_run(SOS_SCHED_CPU_ALL);
+  sos_sched_get_stats(& stats);
+
+  printf("sched: %d threads x %d rounds: 1 CPU %dus, %d CPUs %dus\n",
+	 BENCH_SCHED_NB_THREADS, BENCH_SCHED_NB_ROUNDS,
+	 us_one, sos_smp_get_nb_cpus(), us_all);
+  if (us_all > 0)
+    printf("sched: speedup x%d (/100), %d stolen, %d rebalanced\n",
+	   (us_one * 10) / (us_all / 10 + 1),
+	   stats.nb_stolen, stats.nb_rebalanced);
+}
+
+
+/* ======================================================================
+ * Context switch: two high priority threads on the boot CPU yield to
+ * each other (ping-pong), so that each yield is a switch between
+ * them. Run with the default stack and with a larger one: since the
+ * stack overflows are caught by the guard pages, the cost of a switch
+ * does not depend on the size of the stacks. Then with threads
+ * touching the FPU between 2 yields: their FPU contexts are switched
+ * too (see hwcore/fpu.h)
+ */
+#define BENCH_CTXSW_NB_YIELDS  100000
+#define BENCH_CTXSW_PRIO       (SOS_SCHED_PRIO_DEFAULT - 8)
+
+/** Signaled by each thread when it is done */
+static struct sos_ksema bench_ctxsw_done;
+
+static void bench_ctxsw_thread(void *use_fpu)
+{
+  int i;
+
+  for (i = 0 ; i < BENCH_CTXSW_NB_YIELDS ; i ++)
+    {
+      if (use_fpu)
+	asm volatile ("fld1 ; fstp %%st(0)" : : : "memory");
+      sos_thread_yield();
+    }
+
+  sos_ksema_up(& bench_ctxsw_done);
+}
+
+static void bench_context_switch_run(sos_size_t stack_size,
+				     sos_bool_t use_fpu)
+{
+  sos_ui64_t tsc_start, nb_switches;
+  sos_ui32_t us;
+  int i;
+
+  SOS_ASSERT_FATAL(SOS_OK == sos_ksema_init(& bench_ctxsw_done,
+					    "bench_ctxsw", 0));
+
+  /* The BKL is held from the creation of the threads until they
+     are set up: they cannot start on another CPU meanwhile */
+  tsc_start = sos_tsc_read();
+  for (i = 0 ; i < 2 ; i ++)
+    {
+      struct sos_thread *thr
+	= sos_create_kernel_thread_with_stack("bench_ctxsw",
+					      bench_ctxsw_thread,
+					      (void*)use_fpu, stack_size);
+      SOS_ASSERT_FATAL(thr != NULL);
+      SOS_ASSERT_FATAL(SOS_OK == sos_thread_set_priority(thr,
+							 BENCH_CTXSW_PRIO));
+      SOS_ASSERT_FATAL(SOS_OK
+		       == sos_thread_set_cpu_affinity(thr,
+				  SOS_SCHED_CPU(SOS_SMP_BOOT_CPU)));
+    }
+
+  for (i = 0 ; i < 2 ; i ++)
+    sos_ksema_down(& bench_ctxsw_done, NULL);
+  tsc_start = sos_tsc_read() - tsc_start;
+  SOS_ASSERT_FATAL(SOS_OK == sos_ksema_dispose(& bench_ctxsw_done));
+
+  nb_switches = 2 * BENCH_CTXSW_NB_YIELDS;
+  us = sos_tsc_cycles_to_us(tsc_start);
+  printf("ctxsw: %dB stacks%s, %d yields ping-pong %dus, %d cycles/switch,"
+	 " %d switches/s\n",
+	 stack_size, (use_fpu)?", FPU":"", (sos_ui32_t)nb_switches, us,
+	 (sos_ui32_t)sos_tsc_udiv64(tsc_start, nb_switches, NULL),
+	 (sos_ui32_t)sos_tsc_udiv64(nb_switches * 1000000, us + 1, NULL));
+}
+
+static void bench_context_switch()
+{
+  bench_context_switch_run(SOS_THREAD_KERNEL_STACK_SIZE, FALSE);
+  bench_context_switch_run(4*SOS_PAGE_SIZE, FALSE);
+  bench_context_switch_run(SOS_THREAD_KERNEL_STACK_SIZE, TRUE);
+}
+
+
+/* ======================================================================
+ * Thread spawn/exit: batches of short-lived threads are created and
+ * waited for, with and without the pool of deleted threads (see
+ * sos_thread_set_pool_high_water())
+ */
+#define BENCH_SPAWN_NB_BATCHES 500
+#define BENCH_SPAWN_BATCH      8
+
+/** Signaled by each short-lived thread */
+static struct sos_ksema bench_spawn_done;
+
+static void bench_spawn_thread(void *unused)
+{
+  sos_ksema_up(& bench_spawn_done);
+}
+
+static void bench_thread_spawn_run(sos_ui32_t high_water)
+{
+  struct sos_thread_pool_stats st_start, st_end;
+  sos_ui64_t tsc_start;
+  sos_ui32_t us, nb_threads;
+  int i, j;
+
+  SOS_ASSERT_FATAL(SOS_OK == sos_thread_set_pool_high_water(high_water));
+  SOS_ASSERT_FATAL(SOS_OK == sos_ksema_init(& bench_spawn_done,
+					    "bench_spawn", 0));
+  SOS_ASSERT_FATAL(SOS_OK == sos_thread_get_pool_stats(& st_start));
+
+  tsc_start = sos_tsc_read();
+  for (i = 0 ; i < BENCH_SPAWN_NB_BATCHES ; i ++)
+    {
+      for (j = 0 ; j < BENCH_SPAWN_BATCH ; j ++)
+	SOS_ASSERT_FATAL(NULL != sos_create_kernel_thread("bench_spawn",
+							  bench_spawn_thread,
+							  NULL));
+      for (j = 0 ; j < BENCH_SPAWN_BATCH ; j ++)
+	sos_ksema_down(& bench_spawn_done, NULL);
+    }
+  tsc_start = sos_tsc_read() - tsc_start;
+
+  SOS_ASSERT_FATAL(SOS_OK == sos_thread_get_pool_stats(& st_end));
+  SOS_ASSERT_FATAL(SOS_OK == sos_ksema_dispose(& bench_spawn_done));
+
+  nb_threads = BENCH_SPAWN_NB_BATCHES * BENCH_SPAWN_BATCH;
+  us = sos_tsc_cycles_to_us(tsc_start);
+  printf("spawn: pool %d, %d threads %dus, %d threads/s, %d hits %d misses\n",
+	 high_water, nb_threads, us,
+	 (sos_ui32_t)sos_tsc_udiv64((sos_ui64_t)nb_threads * 1000000,
+				    us + 1, NULL),
+	 st_end.nb_hits - st_start.nb_hits,
+	 st_end.nb_misses - st_start.nb_misses);
+}
+
+static void bench_thread_spawn()
+{
+  bench_thread_spawn_run(0);
+  bench_thread_spawn_run(SOS_THREAD_POOL_HIGH_WATER);
+}
+
+
+/* ======================================================================
+ * Workqueue: batches of trivial tasks run each by its own thread, then
+ * as works handed over to the workers of the workqueue
+ */
+#define BENCH_WORK_NB_BATCHES 125
+#define BENCH_WORK_BATCH      32
+
+/** Signaled by each task */
+static struct sos_ksema bench_work_done;
+
+static void bench_work_task(void *unused)
+{
+  sos_ksema_up(& bench_work_done);
+}
+
+/** @return the duration of the run (in microseconds) */
+static sos_ui32_t bench_workqueue_run(sos_bool_t use_workqueue)
+{
+  sos_ui64_t tsc_start;
+  int i, j;
+
+  SOS_ASSERT_FATAL(SOS_OK == sos_ksema_init(& bench_work_done,
+					    "bench_work", 0));
+
+  tsc_start = sos_tsc_read();
+  for (i = 0 ; i < BENCH_WORK_NB_BATCHES ; i ++)
+    {
+      for (j = 0 ; j < BENCH_WORK_BATCH ; j ++)
+	if (use_workqueue)
+	  SOS_ASSERT_FATAL(SOS_OK == sos_work_submit(bench_work_task, NULL));
+	else
+	  SOS_ASSERT_FATAL(NULL != sos_create_kernel_thread("bench_work",
+							    bench_work_task,
+							    NULL));
+      for (j = 0 ; j < BENCH_WORK_BATCH ; j ++)
+	sos_ksema_down(& bench_work_done, NULL);
+    }
+  tsc_start = sos_tsc_read() - tsc_start;
+
+  SOS_ASSERT_FATAL(SOS_OK == sos_ksema_dispose(& bench_work_done));
+  return sos_tsc_cycles_to_us(tsc_start);
+}
+
+static void bench_workqueue()
+{
+  struct sos_workqueue_stats st_start, st_end;
+  sos_ui32_t nb_tasks, us_threads, us_works, nb_works;
+
+  nb_tasks   = BENCH_WORK_NB_BATCHES * BENCH_WORK_BATCH;
+  us_threads = bench_workqueue_run(FALSE);
+
+  SOS_ASSERT_FATAL(SOS_OK == sos_workqueue_get_stats(& st_start));
+  us_works   = bench_workqueue_run(TRUE);
+  SOS_ASSERT_FATAL(SOS_OK == sos_workqueue_get_stats(& st_end));
+
+  /* Including the works of the mouse simulation meanwhile */
+  nb_works = st_end.nb_done - st_start.nb_done;
+  printf("work: %d tasks, thread each %dus (%d/s), workqueue %dus (%d/s)\n",
+	 nb_tasks,
+	 us_threads, (sos_ui32_t)sos_tsc_udiv64((sos_ui64_t)nb_tasks * 1000000,
+						us_threads + 1, NULL),
+	 us_works, (sos_ui32_t)sos_tsc_udiv64((sos_ui64_t)nb_tasks * 1000000,
+					      us_works + 1, NULL));
+  printf("work: latency avg %d cycles, max %d cycles, max depth %d\n",
+	 (sos_ui32_t)sos_tsc_udiv64(st_end.total_latency_cycles
+				    - st_start.total_latency_cycles,
+				    nb_works + 1, NULL),
+	 (sos_ui32_t)st_end.max_latency_cycles, st_end.max_depth);
+}
+
+
+/* ======================================================================
+ * Threaded IRQ: an unused IRQ line is raised by software, its handler
+ * runs in the thread of the line and takes a mutex (ie may block).
+ * Measures the delay from the IRQ to the start of the handler.
+ */
+#define BENCH_TIRQ_LINE       SOS_IRQ_RESERVED_3
+#define BENCH_TIRQ_NB_ROUNDS  2000
+
+/** Signaled by the threaded handler */
+static struct sos_ksema bench_tirq_done;
+
+/** Taken by the threaded handler: only allowed outside IRQ context */
+static struct sos_kmutex bench_tirq_mutex;
+
+/** Date of the last software IRQ, and total delay to the handlers */
+static volatile sos_ui64_t bench_tirq_raised_tsc;
+static sos_ui64_t bench_tirq_total_cycles, bench_tirq_max_cycles;
+
+static void bench_tirq_handler(int irq_level)
+{
+  sos_ui64_t cycles = sos_tsc_read() - bench_tirq_raised_tsc;
+
+  bench_tirq_total_cycles += cycles;
+  if (cycles > bench_tirq_max_cycles)
+    bench_tirq_max_cycles = cycles;
+
+  SOS_ASSERT_FATAL(! sos_servicing_irq());
+  SOS_ASSERT_FATAL(SOS_OK == sos_kmutex_lock(& bench_tirq_mutex, NULL));
+  SOS_ASSERT_FATAL(SOS_OK == sos_kmutex_unlock(& bench_tirq_mutex));
+
+  sos_ksema_up(& bench_tirq_done);
+}
+
+static void bench_threaded_irq()
+{
+  int i;
+
+  SOS_ASSERT_FATAL(SOS_OK == sos_ksema_init(& bench_tirq_done,
+					    "bench_tirq", 0));
+  SOS_ASSERT_FATAL(SOS_OK == sos_kmutex_init(& bench_tirq_mutex,
+					     "bench_tirq"));
+  SOS_ASSERT_FATAL(SOS_OK
+		   == sos_irq_set_routine_flags(BENCH_TIRQ_LINE,
+						bench_tirq_handler,
+						SOS_IRQ_THREADED));
+
+  bench_tirq_total_cycles = bench_tirq_max_cycles = 0;
+  for (i = 0 ; i < BENCH_TIRQ_NB_ROUNDS ; i ++)
+    {
+      bench_tirq_raised_tsc = sos_tsc_read();
+      asm volatile ("int %0"::"i"(SOS_IRQ_BASE + BENCH_TIRQ_LINE));
+      sos_ksema_down(& bench_tirq_done, NULL);
+    }
+
+  SOS_ASSERT_FATAL(SOS_OK == sos_irq_set_routine(BENCH_TIRQ_LINE, NULL));
+  SOS_ASSERT_FATAL(SOS_OK == sos_kmutex_dispose(& bench_tirq_mutex));
+  SOS_ASSERT_FATAL(SOS_OK == sos_ksema_dispose(& bench_tirq_done));
+
+  printf("tirq: %d IRQs, delay to the threaded handler avg %d cycles,"
+	 " max %d cycles\n",
+	 BENCH_TIRQ_NB_ROUNDS,
+	 (sos_ui32_t)sos_tsc_udiv64(bench_tirq_total_cycles,
+				    BENCH_TIRQ_NB_ROUNDS, NULL),
+	 (sos_ui32_t)bench_tirq_max_cycles);
+}
+
+
+/* ======================================================================
+ * Mutex contention: NB_THREADS threads each take a shared mutex
+ * NB_ROUNDS times around a short critical section, with and without
+ * the adaptive spinning. The critical section and the work outside
+ * it run without the big kernel lock, so that the owner really runs
+ * in parallel with the contenders.
+ */
+#define BENCH_KMUTEX_NB_THREADS  8
+#define BENCH_KMUTEX_NB_ROUNDS   2000
+#define BENCH_KMUTEX_CS_LOOPS    100
+#define BENCH_KMUTEX_WORK_LOOPS  400
+
+/** The contended mutex */
+static struct sos_kmutex bench_kmutex;
+
+/** Signaled by each worker when it is done */
+static struct sos_ksema bench_kmutex_done;
+
+/** Protected by bench_kmutex */
+static volatile sos_ui32_t bench_kmutex_counter;
+
+static void bench_kmutex_worker(void *unused)
+{
+  sos_ui32_t x = 0;
+  int i, j;
+
+  for (i = 0 ; i < BENCH_KMUTEX_NB_ROUNDS ; i ++)
+    {
+      SOS_ASSERT_FATAL(SOS_OK == sos_kmutex_lock(& bench_kmutex, NULL));
+      sos_bkl_unlock();
+      for (j = 0 ; j < BENCH_KMUTEX_CS_LOOPS ; j ++)
+	x = x * 1103515245 + 12345;
+      bench_kmutex_counter ++;
+      sos_bkl_lock();
+      SOS_ASSERT_FATAL(SOS_OK == sos_kmutex_unlock(& bench_kmutex));
+
+      sos_bkl_unlock();
+      for (j = 0 ; j < BENCH_KMUTEX_WORK_LOOPS ; j ++)
+	x = x * 1103515245 + 12345;
+      sos_bkl_lock();
+    }
+
+  bench_sched_sink += x;
+  sos_ksema_up(& bench_kmutex_done);
+}
+
+/** @return the duration of the run (in microseconds) */
+static sos_ui32_t bench_kmutex_run(sos_bool_t adaptive,
+				   struct sos_kmutex_stats *stats)
+{
+  struct sos_kmutex_stats st_start;
+  sos_ui64_t tsc_start;
+  int i;
+
+  SOS_ASSERT_FATAL(SOS_OK == sos_kmutex_init(& bench_kmutex,
+					     "bench_kmutex"));
+  SOS_ASSERT_FATAL(SOS_OK == sos_kmutex_set_adaptive(& bench_kmutex,
+						     adaptive));
+  SOS_ASSERT_FATAL(SOS_OK == sos_ksema_init(& bench_kmutex_done,
+					    "bench_kmutex", 0));
+  bench_kmutex_counter = 0;
+  sos_kmutex_get_stats(& st_start);
+
+  tsc_start = sos_tsc_read();
+  for (i = 0 ; i < BENCH_KMUTEX_NB_THREADS ; i ++)
+    SOS_ASSERT_FATAL(NULL != sos_create_kernel_thread("bench_kmutex",
+						      bench_kmutex_worker,
+						      NULL));
+
+  for (i = 0 ; i < BENCH_KMUTEX_NB_THREADS ; i ++)
+    sos_ksema_down(& bench_kmutex_done, NULL);
+  tsc_start = sos_tsc_read() - tsc_start;
+
+  sos_kmutex_get_stats(stats);
+  stats->nb_spin_acquired -= st_start.nb_spin_acquired;
+  stats->nb_spin_failed   -= st_start.nb_spin_failed;
+  stats->nb_blocked       -= st_start.nb_blocked;
+
+  SOS_ASSERT_FATAL(bench_kmutex_counter
+		   == BENCH_KMUTEX_NB_THREADS * BENCH_KMUTEX_NB_ROUNDS);
+  SOS_ASSERT_FATAL(SOS_OK == sos_ksema_dispose(& bench_kmutex_done));
+  SOS_ASSERT_FATAL(SOS_OK == sos_kmutex_dispose(& bench_kmutex));
+  return sos_tsc_cycles_to_us(tsc_start);
+}
+
+static void bench_kmutex_contention()
+{
+  struct sos_kmutex_stats st_block, st_spin;
+  sos_ui32_t us_block, us_spin;
+
+  us_block = bench_kmutex_run(FALSE, & st_block);
+  us_spin  = bench_kmutex_run(TRUE, & st_spin);
+
+  printf("kmutex: %d threads x %d locks on %d CPUs\n",
+	 BENCH_KMUTEX_NB_THREADS, BENCH_KMUTEX_NB_ROUNDS,
+	 sos_smp_get_nb_cpus());
+  printf("kmutex: blocking %dus (%d blocks)\n",
+	 us_block, st_block.nb_blocked);
+  printf("kmutex: adaptive %dus (%d spin ok, %d spin ko, %d blocks)\n",
+	 us_spin, st_spin.nb_spin_acquired, st_spin.nb_spin_failed,
+	 st_spin.nb_blocked);
+}
+
+
+/* ======================================================================
+ * Priority inversion: the classic three-thread scenario on a single
+ * CPU. A low priority thread L repeatedly holds a lock for a short
+ * time, a medium priority thread M runs long computation bursts, and
+ * a high priority thread H periodically takes the lock. Without
+ * priority inheritance (a semaphore), H waits for the end of the
+ * bursts of M; with it (a mutex), H only waits for the critical
+ * section of L. The worst case latency of H to get the lock is
+ * measured in both cases.
+ */
+#define BENCH_PI_H_ROUNDS      20
+#define BENCH_PI_L_CS_YIELDS   5
+#define BENCH_PI_M_BURST       1000
+#define BENCH_PI_WORK_LOOPS    20000
+
+#define BENCH_PI_PRIO_H  (SOS_SCHED_PRIO_DEFAULT - 8)
+#define BENCH_PI_PRIO_M  (SOS_SCHED_PRIO_DEFAULT - 4)
+#define BENCH_PI_PRIO_L  SOS_SCHED_PRIO_DEFAULT
+
+/** The lock: a mutex, or a semaphore when use_mutex is FALSE */
+static struct
+{
+  sos_bool_t        use_mutex;
+  struct sos_kmutex mutex;
+  struct sos_ksema  sema;
+} bench_pi_lock;
+
+/** Set by H when it is done, so that L and M stop */
+static volatile sos_bool_t bench_pi_h_done;
+
+/** Worst case latency of H to get the lock, in CPU cycles */
+static sos_ui64_t bench_pi_max_latency;
+
+/** Signaled by each thread when it is done */
+static struct sos_ksema bench_pi_done;
+
+static void bench_pi_lock_take()
+{
+  if (bench_pi_lock.use_mutex)
+    SOS_ASSERT_FATAL(SOS_OK == sos_kmutex_lock(& bench_pi_lock.mutex, NULL));
+  else
+    SOS_ASSERT_FATAL(SOS_OK == sos_ksema_down(& bench_pi_lock.sema, NULL));
+}
+
+static void bench_pi_lock_release()
+{
+  if (bench_pi_lock.use_mutex)
+    SOS_ASSERT_FATAL(SOS_OK == sos_kmutex_unlock(& bench_pi_lock.mutex));
+  else
+    SOS_ASSERT_FATAL(SOS_OK == sos_ksema_up(& bench_pi_lock.sema));
+}
+
+/** Helper function to compute without blocking */
+static void bench_pi_work()
+{
+  sos_ui32_t x;
+  int i;
+
+  for (i = 0, x = 0 ; i < BENCH_PI_WORK_LOOPS ; i ++)
+    x = x * 1103515245 + 12345;
+  bench_sched_sink += x;
+}
+
+static void bench_pi_thread_h(void *unused)
+{
+  int round;
+
+  for (round = 0 ; round < BENCH_PI_H_ROUNDS ; round ++)
+    {
+      struct sos_time delay = { .sec = 0, .nanosec = 1000000 };
+      sos_ui64_t tsc_start;
+
+      sos_thread_sleep(& delay);
+
+      tsc_start = sos_tsc_read();
+      bench_pi_lock_take();
+      tsc_start = sos_tsc_read() - tsc_start;
+      bench_pi_lock_release();
+
+      if (tsc_start > bench_pi_max_latency)
+	bench_pi_max_latency = tsc_start;
+    }
+
+  bench_pi_h_done = TRUE;
+  sos_ksema_up(& bench_pi_done);
+}
+
+static void bench_pi_thread_m(void *unused)
+{
+  while (! bench_pi_h_done)
+    {
+      struct sos_time delay = { .sec = 0, .nanosec = 1000000 };
+      int i;
+
+      sos_thread_sleep(& delay);
+      for (i = 0 ; (i < BENCH_PI_M_BURST) && ! bench_pi_h_done ; i ++)
+	{
+	  bench_pi_work();
+	  sos_thread_yield();
+	}
+    }
+
+  sos_ksema_up(& bench_pi_done);
+}
+
+static void bench_pi_thread_l(void *unused)
+{
+  while (! bench_pi_h_done)
+    {
+      int i;
+
+      bench_pi_lock_take();
+      for (i = 0 ; i < BENCH_PI_L_CS_YIELDS ; i ++)
+	{
+	  bench_pi_work();
+	  sos_thread_yield();
+	}
+      bench_pi_lock_release();
+      sos_thread_yield();
+    }
+
+  sos_ksema_up(& bench_pi_done);
+}
+
+/** @return the worst case latency of H (in microseconds) */
+static sos_ui32_t bench_pi_run(sos_bool_t use_mutex)
+{
+  sos_kernel_thread_start_routine_t func[3] = { bench_pi_thread_l,
+						bench_pi_thread_m,
+						bench_pi_thread_h };
+  sos_sched_priority_t prio[3] = { BENCH_PI_PRIO_L,
+				   BENCH_PI_PRIO_M,
+				   BENCH_PI_PRIO_H };
+  int i;
+
+  bench_pi_lock.use_mutex = use_mutex;
+  SOS_ASSERT_FATAL(SOS_OK == sos_kmutex_init(& bench_pi_lock.mutex,
+					     "bench_pi"));
+  SOS_ASSERT_FATAL(SOS_OK == sos_ksema_init(& bench_pi_lock.sema,
+					    "bench_pi", 1));
+  SOS_ASSERT_FATAL(SOS_OK == sos_ksema_init(& bench_pi_done,
+					    "bench_pi_done", 0));
+  bench_pi_h_done      = FALSE;
+  bench_pi_max_latency = 0;
+
+  /* The BKL is held from the creation of the threads until they
+     are set up: they cannot start on another CPU meanwhile */
+  for (i = 0 ; i < 3 ; i ++)
+    {
+      struct sos_thread *thr
+	= sos_create_kernel_thread("bench_pi", func[i], NULL);
+      SOS_ASSERT_FATAL(thr != NULL);
+      SOS_ASSERT_FATAL(SOS_OK == sos_thread_set_priority(thr, prio[i]));
+      SOS_ASSERT_FATAL(SOS_OK
+		       == sos_thread_set_cpu_affinity(thr,
+				  SOS_SCHED_CPU(SOS_SMP_BOOT_CPU)));
+    }
+
+  for (i = 0 ; i < 3 ; i ++)
+    sos_ksema_down(& bench_pi_done, NULL);
+
+  SOS_ASSERT_FATAL(SOS_OK == sos_ksema_dispose(& bench_pi_done));
+  SOS_ASSERT_FATAL(SOS_OK == sos_ksema_dispose(& bench_pi_lock.sema));
+  SOS_ASSERT_FATAL(SOS_OK == sos_kmutex_dispose(& bench_pi_lock.mutex));
+  return sos_tsc_cycles_to_us(bench_pi_max_latency);
+}
+
+static void bench_priority_inversion()
+{
+  sos_ui32_t us_sema, us_mutex;
+
+  us_sema  = bench_pi_run(FALSE);
+  us_mutex = bench_pi_run(TRUE);
+
+  printf("prio inversion: worst H latency %dus w/o inheritance,"
+	 " %dus with\n", us_sema, us_mutex);
+}
+
+
+/* ======================================================================
+ * Read-mostly data: NB_THREADS threads each run NB_ROUNDS short read
+ * critical sections, one out of WRITE_RATIO being a write. The data
+ * are protected by a rwlock, then by a mutex for comparison. As
+ * above, the critical sections run without the big kernel lock.
+ * Also measures the cost of sos_time_get_now(), which reads the time
+ * under a seqlock.
+ */
+#define BENCH_RW_NB_THREADS  8
+#define BENCH_RW_NB_ROUNDS   1000
+#define BENCH_RW_WRITE_RATIO 100
+#define BENCH_RW_CS_LOOPS    2000
+#define BENCH_RW_NB_GET_NOW  100000
+
+/** The lock: a rwlock, or a mutex when use_rwlock is FALSE */
+static struct
+{
+  sos_bool_t         use_rwlock;
+  struct sos_krwlock rwlock;
+  struct sos_kmutex  mutex;
+} bench_rw_lock;
+
+/** The protected data */
+static volatile sos_ui32_t bench_rw_data;
+
+/** Signaled by each worker when it is done */
+static struct sos_ksema bench_rw_done;
+
+static void bench_rw_worker(void *unused)
+{
+  sos_ui32_t x = 0;
+  int i, j;
+
+  for (i = 0 ; i < BENCH_RW_NB_ROUNDS ; i ++)
+    {
+      sos_bool_t is_write = ((i % BENCH_RW_WRITE_RATIO) == 0);
+
+      if (! bench_rw_lock.use_rwlock)
+	SOS_ASSERT_FATAL(SOS_OK == sos_kmutex_lock(& bench_rw_lock.mutex,
+						   NULL));
+      else if (is_write)
+	SOS_ASSERT_FATAL(SOS_OK
+			 == sos_krwlock_write_lock(& bench_rw_lock.rwlock,
+						   NULL));
+      else
+	SOS_ASSERT_FATAL(SOS_OK
+			 == sos_krwlock_read_lock(& bench_rw_lock.rwlock,
+						  NULL));
+
+      sos_bkl_unlock();
+      for (j = 0, x += bench_rw_data ; j < BENCH_RW_CS_LOOPS ; j ++)
+	x = x * 1103515245 + 12345;
+      if (is_write)
+	bench_rw_data ++;
+      sos_bkl_lock();
+
+      if (! bench_rw_lock.use_rwlock)
+	SOS_ASSERT_FATAL(SOS_OK == sos_kmutex_unlock(& bench_rw_lock.mutex));
+      else if (is_write)
+	SOS_ASSERT_FATAL(SOS_OK
+			 == sos_krwlock_write_unlock(& bench_rw_lock.rwlock));
+      else
+	SOS_ASSERT_FATAL(SOS_OK
+			 == sos_krwlock_read_unlock(& bench_rw_lock.rwlock));
+    }
+
+  bench_sched_sink += x;
+  sos_ksema_up(& bench_rw_done);
+}
+
+/** @return the duration of the run (in microseconds) */
+static sos_ui32_t bench_rw_run(sos_bool_t use_rwlock)
+{
+  sos_ui64_t tsc_start;
+  int i;
+
+  bench_rw_lock.use_rwlock = use_rwlock;
+  SOS_ASSERT_FATAL(SOS_OK == sos_krwlock_init(& bench_rw_lock.rwlock,
+					      "bench_rw"));
+  SOS_ASSERT_FATAL(SOS_OK == sos_kmutex_init(& bench_rw_lock.mutex,
+					     "bench_rw"));
+  SOS_ASSERT_FATAL(SOS_OK == sos_ksema_init(& bench_rw_done,
+					    "bench_rw_done", 0));
+  bench_rw_data = 0;
+
+  tsc_start = sos_tsc_read();
+  for (i = 0 ; i < BENCH_RW_NB_THREADS ; i ++)
+    SOS_ASSERT_FATAL(NULL != sos_create_kernel_thread("bench_rw",
+						      bench_rw_worker,
+						      NULL));
+
+  for (i = 0 ; i < BENCH_RW_NB_THREADS ; i ++)
+    sos_ksema_down(& bench_rw_done, NULL);
+  tsc_start = sos_tsc_read() - tsc_start;
+
+  SOS_ASSERT_FATAL(bench_rw_data
+		   == BENCH_RW_NB_THREADS
+		      * (BENCH_RW_NB_ROUNDS / BENCH_RW_WRITE_RATIO));
+  SOS_ASSERT_FATAL(SOS_OK == sos_ksema_dispose(& bench_rw_done));
+  SOS_ASSERT_FATAL(SOS_OK == sos_kmutex_dispose(& bench_rw_lock.mutex));
+  SOS_ASSERT_FATAL(SOS_OK == sos_krwlock_dispose(& bench_rw_lock.rwlock));
+  return sos_tsc_cycles_to_us(tsc_start);
+}
+
+static void bench_rwlock_scaling()
+{
+  struct sos_time now;
+  sos_ui32_t us_mutex, us_rwlock;
+  sos_ui64_t tsc_start;
+  int i;
+
+  us_mutex  = bench_rw_run(FALSE);
+  us_rwlock = bench_rw_run(TRUE);
+
+  printf("rwlock: %d threads x %d sections (1/%d writes) on %d CPUs\n",
+	 BENCH_RW_NB_THREADS, BENCH_RW_NB_ROUNDS, BENCH_RW_WRITE_RATIO,
+	 sos_smp_get_nb_cpus());
+  printf("rwlock: mutex %dus, rwlock %dus\n", us_mutex, us_rwlock);
+
+  tsc_start = sos_tsc_read();
+  for (i = 0 ; i < BENCH_RW_NB_GET_NOW ; i ++)
+    sos_time_get_now(& now);
+  tsc_start = sos_tsc_read() - tsc_start;
+
+  printf("seqlock: sos_time_get_now() %d cycles/call\n",
+	 (sos_ui32_t)sos_tsc_udiv64(tsc_start, BENCH_RW_NB_GET_NOW, NULL));
+}
+
+
+/* ======================================================================
+ * RCU: cost of the read side, compared with disabling the IRQs, and
+ * of a lookup in the list of slab caches (walked under RCU). Then
+ * latency of sos_synchronize_rcu(), and deferred release of a
+ * destroyed cache.
+ */
+#define BENCH_RCU_NB_READS    1000000
+#define BENCH_RCU_NB_LOOKUPS  10000
+#define BENCH_RCU_NB_SYNC     20
+
+static void bench_rcu()
+{
+  struct sos_kmem_cache_info info;
+  struct sos_kslab_cache *cache;
+  struct sos_rcu_stats stats_start, stats;
+  sos_ui64_t tsc_start;
+  sos_ui32_t flags, cy_rcu, cy_irq, cy_lookup, us_sync;
+  int i;
+
+  tsc_start = sos_tsc_read();
+  for (i = 0 ; i < BENCH_RCU_NB_READS ; i ++)
+    {
+      sos_rcu_read_lock();
+      sos_rcu_read_unlock();
+    }
+  cy_rcu = sos_tsc_udiv64(sos_tsc_read() - tsc_start,
+			  BENCH_RCU_NB_READS / 100, NULL);
+
+  tsc_start = sos_tsc_read();
+  for (i = 0 ; i < BENCH_RCU_NB_READS ; i ++)
+    {
+      sos_disable_IRQs(flags);
+      sos_restore_IRQs(flags);
+    }
+  cy_irq = sos_tsc_udiv64(sos_tsc_read() - tsc_start,
+			  BENCH_RCU_NB_READS / 100, NULL);
+
+  tsc_start = sos_tsc_read();
+  for (i = 0 ; i < BENCH_RCU_NB_LOOKUPS ; i ++)
+    SOS_ASSERT_FATAL(SOS_OK == sos_kmem_cache_get_info("thread", & info));
+  cy_lookup = sos_tsc_udiv64(sos_tsc_read() - tsc_start,
+			     BENCH_RCU_NB_LOOKUPS, NULL);
+
+  printf("rcu: read side %d cycles/100, IRQs off %d cycles/100,"
+	 " cache lookup %d cycles\n", cy_rcu, cy_irq, cy_lookup);
+
+  sos_rcu_get_stats(& stats_start);
+  tsc_start = sos_tsc_read();
+  for (i = 0 ; i < BENCH_RCU_NB_SYNC ; i ++)
+    SOS_ASSERT_FATAL(SOS_OK == sos_synchronize_rcu());
+  us_sync = sos_tsc_cycles_to_us(sos_tsc_read() - tsc_start)
+    / BENCH_RCU_NB_SYNC;
+
+  /* The structure of a destroyed cache is released after a grace
+     period, but it cannot be found anymore at once */
+  cache = sos_kmem_cache_create("bench_rcu", 64, 1, 0, 0);
+  SOS_ASSERT_FATAL(NULL != cache);
+  SOS_ASSERT_FATAL(SOS_OK == sos_kmem_cache_get_info("bench_rcu", & info));
+  SOS_ASSERT_FATAL(SOS_OK == sos_kmem_cache_destroy(cache));
+  SOS_ASSERT_FATAL(-SOS_ENOENT == sos_kmem_cache_get_info("bench_rcu",
+							  & info));
+  SOS_ASSERT_FATAL(SOS_OK == sos_synchronize_rcu());
+  sos_rcu_get_stats(& stats);
+
+  printf("rcu: synchronize %dus, %d grace periods, %d callbacks\n",
+	 us_sync, stats.nb_grace_periods - stats_start.nb_grace_periods,
+	 stats.nb_callbacks - stats_start.nb_callbacks);
+}
+
+
+/* ======================================================================
+ * Condition variables: a thread repeatedly broadcasts a new
+ * generation to waiting threads, which each take the mutex to
+ * acknowledge it. Compared with a plain waitqueue on which all the
+ * threads are woken at once and contend for the mutex (thundering
+ * herd), the condvar moves them directly to the mutex (wait-morphing).
+ */
+#define BENCH_CV_NB_THREADS  8
+#define BENCH_CV_NB_ROUNDS   500
+
+static struct
+{
+  sos_bool_t          use_condvar;
+  struct sos_kmutex   mutex;
+  struct sos_kcondvar cond;
+  struct sos_kwaitq   herd_kwq;
+} bench_cv;
+
+/** Protected by bench_cv.mutex */
+static volatile sos_ui32_t bench_cv_generation, bench_cv_nb_acks;
+
+/** Signaled by each worker when it is done */
+static struct sos_ksema bench_cv_done;
+
+static void bench_cv_wait()
+{
+  if (bench_cv.use_condvar)
+    {
+      SOS_ASSERT_FATAL(SOS_OK == sos_kcondvar_wait(& bench_cv.cond,
+						   & bench_cv.mutex, NULL));
+      return;
+    }
+
+  /* No signal is lost: we hold the BKL until we sleep */
+  SOS_ASSERT_FATAL(SOS_OK == sos_kmutex_unlock(& bench_cv.mutex));
+  SOS_ASSERT_FATAL(SOS_OK == sos_kwaitq_wait(& bench_cv.herd_kwq, NULL));
+  SOS_ASSERT_FATAL(SOS_OK == sos_kmutex_lock(& bench_cv.mutex, NULL));
+}
+
+static void bench_cv_broadcast()
+{
+  if (bench_cv.use_condvar)
+    SOS_ASSERT_FATAL(SOS_OK == sos_kcondvar_broadcast(& bench_cv.cond));
+  else
+    SOS_ASSERT_FATAL(SOS_OK == sos_kwaitq_wakeup(& bench_cv.herd_kwq,
+						 SOS_KWQ_WAKEUP_ALL,
+						 SOS_OK));
+}
+
+static void bench_cv_worker(void *unused)
+{
+  sos_ui32_t generation = 0;
+  int i;
+
+  SOS_ASSERT_FATAL(SOS_OK == sos_kmutex_lock(& bench_cv.mutex, NULL));
+  for (i = 0 ; i < BENCH_CV_NB_ROUNDS ; i ++)
+    {
+      while (generation == bench_cv_generation)
+	bench_cv_wait();
+      generation = bench_cv_generation;
+
+      /* The last one to acknowledge wakes the broadcaster */
+      if (++ bench_cv_nb_acks == BENCH_CV_NB_THREADS)
+	bench_cv_broadcast();
+    }
+  SOS_ASSERT_FATAL(SOS_OK == sos_kmutex_unlock(& bench_cv.mutex));
+
+  sos_ksema_up(& bench_cv_done);
+}
+
+/** @return the duration of the run (in microseconds) */
+static sos_ui32_t bench_cv_run(sos_bool_t use_condvar,
+			       sos_count_t *nb_blocked)
+{
+  struct sos_kmutex_stats st_start, st;
+  sos_ui64_t tsc_start;
+  int i;
+
+  bench_cv.use_condvar = use_condvar;
+  SOS_ASSERT_FATAL(SOS_OK == sos_kmutex_init(& bench_cv.mutex, "bench_cv"));
+  SOS_ASSERT_FATAL(SOS_OK == sos_kmutex_set_adaptive(& bench_cv.mutex,
+						     FALSE));
+  SOS_ASSERT_FATAL(SOS_OK == sos_kcondvar_init(& bench_cv.cond, "bench_cv"));
+  SOS_ASSERT_FATAL(SOS_OK == sos_kwaitq_init(& bench_cv.herd_kwq,
+					     "bench_cv"));
+  SOS_ASSERT_FATAL(SOS_OK == sos_ksema_init(& bench_cv_done,
+					    "bench_cv_done", 0));
+  bench_cv_generation = 0;
+  sos_kmutex_get_stats(& st_start);
+
+  tsc_start = sos_tsc_read();
+  for (i = 0 ; i < BENCH_CV_NB_THREADS ; i ++)
+    SOS_ASSERT_FATAL(NULL != sos_create_kernel_thread("bench_cv",
+						      bench_cv_worker,
+						      NULL));
+
+  SOS_ASSERT_FATAL(SOS_OK == sos_kmutex_lock(& bench_cv.mutex, NULL));
+  for (i = 0 ; i < BENCH_CV_NB_ROUNDS ; i ++)
+    {
+      bench_cv_nb_acks = 0;
+      bench_cv_generation ++;
+      bench_cv_broadcast();
+      while (bench_cv_nb_acks < BENCH_CV_NB_THREADS)
+	bench_cv_wait();
+    }
+  SOS_ASSERT_FATAL(SOS_OK == sos_kmutex_unlock(& bench_cv.mutex));
+
+  for (i = 0 ; i < BENCH_CV_NB_THREADS ; i ++)
+    sos_ksema_down(& bench_cv_done, NULL);
+  tsc_start = sos_tsc_read() - tsc_start;
+
+  sos_kmutex_get_stats(& st);
+  *nb_blocked = st.nb_blocked - st_start.nb_blocked;
+
+  SOS_ASSERT_FATAL(SOS_OK == sos_ksema_dispose(& bench_cv_done));
+  SOS_ASSERT_FATAL(SOS_OK == sos_kwaitq_dispose(& bench_cv.herd_kwq));
+  SOS_ASSERT_FATAL(SOS_OK == sos_kcondvar_dispose(& bench_cv.cond));
+  SOS_ASSERT_FATAL(SOS_OK == sos_kmutex_dispose(& bench_cv.mutex));
+  return sos_tsc_cycles_to_us(tsc_start);
+}
+
+static void bench_condvar()
+{
+  struct sos_kcondvar_stats st_start, st;
+  sos_count_t blocked_herd, blocked_cv;
+  sos_ui32_t us_herd, us_cv;
+
+  us_herd = bench_cv_run(FALSE, & blocked_herd);
+  sos_kcondvar_get_stats(& st_start);
+  us_cv   = bench_cv_run(TRUE, & blocked_cv);
+  sos_kcondvar_get_stats(& st);
+
+  printf("condvar: %d threads x %d broadcasts on %d CPUs\n",
+	 BENCH_CV_NB_THREADS, BENCH_CV_NB_ROUNDS, sos_smp_get_nb_cpus());
+  printf("condvar: herd %dus (%d mutex blocks)\n", us_herd, blocked_herd);
+  printf("condvar: morphing %dus (%d mutex blocks, %d morphed, %d woken)\n",
+	 us_cv, blocked_cv, st.nb_morphed - st_start.nb_morphed,
+	 st.nb_woken - st_start.nb_woken);
+}
+
+
+/* ======================================================================
+ * mem*(): the klibc functions (words, SSE2 for the large buffers)
+ * against the byte-at-a-time loops they replaced, for sizes from 8B
+ * to 64kB. The destination of the byte loops is volatile, so that
+ * gcc does not turn them back into calls to the klibc functions
+ */
+#define BENCH_MEM_MAX_SIZE   (64*1024)
+#define BENCH_MEM_NB_BYTES   (4*1024*1024) /**< Bytes handled per size */
+
+static void bench_mem_byte_cpy(void *dst, const void *src, sos_size_t n)
+{
+  volatile char *d = dst;
+  const char *s = src;
+  for ( ; n > 0 ; n--)
+    *d++ = *s++;
+}
+
+static void bench_mem_byte_set(void *dst, int c, sos_size_t n)
+{
+  volatile char *d = dst;
+  for ( ; n > 0 ; n--)
+    *d++ = (char)c;
+}
+
+static int bench_mem_byte_cmp(const void *s1, const void *s2, sos_size_t n)
+{
+  const volatile unsigned char *c1 = s1, *c2 = s2;
+  for ( ; n > 0 ; n--, c1++, c2++)
+    if (*c1 != *c2)
+      return *c1 - *c2;
+  return 0;
+}
+
+/** Sink of the memcmp() results */
+static volatile int bench_mem_sink;
+
+/** @return the average cycles of a call of op on size bytes: 0 for
+    memcpy, 1 for memset, 2 for memcmp */
+static sos_ui32_t bench_mem_run(int op, sos_bool_t bytewise,
+				char *dst, const char *src, sos_size_t size)
+{
+  sos_ui32_t i, nb = BENCH_MEM_NB_BYTES / size;
+  sos_ui64_t tsc_start;
+
+  tsc_start = sos_tsc_read();
+  for (i = 0 ; i < nb ; i ++)
+    switch (op)
+      {
+      case 0:
+	if (bytewise) bench_mem_byte_cpy(dst, src, size);
+	else          memcpy(dst, src, size);
+	break;
+      case 1:
+	if (bytewise) bench_mem_byte_set(dst, i, size);
+	else          memset(dst, i, size);
+	break;
+      default:
+	if (bytewise) bench_mem_sink = bench_mem_byte_cmp(dst, src, size);
+	else          bench_mem_sink = memcmp(dst, src, size);
+	break;
+      }
+
+  return sos_tsc_udiv64(sos_tsc_read() - tsc_start, nb, NULL);
+}
+
+static void bench_mem()
+{
+  static const char *op_names[] = { "memcpy", "memset", "memcmp" };
+  static const sos_size_t sizes[] = { 8, 64, 512, 4096, 65536 };
+  char *src, *dst;
+  int op, i;
+
+  src = (char*)sos_kmalloc(BENCH_MEM_MAX_SIZE, 0);
+  dst = (char*)sos_kmalloc(BENCH_MEM_MAX_SIZE, 0);
+  SOS_ASSERT_FATAL(src && dst);
+  memset(src, 0x42, BENCH_MEM_MAX_SIZE);
+
+  printf("mem: SSE2 %s, cycles per call bytewise/klibc\n",
+	 sos_fpu_has_sse2()?"yes":"no");
+  for (op = 0 ; op < 3 ; op ++)
+    {
+      printf("%s:", op_names[op]);
+      for (i = 0 ; i < sizeof(sizes)/sizeof(sizes[0]) ; i ++)
+	{
+	  sos_size_t size = sizes[i];
+	  sos_ui32_t c_byte, c_klibc;
+
+	  /* memcmp() compares equal buffers: all the bytes are read */
+	  memcpy(dst, src, size);
+	  c_byte  = bench_mem_run(op, TRUE, dst, src, size);
+	  memcpy(dst, src, size);
+	  c_klibc = bench_mem_run(op, FALSE, dst, src, size);
+	  printf(" %dB %d/%d", size, c_byte, c_klibc);
+	}
+      printf("\n");
+    }
+
+  sos_kfree((sos_vaddr_t)src);
+  sos_kfree((sos_vaddr_t)dst);
+}
+
+
+/* ======================================================================
+ * str*(): the klibc functions (words) against the bytewise versions
+ * they replaced, on strings of various lengths
+ */
+#define BENCH_STR_MAX_LEN   2048
+#define BENCH_STR_NB_BYTES  (1024*1024) /**< Bytes scanned per length */
+
+static unsigned int bench_str_byte_len(const char *str)
+{
+  unsigned int retval = 0;
+  while (*str++)
+    retval++;
+  return retval;
+}
+
+static unsigned int bench_str_byte_nlen(const char *s, sos_size_t count)
+{
+  const char *sc;
+  for (sc = s; count-- && *sc != '\0'; ++sc)
+    continue;
+  return sc - s;
+}
+
+static int bench_str_byte_cmp(const char *s1, const char *s2)
+{
+  while (*s1 == *s2++)
+    if (*s1++ == 0)
+      return 0;
+  return (*(const unsigned char *)s1 - *(const unsigned char *)(s2 - 1));
+}
+
+static int bench_str_byte_ncmp(const char *s1, const char *s2, int len)
+{
+  char c1 = '\0', c2 = '\0';
+  while (len > 0)
+    {
+      c1 = (unsigned char) *s1++;
+      c2 = (unsigned char) *s2++;
+      if (c1 == '\0' || c1 != c2)
+        return c1 - c2;
+      len--;
+    }
+  return c1 - c2;
+}
+
+static char *bench_str_byte_zcpy(char *dst, const char *src, int len)
+{
+  int i;
+  for (i = 0; i < len; i++)
+    {
+      dst[i] = src[i];
+      if(src[i] == '\0')
+        return dst;
+    }
+  dst[len-1] = '\0';
+  return dst;
+}
+
+/** Sink of the results */
+static volatile int bench_str_sink;
+
+/** @return the average cycles of a call of op on strings of len
+    characters: strlen, strnlen, strcmp, strncmp, strzcpy */
+static sos_ui32_t bench_str_run(int op, sos_bool_t bytewise,
+				char *dst, const char *s1, const char *s2,
+				sos_size_t len)
+{
+  sos_ui32_t i, nb = BENCH_STR_NB_BYTES / len;
+  sos_ui64_t tsc_start;
+
+  tsc_start = sos_tsc_read();
+  for (i = 0 ; i < nb ; i ++)
+    switch (op)
+      {
+      case 0:
+	bench_str_sink = (bytewise)? bench_str_byte_len(s1) : strlen(s1);
+	break;
+      case 1:
+	bench_str_sink = (bytewise)? bench_str_byte_nlen(s1, len + 1)
+	  : strnlen(s1, len + 1);
+	break;
+      case 2:
+	bench_str_sink = (bytewise)? bench_str_byte_cmp(s1, s2)
+	  : strcmp(s1, s2);
+	break;
+      case 3:
+	bench_str_sink = (bytewise)? bench_str_byte_ncmp(s1, s2, len + 1)
+	  : strncmp(s1, s2, len + 1);
+	break;
+      default:
+	if (bytewise) bench_str_byte_zcpy(dst, s1, len + 1);
+	else          strzcpy(dst, s1, len + 1);
+	break;
+      }
+
+  return sos_tsc_udiv64(sos_tsc_read() - tsc_start, nb, NULL);
+}
+
+static void bench_str()
+{
+  static const char *op_names[]
+    = { "strlen", "strnlen", "strcmp", "strncmp", "strzcpy" };
+  static const sos_size_t lens[] = { 8, 32, 256, BENCH_STR_MAX_LEN };
+  char *s1, *s2, *dst;
+  int op, i;
+
+  s1  = (char*)sos_kmalloc(BENCH_STR_MAX_LEN + 1, 0);
+  s2  = (char*)sos_kmalloc(BENCH_STR_MAX_LEN + 1, 0);
+  dst = (char*)sos_kmalloc(BENCH_STR_MAX_LEN + 1, 0);
+  SOS_ASSERT_FATAL(s1 && s2 && dst);
+
+  printf("str: cycles per call bytewise/klibc\n");
+  for (op = 0 ; op < 5 ; op ++)
+    {
+      printf("%s:", op_names[op]);
+      for (i = 0 ; i < sizeof(lens)/sizeof(lens[0]) ; i ++)
+	{
+	  sos_size_t len = lens[i];
+	  sos_ui32_t c_byte, c_klibc;
+
+	  /* The comparisons compare equal strings: all the characters
+	     are read */
+	  memset(s1, 'a', len);
+	  s1[len] = '\0';
+	  memcpy(s2, s1, len + 1);
+
+	  c_byte  = bench_str_run(op, TRUE, dst, s1, s2, len);
+	  c_klibc = bench_str_run(op, FALSE, dst, s1, s2, len);
+	  printf(" %dB %d/%d", len, c_byte, c_klibc);
+	}
+      printf("\n");
+    }
+
+  sos_kfree((sos_vaddr_t)s1);
+  sos_kfree((sos_vaddr_t)s2);
+  sos_kfree((sos_vaddr_t)dst);
+}
+
+
+/* ======================================================================
+ * Console: printf() lines long enough to scroll the whole screen
+ * several times, each line written to the screen at once by the line
+ * buffer of the CPU
+ */
+#define BENCH_CONSOLE_NB_LINES  200
+#define BENCH_CONSOLE_LINE_LEN  64
+
+static void bench_console()
+{
+  char line[BENCH_CONSOLE_LINE_LEN + 1];
+  sos_ui64_t tsc_start, nb_chars;
+  sos_ui32_t us;
+  int i;
+
+  memset(line, '.', BENCH_CONSOLE_LINE_LEN);
+  line[BENCH_CONSOLE_LINE_LEN] = '\0';
+
+  tsc_start = sos_tsc_read();
+  for (i = 0 ; i < BENCH_CONSOLE_NB_LINES ; i ++)
+    printf("%s\n", line);
+  us = sos_tsc_cycles_to_us(sos_tsc_read() - tsc_start);
+
+  nb_chars = BENCH_CONSOLE_NB_LINES * (BENCH_CONSOLE_LINE_LEN + 1);
+  printf("console: %d lines %dus, %d chars/s\n",
+	 BENCH_CONSOLE_NB_LINES, us,
+	 (sos_ui32_t)sos_tsc_udiv64(nb_chars * 1000000, us + 1, NULL));
+}
+
+
+/* ======================================================================
+ * The benchmark thread
+ */
+static void bench_thread(void *unused)
+{
+  printf("Benchmarks: start\n");
+
+  bench_timeout_actions();
+  bench_timer_softirq();
+  bench_sched_throughput();
+  bench_context_switch();
+  bench_thread_spawn();
+  bench_workqueue();
+  bench_threaded_irq();
+  bench_kmutex_contention();
+  bench_priority_inversion();
+  bench_rwlock_scaling();
+  bench_rcu();
+  bench_condvar();
+  bench_mem();
+  bench_str();
+  bench_console();
+
+#ifdef SOS_KSYNCH_STATS
+  /* Including the locks of the mouse simulation running meanwhile */
+  sos_klock_stats_dump(8);
+#endif
+
+#ifdef SOS_IRQ_TRACE
+  /* Since the boot, including the threaded IRQ benchmark */
+  sos_irq_trace_dump();
+#endif
+
+  printf("Benchmarks: done\n");
+}
+
+
+sos_ret_t sos_bench_start(void)
+{
+  if (NULL == sos_create_kernel_thread("bench", bench_thread, NULL))
+    return -SOS_ENOMEM;
+  return SOS_OK;
+}
@@ -0,0 +1,46 @@
+/* Copyright (C) 2026  AbdAllah MEZITI
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+   USA. 
+*/
+#ifndef _SOS_BENCH_H_
+#define _SOS_BENCH_H_
+
+/**
+ * @file bench.h
+ *
+ * In-kernel micro-benchmarks of the kernel subsystems. They run in a
+ * dedicated kernel thread and print their results on the console.
+ */
+
+#include <os/types.h>
+#include <os/errno.h>
+
+
+/**
+ * When set, the benchmarks are run at boot, once the demo threads are
+ * started
+ */
+/* #define SOS_BENCH */
+
+
+/**
+ * Create the kernel thread that runs all the benchmarks one after the
+ * other
+ */
+sos_ret_t sos_bench_start(void);
+
+
+#endif /* _SOS_BENCH_H_ */
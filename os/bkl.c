@@ -0,0 +1,144 @@
+/* Copyright (C) 2026  AbdAllah MEZITI
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+   USA. 
+*/
+#include <hwcore/irq.h>
+#include <hwcore/smp.h>
+#include <hwcore/spinlock.h>
+#include <os/assert.h>
+
+#include "bkl.h"
+
+
+/** Owner CPU value when the BKL is free */
+#define BKL_NO_OWNER ((sos_ui32_t)-1)
+
+
+/** The BKL. Initially held (once) by the boot CPU */
+static struct
+{
+  struct sos_spinlock lock;
+
+  /** The CPU holding the lock, and how many times */
+  volatile sos_ui32_t owner_cpu;
+  sos_ui32_t depth;
+} bkl = {
+  .lock      = { .next_ticket = 1, .now_serving = 0, .name = "bkl" },
+  .owner_cpu = SOS_SMP_BOOT_CPU,
+  .depth     = 1
+};
+
+
+void sos_bkl_lock(void)
+{
+  sos_ui32_t flags, cpu_id;
+
+  sos_disable_IRQs(flags);
+
+  cpu_id = sos_smp_get_cpu_id();
+  if (bkl.owner_cpu == cpu_id)
+    {
+      bkl.depth ++;
+      sos_restore_IRQs(flags);
+      return;
+    }
+
+  /* The IRQs MUST remain disabled while waiting: an IRQ handler on
+     this CPU would wait behind our ticket */
+  sos_spin_lock(& bkl.lock);
+  bkl.owner_cpu = cpu_id;
+  bkl.depth     = 1;
+
+  sos_restore_IRQs(flags);
+}
+
+
+void sos_bkl_unlock(void)
+{
+  sos_ui32_t flags;
+
+  sos_disable_IRQs(flags);
+
+  SOS_ASSERT_FATAL(bkl.owner_cpu == sos_smp_get_cpu_id());
+  if (--bkl.depth == 0)
+    {
+      bkl.owner_cpu = BKL_NO_OWNER;
+      sos_spin_unlock(& bkl.lock);
+    }
+
+  sos_restore_IRQs(flags);
+}
+
+
+sos_bool_t sos_bkl_is_held(void)
+{
+  sos_ui32_t flags;
+  sos_bool_t retval;
+
+  sos_disable_IRQs(flags);
+  retval = (bkl.owner_cpu == sos_smp_get_cpu_id());
+  sos_restore_IRQs(flags);
+
+  return retval;
+}
+
+
+sos_ui32_t sos_bkl_drop(void)
+{
+  sos_ui32_t flags, depth;
+
+  sos_disable_IRQs(flags);
+
+  SOS_ASSERT_FATAL(bkl.owner_cpu == sos_smp_get_cpu_id());
+  depth = bkl.depth;
+  bkl.depth = 1;
+  sos_bkl_unlock();
+
+  sos_restore_IRQs(flags);
+  return depth;
+}
+
+
+void sos_bkl_retake(sos_ui32_t depth)
+{
+  sos_ui32_t flags;
+
+  SOS_ASSERT_FATAL(depth > 0);
+  sos_disable_IRQs(flags);
+
+  sos_bkl_lock();
+  bkl.depth = depth;
+
+  sos_restore_IRQs(flags);
+}
+
+
+void sos_bkl_yield(void)
+{
+  sos_ui32_t flags;
+
+  sos_disable_IRQs(flags);
+
+  SOS_ASSERT_FATAL(bkl.owner_cpu == sos_smp_get_cpu_id());
+  if ((bkl.depth == 1) && sos_spin_is_contended(& bkl.lock))
+    {
+      /* Another CPU is waiting: it gets the BKL before us */
+      sos_bkl_unlock();
+      sos_bkl_lock();
+    }
+
+  sos_restore_IRQs(flags);
+}
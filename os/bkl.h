@@ -0,0 +1,80 @@
+/* Copyright (C) 2026  AbdAllah MEZITI
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+   USA. 
+*/
+#ifndef _SOS_BKL_H_
+#define _SOS_BKL_H_
+
+/**
+ * @file bkl.h
+ *
+ * The big kernel lock. The kernel code was written for a single,
+ * non-preemptible CPU: it assumes that disabling the IRQs is enough
+ * to be alone in a critical section. On SMP, this remains true as
+ * long as only one CPU at a time runs kernel code: the big kernel
+ * lock (BKL) enforces this.
+ *
+ * The BKL is held by the CPU that runs a thread or an IRQ handler. It
+ * is not released by the context switch: the next thread inherits it
+ * on the same CPU. It is released by the idle threads while they are
+ * halted, and at each sos_thread_yield() when another CPU is waiting
+ * for it. A thread may also release it explicitly around code that
+ * does not touch any shared kernel data.
+ *
+ * The BKL is a ticket lock (FIFO), recursive on a given CPU. It is
+ * initially held by the boot CPU.
+ */
+
+#include <os/types.h>
+#include <os/errno.h>
+
+
+/**
+ * Take the BKL on the current CPU, spinning with the IRQs disabled
+ * when another CPU holds it
+ */
+void sos_bkl_lock(void);
+
+
+/** Release the BKL (once) on the current CPU */
+void sos_bkl_unlock(void);
+
+
+/** @return TRUE when the current CPU holds the BKL */
+sos_bool_t sos_bkl_is_held(void);
+
+
+/**
+ * Hand over the BKL to the next CPU waiting for it, if any, and take
+ * it back. Does nothing if the BKL is held recursively.
+ */
+void sos_bkl_yield(void);
+
+
+/**
+ * Release the BKL completely on the current CPU, whatever the number
+ * of times it is held
+ *
+ * @return The number of times it was held, to be given back to
+ * sos_bkl_retake()
+ */
+sos_ui32_t sos_bkl_drop(void);
+
+
+/** Take the BKL again after sos_bkl_drop() */
+void sos_bkl_retake(sos_ui32_t depth);
+
+#endif /* _SOS_BKL_H_ */
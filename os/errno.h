@@ -33,6 +33,7 @@
 #define SOS_EBUSY  4   /* Object or device still in use */
 #define SOS_EINTR  5   /* Wait/Sleep has been interrupted */
 #define SOS_EPERM  6   /* Mutex/files ownership error */
+#define SOS_ENOENT 7   /* No such object */
 #define SOS_EFATAL 255 /* Internal fatal error */
 
 /* A negative value means that an error occured.  For
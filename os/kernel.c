@@ -26,12 +26,23 @@
 #include <hwcore/irq.h>
 #include <hwcore/exception.h>
 #include <hwcore/i8254.h>
+#include <hwcore/tsc.h>
+#include <hwcore/fpu.h>
+#include <hwcore/apic.h>
+#include <hwcore/smp.h>
 #include <hwcore/paging.h>
 #include "list.h"
 #include "physmem.h"
 #include <os/kmem_vmm.h>
 #include <os/kmalloc.h>
 #include <os/time.h>
+#include <os/bench.h>
+#include <os/bkl.h>
+#include <os/thread.h>
+#include <os/rcu.h>
+#include <os/workqueue.h>
+#include <os/softirq.h>
+#include <lib/klibc.h>
 #include "os/assert.h"
 
 extern struct multiboot_tag_basic_meminfo* mbi_tag_mem;
@@ -64,11 +75,24 @@ static void clk_it(int intid)
 {
   static sos_ui32_t clock_count = 0;
 
+  /* Rebalance the ready threads between the CPUs */
+  sos_sched_do_tick();
+
+  /* Each CPU has its own local APIC timer: only the boot CPU keeps
+     the kernel time */
+  if (sos_smp_get_cpu_id() != SOS_SMP_BOOT_CPU)
+    return;
+
   display_bits(0, 48,
 	       SOS_X86_VIDEO_FG_LTGREEN | SOS_X86_VIDEO_BG_BLUE,
 	       clock_count);
   clock_count++;
 
+  /* Execute the expired timeout actions (if any) */
+  sos_time_do_tick();
+
+  /* Release the data unlinked before the last grace period */
+  sos_rcu_process_callbacks();
 }
 
 
@@ -141,6 +165,7 @@ static void pgflt_ex(int intid, const struct sos_cpu_state *ctxt)
   static sos_ui32_t demand_paging_count = 0;
   sos_vaddr_t faulting_vaddr = sos_cpu_context_get_EX_faulting_vaddr(ctxt);
   sos_paddr_t ppage_paddr;
+  struct sos_thread *overflowed;
 
   /* Check if address is covered by any VMM range */
   if (! sos_kmem_vmm_is_valid_vaddr(faulting_vaddr))
@@ -159,6 +184,22 @@ static void pgflt_ex(int intid, const struct sos_cpu_state *ctxt)
     }
 
 
+  /* The guard pages below the kernel stacks are inside valid VMM
+     ranges, but must never be mapped */
+  overflowed = sos_thread_lookup_stack_guard(faulting_vaddr);
+  if (overflowed)
+    {
+      dump_backtrace(ctxt,
+		     overflowed->kernel_stack_base_addr,
+		     overflowed->kernel_stack_size,
+		     TRUE, TRUE);
+      sos_display_fatal_error("Kernel stack overflow in thread %s at instruction 0x%x on access to address 0x%x!",
+			      overflowed->name,
+			      sos_cpu_context_get_PC(ctxt),
+			      (unsigned)faulting_vaddr);
+    }
+
+
   /*
    * Demand paging
    */
@@ -292,13 +333,23 @@ static void idle_thread()
 
   while (1)
     {
+      /* Let the other CPUs run the kernel while we are halted */
+      sos_bkl_unlock();
+
       /* Remove this instruction if you get an "Invalid opcode" CPU
 	 exception (old 80386 CPU) */
       asm("hlt\n");
 
+      sos_bkl_lock();
+
+      /* Idle: not in an RCU read-side critical section */
+      sos_rcu_quiescent_state();
+      sos_rcu_process_callbacks();
+
       idle_twiddle ++;
-      display_bits(0, 0, SOS_X86_VIDEO_FG_GREEN | SOS_X86_VIDEO_BG_BLUE,
-		   idle_twiddle);
+      if (sos_smp_get_cpu_id() == SOS_SMP_BOOT_CPU)
+	display_bits(0, 0, SOS_X86_VIDEO_FG_GREEN | SOS_X86_VIDEO_BG_BLUE,
+		     idle_twiddle);
       
       /* Lend the CPU to some other thread */
       sos_thread_yield();
@@ -309,6 +360,20 @@ static void idle_thread()
 
 
 
+/* ======================================================================
+ * Entry point of the application processors: their boot thread
+ * becomes their idle thread
+ */
+static void ap_main(sos_vaddr_t stack_base, sos_size_t stack_size)
+{
+  sos_bkl_lock();
+  SOS_ASSERT_FATAL(SOS_OK == sos_thread_cpu_setup(stack_base, stack_size));
+
+  asm volatile ("sti\n");
+  idle_thread();
+}
+
+
 /* ====================================================================================== */
 /* Check if MAGIC is valid and print the Multiboot information structure pointed by ADDR. */
 /* ====================================================================================== */
@@ -352,6 +417,7 @@ void cmain (unsigned long magic, unsigned long addr)
 
 	/* Setup CPU segmentation and IRQ subsystem */
 	sos_gdt_subsystem_setup();
+	sos_smp_subsystem_setup();
 	sos_idt_subsystem_setup();
 
 
@@ -359,10 +425,34 @@ void cmain (unsigned long magic, unsigned long addr)
 	sos_exception_subsystem_setup();
 	sos_irq_subsystem_setup();
 
+	/* Switch the FPU contexts of the threads lazily */
+	if (SOS_OK == sos_fpu_subsystem_setup())
+		printf("FPU: lazy switching%s\n",
+		       sos_fpu_has_sse()?", SSE":"");
+	else
+		printf("FPU: not available to the threads\n");
+
+	/* Check the klibc functions against plain byte loops, with the
+	   SSE2 paths enabled */
+	sos_klibc_selftest();
+
+	/* The per-CPU area is set up: buffer the console by line */
+	console_buffering_setup();
+
+	/* Setup the deferred interrupt work, run on IRQ exit */
+	sos_softirq_subsystem_setup();
+
 
 	/* Configure the timer so as to raise the IRQ0 at a 100Hz rate */
 	sos_i8254_set_frequency(100);
 
+	/* Measure the frequency of the CPU cycle counter against the
+	   timer clock */
+	if (SOS_OK == sos_tsc_subsystem_setup())
+		printf("TSC: %d kHz\n", sos_tsc_get_khz());
+	else
+		printf("TSC: not available\n");
+
 	/* Setup the kernel time subsystem to get prepared to take the timer
 	   ticks into account */
 	tick_resolution = (struct sos_time) { .sec=0, .nanosec=10000000UL };
@@ -397,6 +487,11 @@ void cmain (unsigned long magic, unsigned long addr)
 	/* Bind the page fault exception */
 	sos_exception_set_routine(SOS_EXCEPT_PAGE_FAULT,
 					pgflt_ex);
+
+	/* Handle the double faults on a stack of their own: an
+	   overflow of a kernel stack into its guard page ends there */
+	SOS_ASSERT_FATAL(SOS_OK ==
+		   sos_exception_cpu_setup_double_fault_task());
 	cls ();
 
  	/*
@@ -410,6 +505,11 @@ void cmain (unsigned long magic, unsigned long addr)
 	 
 	if (sos_kmalloc_subsystem_setup())
 		printf("Could not setup the Kmalloc subsystem\n");
+
+	/* Route the IRQs through the APIC when available: the local APIC
+	   timer then replaces the 82c54 to raise the timer IRQ */
+	if (SOS_OK == sos_irq_switch_to_apic())
+		SOS_ASSERT_FATAL(SOS_OK == sos_apic_timer_set_frequency(100));
  	 
 
 	/*
@@ -423,8 +523,19 @@ void cmain (unsigned long magic, unsigned long addr)
 	/* Initialize the scheduler */
 	sos_sched_subsystem_setup();
 
+	/* Initialize the deferred release of the read-mostly data */
+	sos_rcu_subsystem_setup();
+
 	/* Declare the IDLE thread */
-	SOS_ASSERT_FATAL(sos_create_kernel_thread("idle", idle_thread, NULL) != NULL);
+	SOS_ASSERT_FATAL(sos_create_idle_thread("[idle0]", idle_thread, NULL) != NULL);
+
+	/* Start the other CPUs: they wait for the big kernel lock, held
+	   by this thread */
+	if (SOS_OK == sos_smp_start_aps(ap_main))
+		printf("SMP: %d CPUs online\n", sos_smp_get_nb_cpus());
+
+	/* Start the workers of the background works, on all the CPUs */
+	SOS_ASSERT_FATAL(SOS_OK == sos_workqueue_subsystem_setup());
 
 	/* Enabling the HW interrupts here, this will make the timer HW
 	interrupt call the scheduler */
@@ -436,6 +547,11 @@ void cmain (unsigned long magic, unsigned long addr)
 	MouseSim();
 	test_thread();
 
+#ifdef SOS_BENCH
+	/* And measure the kernel subsystems */
+	SOS_ASSERT_FATAL(SOS_OK == sos_bench_start());
+#endif
+
 
 
   /*
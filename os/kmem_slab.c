@@ -21,6 +21,8 @@
 #include <os/list.h>
 #include <os/assert.h>
 #include <hwcore/paging.h>
+#include <hwcore/spinlock.h>
+#include <os/rcu.h>
 #include <os/physmem.h>
 #include <os/kmem_vmm.h>
 
@@ -49,6 +51,9 @@ struct sos_kslab_cache
 #define ON_SLAB (1<<31) /* struct sos_kslab is included inside the slab */
   sos_ui32_t  flags;
 
+  /** Protects the run-time data below */
+  struct sos_spinlock lock;
+
   /* Supervision data (updated at run-time) */
   sos_count_t nb_free_objects;
 
@@ -57,6 +62,9 @@ struct sos_kslab_cache
 
   /* The caches are linked together on the kslab_cache_list */
   struct sos_kslab_cache *prev, *next;
+
+  /* Deferred release of a destroyed cache, see sos_kmem_cache_destroy() */
+  struct sos_rcu_head rcu;
 };
 
 
@@ -95,8 +103,13 @@ static struct sos_kslab_cache *cache_of_struct_kslab_cache;
 /** The cache of slab structures for non-ON_SLAB caches */
 static struct sos_kslab_cache *cache_of_struct_kslab;
 
-/** The list of slab caches */
+/**
+ * The list of slab caches, and the lock protecting it against the
+ * other writers. The readers walk it under RCU: its head, the cache
+ * of caches, is never destroyed
+ */
 static struct sos_kslab_cache *kslab_cache_list;
+static struct sos_spinlock kslab_cache_list_lock;
 
 /* Helper function to initialize a cache structure */
 static sos_ret_t
@@ -167,6 +180,7 @@ cache_initialize(/*out*/struct sos_kslab_cache *the_cache,
   if (space_left >= sizeof(struct sos_kslab))
     the_cache->flags |= ON_SLAB;
 
+  sos_spin_init(& the_cache->lock, the_cache->name);
   return SOS_OK;
 }
 
@@ -177,6 +191,8 @@ cache_add_slab(struct sos_kslab_cache *kslab_cache,
 	       sos_vaddr_t vaddr_slab,
 	       struct sos_kslab *slab)
 {
+
+  sos_ui32_t flags;
   int i;
 
   /* Setup the slab structure */
@@ -185,10 +201,7 @@ cache_add_slab(struct sos_kslab_cache *kslab_cache,
 
   /* Establish the address of the first free object */
   slab->first_object = vaddr_slab;
-
-  /* Account for this new slab in the cache */
   slab->nb_free = kslab_cache->nb_objects_per_slab;
-  kslab_cache->nb_free_objects += slab->nb_free;
 
   /* Build the list of free objects */
   for (i = 0 ; i <  kslab_cache->nb_objects_per_slab ; i++)
@@ -203,9 +216,13 @@ cache_add_slab(struct sos_kslab_cache *kslab_cache,
 		    (struct sos_kslab_free_object *)obj_vaddr);
     }
 
-  /* Add the slab to the cache's slab list: add the head of the list
-     since this slab is non full */
+  /* Account for this new slab in the cache, and add the slab to the
+     cache's slab list: add the head of the list since this slab is
+     non full */
+  sos_spin_lock_irqsave(& kslab_cache->lock, flags);
+  kslab_cache->nb_free_objects += slab->nb_free;
   list_add_head(kslab_cache->slab_list, slab);
+  sos_spin_unlock_irqrestore(& kslab_cache->lock, flags);
 
   return SOS_OK;
 }
@@ -280,7 +297,26 @@ cache_grow(struct sos_kslab_cache *kslab_cache,
 
 
 /**
- * Helper function to release a slab
+ * Helper function to remove an empty slab from the slabs' list of its
+ * cache. MUST be called with the cache lock held
+ */
+static void
+cache_unlink_slab(struct sos_kslab *slab)
+{
+  struct sos_kslab_cache *kslab_cache = slab->cache;
+
+  SOS_ASSERT_FATAL(kslab_cache != NULL);
+  SOS_ASSERT_FATAL(slab->nb_free == kslab_cache->nb_objects_per_slab);
+
+  list_delete(kslab_cache->slab_list, slab);
+  kslab_cache->nb_free_objects -= slab->nb_free;
+}
+
+
+/**
+ * Helper function to release a slab, already removed from its cache
+ * by cache_unlink_slab(). MUST be called without the cache lock held,
+ * since it releases the slab structure and the range
  *
  * The corresponding range is always deleted, except when the @param
  * must_del_range_now is not set. This happens only when the function
@@ -296,14 +332,9 @@ cache_release_slab(struct sos_kslab *slab,
 
   SOS_ASSERT_FATAL(kslab_cache != NULL);
   SOS_ASSERT_FATAL(range != NULL);
-  SOS_ASSERT_FATAL(slab->nb_free == slab->cache->nb_objects_per_slab);
-
-  /* First, remove the slab from the slabs' list of the cache */
-  list_delete(kslab_cache->slab_list, slab);
-  slab->cache->nb_free_objects -= slab->nb_free;
 
   /* Release the slab structure if it is OFF slab */
-  if (! (slab->cache->flags & ON_SLAB))
+  if (! (kslab_cache->flags & ON_SLAB))
     sos_kmem_cache_free((sos_vaddr_t)slab);
 
   /* Ok, the range is not bound to any slab anymore */
@@ -365,6 +396,8 @@ create_cache_of_caches(sos_vaddr_t vaddr_first_slab_of_caches,
   /* We initialize it */
   memcpy(real_cache_of_caches, & fake_cache_of_caches,
 	 sizeof(struct sos_kslab_cache));
+  sos_spin_dispose(& fake_cache_of_caches.lock);
+  sos_spin_init(& real_cache_of_caches->lock, real_cache_of_caches->name);
   /* We need to update the slab's 'cache' field */
   slab_of_caches->cache = real_cache_of_caches;
   
@@ -449,6 +482,7 @@ sos_kmem_cache_subsystem_setup_prepare(sos_vaddr_t kernel_core_base,
 
   /* In the begining, there isn't any cache */
   kslab_cache_list = NULL;
+  sos_spin_init(& kslab_cache_list_lock, "kslab_cache_list");
   cache_of_struct_kslab = NULL;
   cache_of_struct_kslab_cache = NULL;
 
@@ -564,6 +598,7 @@ sos_kmem_cache_create(const char* name,
 		      sos_ui32_t  cache_flags)
 {
   struct sos_kslab_cache *new_cache;
+  sos_ui32_t flags;
 
   /* Allocate the new cache */
   new_cache = (struct sos_kslab_cache*)
@@ -582,7 +617,9 @@ sos_kmem_cache_create(const char* name,
     }
 
   /* Add the cache to the list of slab caches */
-  list_add_tail(kslab_cache_list, new_cache);
+  sos_spin_lock_irqsave(& kslab_cache_list_lock, flags);
+  list_add_tail_rcu(kslab_cache_list, new_cache);
+  sos_spin_unlock_irqrestore(& kslab_cache_list_lock, flags);
   
   /* if the min_free_objs is set, pre-allocate a slab */
   if (min_free_objs)
@@ -598,30 +635,57 @@ sos_kmem_cache_create(const char* name,
 }
 
   
+/** Helper function to release a destroyed cache after a grace
+    period, see sos_kmem_cache_destroy() */
+static void cache_free_rcu(struct sos_rcu_head *head)
+{
+  struct sos_kslab_cache *kslab_cache
+    = (struct sos_kslab_cache*)((sos_vaddr_t)head
+				- (sos_vaddr_t)& ((struct sos_kslab_cache*)0)->rcu);
+
+  sos_spin_dispose(& kslab_cache->lock);
+  sos_kmem_cache_free((sos_vaddr_t)kslab_cache);
+}
+
+
 sos_ret_t sos_kmem_cache_destroy(struct sos_kslab_cache *kslab_cache)
 {
   int nb_slabs;
   struct sos_kslab *slab;
+  sos_ui32_t flags;
 
   if (! kslab_cache)
     return -SOS_EINVAL;
 
   /* Refuse to destroy the cache if there are any objects still
      allocated */
+  sos_spin_lock_irqsave(& kslab_cache->lock, flags);
   list_foreach(kslab_cache->slab_list, slab, nb_slabs)
     {
       if (slab->nb_free != kslab_cache->nb_objects_per_slab)
-	return -SOS_EBUSY;
+	{
+	  sos_spin_unlock_irqrestore(& kslab_cache->lock, flags);
+	  return -SOS_EBUSY;
+	}
     }
 
   /* Remove all the slabs */
   while ((slab = list_get_head(kslab_cache->slab_list)) != NULL)
     {
+      cache_unlink_slab(slab);
+      sos_spin_unlock_irqrestore(& kslab_cache->lock, flags);
       cache_release_slab(slab, TRUE);
+      sos_spin_lock_irqsave(& kslab_cache->lock, flags);
     }
+  sos_spin_unlock_irqrestore(& kslab_cache->lock, flags);
+
+  /* Remove the cache. Its structure is released once the readers
+     of the list of caches cannot be using it anymore */
+  sos_spin_lock_irqsave(& kslab_cache_list_lock, flags);
+  list_delete_rcu(kslab_cache_list, kslab_cache);
+  sos_spin_unlock_irqrestore(& kslab_cache_list_lock, flags);
 
-  /* Remove the cache */
-  return sos_kmem_cache_free((sos_vaddr_t)kslab_cache);
+  return sos_call_rcu(& kslab_cache->rcu, cache_free_rcu);
 }
 
 
@@ -630,17 +694,26 @@ sos_vaddr_t sos_kmem_cache_alloc(struct sos_kslab_cache *kslab_cache,
 {
   sos_vaddr_t obj_vaddr;
   struct sos_kslab * slab_head;
+  sos_bool_t must_grow;
+  sos_ui32_t flags;
 #define ALLOC_RET return
 
+  sos_spin_lock_irqsave(& kslab_cache->lock, flags);
+
   /* If the slab at the head of the slabs' list has no free object,
      then the other slabs don't either => need to allocate a new
-     slab */
-  if ((! kslab_cache->slab_list)
-      || (! list_get_head(kslab_cache->slab_list)->free))
+     slab. The cache lock is released meanwhile, because growing the
+     cache allocates from other caches (or from this one, for the
+     cache of ranges): another CPU may then empty the new slab
+     first */
+  while ((! kslab_cache->slab_list)
+	 || (! list_get_head(kslab_cache->slab_list)->free))
     {
+      sos_spin_unlock_irqrestore(& kslab_cache->lock, flags);
       if (cache_grow(kslab_cache, alloc_flags) != SOS_OK)
 	/* Not enough memory or blocking alloc */
 	ALLOC_RET( (sos_vaddr_t)NULL);
+      sos_spin_lock_irqsave(& kslab_cache->lock, flags);
     }
 
   /* Here: we are sure that list_get_head(kslab_cache->slab_list)
@@ -655,10 +728,6 @@ sos_vaddr_t sos_kmem_cache_alloc(struct sos_kslab_cache *kslab_cache,
   slab_head->nb_free --;
   kslab_cache->nb_free_objects --;
 
-  /* If needed, reset object's contents */
-  if (kslab_cache->flags & SOS_KSLAB_CREATE_ZERO)
-    memset((void*)obj_vaddr, 0x0, kslab_cache->alloc_obj_size);
-
   /* Slab is now full ? */
   if (slab_head->free == NULL)
     {
@@ -667,6 +736,16 @@ sos_vaddr_t sos_kmem_cache_alloc(struct sos_kslab_cache *kslab_cache,
       slab = list_pop_head(kslab_cache->slab_list);
       list_add_tail(kslab_cache->slab_list, slab);
     }
+
+  /* See below */
+  must_grow = (kslab_cache->min_free_objects > 0)
+    && (kslab_cache->nb_free_objects == (kslab_cache->min_free_objects - 1));
+
+  sos_spin_unlock_irqrestore(& kslab_cache->lock, flags);
+
+  /* If needed, reset object's contents */
+  if (kslab_cache->flags & SOS_KSLAB_CREATE_ZERO)
+    memset((void*)obj_vaddr, 0x0, kslab_cache->alloc_obj_size);
   
   /*
    * For caches that require a minimum amount of free objects left,
@@ -682,8 +761,7 @@ sos_vaddr_t sos_kmem_cache_alloc(struct sos_kslab_cache *kslab_cache,
    * recursion). By telling precisely "==", then the cache_grow would
    * only be called the first time.
    */
-  if ((kslab_cache->min_free_objects > 0)
-      && (kslab_cache->nb_free_objects == (kslab_cache->min_free_objects - 1)))
+  if (must_grow)
     {
       /* No: allocate a new slab now */
       if (cache_grow(kslab_cache, alloc_flags) != SOS_OK)
@@ -703,7 +781,8 @@ sos_vaddr_t sos_kmem_cache_alloc(struct sos_kslab_cache *kslab_cache,
  * Helper function to free the object located at the given address.
  *
  * @param empty_slab is the address of the slab to release, if removing
- * the object causes the slab to become empty.
+ * the object causes the slab to become empty. It is then already
+ * removed from its cache.
  */
 inline static
 sos_ret_t
@@ -711,6 +790,7 @@ free_object(sos_vaddr_t vaddr,
 	    struct sos_kslab ** empty_slab)
 {
   struct sos_kslab_cache *kslab_cache;
+  sos_ui32_t flags;
 
   /* Lookup the slab containing the object in the slabs' list */
   struct sos_kslab *slab = sos_kmem_vmm_resolve_slab(vaddr);
@@ -741,6 +821,7 @@ free_object(sos_vaddr_t vaddr,
   /*
    * Ok: we now release the object
    */
+  sos_spin_lock_irqsave(& kslab_cache->lock, flags);
 
   /* Did find a full slab => will not be full any more => move it
      to the head of the slabs' list */
@@ -762,9 +843,11 @@ free_object(sos_vaddr_t vaddr,
       && (kslab_cache->nb_free_objects - slab->nb_free
 	  >= kslab_cache->min_free_objects))
     {
+      cache_unlink_slab(slab);
       *empty_slab = slab;
     }
 
+  sos_spin_unlock_irqrestore(& kslab_cache->lock, flags);
   return SOS_OK;
 }
 
@@ -810,3 +893,28 @@ sos_kmem_cache_release_struct_range(struct sos_kmem_range *the_range)
   return NULL;
 }
 
+
+sos_ret_t sos_kmem_cache_get_info(const char *name,
+				  struct sos_kmem_cache_info *info)
+{
+  struct sos_kslab_cache *kslab_cache;
+  int nb_caches;
+  sos_ret_t retval = -SOS_ENOENT;
+
+  sos_rcu_read_lock();
+  list_foreach_rcu(kslab_cache_list, kslab_cache, nb_caches)
+    {
+      if (strcmp(kslab_cache->name, name))
+	continue;
+
+      info->obj_size            = kslab_cache->alloc_obj_size;
+      info->nb_objects_per_slab = kslab_cache->nb_objects_per_slab;
+      info->nb_pages_per_slab   = kslab_cache->nb_pages_per_slab;
+      info->nb_free_objects     = kslab_cache->nb_free_objects;
+      retval = SOS_OK;
+      break;
+    }
+  sos_rcu_read_unlock();
+
+  return retval;
+}
@@ -164,6 +164,27 @@ sos_kmem_cache_create(const char* name,
 sos_ret_t sos_kmem_cache_destroy(struct sos_kslab_cache *kslab_cache);
 
 
+/** Description of a cache, see sos_kmem_cache_get_info() */
+struct sos_kmem_cache_info
+{
+  sos_size_t  obj_size; /* actual object size, with the alignment */
+  sos_count_t nb_objects_per_slab;
+  sos_count_t nb_pages_per_slab;
+  sos_count_t nb_free_objects;
+};
+
+/**
+ * Look up the cache with the given name and get its description. The
+ * list of caches is walked without any lock (see os/rcu.h): this may
+ * be called concurrently with the creation and the destruction of
+ * caches.
+ *
+ * @return -SOS_ENOENT when there is no cache with this name
+ */
+sos_ret_t sos_kmem_cache_get_info(const char *name,
+				  struct sos_kmem_cache_info *info);
+
+
 /*
  * Flags for sos_kmem_cache_alloc()
  */
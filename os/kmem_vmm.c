@@ -460,7 +460,9 @@ sos_ret_t sos_kmem_vmm_del_range(struct sos_kmem_range *range)
       /* Ok, we got the range. Now, insert this range in the free list */
       kmem_free_range_list = insert_range(kmem_free_range_list, range);
 
-      /* Unmap the physical pages */
+      /* Unmap the physical pages. sos_paging_unmap() waits for the
+	 other CPUs to flush their TLB, hence no CPU may access the
+	 range anymore once it is handed out again */
       for (i = 0 ; i < range->nb_pages ; i ++)
 	{
 	  /* This will work even if no page is mapped at this address */
@@ -18,16 +18,211 @@
 
 
 #include <hwcore/irq.h>
+#include <hwcore/atomic.h>
+#include <hwcore/smp.h>
+#include <hwcore/tsc.h>
+#include <lib/klibc.h>
+#include <lib/stdio.h>
+#include <os/bkl.h>
+#include <os/list.h>
+#include <os/assert.h>
 
 
 #include "ksynch.h"
 
 
+/** Statistics of the adaptive mutexes (protected by the BKL) */
+static struct sos_kmutex_stats kmutex_stats;
+
+/** Statistics of the condvars (protected by the BKL) */
+static struct sos_kcondvar_stats kcondvar_stats;
+
+
+#ifdef SOS_KSYNCH_STATS
+
+/** Maximum number of lock names whose statistics are recorded */
+#define KLOCK_STATS_MAX_NAMES 64
+
+/** The statistics, one per lock name (protected by the BKL) */
+static struct sos_klock_stats klock_stats[KLOCK_STATS_MAX_NAMES];
+static sos_ui32_t klock_stats_nb_names;
+
+
+/**
+ * Helper function to find, or create, the statistics of the locks of
+ * the given name
+ *
+ * @return NULL when there is no room left for a new name
+ */
+static struct sos_klock_stats *klock_stats_lookup(const char *name)
+{
+  struct sos_klock_stats *stats = NULL;
+  sos_ui32_t flags, i;
+
+  if (NULL == name)
+    name = "<unknown>";
+
+  sos_disable_IRQs(flags);
+  for (i = 0 ; i < klock_stats_nb_names ; i ++)
+    if (0 == strncmp(klock_stats[i].name, name,
+		     SOS_KLOCK_STATS_MAX_NAMELEN - 1))
+      {
+	stats = & klock_stats[i];
+	break;
+      }
+
+  if ((NULL == stats) && (klock_stats_nb_names < KLOCK_STATS_MAX_NAMES))
+    {
+      stats = & klock_stats[klock_stats_nb_names ++];
+      memset(stats, 0x0, sizeof(struct sos_klock_stats));
+      strzcpy(stats->name, name, SOS_KLOCK_STATS_MAX_NAMELEN);
+    }
+  sos_restore_IRQs(flags);
+
+  return stats;
+}
+
+
+static void _klock_stats_acquired(struct sos_klock_stats *stats,
+				  sos_ui64_t *acquired_tsc,
+				  sos_bool_t contended,
+				  sos_ui64_t wait_start_tsc)
+{
+  *acquired_tsc = sos_tsc_read();
+  if (NULL == stats)
+    return;
+
+  stats->nb_acquired ++;
+  if (contended)
+    {
+      sos_ui64_t wait_cycles = *acquired_tsc - wait_start_tsc;
+
+      stats->nb_contended ++;
+      stats->total_wait_cycles += wait_cycles;
+      if (wait_cycles > stats->max_wait_cycles)
+	stats->max_wait_cycles = wait_cycles;
+    }
+}
+
+
+static void _klock_stats_released(struct sos_klock_stats *stats,
+				  sos_ui64_t acquired_tsc)
+{
+  sos_ui64_t hold_cycles;
+
+  if ((NULL == stats) || (0 == acquired_tsc))
+    return;
+
+  hold_cycles = sos_tsc_read() - acquired_tsc;
+  stats->total_hold_cycles += hold_cycles;
+  if (hold_cycles > stats->max_hold_cycles)
+    stats->max_hold_cycles = hold_cycles;
+}
+
+
+void sos_klock_stats_dump(unsigned int nb_locks)
+{
+  sos_bool_t dumped[KLOCK_STATS_MAX_NAMES];
+  sos_ui32_t flags, i;
+
+  sos_disable_IRQs(flags);
+  memset(dumped, 0x0, sizeof(dumped));
+
+  printf("lock acquired contended wait avg/max(us) hold avg/max(us)\n");
+  for ( ; nb_locks > 0 ; nb_locks --)
+    {
+      struct sos_klock_stats *stats = NULL;
+      sos_ui32_t best = 0;
+      sos_ui64_t avg_wait = 0, avg_hold = 0;
+
+      /* Most contended lock not dumped yet, the longest total wait
+	 first in case of a tie */
+      for (i = 0 ; i < klock_stats_nb_names ; i ++)
+	{
+	  struct sos_klock_stats *s = & klock_stats[i];
+
+	  if (dumped[i])
+	    continue;
+	  if ((NULL == stats)
+	      || (s->nb_contended > stats->nb_contended)
+	      || ((s->nb_contended == stats->nb_contended)
+		  && (s->total_wait_cycles > stats->total_wait_cycles)))
+	    {
+	      stats = s;
+	      best  = i;
+	    }
+	}
+
+      if (NULL == stats)
+	break;
+      dumped[best] = TRUE;
+
+      if (stats->nb_contended > 0)
+	avg_wait = sos_tsc_udiv64(stats->total_wait_cycles,
+				  stats->nb_contended, NULL);
+      if (stats->nb_acquired > 0)
+	avg_hold = sos_tsc_udiv64(stats->total_hold_cycles,
+				  stats->nb_acquired, NULL);
+
+      printf("%s %d %d %d/%d %d/%d\n", stats->name,
+	     stats->nb_acquired, stats->nb_contended,
+	     sos_tsc_cycles_to_us(avg_wait),
+	     sos_tsc_cycles_to_us(stats->max_wait_cycles),
+	     sos_tsc_cycles_to_us(avg_hold),
+	     sos_tsc_cycles_to_us(stats->max_hold_cycles));
+    }
+
+  sos_restore_IRQs(flags);
+}
+
+
+# define klock_stats_init(lock,name) \
+  ({ (lock)->stats = klock_stats_lookup(name); (lock)->acquired_tsc = 0; })
+# define klock_stats_now() sos_tsc_read()
+# define klock_stats_acquired(lock,contended,wait_start_tsc) \
+  _klock_stats_acquired((lock)->stats, & (lock)->acquired_tsc, \
+			contended, wait_start_tsc)
+# define klock_stats_released(lock) \
+  _klock_stats_released((lock)->stats, (lock)->acquired_tsc)
+
+#else
+# define klock_stats_init(lock,name) ({ /* nop */ })
+# define klock_stats_now() ((sos_ui64_t)0)
+# define klock_stats_acquired(lock,contended,wait_start_tsc) \
+  ({ (void)(contended); (void)(wait_start_tsc); })
+# define klock_stats_released(lock) ({ /* nop */ })
+#endif /* SOS_KSYNCH_STATS */
+
+
+#ifdef SOS_LOCKDEP
+# define klock_lockdep_acquire(lock,flags) \
+  sos_lockdep_acquire((lock)->lockdep_class, flags)
+# define klock_lockdep_release(lock) \
+  sos_lockdep_release((lock)->lockdep_class)
+#else
+# define klock_lockdep_acquire(lock,flags) ({ /* nop */ })
+# define klock_lockdep_release(lock) ({ /* nop */ })
+#endif
+
+
 sos_ret_t sos_ksema_init(struct sos_ksema *sema, const char *name,
 			 int initial_value)
 {
+  sos_ret_t retval;
+
   sema->value = initial_value;
-  return sos_kwaitq_init(& sema->kwaitq, name);
+  klock_stats_init(sema, name);
+#ifdef SOS_LOCKDEP
+  /* Only the semaphores used as locks are validated */
+  sema->lockdep_class = (1 == initial_value) ?
+    sos_lockdep_get_class(name, SOS_LOCKDEP_SLEEP) : 0;
+#endif
+  retval = sos_kwaitq_init(& sema->kwaitq, name);
+  if (SOS_OK != retval)
+    return retval;
+
+  /* The highest priority thread enters first */
+  return sos_kwaitq_set_order(& sema->kwaitq, SOS_KWQ_ORDER_PRIO);
 }
 
 
@@ -46,19 +241,27 @@ sos_ret_t sos_ksema_down(struct sos_ksema *sema,
   sos_disable_IRQs(flags);
   retval = SOS_OK;
 
+  klock_lockdep_acquire(sema, 0);
   sema->value --;
   if (sema->value < 0)
     {
+      sos_ui64_t wait_start_tsc = klock_stats_now();
+
       /* Wait for somebody to wake us */
-      retval = sos_kwaitq_wait(& sema->kwaitq, timeout);
+      retval = sos_kwaitq_wait_exclusive(& sema->kwaitq, timeout);
 
       /* Something wrong happened (timeout, external wakeup, ...) ? */
       if (SOS_OK != retval)
 	{
 	  /* Yes: pretend we did not ask for the semaphore */
 	  sema->value ++;
+	  klock_lockdep_release(sema);
 	}
+      else
+	klock_stats_acquired(sema, TRUE, wait_start_tsc);
     }
+  else
+    klock_stats_acquired(sema, FALSE, 0);
 
   sos_restore_IRQs(flags);
   return retval;
@@ -77,6 +280,8 @@ sos_ret_t sos_ksema_trydown(struct sos_ksema *sema)
     {
       /* Yes: we take it now */
       sema->value --;      
+      klock_stats_acquired(sema, FALSE, 0);
+      klock_lockdep_acquire(sema, SOS_LOCKDEP_TRY);
       retval = SOS_OK;
     }
   else
@@ -97,6 +302,8 @@ sos_ret_t sos_ksema_up(struct sos_ksema *sema)
 
   sos_disable_IRQs(flags);
 
+  klock_stats_released(sema);
+  klock_lockdep_release(sema);
   sema->value ++;
   retval = sos_kwaitq_wakeup(& sema->kwaitq, 1, SOS_OK);
 
@@ -107,8 +314,29 @@ sos_ret_t sos_ksema_up(struct sos_ksema *sema)
 
 sos_ret_t sos_kmutex_init(struct sos_kmutex *mutex, const char *name)
 {
-  mutex->owner = NULL;
-  return sos_kwaitq_init(& mutex->kwaitq, name);
+  sos_ret_t retval;
+
+  mutex->owner    = NULL;
+  mutex->adaptive = TRUE;
+  klock_stats_init(mutex, name);
+#ifdef SOS_LOCKDEP
+  mutex->lockdep_class = sos_lockdep_get_class(name, SOS_LOCKDEP_SLEEP);
+#endif
+  retval = sos_kwaitq_init(& mutex->kwaitq, name);
+  if (SOS_OK != retval)
+    return retval;
+
+  /* The mutex is handed over to the highest priority waiter, which is
+     also the one the owner inherits the priority of */
+  return sos_kwaitq_set_order(& mutex->kwaitq, SOS_KWQ_ORDER_PRIO);
+}
+
+
+sos_ret_t sos_kmutex_set_adaptive(struct sos_kmutex *mutex,
+				  sos_bool_t adaptive)
+{
+  mutex->adaptive = adaptive;
+  return SOS_OK;
 }
 
 
@@ -118,6 +346,140 @@ sos_ret_t sos_kmutex_dispose(struct sos_kmutex *mutex)
 }
 
 
+/**
+ * Helper function to busy-wait for the mutex to be released, as long
+ * as its owner is running on another CPU. Since the other CPUs need
+ * the BKL to run kernel code, the BKL is dropped meanwhile (with the
+ * IRQs restored to their state at the time of the lock).
+ *
+ * MUST be called with the IRQs disabled (saved in flags) and the BKL
+ * held. Returns in the same state. The caller MUST then check whether
+ * the mutex is free, whatever the reason the spin stopped for: it may
+ * have been released after that, before the BKL was retaken
+ */
+static void kmutex_spin(struct sos_kmutex *mutex,
+			struct sos_thread *owner,
+			sos_ui32_t flags)
+{
+  sos_ui32_t depth, loops;
+
+  depth = sos_bkl_drop();
+  sos_restore_IRQs(flags);
+
+  for (loops = 0 ; loops < SOS_KMUTEX_SPIN_LOOPS ; loops ++)
+    {
+      /* Updated by the other CPUs behind our back */
+      struct sos_thread *cur_owner
+	= *(struct sos_thread * volatile *) & mutex->owner;
+
+      if (NULL == cur_owner)
+	break;
+
+      /* The owner changed, blocked or was preempted: it won't
+	 release the mutex soon */
+      if ((cur_owner != owner) || ! sos_smp_is_running(owner))
+	break;
+
+      sos_cpu_relax();
+    }
+
+  sos_disable_IRQs(flags);
+  sos_bkl_retake(depth);
+}
+
+
+/**
+ * Helper function to compute the priority of a thread: its base
+ * priority, or the priority of the highest priority thread waiting
+ * for one of the mutexes it holds. This thread is the first one in
+ * the (priority-ordered) kwaitq of each mutex
+ */
+static sos_sched_priority_t kmutex_inherited_priority(struct sos_thread *thr)
+{
+  sos_sched_priority_t prio = thr->base_priority;
+  struct sos_kmutex *mutex;
+  int nb_mutexes;
+
+  list_foreach_named(thr->kmutex_held_list, mutex, nb_mutexes,
+		     held_prev, held_next)
+    {
+      struct sos_kwaitq_entry *kwq_entry
+	= list_get_head_named(mutex->kwaitq.waiting_list,
+			      prev_entry_in_kwaitq, next_entry_in_kwaitq);
+
+      if ((NULL != kwq_entry)
+	  && (SOS_SCHED_PRIO_CMP(kwq_entry->thread->priority, prio) > 0))
+	prio = kwq_entry->thread->priority;
+    }
+
+  return prio;
+}
+
+
+sos_ret_t sos_kmutex_update_priority(struct sos_thread *thr)
+{
+  int depth;
+
+  for (depth = 0 ;
+       (NULL != thr) && (depth < SOS_KMUTEX_PI_MAX_DEPTH) ;
+       depth ++)
+    {
+      sos_sched_priority_t prio = kmutex_inherited_priority(thr);
+      sos_ret_t retval;
+
+      if (prio == thr->priority)
+	break;
+
+      retval = sos_sched_change_priority(thr, prio);
+      if (SOS_OK != retval)
+	return retval;
+
+      /* The owner of the mutex thr is waiting for inherits the new
+	 priority in turn */
+      if (NULL == thr->kmutex_blocked_on)
+	break;
+      thr = thr->kmutex_blocked_on->owner;
+    }
+
+  return SOS_OK;
+}
+
+
+/**
+ * Helper function to raise the priority of the owners along the chain
+ * starting at the owner of the given mutex, for a thread of the given
+ * priority about to wait for it. Cheaper than
+ * sos_kmutex_update_priority() since the priorities only increase
+ */
+static void kmutex_boost_chain(struct sos_kmutex *mutex,
+			       sos_sched_priority_t prio)
+{
+  int depth;
+
+  for (depth = 0 ;
+       (NULL != mutex) && (depth < SOS_KMUTEX_PI_MAX_DEPTH) ;
+       depth ++)
+    {
+      struct sos_thread *owner = mutex->owner;
+
+      if ((NULL == owner) || (SOS_SCHED_PRIO_CMP(prio, owner->priority) <= 0))
+	break;
+
+      sos_sched_change_priority(owner, prio);
+      mutex = owner->kmutex_blocked_on;
+    }
+}
+
+
+/** Helper function to give the mutex to the given thread */
+static void kmutex_set_owner(struct sos_kmutex *mutex,
+			     struct sos_thread *thr)
+{
+  mutex->owner = thr;
+  list_add_tail_named(thr->kmutex_held_list, mutex, held_prev, held_next);
+}
+
+
 /*
  * Implementation based on ownership transfer (ie no while()
  * loop). The only assumption is that the thread awoken by
@@ -131,35 +493,82 @@ sos_ret_t sos_kmutex_lock(struct sos_kmutex *mutex,
 			  struct sos_time *timeout)
 {
   __label__ exit_kmutex_lock;
+  struct sos_thread *myself;
+  sos_ui64_t wait_start_tsc;
   sos_ui32_t flags;
   sos_ret_t retval;
 
   sos_disable_IRQs(flags);
   retval = SOS_OK;
+  myself = sos_thread_get_current();
+
+  /* Validated before we wait for it */
+  if (myself != mutex->owner)
+    klock_lockdep_acquire(mutex, 0);
 
   /* Mutex already owned ? */
   if (NULL != mutex->owner)
     {
       /* Owned by us or by someone else ? */
-      if (sos_thread_get_current() == mutex->owner)
+      if (myself == mutex->owner)
 	{
 	  /* Owned by us: do nothing */
 	  retval = -SOS_EBUSY;
 	  goto exit_kmutex_lock;
 	}
 
+      wait_start_tsc = klock_stats_now();
+
+      /* Owner running on another CPU: it should release the mutex
+	 soon, which costs less than blocking. Useless when other
+	 threads are already waiting, since the mutex is then directly
+	 transferred to them */
+      if (mutex->adaptive
+	  && sos_kwaitq_is_empty(& mutex->kwaitq)
+	  && sos_smp_is_running(mutex->owner))
+	{
+	  /* A release after the spin gave up found nobody to wake up:
+	     the mutex is then free, and we must not block */
+	  kmutex_spin(mutex, mutex->owner, flags);
+	  if (NULL == mutex->owner)
+	    {
+	      kmutex_stats.nb_spin_acquired ++;
+	      kmutex_set_owner(mutex, myself);
+	      klock_stats_acquired(mutex, TRUE, wait_start_tsc);
+	      goto exit_kmutex_lock;
+	    }
+
+	  kmutex_stats.nb_spin_failed ++;
+	}
+
+      /* The owner (and the owners it waits for) must not run with a
+	 lower priority than us meanwhile */
+      myself->kmutex_blocked_on = mutex;
+      kmutex_boost_chain(mutex, myself->priority);
+
       /* Wait for somebody to wake us */
-      retval = sos_kwaitq_wait(& mutex->kwaitq, timeout);
+      kmutex_stats.nb_blocked ++;
+      retval = sos_kwaitq_wait_exclusive(& mutex->kwaitq, timeout);
+      myself->kmutex_blocked_on = NULL;
 
       /* Something wrong happened ? */
       if (SOS_OK != retval)
 	{
+	  /* The owner does not inherit our priority anymore */
+	  sos_kmutex_update_priority(mutex->owner);
+	  klock_lockdep_release(mutex);
 	  goto exit_kmutex_lock;
 	}
+
+      /* The mutex was transferred to us by sos_kmutex_unlock() */
+      SOS_ASSERT_FATAL(myself == mutex->owner);
+      klock_stats_acquired(mutex, TRUE, wait_start_tsc);
+      goto exit_kmutex_lock;
     }
 
   /* Ok, the mutex is available to us: take it */
-  mutex->owner = sos_thread_get_current();
+  kmutex_set_owner(mutex, myself);
+  klock_stats_acquired(mutex, FALSE, 0);
 
  exit_kmutex_lock:
   sos_restore_IRQs(flags);
@@ -178,7 +587,9 @@ sos_ret_t sos_kmutex_trylock(struct sos_kmutex *mutex)
   if (NULL == mutex->owner)
     {
       /* Great ! Take it now */
-      mutex->owner = sos_thread_get_current();
+      kmutex_set_owner(mutex, sos_thread_get_current());
+      klock_stats_acquired(mutex, FALSE, 0);
+      klock_lockdep_acquire(mutex, SOS_LOCKDEP_TRY);
 
       retval = SOS_OK;
     }
@@ -195,15 +606,24 @@ sos_ret_t sos_kmutex_trylock(struct sos_kmutex *mutex)
 
 sos_ret_t sos_kmutex_unlock(struct sos_kmutex *mutex)
 {
+  struct sos_thread *myself;
   sos_ui32_t flags;
   sos_ret_t  retval;
 
   sos_disable_IRQs(flags);
+  myself = sos_thread_get_current();
 
-  if (sos_thread_get_current() != mutex->owner)
-    retval = -SOS_EPERM;
+  if (myself != mutex->owner)
+    {
+      sos_restore_IRQs(flags);
+      return -SOS_EPERM;
+    }
+
+  list_delete_named(myself->kmutex_held_list, mutex, held_prev, held_next);
+  klock_stats_released(mutex);
+  klock_lockdep_release(mutex);
 
-  else if (sos_kwaitq_is_empty(& mutex->kwaitq))
+  if (sos_kwaitq_is_empty(& mutex->kwaitq))
     {
       /*
        * There is NOT ANY thread waiting => we really mark the mutex
@@ -216,18 +636,370 @@ sos_ret_t sos_kmutex_unlock(struct sos_kmutex *mutex)
     {
       /*
        * There is at least 1 thread waiting => we DO NOT mark the
-       * mutex as free !
-       * Actually, we should have written:
-       *   mutex->owner = thread_that_is_woken_up;
-       * But the real Id of the next thread owning the mutex is not
-       * that important. What is important here is that mutex->owner
-       * IS NOT NULL. Otherwise there will be a possibility for the
-       * thread woken up here to have the mutex stolen by a thread
-       * locking the mutex in the meantime.
+       * mutex as free: it is transferred to the thread woken up
+       * (the first in the kwaitq, ie the highest priority one, in
+       * FIFO order). Otherwise there would be a
+       * possibility for the thread woken up here to have the mutex
+       * stolen by a thread locking the mutex in the meantime. The new
+       * owner inherits the priority of the remaining waiters.
        */
+      struct sos_thread *new_owner
+	= list_get_head_named(mutex->kwaitq.waiting_list,
+			      prev_entry_in_kwaitq,
+			      next_entry_in_kwaitq)->thread;
+
       retval = sos_kwaitq_wakeup(& mutex->kwaitq, 1, SOS_OK);
-    } 
- 
+      new_owner->kmutex_blocked_on = NULL;
+      kmutex_set_owner(mutex, new_owner);
+      sos_kmutex_update_priority(new_owner);
+    }
+
+  /* We don't inherit the priority of the waiters of this mutex
+     anymore */
+  sos_kmutex_update_priority(myself);
+
+  sos_restore_IRQs(flags);
+  return retval;
+}
+
+
+sos_ret_t sos_kmutex_get_stats(struct sos_kmutex_stats *stats)
+{
+  sos_ui32_t flags;
+
+  sos_disable_IRQs(flags);
+  *stats = kmutex_stats;
+  sos_restore_IRQs(flags);
+
+  return SOS_OK;
+}
+
+
+sos_ret_t sos_krwlock_init(struct sos_krwlock *rwlock, const char *name)
+{
+  sos_ret_t retval;
+
+  rwlock->nb_readers         = 0;
+  rwlock->writer             = NULL;
+  rwlock->nb_waiting_writers = 0;
+
+  retval = sos_kwaitq_init(& rwlock->readers_kwaitq, name);
+  if (SOS_OK != retval)
+    return retval;
+  return sos_kwaitq_init(& rwlock->writers_kwaitq, name);
+}
+
+
+sos_ret_t sos_krwlock_dispose(struct sos_krwlock *rwlock)
+{
+  sos_ui32_t flags;
+  sos_ret_t retval;
+
+  sos_disable_IRQs(flags);
+
+  if ((rwlock->nb_readers > 0) || (NULL != rwlock->writer))
+    retval = -SOS_EBUSY;
+  else
+    {
+      retval = sos_kwaitq_dispose(& rwlock->readers_kwaitq);
+      if (SOS_OK == retval)
+	retval = sos_kwaitq_dispose(& rwlock->writers_kwaitq);
+    }
+
+  sos_restore_IRQs(flags);
+  return retval;
+}
+
+
+sos_ret_t sos_krwlock_read_lock(struct sos_krwlock *rwlock,
+				struct sos_time *timeout)
+{
+  sos_ui32_t flags;
+  sos_ret_t retval = SOS_OK;
+
+  sos_disable_IRQs(flags);
+
+  /* Wait behind the writer holding the lock, and behind the writers
+     waiting for it (writers preference). The woken up readers check
+     again, since another writer may have come meanwhile */
+  while ((NULL != rwlock->writer) || (rwlock->nb_waiting_writers > 0))
+    {
+      retval = sos_kwaitq_wait(& rwlock->readers_kwaitq, timeout);
+      if (SOS_OK != retval)
+	break;
+    }
+
+  if (SOS_OK == retval)
+    rwlock->nb_readers ++;
+
+  sos_restore_IRQs(flags);
+  return retval;
+}
+
+
+sos_ret_t sos_krwlock_read_trylock(struct sos_krwlock *rwlock)
+{
+  sos_ui32_t flags;
+  sos_ret_t retval;
+
+  sos_disable_IRQs(flags);
+
+  if ((NULL != rwlock->writer) || (rwlock->nb_waiting_writers > 0))
+    retval = -SOS_EBUSY;
+  else
+    {
+      rwlock->nb_readers ++;
+      retval = SOS_OK;
+    }
+
+  sos_restore_IRQs(flags);
+  return retval;
+}
+
+
+sos_ret_t sos_krwlock_read_unlock(struct sos_krwlock *rwlock)
+{
+  sos_ui32_t flags;
+  sos_ret_t retval = SOS_OK;
+
+  sos_disable_IRQs(flags);
+
+  if (rwlock->nb_readers <= 0)
+    retval = -SOS_EPERM;
+
+  /* Last reader: the first waiting writer may go */
+  else if ((--rwlock->nb_readers == 0) && (rwlock->nb_waiting_writers > 0))
+    retval = sos_kwaitq_wakeup(& rwlock->writers_kwaitq, 1, SOS_OK);
+
   sos_restore_IRQs(flags);
   return retval;
 }
+
+
+sos_ret_t sos_krwlock_write_lock(struct sos_krwlock *rwlock,
+				 struct sos_time *timeout)
+{
+  struct sos_thread *myself;
+  sos_ui32_t flags;
+  sos_ret_t retval = SOS_OK;
+
+  sos_disable_IRQs(flags);
+  myself = sos_thread_get_current();
+
+  if (myself == rwlock->writer)
+    {
+      sos_restore_IRQs(flags);
+      return -SOS_EBUSY;
+    }
+
+  rwlock->nb_waiting_writers ++;
+  while ((NULL != rwlock->writer) || (rwlock->nb_readers > 0))
+    {
+      retval = sos_kwaitq_wait_exclusive(& rwlock->writers_kwaitq, timeout);
+      if (SOS_OK != retval)
+	break;
+    }
+  rwlock->nb_waiting_writers --;
+
+  if (SOS_OK == retval)
+    rwlock->writer = myself;
+
+  /* We gave up: the readers we kept waiting may go, unless another
+     writer is still there */
+  else if ((NULL == rwlock->writer) && (rwlock->nb_waiting_writers == 0))
+    sos_kwaitq_wakeup(& rwlock->readers_kwaitq, SOS_KWQ_WAKEUP_ALL, SOS_OK);
+
+  sos_restore_IRQs(flags);
+  return retval;
+}
+
+
+sos_ret_t sos_krwlock_write_trylock(struct sos_krwlock *rwlock)
+{
+  sos_ui32_t flags;
+  sos_ret_t retval;
+
+  sos_disable_IRQs(flags);
+
+  if ((NULL != rwlock->writer) || (rwlock->nb_readers > 0))
+    retval = -SOS_EBUSY;
+  else
+    {
+      rwlock->writer = sos_thread_get_current();
+      retval = SOS_OK;
+    }
+
+  sos_restore_IRQs(flags);
+  return retval;
+}
+
+
+sos_ret_t sos_krwlock_write_unlock(struct sos_krwlock *rwlock)
+{
+  sos_ui32_t flags;
+  sos_ret_t retval;
+
+  sos_disable_IRQs(flags);
+
+  if (sos_thread_get_current() != rwlock->writer)
+    retval = -SOS_EPERM;
+  else
+    {
+      rwlock->writer = NULL;
+
+      /* Writers first */
+      if (rwlock->nb_waiting_writers > 0)
+	retval = sos_kwaitq_wakeup(& rwlock->writers_kwaitq, 1, SOS_OK);
+      else
+	retval = sos_kwaitq_wakeup(& rwlock->readers_kwaitq,
+				   SOS_KWQ_WAKEUP_ALL, SOS_OK);
+    }
+
+  sos_restore_IRQs(flags);
+  return retval;
+}
+
+
+sos_ret_t sos_kcondvar_init(struct sos_kcondvar *cond, const char *name)
+{
+  sos_ret_t retval;
+
+  cond->mutex = NULL;
+  retval = sos_kwaitq_init(& cond->kwaitq, name);
+  if (SOS_OK != retval)
+    return retval;
+
+  return sos_kwaitq_set_order(& cond->kwaitq, SOS_KWQ_ORDER_PRIO);
+}
+
+
+sos_ret_t sos_kcondvar_dispose(struct sos_kcondvar *cond)
+{
+  return sos_kwaitq_dispose(& cond->kwaitq);
+}
+
+
+sos_ret_t sos_kcondvar_wait(struct sos_kcondvar *cond,
+			    struct sos_kmutex *mutex,
+			    struct sos_time *timeout)
+{
+  struct sos_thread *myself;
+  sos_ui32_t flags;
+  sos_ret_t retval;
+
+  sos_disable_IRQs(flags);
+  myself = sos_thread_get_current();
+
+  if (myself != mutex->owner)
+    {
+      sos_restore_IRQs(flags);
+      return -SOS_EPERM;
+    }
+
+  if ((NULL != cond->mutex) && (mutex != cond->mutex))
+    {
+      sos_restore_IRQs(flags);
+      return -SOS_EINVAL;
+    }
+  cond->mutex = mutex;
+
+  /* No signal can be lost between the unlock and the wait: the IRQs
+     are disabled and we hold the BKL */
+  sos_kmutex_unlock(mutex);
+  retval = sos_kwaitq_wait_exclusive(& cond->kwaitq, timeout);
+
+  if (sos_kwaitq_is_empty(& cond->kwaitq))
+    cond->mutex = NULL;
+
+  /* Moved to the kwaitq of the mutex by a signal, and the mutex
+     was then transferred to us (by the signal itself when it was
+     free, or by sos_kmutex_unlock()) ? */
+  if (myself == mutex->owner)
+    {
+      SOS_ASSERT_FATAL(SOS_OK == retval);
+      klock_stats_acquired(mutex, FALSE, 0);
+      klock_lockdep_acquire(mutex, 0);
+      goto exit_kcondvar_wait;
+    }
+
+  /* Moved to the kwaitq of the mutex, but timeout: the owner does not
+     inherit our priority anymore */
+  if (mutex == myself->kmutex_blocked_on)
+    {
+      myself->kmutex_blocked_on = NULL;
+      sos_kmutex_update_priority(mutex->owner);
+    }
+
+  /* Timeout: lock the mutex by ourselves */
+  SOS_ASSERT_FATAL(SOS_OK == sos_kmutex_lock(mutex, NULL));
+
+ exit_kcondvar_wait:
+  sos_restore_IRQs(flags);
+  return retval;
+}
+
+
+/** Helper function to wake up (or move to the mutex) up to nb_threads
+    waiters of the condvar */
+static sos_ret_t kcondvar_wakeup(struct sos_kcondvar *cond,
+				 unsigned int nb_threads)
+{
+  struct sos_kmutex *mutex;
+  sos_ui32_t flags;
+
+  sos_disable_IRQs(flags);
+  mutex = cond->mutex;
+
+  for ( ; (nb_threads > 0) && ! sos_kwaitq_is_empty(& cond->kwaitq) ;
+	nb_threads --)
+    {
+      struct sos_thread *thr;
+
+      /* The waiter now waits for the mutex, as if it had called
+	 sos_kmutex_lock() */
+      thr = sos_kwaitq_requeue_first(& cond->kwaitq, & mutex->kwaitq);
+
+      /* Mutex free: nobody would hand it over to the waiter, so give
+	 it right away, as sos_kmutex_unlock() does. The next waiters
+	 are moved behind it, and get the mutex in turn when it
+	 unlocks it */
+      if (NULL == mutex->owner)
+	{
+	  sos_kwaitq_wakeup(& mutex->kwaitq, 1, SOS_OK);
+	  kmutex_set_owner(mutex, thr);
+	  kcondvar_stats.nb_woken ++;
+	  continue;
+	}
+
+      thr->kmutex_blocked_on = mutex;
+      kmutex_boost_chain(mutex, thr->priority);
+      kcondvar_stats.nb_morphed ++;
+    }
+
+  sos_restore_IRQs(flags);
+  return SOS_OK;
+}
+
+
+sos_ret_t sos_kcondvar_signal(struct sos_kcondvar *cond)
+{
+  return kcondvar_wakeup(cond, 1);
+}
+
+
+sos_ret_t sos_kcondvar_broadcast(struct sos_kcondvar *cond)
+{
+  return kcondvar_wakeup(cond, SOS_KWQ_WAKEUP_ALL);
+}
+
+
+sos_ret_t sos_kcondvar_get_stats(struct sos_kcondvar_stats *stats)
+{
+  sos_ui32_t flags;
+
+  sos_disable_IRQs(flags);
+  *stats = kcondvar_stats;
+  sos_restore_IRQs(flags);
+
+  return SOS_OK;
+}
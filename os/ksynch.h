@@ -28,6 +28,42 @@
 
 #include <os/errno.h>
 #include <os/kwaitq.h>
+#include <hwcore/atomic.h>
+
+
+/* Uncomment to record the per-lock statistics of the semaphores and
+   mutexes */
+/* #define SOS_KSYNCH_STATS */
+
+
+#ifdef SOS_KSYNCH_STATS
+
+/**
+ * Statistics of all the semaphores or mutexes initialized with the
+ * same name. The times are in TSC cycles. For a semaphore, the hold
+ * time goes from a down to the next up, which is only meaningful for
+ * the semaphores used for mutual exclusion.
+ */
+struct sos_klock_stats
+{
+#define SOS_KLOCK_STATS_MAX_NAMELEN 32
+  char name[SOS_KLOCK_STATS_MAX_NAMELEN];
+
+  sos_count_t nb_acquired;
+  sos_count_t nb_contended;      /**< Acquisitions that had to wait */
+  sos_ui64_t  total_wait_cycles;
+  sos_ui64_t  max_wait_cycles;
+  sos_ui64_t  total_hold_cycles;
+  sos_ui64_t  max_hold_cycles;
+};
+
+
+/**
+ * Print the statistics of the nb_locks most contended lock names
+ */
+void sos_klock_stats_dump(unsigned int nb_locks);
+
+#endif /* SOS_KSYNCH_STATS */
 
 
 /* ====================================================================
@@ -42,6 +78,15 @@ struct sos_ksema
 {
   int value;
   struct sos_kwaitq kwaitq;
+
+#ifdef SOS_KSYNCH_STATS
+  struct sos_klock_stats *stats; /**< NULL when not recorded */
+  sos_ui64_t acquired_tsc;       /**< Last successful down */
+#endif
+
+#ifdef SOS_LOCKDEP
+  sos_lockdep_class_t lockdep_class; /**< 0: not validated */
+#endif
 };
 
 
@@ -100,6 +145,13 @@ sos_ret_t sos_ksema_up(struct sos_ksema *sema);
 /* ====================================================================
  * Kernel mutex (ie binary semaphore with strong ownership),
  * NON-recursive !
+ *
+ * The mutexes implement priority inheritance: while a thread waits
+ * for a mutex, the owner runs at least with the priority of the
+ * waiter, and so on along the chain of the owners waiting for other
+ * mutexes (up to SOS_KMUTEX_PI_MAX_DEPTH owners). Unlike the
+ * semaphores, a mutex thus cannot be held for long by a low priority
+ * thread because medium priority threads keep it away from the CPU.
  */
 
 
@@ -110,6 +162,48 @@ struct sos_kmutex
 {
   struct sos_thread  *owner;
   struct sos_kwaitq  kwaitq;
+
+  /** TRUE when sos_kmutex_lock() spins while the owner is running on
+      another CPU, before blocking (default) */
+  sos_bool_t         adaptive;
+
+  /** Other mutexes held by the owner */
+  struct sos_kmutex  *held_prev, *held_next;
+
+#ifdef SOS_KSYNCH_STATS
+  struct sos_klock_stats *stats; /**< NULL when not recorded */
+  sos_ui64_t acquired_tsc;       /**< When the owner got the mutex */
+#endif
+
+#ifdef SOS_LOCKDEP
+  sos_lockdep_class_t lockdep_class;
+#endif
+};
+
+
+/** Maximum length of the chain of owners boosted by a waiter */
+#define SOS_KMUTEX_PI_MAX_DEPTH 16
+
+
+/**
+ * Maximum number of busy-wait iterations of an adaptive mutex lock
+ * before the thread blocks. The owner of the mutex is expected to
+ * release it within a few microseconds when it is running.
+ */
+#define SOS_KMUTEX_SPIN_LOOPS 2000
+
+
+/** Statistics of the adaptive mutexes, for all the mutexes */
+struct sos_kmutex_stats
+{
+  /** Mutex acquired after spinning */
+  sos_count_t nb_spin_acquired;
+
+  /** Spinning given up (owner blocked or preempted, spin too long) */
+  sos_count_t nb_spin_failed;
+
+  /** Threads blocked in sos_kmutex_lock() */
+  sos_count_t nb_blocked;
 };
 
 
@@ -124,6 +218,13 @@ struct sos_kmutex
 sos_ret_t sos_kmutex_init(struct sos_kmutex *mutex, const char *name);
 
 
+/*
+ * Enable (default) or disable the adaptive spinning of the mutex
+ */
+sos_ret_t sos_kmutex_set_adaptive(struct sos_kmutex *mutex,
+				  sos_bool_t adaptive);
+
+
 /*
  * De-initialize a kernel mutex
  *
@@ -167,4 +268,325 @@ sos_ret_t sos_kmutex_trylock(struct sos_kmutex *mutex);
 sos_ret_t sos_kmutex_unlock(struct sos_kmutex *mutex);
 
 
+/**
+ * Update the priority of the given thread after a change of its base
+ * priority or of the waiters of the mutexes it holds, and propagate
+ * it along the chain of the owners it is waiting for. MUST be called
+ * with the IRQs disabled
+ *
+ * @note: The use of this function is RESERVED (see
+ * sos_thread_set_priority())
+ */
+sos_ret_t sos_kmutex_update_priority(struct sos_thread *thr);
+
+
+/**
+ * Get a copy of the adaptive mutex statistics
+ */
+sos_ret_t sos_kmutex_get_stats(struct sos_kmutex_stats *stats);
+
+
+
+/* ====================================================================
+ * Kernel reader/writer locks, NON-recursive !
+ *
+ * Any number of readers, or a single writer, may hold the lock. The
+ * writers have the preference: once a writer waits, the new readers
+ * wait behind it, so that a steady flow of readers cannot starve the
+ * writers.
+ */
+
+
+/**
+ * The structure of a (NON-RECURSIVE) kernel reader/writer lock
+ */
+struct sos_krwlock
+{
+  /** Number of readers holding the lock */
+  int nb_readers;
+
+  /** The writer holding the lock, if any */
+  struct sos_thread *writer;
+
+  /** Number of writers waiting for the lock */
+  int nb_waiting_writers;
+
+  struct sos_kwaitq readers_kwaitq;
+  struct sos_kwaitq writers_kwaitq;
+};
+
+
+/*
+ * Initialize a kernel reader/writer lock structure with the given
+ * name
+ *
+ * @param name Name of the lock (for debugging purpose only; safe
+ * [deep copied])
+ */
+sos_ret_t sos_krwlock_init(struct sos_krwlock *rwlock, const char *name);
+
+
+/*
+ * De-initialize a kernel reader/writer lock
+ *
+ * @return -SOS_EBUSY when the lock is held or when at least a thread
+ * is waiting for it.
+ */
+sos_ret_t sos_krwlock_dispose(struct sos_krwlock *rwlock);
+
+
+/*
+ * Lock the rwlock for reading
+ *
+ * @param timeout Maximum time to wait for the lock. Or NULL for "no
+ * limit". Updated on return to reflect the time remaining (0 when
+ * timeout has been triggered)
+ *
+ * @return -SOS_EINTR when timeout was triggered or when another waitq
+ * woke us up.
+ *
+ * @note This is a BLOCKING FUNCTION
+ */
+sos_ret_t sos_krwlock_read_lock(struct sos_krwlock *rwlock,
+				struct sos_time *timeout);
+
+
+/*
+ * Try to lock the rwlock for reading without blocking.
+ *
+ * @return -SOS_EBUSY when locking the rwlock would block
+ */
+sos_ret_t sos_krwlock_read_trylock(struct sos_krwlock *rwlock);
+
+
+/**
+ * Release the rwlock locked for reading, eventually waking up a
+ * writer
+ */
+sos_ret_t sos_krwlock_read_unlock(struct sos_krwlock *rwlock);
+
+
+/*
+ * Lock the rwlock for writing
+ *
+ * @param timeout see sos_krwlock_read_lock()
+ *
+ * @return -SOS_EINTR when timeout was triggered or when another waitq
+ * woke us up, -SOS_EBUSY when the thread already owns the lock for
+ * writing.
+ *
+ * @note This is a BLOCKING FUNCTION
+ */
+sos_ret_t sos_krwlock_write_lock(struct sos_krwlock *rwlock,
+				 struct sos_time *timeout);
+
+
+/*
+ * Try to lock the rwlock for writing without blocking.
+ *
+ * @return -SOS_EBUSY when locking the rwlock would block
+ */
+sos_ret_t sos_krwlock_write_trylock(struct sos_krwlock *rwlock);
+
+
+/**
+ * Release the rwlock locked for writing, waking up the next writer,
+ * or all the readers when no writer is waiting
+ *
+ * @return -SOS_EPERM when the calling thread is NOT the writer
+ */
+sos_ret_t sos_krwlock_write_unlock(struct sos_krwlock *rwlock);
+
+
+
+/* ====================================================================
+ * Kernel condition variables
+ *
+ * A condition variable is always used with the same mutex, which
+ * protects the condition:
+ *
+ *   sos_kmutex_lock(& mutex, NULL);
+ *   while (! condition)
+ *     sos_kcondvar_wait(& cond, & mutex, NULL);
+ *   ...
+ *   sos_kmutex_unlock(& mutex);
+ *
+ * The condvar implements "wait-morphing": a signal/broadcast issued
+ * while the mutex is held does not wake the waiters, which would
+ * immediately block again on the mutex. It moves them to the kwaitq
+ * of the mutex instead, and the mutex is then handed over to them
+ * one after the other by sos_kmutex_unlock(). A broadcast thus wakes
+ * the threads one at a time, as the mutex gets available, without
+ * thundering herd. When the mutex is free, the first waiter is given
+ * the mutex right away, and the others are moved behind it.
+ */
+
+
+/**
+ * The structure of a kernel condition variable
+ */
+struct sos_kcondvar
+{
+  /** The mutex used by the threads waiting, NULL when nobody waits */
+  struct sos_kmutex *mutex;
+
+  struct sos_kwaitq kwaitq;
+};
+
+
+/** Statistics of the condition variables, for all of them */
+struct sos_kcondvar_stats
+{
+  /** Waiters moved to the kwaitq of the mutex by signal/broadcast */
+  sos_count_t nb_morphed;
+
+  /** Waiters woken up by signal/broadcast, and directly given the
+      mutex (it was free) */
+  sos_count_t nb_woken;
+};
+
+
+/*
+ * Initialize a kernel condition variable structure with the given
+ * name
+ *
+ * @param name Name of the condvar (for debugging purpose only; safe
+ * [deep copied])
+ */
+sos_ret_t sos_kcondvar_init(struct sos_kcondvar *cond, const char *name);
+
+
+/*
+ * De-initialize a kernel condition variable
+ *
+ * @return -SOS_EBUSY when at least a thread is waiting on it
+ */
+sos_ret_t sos_kcondvar_dispose(struct sos_kcondvar *cond);
+
+
+/*
+ * Atomically release the mutex and wait for the condition to be
+ * signaled. The mutex is owned again by the calling thread on return,
+ * in any case.
+ *
+ * @param mutex The mutex owned by the calling thread. Must be the
+ * same for all the threads waiting on the condvar at the same time
+ *
+ * @param timeout Maximum time to wait for the signal. Or NULL for "no
+ * limit". Updated on return to reflect the time remaining (0 when
+ * timeout has been triggered)
+ *
+ * @return -SOS_EINTR when timeout was triggered or when another waitq
+ * woke us up, -SOS_EPERM when the calling thread is NOT the owner of
+ * the mutex, -SOS_EINVAL when other threads wait with another mutex.
+ *
+ * @note This is a BLOCKING FUNCTION
+ */
+sos_ret_t sos_kcondvar_wait(struct sos_kcondvar *cond,
+			    struct sos_kmutex *mutex,
+			    struct sos_time *timeout);
+
+
+/**
+ * Wake up one thread waiting on the condvar, if any. Should be called
+ * with the mutex held, for the waiter to be directly moved to the
+ * mutex (see wait-morphing above).
+ */
+sos_ret_t sos_kcondvar_signal(struct sos_kcondvar *cond);
+
+
+/**
+ * Wake up all the threads waiting on the condvar. Should be called
+ * with the mutex held (see sos_kcondvar_signal())
+ */
+sos_ret_t sos_kcondvar_broadcast(struct sos_kcondvar *cond);
+
+
+/**
+ * Get a copy of the condition variable statistics
+ */
+sos_ret_t sos_kcondvar_get_stats(struct sos_kcondvar_stats *stats);
+
+
+
+/* ====================================================================
+ * Kernel sequence locks
+ *
+ * For small data read very often and seldom written, such as the
+ * current time. The readers never block nor write anything: they
+ * read the data optimistically and retry when a writer updated it
+ * meanwhile:
+ *
+ *   do {
+ *     seq = sos_kseqlock_read_begin(& lock);
+ *     ... copy the data ...
+ *   } while (sos_kseqlock_read_retry(& lock, seq));
+ *
+ * The writers MUST be serialized by another lock (eg a spinlock), and
+ * MUST NOT be interrupted by a reader on the same CPU (eg disable the
+ * IRQs when the data are read by IRQ handlers): the reader would spin
+ * forever.
+ */
+
+
+/**
+ * The structure of a kernel sequence lock: odd while a writer updates
+ * the data
+ */
+struct sos_kseqlock
+{
+  volatile sos_ui32_t sequence;
+};
+
+
+/** Static initializer of a sequence lock */
+#define SOS_KSEQLOCK_INITIALIZER { .sequence = 0 }
+
+
+static inline void sos_kseqlock_init(struct sos_kseqlock *seqlock)
+{
+  seqlock->sequence = 0;
+}
+
+
+/** Start reading the data. @return the value to give to
+    sos_kseqlock_read_retry() */
+static inline sos_ui32_t sos_kseqlock_read_begin(struct sos_kseqlock *seqlock)
+{
+  sos_ui32_t seq;
+
+  while ((seq = seqlock->sequence) & 1)
+    sos_cpu_relax();
+
+  sos_rmb();
+  return seq;
+}
+
+
+/** @return TRUE when the data read since sos_kseqlock_read_begin()
+    may be inconsistent, ie they must be read again */
+static inline sos_bool_t sos_kseqlock_read_retry(struct sos_kseqlock *seqlock,
+						 sos_ui32_t seq)
+{
+  sos_rmb();
+  return (seqlock->sequence != seq);
+}
+
+
+/** Start updating the data. The writers MUST be serialized */
+static inline void sos_kseqlock_write_begin(struct sos_kseqlock *seqlock)
+{
+  seqlock->sequence = seqlock->sequence + 1;
+  sos_wmb();
+}
+
+
+/** End the update of the data */
+static inline void sos_kseqlock_write_end(struct sos_kseqlock *seqlock)
+{
+  sos_wmb();
+  seqlock->sequence = seqlock->sequence + 1;
+}
+
+
 #endif /* _SOS_KSYNCH_H_ */
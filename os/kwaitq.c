@@ -41,6 +41,30 @@ sos_ret_t sos_kwaitq_init(struct sos_kwaitq *kwq,
 }
 
 
+sos_ret_t sos_kwaitq_set_order(struct sos_kwaitq *kwq,
+			       sos_ui32_t order)
+{
+  sos_ui32_t flags;
+  sos_ret_t retval;
+
+  if ((SOS_KWQ_ORDER_FIFO != order) && (SOS_KWQ_ORDER_PRIO != order))
+    return -SOS_EINVAL;
+
+  sos_disable_IRQs(flags);
+  if (list_is_empty_named(kwq->waiting_list,
+			  prev_entry_in_kwaitq, next_entry_in_kwaitq))
+    {
+      kwq->order = order;
+      retval = SOS_OK;
+    }
+  else
+    retval = -SOS_EBUSY;
+
+  sos_restore_IRQs(flags);
+  return retval;
+}
+
+
 sos_ret_t sos_kwaitq_dispose(struct sos_kwaitq *kwq)
 {
   sos_ui32_t flags;
@@ -80,9 +104,77 @@ sos_ret_t sos_kwaitq_init_entry(struct sos_kwaitq_entry *kwq_entry)
 }
 
 
+/**
+ * Internal helper function to insert the entry in the waiting_list of
+ * the kwaitq, according to its order. For the priority order, the
+ * entry is inserted after the last entry of the same or higher
+ * priority, found in constant time from the prio_tail array
+ */
+static void _kwaitq_list_insert(struct sos_kwaitq *kwq,
+				struct sos_kwaitq_entry *kwq_entry)
+{
+  sos_sched_priority_t prio;
+  sos_ui32_t mask;
+
+  if (SOS_KWQ_ORDER_PRIO != kwq->order)
+    {
+      list_add_tail_named(kwq->waiting_list, kwq_entry,
+			  prev_entry_in_kwaitq, next_entry_in_kwaitq);
+      return;
+    }
+
+  prio = kwq_entry->thread->priority;
+  kwq_entry->priority = prio;
+
+  /* Priorities higher or equal to ours (ie numerically lower) */
+  if (prio >= SOS_SCHED_PRIO_LOWEST)
+    mask = kwq->prio_bitmap;
+  else
+    mask = kwq->prio_bitmap & ((1U << (prio + 1)) - 1);
+
+  if (0 == mask)
+    list_add_head_named(kwq->waiting_list, kwq_entry,
+			prev_entry_in_kwaitq, next_entry_in_kwaitq);
+  else
+    list_insert_after_named(kwq->waiting_list,
+			    kwq->prio_tail[31 - __builtin_clz(mask)],
+			    kwq_entry,
+			    prev_entry_in_kwaitq, next_entry_in_kwaitq);
+
+  kwq->prio_tail[prio] = kwq_entry;
+  kwq->prio_bitmap |= (1U << prio);
+}
+
+
+/** Internal helper function to remove the entry from the
+    waiting_list of the kwaitq */
+static void _kwaitq_list_delete(struct sos_kwaitq *kwq,
+				struct sos_kwaitq_entry *kwq_entry)
+{
+  sos_sched_priority_t prio = kwq_entry->priority;
+
+  if ((SOS_KWQ_ORDER_PRIO == kwq->order)
+      && (kwq->prio_tail[prio] == kwq_entry))
+    {
+      /* The previous entry becomes the last one of this priority, if
+	 it has the same priority */
+      if ((kwq->waiting_list != kwq_entry)
+	  && (kwq_entry->prev_entry_in_kwaitq->priority == prio))
+	kwq->prio_tail[prio] = kwq_entry->prev_entry_in_kwaitq;
+      else
+	{
+	  kwq->prio_tail[prio] = NULL;
+	  kwq->prio_bitmap &= ~(1U << prio);
+	}
+    }
+
+  list_delete_named(kwq->waiting_list, kwq_entry,
+		    prev_entry_in_kwaitq, next_entry_in_kwaitq);
+}
+
+
 /** Internal helper function equivalent to sos_kwaitq_add_entry(), but
-    without interrupt protection scheme, and explicit priority
-    ordering */
+    without interrupt protection scheme */
 inline static sos_ret_t _kwaitq_add_entry(struct sos_kwaitq *kwq,
 					  struct sos_kwaitq_entry *kwq_entry)
 {
@@ -97,8 +189,7 @@ inline static sos_ret_t _kwaitq_add_entry(struct sos_kwaitq *kwq,
   kwq_entry->wakeup_status    = SOS_OK;
 
   /* Add the thread in the list */
-  list_add_tail_named(kwq->waiting_list, kwq_entry,
-		      prev_entry_in_kwaitq, next_entry_in_kwaitq);
+  _kwaitq_list_insert(kwq, kwq_entry);
 
   /* Update the list of waitqueues for the thread */
   list_add_tail_named(kwq_entry->thread->kwaitq_list, kwq_entry,
@@ -132,8 +223,7 @@ _kwaitq_remove_entry(struct sos_kwaitq *kwq,
 {
   SOS_ASSERT_FATAL(kwq_entry->kwaitq == kwq);
 
-  list_delete_named(kwq->waiting_list, kwq_entry,
-		    prev_entry_in_kwaitq, next_entry_in_kwaitq);
+  _kwaitq_list_delete(kwq, kwq_entry);
 
   list_delete_named(kwq_entry->thread->kwaitq_list, kwq_entry,
 		    prev_entry_for_thread, next_entry_for_thread);
@@ -157,14 +247,18 @@ sos_ret_t sos_kwaitq_remove_entry(struct sos_kwaitq *kwq,
 }
 
 
-sos_ret_t sos_kwaitq_wait(struct sos_kwaitq *kwq,
-			  struct sos_time *timeout)
+/** Internal helper function for sos_kwaitq_wait() and
+    sos_kwaitq_wait_exclusive() */
+static sos_ret_t _kwaitq_wait(struct sos_kwaitq *kwq,
+			      struct sos_time *timeout,
+			      sos_ui32_t kwq_flags)
 {
   sos_ui32_t flags;
   sos_ret_t retval;
   struct sos_kwaitq_entry kwq_entry;
 
   sos_kwaitq_init_entry(& kwq_entry);
+  kwq_entry.flags = kwq_flags;
 
   sos_disable_IRQs(flags);
 
@@ -178,8 +272,9 @@ sos_ret_t sos_kwaitq_wait(struct sos_kwaitq *kwq,
   if (! kwq_entry.wakeup_triggered)
     {
       /* Yes (timeout occured, or wakeup on another waitqueue): remove
-	 the waitq entry by ourselves */
-      _kwaitq_remove_entry(kwq, & kwq_entry);
+	 the waitq entry by ourselves. It may have been moved to
+	 another kwaitq meanwhile (sos_kwaitq_requeue_first()) */
+      _kwaitq_remove_entry(kwq_entry.kwaitq, & kwq_entry);
       retval = -SOS_EINTR;
     }
   else
@@ -194,26 +289,59 @@ sos_ret_t sos_kwaitq_wait(struct sos_kwaitq *kwq,
 }
 
 
-sos_ret_t sos_kwaitq_wakeup(struct sos_kwaitq *kwq,
-			    unsigned int nb_threads,
-			    sos_ret_t wakeup_status)
+sos_ret_t sos_kwaitq_wait(struct sos_kwaitq *kwq,
+			  struct sos_time *timeout)
 {
+  return _kwaitq_wait(kwq, timeout, 0);
+}
+
+
+sos_ret_t sos_kwaitq_wait_exclusive(struct sos_kwaitq *kwq,
+				    struct sos_time *timeout)
+{
+  return _kwaitq_wait(kwq, timeout, SOS_KWQ_EXCLUSIVE);
+}
+
+
+/** Internal helper function for sos_kwaitq_wakeup() and
+    sos_kwaitq_wakeup_shared() */
+static sos_ret_t _kwaitq_wakeup(struct sos_kwaitq *kwq,
+				unsigned int nb_threads,
+				sos_ret_t wakeup_status,
+				sos_bool_t wake_all_shared)
+{
+  struct sos_kwaitq_entry *kwq_entry, *next_entry;
   sos_ui32_t flags;
 
   sos_disable_IRQs(flags);
 
   /* Wake up as much threads waiting in waitqueue as possible (up to
      nb_threads), scanning the list in FIFO order */
-  while (! list_is_empty_named(kwq->waiting_list,
-			       prev_entry_in_kwaitq, next_entry_in_kwaitq))
+  kwq_entry = list_get_head_named(kwq->waiting_list,
+				  prev_entry_in_kwaitq, next_entry_in_kwaitq);
+  while (NULL != kwq_entry)
     {
-      struct sos_kwaitq_entry *kwq_entry
-	= list_get_head_named(kwq->waiting_list,
-			      prev_entry_in_kwaitq, next_entry_in_kwaitq);
+      sos_bool_t exclusive = (kwq_entry->flags & SOS_KWQ_EXCLUSIVE);
 
-      /* Enough threads woken up ? */
+      /* The list is circular */
+      next_entry = kwq_entry->next_entry_in_kwaitq;
+      if (next_entry == list_get_head_named(kwq->waiting_list,
+					    prev_entry_in_kwaitq,
+					    next_entry_in_kwaitq))
+	next_entry = NULL;
+
+      /* Enough threads woken up ? Then only the non-exclusive threads
+	 are still woken up by sos_kwaitq_wakeup_shared() */
       if (nb_threads <= 0)
-	break;
+	{
+	  if (! wake_all_shared)
+	    break;
+	  if (exclusive)
+	    {
+	      kwq_entry = next_entry;
+	      continue;
+	    }
+	}
 
       /*
        * Ok: wake up the thread for this entry
@@ -226,6 +354,7 @@ sos_ret_t sos_kwaitq_wakeup(struct sos_kwaitq *kwq,
 	     particular: don't call set_ready() here because this
 	     would result in an inconsistent configuration (currently
 	     running thread marked as "waiting for CPU"...). */
+	  kwq_entry = next_entry;
 	  continue;
 	}
       else
@@ -240,10 +369,76 @@ sos_ret_t sos_kwaitq_wakeup(struct sos_kwaitq *kwq,
       kwq_entry->wakeup_status    = wakeup_status;
 
       /* Next iteration... */
-      nb_threads --;
+      if (exclusive || ! wake_all_shared)
+	nb_threads --;
+      kwq_entry = next_entry;
+    }
+
+  sos_restore_IRQs(flags);
+
+  return SOS_OK;
+}
+
+
+sos_ret_t sos_kwaitq_wakeup(struct sos_kwaitq *kwq,
+			    unsigned int nb_threads,
+			    sos_ret_t wakeup_status)
+{
+  return _kwaitq_wakeup(kwq, nb_threads, wakeup_status, FALSE);
+}
+
+
+sos_ret_t sos_kwaitq_wakeup_shared(struct sos_kwaitq *kwq,
+				   unsigned int nb_exclusive,
+				   sos_ret_t wakeup_status)
+{
+  return _kwaitq_wakeup(kwq, nb_exclusive, wakeup_status, TRUE);
+}
+
+
+struct sos_thread *sos_kwaitq_requeue_first(struct sos_kwaitq *kwq,
+					    struct sos_kwaitq *dest_kwq)
+{
+  struct sos_kwaitq_entry *kwq_entry;
+  sos_ui32_t flags;
+
+  sos_disable_IRQs(flags);
+
+  if (list_is_empty_named(kwq->waiting_list,
+			  prev_entry_in_kwaitq, next_entry_in_kwaitq))
+    {
+      sos_restore_IRQs(flags);
+      return NULL;
     }
 
+  kwq_entry = list_get_head_named(kwq->waiting_list,
+				  prev_entry_in_kwaitq, next_entry_in_kwaitq);
+  _kwaitq_remove_entry(kwq, kwq_entry);
+  _kwaitq_add_entry(dest_kwq, kwq_entry);
+
   sos_restore_IRQs(flags);
+  return kwq_entry->thread;
+}
+
+
+sos_ret_t sos_kwaitq_change_priority(struct sos_thread *thr)
+{
+  struct sos_kwaitq_entry *kwq_entry;
+  int nb_entries;
+
+  list_foreach_named(thr->kwaitq_list, kwq_entry, nb_entries,
+		     prev_entry_for_thread, next_entry_for_thread)
+    {
+      struct sos_kwaitq *kwq = kwq_entry->kwaitq;
+
+      if ((SOS_KWQ_ORDER_PRIO != kwq->order)
+	  || (kwq_entry->priority == thr->priority))
+	continue;
+
+      /* Move the entry behind the threads of its new priority */
+      _kwaitq_list_delete(kwq, kwq_entry);
+      _kwaitq_list_insert(kwq, kwq_entry);
+    }
 
   return SOS_OK;
 }
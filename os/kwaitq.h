@@ -44,9 +44,18 @@
 struct sos_kwaitq_entry;
 
 
+/**
+ * Ordering of the threads in a kwaitq (see sos_kwaitq_set_order())
+ */
+#define SOS_KWQ_ORDER_FIFO  0 /**< FIFO order (default) */
+#define SOS_KWQ_ORDER_PRIO  1 /**< Highest priority first, then FIFO */
+
+
 /**
  * Definition of a waitqueue. In a kwaitq, the threads are ordererd in
- * FIFO order.
+ * FIFO order, or by decreasing priority (and FIFO for a given
+ * priority). The waiting_list is always kept in the order of the
+ * wakeups.
  */
 struct sos_kwaitq
 {
@@ -55,9 +64,31 @@ struct sos_kwaitq
   char name[SOS_KWQ_DEBUG_MAX_NAMELEN];
 #endif
   struct sos_kwaitq_entry *waiting_list;
+
+  /** SOS_KWQ_ORDER_FIFO or SOS_KWQ_ORDER_PRIO */
+  sos_ui32_t order;
+
+  /** SOS_KWQ_ORDER_PRIO: last entry of each priority in the
+      waiting_list (where to insert a new entry of this priority), and
+      bit set for each priority with a waiting thread */
+  struct sos_kwaitq_entry *prio_tail[SOS_SCHED_NUM_PRIO];
+  sos_ui32_t prio_bitmap;
 };
 
 
+/**
+ * Flags of a waitqueue entry
+ *
+ * The threads waiting for a resource that only one of them can take
+ * (a semaphore, a mutex, ...) wait in EXCLUSIVE mode. The other
+ * (non-exclusive) threads wait for an event (data available, a
+ * condition, ...). sos_kwaitq_wakeup() ignores the mode, but
+ * sos_kwaitq_wakeup_shared() wakes all the non-exclusive threads and
+ * only as many exclusive threads as requested.
+ */
+#define SOS_KWQ_EXCLUSIVE (1 << 0)
+
+
 /**
  * Definition of an entry for a thread waiting in the waitqueue
  */
@@ -69,6 +100,13 @@ struct sos_kwaitq_entry
   /** The kwaitqueue this entry belongs to */
   struct sos_kwaitq *kwaitq;
 
+  /** SOS_KWQ_EXCLUSIVE or 0 */
+  sos_ui32_t flags;
+
+  /** Priority of the thread when the entry was sorted in the kwaitq
+      (SOS_KWQ_ORDER_PRIO) */
+  sos_sched_priority_t priority;
+
   /** TRUE when somebody woke up this entry */
   sos_bool_t wakeup_triggered;
 
@@ -94,6 +132,18 @@ sos_ret_t sos_kwaitq_init(struct sos_kwaitq *kwq,
 			  const char *name);
 
 
+/**
+ * Change the order of the threads in the waitqueue, which must be
+ * empty
+ *
+ * @param order SOS_KWQ_ORDER_FIFO or SOS_KWQ_ORDER_PRIO
+ *
+ * @return -SOS_EBUSY in case a thread is in the waitqueue
+ */
+sos_ret_t sos_kwaitq_set_order(struct sos_kwaitq *kwq,
+			       sos_ui32_t order);
+
+
 /**
  * Release a waitqueue, making sure that no thread is in it.
  *
@@ -164,9 +214,19 @@ sos_ret_t sos_kwaitq_wait(struct sos_kwaitq *kwq,
 			  struct sos_time *timeout);
 
 
+/**
+ * Same as sos_kwaitq_wait(), the thread waiting in EXCLUSIVE mode
+ * (see SOS_KWQ_EXCLUSIVE)
+ *
+ * @note This is a BLOCKING FUNCTION
+ */
+sos_ret_t sos_kwaitq_wait_exclusive(struct sos_kwaitq *kwq,
+				    struct sos_time *timeout);
+
+
 /**
  * Wake up as much as nb_thread threads (SOS_KWQ_WAKEUP_ALL to wake
- * up all threads) in the kwaitq kwq, in FIFO order.
+ * up all threads) in the kwaitq kwq, in FIFO order, exclusive or not.
  *
  * @param wakeup_status The value returned by sos_kwaitq_wait() when
  * the thread will effectively woken up due to this wakeup.
@@ -177,4 +237,44 @@ sos_ret_t sos_kwaitq_wakeup(struct sos_kwaitq *kwq,
 #define SOS_KWQ_WAKEUP_ALL (~((unsigned int)0))
 
 
+/**
+ * Wake up as much as nb_exclusive EXCLUSIVE threads
+ * (SOS_KWQ_WAKEUP_ALL to wake up all threads), and ALL the
+ * non-exclusive threads in the kwaitq kwq, in FIFO order.
+ *
+ * @param wakeup_status As for sos_kwaitq_wakeup()
+ *
+ * @note: No state change/context switch can occur here !
+ */
+sos_ret_t sos_kwaitq_wakeup_shared(struct sos_kwaitq *kwq,
+				   unsigned int nb_exclusive,
+				   sos_ret_t wakeup_status);
+
+
+/**
+ * Sort again the entries of the thread in the priority-ordered
+ * waitqueues after its priority changed. MUST be called with the IRQs
+ * disabled
+ *
+ * @note: The use of this function is RESERVED (see
+ * sos_sched_change_priority())
+ */
+sos_ret_t sos_kwaitq_change_priority(struct sos_thread *thr);
+
+
+/**
+ * Move the first waiting thread of the kwaitq kwq to the kwaitq
+ * dest_kwq, WITHOUT waking it up: its sos_kwaitq_wait() will return
+ * when it is woken up from dest_kwq, with the wakeup status given
+ * there ("wait-morphing", see the kernel condition variables)
+ *
+ * @return The thread moved, or NULL when there was no thread waiting
+ * in kwq
+ *
+ * @note: No state change/context switch can occur here !
+ */
+struct sos_thread *sos_kwaitq_requeue_first(struct sos_kwaitq *kwq,
+					    struct sos_kwaitq *dest_kwq);
+
+
 #endif /* _SOS_KWAITQ_H_ */
@@ -131,6 +131,50 @@
                    (iterator); }) ; )
 
 
+/*
+ * RCU variants (see os/rcu.h): the readers walk the list forward
+ * without any lock while a writer adds or deletes items. The deleted
+ * items keep their next link, so that the readers standing on them
+ * go on; they may be released only after a grace period. The head of
+ * the list MUST NOT be deleted while readers may walk the list.
+ */
+
+/* Internal macro: order the stores of the writer */
+#define __list_rcu_barrier() asm volatile("" : : : "memory")
+
+#define list_add_tail_rcu_named(list,item,prev,next) ({ \
+  if (list) { \
+    (item)->prev = (list)->prev; \
+    (item)->next = (list); \
+    __list_rcu_barrier(); \
+    (list)->prev->next = (item); \
+    (list)->prev = (item); \
+  } else { \
+    (item)->next = (item)->prev = (item); \
+    __list_rcu_barrier(); \
+    (list) = (item); \
+  } \
+})
+
+/** @note NO check whether item really is in list ! */
+#define list_delete_rcu_named(list,item,prev,next) ({ \
+  if ( ((item)->next == (item)) && ((item)->prev == (item)) ) \
+    (list) = NULL; \
+  else { \
+    (item)->prev->next = (item)->next; \
+    (item)->next->prev = (item)->prev; \
+    if ((item) == (list)) (list) = (item)->next; \
+  } \
+})
+
+#define list_foreach_rcu_named(list,iterator,nb_elements,prev,next) \
+        for (nb_elements=0, \
+               (iterator) = *(typeof(list) volatile *) & (list) ; \
+             (iterator) && (!nb_elements || ((iterator) != (list))) ; \
+             nb_elements++, \
+               (iterator) = *(typeof(iterator) volatile *) & (iterator)->next )
+
+
 /*
  * the same macros : assume that the prev and next fields are really
  * named "prev" and "next"
@@ -183,4 +227,13 @@
 #define list_collapse(list,iterator) \
   list_collapse_named(list,iterator,prev,next)
 
+#define list_add_tail_rcu(list,item) \
+  list_add_tail_rcu_named(list,item,prev,next)
+
+#define list_delete_rcu(list,item) \
+  list_delete_rcu_named(list,item,prev,next)
+
+#define list_foreach_rcu(list,iterator,nb_elements) \
+  list_foreach_rcu_named(list,iterator,nb_elements,prev,next)
+
 #endif /* _SOS_LIST_H_ */
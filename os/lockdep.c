@@ -0,0 +1,325 @@
+/* Copyright (C) 2026  AbdAllah MEZITI
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+   USA. 
+*/
+
+#include <hwcore/irq.h>
+#include <hwcore/smp.h>
+#include <hwcore/spinlock.h>
+#include <hwcore/cpu_context.h>
+#include <lib/klibc.h>
+#include <lib/stdio.h>
+#include <os/thread.h>
+
+#include "lockdep.h"
+
+
+#ifdef SOS_LOCKDEP
+
+/** The IF flag of EFLAGS: the IRQs are enabled */
+#define LOCKDEP_EFLAGS_IF (1 << 9)
+
+/** Usage of a class of spinlocks */
+#define LOCKDEP_USED_IN_IRQ       (1 << 0) /**< Taken by an IRQ handler */
+#define LOCKDEP_USED_IRQS_ENABLED (1 << 1) /**< Taken with IRQs enabled */
+
+/** Problems already reported for a class */
+#define LOCKDEP_REPORTED_IRQ      (1 << 2)
+#define LOCKDEP_REPORTED_SLEEP    (1 << 3)
+
+#define LOCKDEP_BITMAP_WORDS (SOS_LOCKDEP_MAX_CLASSES / 32)
+#define LOCKDEP_BIT_IS_SET(bitmap,i) ((bitmap)[(i) / 32] & (1U << ((i) % 32)))
+#define LOCKDEP_BIT_SET(bitmap,i) ((bitmap)[(i) / 32] |= (1U << ((i) % 32)))
+
+/** Maximum number of frames of the backtraces */
+#define LOCKDEP_BACKTRACE_DEPTH 10
+
+
+/** A class of locks */
+struct lockdep_class
+{
+#define LOCKDEP_MAX_NAMELEN 32
+  char name[LOCKDEP_MAX_NAMELEN];
+
+  /** SOS_LOCKDEP_SPIN or SOS_LOCKDEP_SLEEP */
+  sos_ui32_t kind;
+
+  /** LOCKDEP_USED_* and LOCKDEP_REPORTED_* flags */
+  sos_ui32_t usage;
+
+  /** The classes taken while a lock of this class was held: the
+      edges of the graph of the lock order */
+  sos_ui32_t after[LOCKDEP_BITMAP_WORDS];
+};
+
+
+/** The classes, and the lock protecting them (not validated itself,
+    since it has no class) */
+static struct lockdep_class lockdep_classes[SOS_LOCKDEP_MAX_CLASSES];
+static sos_ui32_t lockdep_nb_classes;
+static struct sos_spinlock lockdep_lock
+  = SOS_SPINLOCK_INITIALIZER("lockdep");
+
+
+sos_lockdep_class_t sos_lockdep_get_class(const char *name,
+					  sos_ui32_t kind)
+{
+  sos_lockdep_class_t lock_class = 0;
+  sos_ui32_t flags, i;
+
+  if (NULL == name)
+    name = "<unknown>";
+
+  sos_spin_lock_irqsave(& lockdep_lock, flags);
+  for (i = 0 ; i < lockdep_nb_classes ; i ++)
+    if ((kind == lockdep_classes[i].kind)
+	&& (0 == strncmp(lockdep_classes[i].name, name,
+			 LOCKDEP_MAX_NAMELEN - 1)))
+      {
+	lock_class = i + 1;
+	break;
+      }
+
+  if ((0 == lock_class) && (lockdep_nb_classes < SOS_LOCKDEP_MAX_CLASSES))
+    {
+      struct lockdep_class *cls = & lockdep_classes[lockdep_nb_classes ++];
+
+      memset(cls, 0x0, sizeof(struct lockdep_class));
+      strzcpy(cls->name, name, LOCKDEP_MAX_NAMELEN);
+      cls->kind  = kind;
+      lock_class = lockdep_nb_classes;
+    }
+  sos_spin_unlock_irqrestore(& lockdep_lock, flags);
+
+  return lock_class;
+}
+
+
+static void lockdep_backtracer(sos_vaddr_t PC,
+			       sos_vaddr_t params,
+			       sos_ui32_t depth,
+			       void *custom_arg)
+{
+  printf("lockdep:  [%d] PC=0x%x\n", (unsigned)depth, (unsigned)PC);
+}
+
+
+/** Helper function to end a report with the backtrace of the thread */
+static void lockdep_report_backtrace(struct sos_thread *thr)
+{
+  printf("lockdep: in thread %s%s\n", thr->name,
+	 sos_servicing_irq() ? " (IRQ handler)" : "");
+  sos_backtrace(NULL, LOCKDEP_BACKTRACE_DEPTH,
+		thr->kernel_stack_base_addr, thr->kernel_stack_size,
+		lockdep_backtracer, NULL);
+}
+
+
+/**
+ * Helper function to search a path from the class "from" to the class
+ * "to" in the graph of the lock order (breadth-first)
+ *
+ * @param prev Filled with the previous class along the path, for each
+ * class reached
+ *
+ * @return TRUE when "to" can be reached
+ */
+static sos_bool_t lockdep_find_path(sos_ui32_t from, sos_ui32_t to,
+				    sos_ui32_t prev[])
+{
+  sos_ui32_t queue[SOS_LOCKDEP_MAX_CLASSES];
+  sos_ui32_t visited[LOCKDEP_BITMAP_WORDS];
+  sos_ui32_t head = 0, tail = 0, i;
+
+  memset(visited, 0x0, sizeof(visited));
+  queue[tail ++] = from;
+  LOCKDEP_BIT_SET(visited, from);
+
+  while (head < tail)
+    {
+      sos_ui32_t cur = queue[head ++];
+
+      for (i = 0 ; i < lockdep_nb_classes ; i ++)
+	{
+	  if (! LOCKDEP_BIT_IS_SET(lockdep_classes[cur].after, i)
+	      || LOCKDEP_BIT_IS_SET(visited, i))
+	    continue;
+
+	  prev[i] = cur;
+	  if (i == to)
+	    return TRUE;
+
+	  LOCKDEP_BIT_SET(visited, i);
+	  queue[tail ++] = i;
+	}
+    }
+
+  return FALSE;
+}
+
+
+/**
+ * Helper function to record that the class "to" is taken while the
+ * class "from" is held, reporting the cycle this creates in the lock
+ * order, if any
+ */
+static void lockdep_add_order(struct sos_thread *thr,
+			      sos_ui32_t from, sos_ui32_t to)
+{
+  sos_ui32_t prev[SOS_LOCKDEP_MAX_CLASSES];
+  sos_ui32_t path[SOS_LOCKDEP_MAX_CLASSES];
+  sos_ui32_t cur;
+  int nb_path;
+
+  /* Already known: validated when it was recorded */
+  if (LOCKDEP_BIT_IS_SET(lockdep_classes[from].after, to))
+    return;
+
+  if (from == to)
+    {
+      printf("lockdep: %s taken while holding a lock of the same class\n",
+	     lockdep_classes[to].name);
+      lockdep_report_backtrace(thr);
+    }
+
+  /* Is "from" taken after "to" somewhere ? */
+  else if (lockdep_find_path(to, from, prev))
+    {
+      printf("lockdep: possible deadlock taking %s while holding %s,"
+	     " elsewhere taken in this order:\n",
+	     lockdep_classes[to].name, lockdep_classes[from].name);
+
+      /* Walk the path back from "from" to "to" */
+      nb_path = 0;
+      for (cur = from ; cur != to ; cur = prev[cur])
+	path[nb_path ++] = cur;
+      path[nb_path ++] = to;
+
+      while (nb_path > 0)
+	printf("lockdep:   %s\n", lockdep_classes[path[-- nb_path]].name);
+      lockdep_report_backtrace(thr);
+    }
+
+  LOCKDEP_BIT_SET(lockdep_classes[from].after, to);
+}
+
+
+void sos_lockdep_acquire(sos_lockdep_class_t lock_class, sos_ui32_t flags)
+{
+  struct lockdep_class *cls;
+  struct sos_thread *thr;
+  sos_ui32_t irq_flags, idx, i;
+
+  if (0 == lock_class)
+    return;
+
+  idx = lock_class - 1;
+  cls = & lockdep_classes[idx];
+
+  /* The IRQ flags at the time of the lock */
+  sos_spin_lock_irqsave(& lockdep_lock, irq_flags);
+
+  /* Nothing to validate before the threads are set up */
+  thr = sos_cpu_local()->current_thread;
+  if (NULL == thr)
+    goto exit_lockdep_acquire;
+
+  if (SOS_LOCKDEP_SPIN == cls->kind)
+    {
+      if (sos_servicing_irq())
+	cls->usage |= LOCKDEP_USED_IN_IRQ;
+      else if (irq_flags & LOCKDEP_EFLAGS_IF)
+	cls->usage |= LOCKDEP_USED_IRQS_ENABLED;
+
+      if ((cls->usage & LOCKDEP_USED_IN_IRQ)
+	  && (cls->usage & LOCKDEP_USED_IRQS_ENABLED)
+	  && ! (cls->usage & LOCKDEP_REPORTED_IRQ))
+	{
+	  cls->usage |= LOCKDEP_REPORTED_IRQ;
+	  printf("lockdep: spinlock %s taken by IRQ handlers and with the"
+		 " IRQs enabled\n", cls->name);
+	  lockdep_report_backtrace(thr);
+	}
+    }
+  else if (! (flags & SOS_LOCKDEP_TRY)
+	   && ! (cls->usage & LOCKDEP_REPORTED_SLEEP))
+    {
+      if (sos_servicing_irq())
+	{
+	  cls->usage |= LOCKDEP_REPORTED_SLEEP;
+	  printf("lockdep: blocking lock %s taken by an IRQ handler\n",
+		 cls->name);
+	  lockdep_report_backtrace(thr);
+	}
+      else
+	for (i = 0 ; i < thr->lockdep_nb_held ; i ++)
+	  {
+	    struct lockdep_class *held
+	      = & lockdep_classes[thr->lockdep_held[i] - 1];
+
+	    if (SOS_LOCKDEP_SPIN != held->kind)
+	      continue;
+
+	    cls->usage |= LOCKDEP_REPORTED_SLEEP;
+	    printf("lockdep: blocking lock %s taken while holding"
+		   " spinlock %s\n", cls->name, held->name);
+	    lockdep_report_backtrace(thr);
+	    break;
+	  }
+    }
+
+  /* A trylock does not wait: it cannot deadlock */
+  if (! (flags & SOS_LOCKDEP_TRY))
+    for (i = 0 ; i < thr->lockdep_nb_held ; i ++)
+      lockdep_add_order(thr, thr->lockdep_held[i] - 1, idx);
+
+  /* Deeper locks are not validated */
+  if (thr->lockdep_nb_held < SOS_LOCKDEP_MAX_HELD)
+    thr->lockdep_held[thr->lockdep_nb_held ++] = lock_class;
+
+ exit_lockdep_acquire:
+  sos_spin_unlock_irqrestore(& lockdep_lock, irq_flags);
+}
+
+
+void sos_lockdep_release(sos_lockdep_class_t lock_class)
+{
+  struct sos_thread *thr;
+  sos_ui32_t irq_flags;
+  int i;
+
+  if (0 == lock_class)
+    return;
+
+  sos_spin_lock_irqsave(& lockdep_lock, irq_flags);
+
+  /* The locks are usually released in the reverse order. A lock not
+     found was taken by another thread (semaphore) or too deep */
+  thr = sos_cpu_local()->current_thread;
+  if (NULL != thr)
+    for (i = thr->lockdep_nb_held - 1 ; i >= 0 ; i --)
+      if (thr->lockdep_held[i] == lock_class)
+	{
+	  thr->lockdep_nb_held --;
+	  for ( ; i < thr->lockdep_nb_held ; i ++)
+	    thr->lockdep_held[i] = thr->lockdep_held[i + 1];
+	  break;
+	}
+
+  sos_spin_unlock_irqrestore(& lockdep_lock, irq_flags);
+}
+
+#endif /* SOS_LOCKDEP */
@@ -0,0 +1,101 @@
+/* Copyright (C) 2026  AbdAllah MEZITI
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+   USA. 
+*/
+#ifndef _SOS_LOCKDEP_H_
+#define _SOS_LOCKDEP_H_
+
+/**
+ * @file lockdep.h
+ *
+ * Lock validator, for the debug builds: records the order in which
+ * the classes of locks are taken, and reports at once the orders that
+ * could deadlock, even if they never did:
+ *  - a cycle in the order of the classes (A then B in a thread, B then
+ *    A in another one)
+ *  - a spinlock taken in an IRQ handler AND with the IRQs enabled
+ *    (the handler may interrupt the holder on the same CPU)
+ *  - a blocking lock (ksema, kmutex) taken in an IRQ handler, or while
+ *    holding a spinlock
+ *
+ * The class of a lock is its name: all the locks initialized with the
+ * same name are the same class. Each problem is reported once, with
+ * a backtrace of the thread.
+ *
+ * The spinlocks initialized with sos_spin_init(), the mutexes and the
+ * semaphores initialized to 1 (ie used as locks) are validated. The
+ * big kernel lock is not.
+ *
+ * When SOS_LOCKDEP is not defined, the validator and the fields it
+ * adds to the locks and to the threads are compiled out.
+ */
+
+#include <os/types.h>
+#include <os/errno.h>
+
+/* Uncomment to validate the order of the locks */
+/* #define SOS_LOCKDEP */
+
+
+#ifdef SOS_LOCKDEP
+
+/** Maximum number of lock classes */
+#define SOS_LOCKDEP_MAX_CLASSES 64
+
+/** Maximum number of locks held by a thread that are validated */
+#define SOS_LOCKDEP_MAX_HELD    16
+
+/** Index of a lock class + 1, 0 for the locks not validated */
+typedef sos_ui32_t sos_lockdep_class_t;
+
+/** Kinds of locks */
+#define SOS_LOCKDEP_SPIN   (1 << 0) /**< Busy-waiting lock */
+#define SOS_LOCKDEP_SLEEP  (1 << 1) /**< Blocking lock */
+
+/** The lock is taken without waiting (trylock): it cannot deadlock */
+#define SOS_LOCKDEP_TRY    (1 << 2)
+
+
+/**
+ * Get the class of the locks of the given name (created when needed)
+ *
+ * @param kind SOS_LOCKDEP_SPIN or SOS_LOCKDEP_SLEEP
+ *
+ * @return 0 when there are too many classes
+ */
+sos_lockdep_class_t sos_lockdep_get_class(const char *name,
+					  sos_ui32_t kind);
+
+
+/**
+ * Validate that the current thread may take a lock of the given
+ * class, and record it as held. MUST be called BEFORE waiting for the
+ * lock, so that a deadlock is reported before it happens
+ *
+ * @param flags 0 or SOS_LOCKDEP_TRY
+ */
+void sos_lockdep_acquire(sos_lockdep_class_t lock_class, sos_ui32_t flags);
+
+
+/**
+ * Record that the current thread released a lock of the given class
+ * (or gave up waiting for it)
+ */
+void sos_lockdep_release(sos_lockdep_class_t lock_class);
+
+#endif /* SOS_LOCKDEP */
+
+#endif /* _SOS_LOCKDEP_H_ */
@@ -30,6 +30,7 @@
 #include <os/thread.h>
 #include <os/ksynch.h>
 #include <os/kmalloc.h>
+#include <os/workqueue.h>
 #include <lib/x86_videomem.h>
  
 // Historique :
@@ -104,7 +105,7 @@ static Point_t ChoosePosition(Element_t * pMouse, int Positions[], int Count);
 static int EvaluatePositions(Point_t Org, int Positions[], Point_t * Cheese);
 static sos_bool_t IsCollision(Point_t Org, Point_t p, Point_t *Cheese);
 static sos_bool_t AffectMovement(Point_t Org, Point_t p);
-static void MouseCreator(void);
+static void MouseCreator(void *Unused);
 static sos_ret_t CreateMouse(void);
 
 //*****************************************************************************
@@ -113,7 +114,6 @@ static sos_ret_t CreateMouse(void);
 
 static Element_t * * pMap;
 static struct sos_ksema SemMap;
-static struct sos_ksema SemMouse;
 static int MouseCount = 0;
 static int CheeseCount = 0;
 static int ObstacleCount = 0;
@@ -137,16 +137,12 @@ void MouseSim(void)
   //Creation du semaphore de protection de la carte
   SOS_ASSERT_FATAL(SOS_OK == sos_ksema_init(& SemMap, "SemMap", 1));
 	
-  //Creation du semaphore de creation de souris
-  SOS_ASSERT_FATAL(SOS_OK == sos_ksema_init(& SemMouse, "SemMouse", 2));
-	
   //Creation de la carte
   SOS_ASSERT_FATAL(SOS_OK == CreateMap());
 
-  //Creation du thread createur de souris
-  SOS_ASSERT_FATAL(sos_create_kernel_thread("MouseCreator",
-					    (sos_kernel_thread_start_routine_t)MouseCreator,
-					    0) != NULL);
+  //Creation des deux premieres souris par la workqueue
+  SOS_ASSERT_FATAL(SOS_OK == sos_work_submit(MouseCreator, NULL));
+  SOS_ASSERT_FATAL(SOS_OK == sos_work_submit(MouseCreator, NULL));
 
 }
 
@@ -687,8 +683,8 @@ static sos_bool_t IsCollision(Point_t Org, Point_t p, Point_t *Cheese)
 			Set(pMouse->Status, MOUSE_EMPTY);
 			Reset(pMouse->Status, MOUSE_FULL);
 			pMouse->Color = SOS_X86_VIDEO_FG_LTRED;
-			//Autoriser la creation d'une autre souris
-			sos_ksema_up(& SemMouse);
+			//Demander la creation d'une autre souris
+			sos_work_submit(MouseCreator, NULL);
 			return TRUE;
 		case OUTPUT:
 			break;
@@ -700,17 +696,14 @@ static sos_bool_t IsCollision(Point_t Org, Point_t p, Point_t *Cheese)
 }
 
 //*****************************************************************************
-// But du thread : Creer une souris et la placer autour de l'entree
+// But du travail (workqueue) : Creer une souris et la placer autour de
+// l'entree
 //*****************************************************************************
-static void MouseCreator(void)
+static void MouseCreator(void *Unused)
 {	
-	while(1)
-	{
-		sos_ksema_down(& SemMouse, NULL);
-		sos_ksema_down(& SemMap, NULL);
-		CreateMouse();
-		sos_ksema_up(& SemMap);
-	}
+	sos_ksema_down(& SemMap, NULL);
+	CreateMouse();
+	sos_ksema_up(& SemMap);
 }
 
 //*****************************************************************************
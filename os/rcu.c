@@ -0,0 +1,190 @@
+/* Copyright (C) 2026  AbdAllah MEZITI
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+   USA. 
+*/
+
+#include <hwcore/irq.h>
+#include <lib/klibc.h>
+#include <os/assert.h>
+#include <os/list.h>
+#include <os/ksynch.h>
+
+#include "rcu.h"
+
+
+/**
+ * The state of the grace periods. Protected by the BKL and by
+ * disabling the IRQs
+ */
+static struct
+{
+  /** TRUE while a grace period is running */
+  sos_bool_t gp_in_progress;
+
+  /** CPUs that did not go through a quiescent state since the start
+      of the current grace period */
+  sos_ui32_t cpus_pending;
+
+  /** Callbacks waiting for the next grace period to start */
+  struct sos_rcu_head *next_list;
+
+  /** Callbacks waiting for the end of the current grace period */
+  struct sos_rcu_head *wait_list;
+
+  /** Callbacks whose grace period elapsed, to be called */
+  struct sos_rcu_head *done_list;
+
+  struct sos_rcu_stats stats;
+} rcu;
+
+
+sos_ret_t sos_rcu_subsystem_setup(void)
+{
+  memset(& rcu, 0x0, sizeof(rcu));
+  return SOS_OK;
+}
+
+
+/** Helper function to start a grace period for the next callbacks */
+static void rcu_start_gp(void)
+{
+  SOS_ASSERT_FATAL(! rcu.gp_in_progress);
+  SOS_ASSERT_FATAL(list_is_empty(rcu.wait_list));
+
+  rcu.wait_list      = rcu.next_list;
+  rcu.next_list      = NULL;
+  rcu.cpus_pending   = (1UL << sos_smp_get_nb_cpus()) - 1;
+  rcu.gp_in_progress = TRUE;
+}
+
+
+/** Helper function called when all the CPUs went through a quiescent
+    state */
+static void rcu_complete_gp(void)
+{
+  struct sos_rcu_head *head;
+
+  /* The callbacks of this grace period may be called */
+  list_collapse(rcu.wait_list, head)
+    list_add_tail(rcu.done_list, head);
+
+  rcu.gp_in_progress = FALSE;
+  rcu.stats.nb_grace_periods ++;
+
+  if (! list_is_empty(rcu.next_list))
+    rcu_start_gp();
+}
+
+
+sos_ret_t sos_call_rcu(struct sos_rcu_head *head,
+		       sos_rcu_callback_t *func)
+{
+  sos_ui32_t flags;
+
+  if (! func)
+    return -SOS_EINVAL;
+
+  sos_disable_IRQs(flags);
+
+  head->func = func;
+  list_add_tail(rcu.next_list, head);
+  if (! rcu.gp_in_progress)
+    rcu_start_gp();
+
+  sos_restore_IRQs(flags);
+  return SOS_OK;
+}
+
+
+void sos_rcu_quiescent_state(void)
+{
+  struct sos_cpu_local *cpu = sos_cpu_local();
+  sos_ui32_t flags;
+
+  /* Blocking or yielding in a read-side critical section ? */
+  SOS_ASSERT_FATAL(cpu->rcu_nesting == 0);
+
+  sos_disable_IRQs(flags);
+  if (rcu.gp_in_progress && (rcu.cpus_pending & (1UL << cpu->cpu_id)))
+    {
+      rcu.cpus_pending &= ~(1UL << cpu->cpu_id);
+      if (0 == rcu.cpus_pending)
+	rcu_complete_gp();
+    }
+  sos_restore_IRQs(flags);
+}
+
+
+void sos_rcu_process_callbacks(void)
+{
+  sos_ui32_t flags;
+
+  sos_disable_IRQs(flags);
+  while (! list_is_empty(rcu.done_list))
+    {
+      struct sos_rcu_head *head = list_pop_head(rcu.done_list);
+      rcu.stats.nb_callbacks ++;
+      head->func(head);
+    }
+  sos_restore_IRQs(flags);
+}
+
+
+/** Used by sos_synchronize_rcu() to wait for the grace period */
+struct rcu_synchronize
+{
+  struct sos_rcu_head head;
+  struct sos_ksema    done;
+};
+
+static void rcu_wakeup_synchronize(struct sos_rcu_head *head)
+{
+  struct rcu_synchronize *sync = (struct rcu_synchronize*)head;
+  sos_ksema_up(& sync->done);
+}
+
+
+sos_ret_t sos_synchronize_rcu(void)
+{
+  struct rcu_synchronize sync;
+  sos_ret_t retval;
+
+  /* We would wait for ourselves */
+  SOS_ASSERT_FATAL(sos_cpu_local()->rcu_nesting == 0);
+
+  retval = sos_ksema_init(& sync.done, "rcu_sync", 0);
+  if (SOS_OK != retval)
+    return retval;
+
+  retval = sos_call_rcu(& sync.head, rcu_wakeup_synchronize);
+  if (SOS_OK == retval)
+    retval = sos_ksema_down(& sync.done, NULL);
+
+  sos_ksema_dispose(& sync.done);
+  return retval;
+}
+
+
+sos_ret_t sos_rcu_get_stats(struct sos_rcu_stats *stats)
+{
+  sos_ui32_t flags;
+
+  sos_disable_IRQs(flags);
+  *stats = rcu.stats;
+  sos_restore_IRQs(flags);
+
+  return SOS_OK;
+}
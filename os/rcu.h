@@ -0,0 +1,156 @@
+/* Copyright (C) 2026  AbdAllah MEZITI
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+   USA. 
+*/
+#ifndef _SOS_RCU_H_
+#define _SOS_RCU_H_
+
+/**
+ * @file rcu.h
+ *
+ * Read-Copy-Update: lets the readers of a shared data structure run
+ * without any lock, the writers deferring the release of the data
+ * they unlink until no reader may still use them.
+ *
+ * This is a quiescent-state-based implementation (QSBR): the kernel
+ * is not preemptible, so that a CPU that switches context or runs its
+ * idle loop cannot be in the middle of a read-side critical section
+ * anymore. A grace period ends once all the CPUs went through such a
+ * quiescent state: the data unlinked before it started may then be
+ * released.
+ *
+ * The read-side critical sections MUST NOT block nor yield. The
+ * writers still have to be serialized (eg by a spinlock or the
+ * BKL), and have to publish and unlink the data with the RCU list
+ * macros of list.h.
+ */
+
+#include <os/types.h>
+#include <os/errno.h>
+#include <hwcore/atomic.h>
+#include <hwcore/smp.h>
+
+
+/** Callback called when a grace period elapsed, see sos_call_rcu() */
+struct sos_rcu_head;
+typedef void (sos_rcu_callback_t)(struct sos_rcu_head *head);
+
+
+/**
+ * To be embedded in the structure to release after a grace period
+ */
+struct sos_rcu_head
+{
+  sos_rcu_callback_t *func;
+
+  /* Other callbacks waiting for the same grace period */
+  struct sos_rcu_head *prev, *next;
+};
+
+
+/** Statistics of the RCU subsystem */
+struct sos_rcu_stats
+{
+  /** Grace periods completed */
+  sos_count_t nb_grace_periods;
+
+  /** Callbacks called */
+  sos_count_t nb_callbacks;
+};
+
+
+/**
+ * Initialize the RCU subsystem
+ */
+sos_ret_t sos_rcu_subsystem_setup(void);
+
+
+/** Enter a read-side critical section. Sections may be nested */
+static inline void sos_rcu_read_lock(void)
+{
+  sos_cpu_local()->rcu_nesting ++;
+  sos_barrier();
+}
+
+
+/** Leave a read-side critical section */
+static inline void sos_rcu_read_unlock(void)
+{
+  sos_barrier();
+  sos_cpu_local()->rcu_nesting --;
+}
+
+
+/**
+ * Read a pointer published by a writer, to dereference it in a
+ * read-side critical section
+ */
+#define sos_rcu_dereference(ptr) \
+  (*(typeof(ptr) volatile *) & (ptr))
+
+
+/**
+ * Publish the pointer to a new structure, once it is fully
+ * initialized
+ */
+#define sos_rcu_assign_pointer(ptr,value) \
+  ({ sos_wmb(); (ptr) = (value); })
+
+
+/**
+ * Call func(head) once all the read-side critical sections running
+ * at the time of the call are over. The callbacks are called from
+ * the idle threads or from the timer IRQ handler: they MUST NOT
+ * block.
+ */
+sos_ret_t sos_call_rcu(struct sos_rcu_head *head,
+		       sos_rcu_callback_t *func);
+
+
+/**
+ * Wait until all the read-side critical sections running at the time
+ * of the call are over
+ *
+ * @note This is a BLOCKING FUNCTION
+ */
+sos_ret_t sos_synchronize_rcu(void);
+
+
+/**
+ * Tell the RCU subsystem that the current CPU is not in a read-side
+ * critical section anymore. Called at each context switch and by the
+ * idle threads.
+ *
+ * @note: The use of this function is RESERVED
+ */
+void sos_rcu_quiescent_state(void);
+
+
+/**
+ * Call the callbacks whose grace period elapsed. Called by the idle
+ * threads and the timer IRQ handler.
+ *
+ * @note: The use of this function is RESERVED
+ */
+void sos_rcu_process_callbacks(void);
+
+
+/**
+ * Get a copy of the RCU statistics
+ */
+sos_ret_t sos_rcu_get_stats(struct sos_rcu_stats *stats);
+
+#endif /* _SOS_RCU_H_ */
@@ -20,33 +20,137 @@
 #include <lib/klibc.h>
 #include <os/assert.h>
 #include <os/list.h>
+#include <hwcore/smp.h>
+#include <os/kwaitq.h>
 
 #include "sched.h"
 
 
 /**
- * The definition of the scheduler queue. We could have used a normal
- * kwaitq here, it would have had the same properties. But, in the
- * definitive version (O(1) scheduler), the structure has to be a bit
- * more complicated. So, in order to keep the changes as small as
- * possible between this version and the definitive one, we don't use
- * kwaitq here.
+ * The definition of the scheduler queues: one per CPU, made of one
+ * FIFO list per priority. A bitmap of the non-empty lists gives the
+ * highest priority ready thread in O(1).
+ *
+ * A thread is queued on the CPU it last ran on when it is allowed to
+ * (see add_in_ready_queue()). An idle CPU steals half the threads of
+ * the most loaded one, and each CPU periodically pulls threads from
+ * the most loaded one to even the loads (see sos_sched_do_tick()).
+ *
+ * The queues are protected by the big kernel lock (see bkl.h) and by
+ * disabling the IRQs.
  */
 static struct
 {
   unsigned int nr_threads;
-  struct sos_thread *thread_list;
-} ready_queue;
+  struct sos_thread *thread_list[SOS_SCHED_NUM_PRIO];
+
+  /** Bit prio set when thread_list[prio] is not empty */
+  sos_ui32_t prio_bitmap;
+
+  /** TRUE when the CPU is running its idle thread */
+  sos_bool_t running_idle;
+
+  /** Ticks until the next rebalance of this CPU */
+  sos_ui32_t rebalance_countdown;
+} ready_queue[SOS_SMP_MAX_CPUS];
+
+
+/** CPUs having an idle thread, ie able to run the threads */
+static sos_ui32_t sched_online_cpus;
+
+/** Statistics, see sched.h */
+static struct sos_sched_stats sched_stats;
+
+
+/** Ticks between two rebalances of a given CPU */
+#define SCHED_REBALANCE_TICKS 10
 
 
 sos_ret_t sos_sched_subsystem_setup()
 {
-  memset(& ready_queue, 0x0, sizeof(ready_queue));
+  memset(ready_queue, 0x0, sizeof(ready_queue));
+  memset(& sched_stats, 0x0, sizeof(sched_stats));
+  sched_online_cpus = 0;
 
   return SOS_OK;
 }
 
 
+/** The load of a CPU: its ready threads, plus the one it is running */
+static inline unsigned int cpu_load(sos_ui32_t cpu)
+{
+  return ready_queue[cpu].nr_threads
+    + ((ready_queue[cpu].running_idle)?0:1);
+}
+
+
+/**
+ * Helper function to add a thread in the queue of the given CPU,
+ * according to its priority
+ */
+static void queue_add(sos_ui32_t cpu, struct sos_thread *thr,
+		      sos_bool_t insert_at_tail)
+{
+  sos_sched_priority_t prio = thr->priority;
+
+  if (insert_at_tail)
+    list_add_tail_named(ready_queue[cpu].thread_list[prio], thr,
+			ready.rdy_prev, ready.rdy_next);
+  else
+    list_add_head_named(ready_queue[cpu].thread_list[prio], thr,
+			ready.rdy_prev, ready.rdy_next);
+  ready_queue[cpu].prio_bitmap |= (1UL << prio);
+  ready_queue[cpu].nr_threads ++;
+  thr->sched_cpu = cpu;
+}
+
+
+/** Helper function to remove a thread from the queue of its CPU */
+static void queue_del(struct sos_thread *thr)
+{
+  sos_ui32_t cpu = thr->sched_cpu;
+  sos_sched_priority_t prio = thr->priority;
+
+  list_delete_named(ready_queue[cpu].thread_list[prio], thr,
+		    ready.rdy_prev, ready.rdy_next);
+  if (list_is_empty_named(ready_queue[cpu].thread_list[prio],
+			  ready.rdy_prev, ready.rdy_next))
+    ready_queue[cpu].prio_bitmap &= ~(1UL << prio);
+  ready_queue[cpu].nr_threads --;
+}
+
+
+/**
+ * Helper function to choose the CPU queue of a thread: the CPU it
+ * last ran on if allowed, or the least loaded allowed CPU otherwise
+ */
+static sos_ui32_t select_cpu(struct sos_thread *thr)
+{
+  sos_ui32_t allowed = thr->cpu_affinity & sched_online_cpus;
+  sos_ui32_t cpu, best_cpu;
+
+  /* No allowed CPU online (yet): stay on the current CPU */
+  if (! allowed)
+    return sos_smp_get_cpu_id();
+
+  if ((SOS_THR_CREATED != thr->state)
+      && (allowed & SOS_SCHED_CPU(thr->sched_cpu)))
+    return thr->sched_cpu;
+
+  best_cpu = SOS_SMP_MAX_CPUS;
+  for (cpu = 0 ; cpu < SOS_SMP_MAX_CPUS ; cpu ++)
+    {
+      if (! (allowed & SOS_SCHED_CPU(cpu)))
+	continue;
+      if ((best_cpu >= SOS_SMP_MAX_CPUS)
+	  || (cpu_load(cpu) < cpu_load(best_cpu)))
+	best_cpu = cpu;
+    }
+
+  return best_cpu;
+}
+
+
 /**
  * Helper function to add a thread in a ready queue AND to change the
  * state of the given thread to "READY".
@@ -57,19 +161,16 @@ sos_ret_t sos_sched_subsystem_setup()
 static sos_ret_t add_in_ready_queue(struct sos_thread *thr,
 				    sos_bool_t insert_at_tail)
 {
+  sos_ui32_t cpu;
 
   SOS_ASSERT_FATAL( (SOS_THR_CREATED == thr->state)
 		    || (SOS_THR_RUNNING == thr->state) /* Yield */
 		    || (SOS_THR_BLOCKED == thr->state) );
 
+  cpu = select_cpu(thr);
+
   /* Add the thread to the CPU queue */
-  if (insert_at_tail)
-    list_add_tail_named(ready_queue.thread_list, thr,
-			ready.rdy_prev, ready.rdy_next);
-  else
-    list_add_head_named(ready_queue.thread_list, thr,
-			ready.rdy_prev, ready.rdy_next);
-  ready_queue.nr_threads ++;
+  queue_add(cpu, thr, insert_at_tail);
 
   /* Ok, thread is now really ready to be (re)started */
   thr->state = SOS_THR_READY;
@@ -78,6 +179,73 @@ static sos_ret_t add_in_ready_queue(struct sos_thread *thr,
 }
 
 
+/**
+ * Helper function to move at most nb_threads threads allowed on
+ * this_cpu from the queue of from_cpu to the queue of this_cpu. The
+ * lowest priority threads, and the last ones to run among them, are
+ * moved first
+ *
+ * @return the number of threads moved
+ */
+static unsigned int pull_threads(sos_ui32_t this_cpu, sos_ui32_t from_cpu,
+				 unsigned int nb_threads)
+{
+  struct sos_thread *thr, *prev_thr;
+  unsigned int nb_moved = 0;
+  int prio;
+
+  for (prio = SOS_SCHED_PRIO_LOWEST ;
+       (prio >= SOS_SCHED_PRIO_HIGHEST) && (nb_moved < nb_threads) ;
+       prio --)
+    {
+      if (! (ready_queue[from_cpu].prio_bitmap & (1UL << prio)))
+	continue;
+
+      /* Scan the list backward, up to its head */
+      thr = list_get_tail_named(ready_queue[from_cpu].thread_list[prio],
+				ready.rdy_prev, ready.rdy_next);
+      do
+	{
+	  sos_bool_t is_head
+	    = (thr == ready_queue[from_cpu].thread_list[prio]);
+	  prev_thr = thr->ready.rdy_prev;
+
+	  if (thr->cpu_affinity & SOS_SCHED_CPU(this_cpu))
+	    {
+	      queue_del(thr);
+	      queue_add(this_cpu, thr, TRUE);
+	      nb_moved ++;
+	    }
+
+	  if (is_head)
+	    break;
+	  thr = prev_thr;
+	}
+      while (nb_moved < nb_threads);
+    }
+
+  return nb_moved;
+}
+
+
+/** Helper function to find the most loaded CPU other than this_cpu */
+static sos_ui32_t busiest_cpu(sos_ui32_t this_cpu)
+{
+  sos_ui32_t cpu, best_cpu = SOS_SMP_MAX_CPUS;
+
+  for (cpu = 0 ; cpu < SOS_SMP_MAX_CPUS ; cpu ++)
+    {
+      if ((cpu == this_cpu) || !(sched_online_cpus & SOS_SCHED_CPU(cpu)))
+	continue;
+      if ((best_cpu >= SOS_SMP_MAX_CPUS)
+	  || (ready_queue[cpu].nr_threads > ready_queue[best_cpu].nr_threads))
+	best_cpu = cpu;
+    }
+
+  return best_cpu;
+}
+
+
 sos_ret_t sos_sched_set_ready(struct sos_thread *thr)
 {
   sos_ret_t retval;
@@ -93,11 +261,87 @@ sos_ret_t sos_sched_set_ready(struct sos_thread *thr)
 }
 
 
+sos_ret_t sos_sched_set_idle_thread(struct sos_thread *thr)
+{
+  struct sos_cpu_local *cpu = sos_cpu_local();
+
+  if (cpu->idle_thread != NULL)
+    return -SOS_EBUSY;
+
+  cpu->idle_thread  = thr;
+  thr->cpu_affinity = SOS_SCHED_CPU(cpu->cpu_id);
+  thr->sched_cpu    = cpu->cpu_id;
+
+  /* This CPU may now run threads */
+  ready_queue[cpu->cpu_id].rebalance_countdown = SCHED_REBALANCE_TICKS;
+  sched_online_cpus |= SOS_SCHED_CPU(cpu->cpu_id);
+  return SOS_OK;
+}
+
+
+sos_ret_t sos_sched_set_affinity(struct sos_thread *thr, sos_ui32_t cpu_mask)
+{
+  if (! (cpu_mask & SOS_SCHED_CPU_ALL))
+    return -SOS_EINVAL;
+  if (thr == sos_cpu_local()->idle_thread)
+    return -SOS_EPERM;
+
+  thr->cpu_affinity = cpu_mask;
+
+  /* A ready thread queued on a CPU that is not allowed anymore moves
+     to an allowed one. A running thread will move when it is
+     rescheduled */
+  if ((SOS_THR_READY == thr->state)
+      && !(cpu_mask & SOS_SCHED_CPU(thr->sched_cpu)))
+    {
+      queue_del(thr);
+
+      thr->state = SOS_THR_CREATED; /* Choose the least loaded CPU */
+      add_in_ready_queue(thr, TRUE);
+    }
+
+  return SOS_OK;
+}
+
+
+sos_ret_t sos_sched_change_priority(struct sos_thread *thr,
+				    sos_sched_priority_t priority)
+{
+  if (! SOS_SCHED_PRIO_IS_VALID(priority))
+    return -SOS_EINVAL;
+
+  /* A ready thread moves to the tail of its new priority list. The
+     idle threads are never queued */
+  if ((SOS_THR_READY == thr->state) && (NULL != thr->ready.rdy_next))
+    {
+      queue_del(thr);
+      thr->priority = priority;
+      queue_add(thr->sched_cpu, thr, TRUE);
+    }
+  else
+    thr->priority = priority;
+
+  /* A waiting thread moves in the priority-ordered waitqueues */
+  sos_kwaitq_change_priority(thr);
+
+  return SOS_OK;
+}
+
+
 struct sos_thread * sos_reschedule(struct sos_thread *current_thread,
 				   sos_bool_t do_yield)
 {
+  sos_ui32_t this_cpu = sos_smp_get_cpu_id();
+  struct sos_thread *idle_thread = sos_cpu_local()->idle_thread;
 
-  if (SOS_THR_ZOMBIE == current_thread->state)
+  if (current_thread == idle_thread)
+    {
+      /* The idle thread is never in the ready queue: it is elected
+	 below when no other thread is ready */
+      SOS_ASSERT_FATAL(SOS_THR_RUNNING == current_thread->state);
+      current_thread->state = SOS_THR_READY;
+    }
+  else if (SOS_THR_ZOMBIE == current_thread->state)
     {
       /* Don't think of returning to this thread since it is
 	 terminated */
@@ -115,19 +359,72 @@ struct sos_thread * sos_reschedule(struct sos_thread *current_thread,
 	add_in_ready_queue(current_thread, FALSE);
     }
 
-  /* The next thread is that at the head of the ready list */
-  if (ready_queue.nr_threads > 0)
+  /* Nothing to do here: steal half the threads of the most loaded
+     CPU */
+  if ((ready_queue[this_cpu].nr_threads == 0) && (idle_thread != NULL))
+    {
+      sos_ui32_t victim = busiest_cpu(this_cpu);
+      if ((victim < SOS_SMP_MAX_CPUS) && (ready_queue[victim].nr_threads > 0))
+	sched_stats.nb_stolen
+	  += pull_threads(this_cpu, victim,
+			  (ready_queue[victim].nr_threads + 1) / 2);
+    }
+
+  /* The next thread is the highest priority one */
+  if (ready_queue[this_cpu].nr_threads > 0)
     {
       struct sos_thread *next_thr;
 
-      /* Queue is not empty: take the thread at its head */
-      next_thr = list_pop_head_named(ready_queue.thread_list,
+      /* Queue is not empty: take the thread at the head of the
+	 highest priority list */
+      sos_sched_priority_t prio
+	= __builtin_ctz(ready_queue[this_cpu].prio_bitmap);
+      next_thr = list_get_head_named(ready_queue[this_cpu].thread_list[prio],
 				     ready.rdy_prev, ready.rdy_next);
-      ready_queue.nr_threads --;
+      queue_del(next_thr);
+      ready_queue[this_cpu].running_idle = FALSE;
 
       return next_thr;
     }
 
+  /* Nothing else to do on this CPU */
+  if (idle_thread != NULL)
+    {
+      ready_queue[this_cpu].running_idle = TRUE;
+      return idle_thread;
+    }
+
   SOS_FATAL_ERROR("No kernel thread ready ?!");
   return NULL;
 }
+
+
+void sos_sched_do_tick(void)
+{
+  sos_ui32_t this_cpu = sos_smp_get_cpu_id();
+  sos_ui32_t victim;
+  unsigned int my_load, victim_load;
+
+  if (! (sched_online_cpus & SOS_SCHED_CPU(this_cpu)))
+    return;
+  if (--ready_queue[this_cpu].rebalance_countdown > 0)
+    return;
+  ready_queue[this_cpu].rebalance_countdown = SCHED_REBALANCE_TICKS;
+
+  /* Even our load with the most loaded CPU */
+  victim = busiest_cpu(this_cpu);
+  if (victim >= SOS_SMP_MAX_CPUS)
+    return;
+
+  my_load     = cpu_load(this_cpu);
+  victim_load = cpu_load(victim);
+  if (victim_load > my_load + 1)
+    sched_stats.nb_rebalanced
+      += pull_threads(this_cpu, victim, (victim_load - my_load) / 2);
+}
+
+
+void sos_sched_get_stats(struct sos_sched_stats *stats)
+{
+  *stats = sched_stats;
+}
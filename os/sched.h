@@ -22,7 +22,13 @@
 /**
  * @file sched.h
  *
- * A basic scheduler with simple FIFO threads' ordering.
+ * A basic priority scheduler with one ready queue per CPU: the
+ * highest priority ready thread runs first, threads of the same
+ * priority in FIFO order. There is no preemption: the priorities are
+ * only taken into account when the current thread blocks or
+ * yields. Idle CPUs steal threads from the most loaded one, and the
+ * loads are periodically rebalanced. Each thread may be restricted to
+ * a subset of the CPUs (its CPU affinity).
  *
  * The functions below manage CPU queues, and are NEVER responsible
  * for context switches (see thread.h for that) or synchronizations
@@ -39,9 +45,45 @@
 #include <os/errno.h>
 
 
+/** Thread priority: the lower the value, the higher the priority */
+typedef sos_ui32_t sos_sched_priority_t;
+
+#define SOS_SCHED_PRIO_HIGHEST  0
+#define SOS_SCHED_PRIO_LOWEST   31
+#define SOS_SCHED_NUM_PRIO      (SOS_SCHED_PRIO_LOWEST + 1)
+
+/** Priority of the new threads */
+#define SOS_SCHED_PRIO_DEFAULT  16
+
+#define SOS_SCHED_PRIO_IS_VALID(prio) \
+  ((prio) <= SOS_SCHED_PRIO_LOWEST)
+
+/** > 0 when prio1 is higher than prio2, 0 when they are equal */
+#define SOS_SCHED_PRIO_CMP(prio1,prio2) \
+  ((int)(prio2) - (int)(prio1))
+
+
 #include <os/thread.h>
 
 
+/** CPU affinity mask for the given CPU */
+#define SOS_SCHED_CPU(cpu_id)  (1UL << (cpu_id))
+
+/** CPU affinity mask for all the CPUs */
+#define SOS_SCHED_CPU_ALL      (~0UL)
+
+
+/** Scheduler statistics */
+struct sos_sched_stats
+{
+  /** Threads stolen by idle CPUs */
+  sos_count_t nb_stolen;
+
+  /** Threads moved by the periodic rebalances */
+  sos_count_t nb_rebalanced;
+};
+
+
 /**
  * Initialize the scheduler
  *
@@ -58,6 +100,42 @@ sos_ret_t sos_sched_subsystem_setup();
 sos_ret_t sos_sched_set_ready(struct sos_thread * thr);
 
 
+/**
+ * Declare the idle thread of the current CPU: it is never in the ready
+ * queue, and is returned by sos_reschedule() when the ready queue is
+ * empty.
+ *
+ * @note: The use of this function is RESERVED (see
+ * sos_create_idle_thread())
+ */
+sos_ret_t sos_sched_set_idle_thread(struct sos_thread * thr);
+
+
+/**
+ * Restrict the CPUs allowed to run the given thread. A ready thread is
+ * moved at once, a running thread when it is rescheduled.
+ *
+ * @param cpu_mask Combination of SOS_SCHED_CPU() masks
+ *
+ * @note: The use of this function is RESERVED (see
+ * sos_thread_set_cpu_affinity())
+ */
+sos_ret_t sos_sched_set_affinity(struct sos_thread * thr,
+				 sos_ui32_t cpu_mask);
+
+
+/**
+ * Change the effective priority of the given thread, moving it in its
+ * ready queue when it is ready, or in the priority-ordered waitqueues
+ * when it waits. Its base priority is managed by thread.c
+ *
+ * @note: The use of this function is RESERVED (see
+ * sos_thread_set_priority() and ksynch.c)
+ */
+sos_ret_t sos_sched_change_priority(struct sos_thread * thr,
+				    sos_sched_priority_t priority);
+
+
 /**
  * Return the identifier of the next thread to run. Also removes it
  * from the ready list, but does NOT set is as current_thread !
@@ -72,4 +150,16 @@ sos_ret_t sos_sched_set_ready(struct sos_thread * thr);
 struct sos_thread * sos_reschedule(struct sos_thread * current_thread,
 				    sos_bool_t do_yield);
 
+
+/**
+ * Periodic work of the scheduler on the current CPU: rebalance its
+ * load with the most loaded CPU. To be called from the timer IRQ
+ * handler of each CPU.
+ */
+void sos_sched_do_tick(void);
+
+
+/** Get a copy of the scheduler statistics */
+void sos_sched_get_stats(struct sos_sched_stats *stats);
+
 #endif /* _SOS_WAITQUEUE_H_ */
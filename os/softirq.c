@@ -0,0 +1,207 @@
+/* Copyright (C) 2026  AbdAllah MEZITI
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+   USA. 
+*/
+
+#include <hwcore/irq.h>
+#include <hwcore/smp.h>
+#include <hwcore/tsc.h>
+#include <lib/klibc.h>
+#include <os/assert.h>
+#include <os/list.h>
+#include <os/bkl.h>
+
+#include "softirq.h"
+
+
+/** The routines of the softirqs */
+static sos_softirq_routine_t *softirq_routines[SOS_SOFTIRQ_NUM];
+
+/** Protected by the BKL and by disabling the IRQs */
+static struct sos_softirq_stats softirq_stats[SOS_SOFTIRQ_NUM];
+
+/**
+ * The tasklets scheduled on each CPU. Protected by disabling the IRQs
+ * (only accessed by their CPU)
+ */
+static struct sos_tasklet *tasklet_list[SOS_SMP_MAX_CPUS];
+
+
+/** Routine of the SOS_SOFTIRQ_TASKLET softirq */
+static void tasklet_softirq(void)
+{
+  struct sos_tasklet *todo, *tasklet;
+  sos_ui32_t flags;
+
+  /* Only run the tasklets scheduled so far: those they schedule
+     again will be run at the next restart of the softirqs */
+  sos_disable_IRQs(flags);
+  todo = tasklet_list[sos_smp_get_cpu_id()];
+  list_init(tasklet_list[sos_smp_get_cpu_id()]);
+
+  while (! list_is_empty(todo))
+    {
+      tasklet = list_pop_head(todo);
+      tasklet->scheduled = FALSE;
+
+      sos_restore_IRQs(flags);
+      tasklet->routine(tasklet);
+      sos_disable_IRQs(flags);
+    }
+  sos_restore_IRQs(flags);
+}
+
+
+sos_ret_t sos_softirq_subsystem_setup(void)
+{
+  memset(softirq_routines, 0x0, sizeof(softirq_routines));
+  memset(softirq_stats, 0x0, sizeof(softirq_stats));
+  memset(tasklet_list, 0x0, sizeof(tasklet_list));
+
+  return sos_softirq_set_routine(SOS_SOFTIRQ_TASKLET, tasklet_softirq);
+}
+
+
+sos_ret_t sos_softirq_set_routine(int softirq,
+				  sos_softirq_routine_t *routine)
+{
+  sos_ui32_t flags;
+
+  if ((softirq < 0) || (softirq >= SOS_SOFTIRQ_NUM))
+    return -SOS_EINVAL;
+
+  sos_disable_IRQs(flags);
+  softirq_routines[softirq] = routine;
+  sos_restore_IRQs(flags);
+
+  return SOS_OK;
+}
+
+
+sos_ret_t sos_softirq_raise(int softirq)
+{
+  sos_ui32_t flags;
+
+  if ((softirq < 0) || (softirq >= SOS_SOFTIRQ_NUM))
+    return -SOS_EINVAL;
+
+  sos_disable_IRQs(flags);
+  sos_cpu_local()->softirq_pending |= (1 << softirq);
+  softirq_stats[softirq].nb_raised ++;
+  sos_restore_IRQs(flags);
+
+  return SOS_OK;
+}
+
+
+void sos_softirq_irq_exit(void)
+{
+  struct sos_cpu_local *cpu = sos_cpu_local();
+  int restart;
+
+  /* Nothing to do, or an IRQ that interrupted the softirqs: they
+     will see what it raised before they return */
+  if ((0 == cpu->softirq_pending) || cpu->softirq_active)
+    return;
+
+  cpu->softirq_active = TRUE;
+  sos_bkl_lock();
+
+  for (restart = 0 ;
+       (restart < SOS_SOFTIRQ_MAX_RESTART) && (0 != cpu->softirq_pending) ;
+       restart ++)
+    {
+      sos_ui32_t pending = cpu->softirq_pending;
+      int softirq;
+
+      cpu->softirq_pending = 0;
+      asm volatile ("sti");
+
+      for (softirq = 0 ; softirq < SOS_SOFTIRQ_NUM ; softirq ++)
+	{
+	  struct sos_softirq_stats *st = & softirq_stats[softirq];
+	  sos_ui64_t cycles;
+
+	  if (! (pending & (1 << softirq)) || ! softirq_routines[softirq])
+	    continue;
+
+	  cycles = sos_tsc_read();
+	  softirq_routines[softirq]();
+	  cycles = sos_tsc_read() - cycles;
+
+	  asm volatile ("cli");
+	  st->nb_runs ++;
+	  st->total_cycles += cycles;
+	  if (cycles > st->max_cycles)
+	    st->max_cycles = cycles;
+	  asm volatile ("sti");
+	}
+
+      asm volatile ("cli");
+    }
+
+  sos_bkl_unlock();
+  cpu->softirq_active = FALSE;
+}
+
+
+sos_ret_t sos_softirq_get_stats(int softirq,
+				struct sos_softirq_stats *stats)
+{
+  sos_ui32_t flags;
+
+  if ((softirq < 0) || (softirq >= SOS_SOFTIRQ_NUM) || ! stats)
+    return -SOS_EINVAL;
+
+  sos_disable_IRQs(flags);
+  *stats = softirq_stats[softirq];
+  sos_restore_IRQs(flags);
+
+  return SOS_OK;
+}
+
+
+sos_ret_t sos_tasklet_init(struct sos_tasklet *tasklet,
+			   sos_tasklet_routine_t *routine,
+			   void *routine_data)
+{
+  if (! tasklet || ! routine)
+    return -SOS_EINVAL;
+
+  tasklet->routine      = routine;
+  tasklet->routine_data = routine_data;
+  tasklet->scheduled    = FALSE;
+  tasklet->prev = tasklet->next = NULL;
+
+  return SOS_OK;
+}
+
+
+sos_ret_t sos_tasklet_schedule(struct sos_tasklet *tasklet)
+{
+  sos_ui32_t flags;
+
+  sos_disable_IRQs(flags);
+  if (! tasklet->scheduled)
+    {
+      tasklet->scheduled = TRUE;
+      list_add_tail(tasklet_list[sos_smp_get_cpu_id()], tasklet);
+      sos_softirq_raise(SOS_SOFTIRQ_TASKLET);
+    }
+  sos_restore_IRQs(flags);
+
+  return SOS_OK;
+}
@@ -0,0 +1,159 @@
+/* Copyright (C) 2026  AbdAllah MEZITI
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+   USA. 
+*/
+#ifndef _SOS_SOFTIRQ_H_
+#define _SOS_SOFTIRQ_H_
+
+/**
+ * @file softirq.h
+ *
+ * Deferred interrupt work ("bottom halves"). An IRQ handler does the
+ * minimum with the IRQs disabled, and raises a softirq for the
+ * rest. The pending softirqs of a CPU are run on exit from its
+ * outermost IRQ handler (see irq_wrappers.S), with the IRQs enabled
+ * and the big kernel lock held, before returning to the interrupted
+ * thread.
+ *
+ * Like the IRQ handlers, the softirq routines MUST NOT block nor
+ * yield: sos_servicing_irq() is TRUE while they run. A softirq routine
+ * never runs concurrently with itself on the same CPU, and the BKL
+ * serializes them with the other CPUs.
+ *
+ * The tasklets are dynamically registered softirq routines: each one
+ * is run once on the CPU that scheduled it, however many times it
+ * was scheduled before it could run.
+ */
+
+#include <os/types.h>
+#include <os/errno.h>
+
+
+/**
+ * The softirqs, run in this order when several are pending
+ */
+#define SOS_SOFTIRQ_TIMER    0 /**< Expired timeout actions (time.h) */
+#define SOS_SOFTIRQ_TASKLET  1 /**< Scheduled tasklets */
+#define SOS_SOFTIRQ_NUM      2
+
+
+/**
+ * Number of times the pending softirqs are looked at again, when
+ * they are raised again by the IRQs occurring while they run. Past
+ * that, they wait for the next IRQ exit.
+ */
+#define SOS_SOFTIRQ_MAX_RESTART 8
+
+
+/** The routine of a softirq. Called with the IRQs enabled */
+typedef void (sos_softirq_routine_t)(void);
+
+
+/** Statistics of a softirq */
+struct sos_softirq_stats
+{
+  /** Number of times it was raised (possibly while already pending) */
+  sos_count_t nb_raised;
+
+  /** Number of times its routine was called */
+  sos_count_t nb_runs;
+
+  /** Cycles spent in its routine (see tsc.h) */
+  sos_ui64_t  total_cycles;
+  sos_ui64_t  max_cycles;
+};
+
+
+sos_ret_t sos_softirq_subsystem_setup(void);
+
+
+/**
+ * Set the routine of the given softirq
+ */
+sos_ret_t sos_softirq_set_routine(int softirq,
+				  sos_softirq_routine_t *routine);
+
+
+/**
+ * Mark the softirq pending on the current CPU
+ *
+ * @note Mostly called from IRQ handlers. When called from a thread,
+ * the softirq runs at the next IRQ exit on this CPU
+ */
+sos_ret_t sos_softirq_raise(int softirq);
+
+
+/**
+ * Run the pending softirqs of the current CPU, if any and if not
+ * already running. Called with the IRQs disabled, returns with the
+ * IRQs disabled.
+ *
+ * @note The use of this function is RESERVED (to irq_wrappers.S)
+ */
+void sos_softirq_irq_exit(void);
+
+
+/**
+ * Get the statistics of the given softirq
+ */
+sos_ret_t sos_softirq_get_stats(int softirq,
+				struct sos_softirq_stats *stats);
+
+
+/* =======================================================================
+ * Tasklets
+ */
+
+/** The routine of a tasklet, called with the IRQs enabled */
+struct sos_tasklet;
+typedef void (sos_tasklet_routine_t)(struct sos_tasklet *tasklet);
+
+
+/**
+ * The structure of a tasklet, to be initialized with
+ * sos_tasklet_init(). The fields are PRIVATE to softirq.c, except
+ * routine_data.
+ */
+struct sos_tasklet
+{
+  sos_tasklet_routine_t *routine;
+
+  /** PUBLIC: (Custom) data available for the routine */
+  void                  *routine_data;
+
+  /** TRUE from the scheduling of the tasklet until its routine is
+      called */
+  sos_bool_t             scheduled;
+
+  /** To chain the scheduled tasklets of a CPU */
+  struct sos_tasklet    *prev, *next;
+};
+
+
+sos_ret_t sos_tasklet_init(struct sos_tasklet *tasklet,
+			   sos_tasklet_routine_t *routine,
+			   void *routine_data);
+
+
+/**
+ * Schedule the tasklet on the current CPU. Does nothing when the
+ * tasklet is already scheduled.
+ *
+ * @note 'tasklet' MUST remain valid until its routine is called
+ */
+sos_ret_t sos_tasklet_schedule(struct sos_tasklet *tasklet);
+
+#endif /* _SOS_SOFTIRQ_H_ */
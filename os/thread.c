@@ -19,36 +19,30 @@
 #include <os/physmem.h>
 #include <os/kmem_slab.h>
 #include <os/kmalloc.h>
+#include <os/kmem_vmm.h>
+#include <hwcore/paging.h>
 #include <lib/klibc.h>
+#include <lib/stdio.h>
 #include <os/list.h>
 #include <os/assert.h>
 
 #include <hwcore/irq.h>
+#include <hwcore/smp.h>
+#include <os/bkl.h>
+#include <os/ksynch.h>
+#include <os/rcu.h>
 
 #include "thread.h"
 
 
 /**
- * The size of the stack of a kernel thread
- */
-#define SOS_THREAD_KERNEL_STACK_SIZE (1*SOS_PAGE_SIZE)
-
-
-/**
- * The identifier of the thread currently running on CPU.
+ * The identifier of the thread currently running on the current CPU.
  *
- * We only support a SINGLE processor, ie a SINGLE thread
- * running at any time in the system. This greatly simplifies the
- * implementation of the system, since we don't have to complicate
- * things in order to retrieve the identifier of the threads running
- * on the CPU. On multiprocessor systems the current_thread below is
- * an array indexed by the id of the CPU, so that the challenge is to
- * retrieve the identifier of the CPU. This is usually done based on
- * the stack address (Linux implementation) or on some form of TLS
- * ("Thread Local Storage": can be implemented by way of LDTs for the
- * processes, accessed through the fs or gs registers).
+ * Each CPU runs its own thread: the identifier is stored in the
+ * per-CPU area of the CPU (see hwcore/smp.h), accessed through the
+ * %gs segment register.
  */
-static volatile struct sos_thread *current_thread = NULL;
+#define current_thread (sos_cpu_local()->current_thread)
 
 
 /*
@@ -65,6 +59,21 @@ static struct sos_thread *thread_list = NULL;
 static struct sos_kslab_cache *cache_thread;
 
 
+/**
+ * The pool of the thread structures of the deleted threads, each one
+ * still owning its stack: short-lived threads do not pay for the
+ * allocation of the stack (a kernel virtual range and its physical
+ * pages) and its release. Linked with the gbl_prev/gbl_next fields.
+ */
+static struct sos_thread *thread_pool = NULL;
+
+/** Maximum number of threads kept in the pool */
+static sos_ui32_t thread_pool_high_water = SOS_THREAD_POOL_HIGH_WATER;
+
+/** Pool statistics (see sos_thread_get_pool_stats()) */
+static struct sos_thread_pool_stats thread_pool_stats;
+
+
 struct sos_thread *sos_thread_get_current()
 {
   SOS_ASSERT_FATAL(current_thread->state == SOS_THR_RUNNING);
@@ -75,38 +84,53 @@ struct sos_thread *sos_thread_get_current()
 inline static sos_ret_t _set_current(struct sos_thread *thr)
 {
   SOS_ASSERT_FATAL(thr->state == SOS_THR_READY);
+
+  /* Context switch: the previous thread cannot be in an RCU
+     read-side critical section */
+  sos_rcu_quiescent_state();
+
+  /* Do not let the next thread complete the unterminated line of
+     this one */
+  console_flush();
+
+  /* Arm the lazy restore of the FPU context of the new thread */
+  sos_fpu_switch((current_thread)?& current_thread->fpu_state:NULL,
+		 & thr->fpu_state);
+
   current_thread = thr;
   current_thread->state = SOS_THR_RUNNING;
   return SOS_OK;
 }
 
 
-sos_ret_t sos_thread_subsystem_setup(sos_vaddr_t init_thread_stack_base_addr,
-				     sos_size_t init_thread_stack_size)
+/**
+ * Helper function to create the structure of the thread that is
+ * running the current code on the current CPU, on the given stack
+ */
+static struct sos_thread *
+_create_current_thread(const char *name,
+		       sos_vaddr_t stack_base_addr,
+		       sos_size_t stack_size)
 {
+  sos_ui32_t flags;
   struct sos_thread *myself;
 
-  /* Allocate the cache of threads */
-  cache_thread = sos_kmem_cache_create("thread",
-				       sizeof(struct sos_thread),
-				       2,
-				       0,
-				       SOS_KSLAB_CREATE_MAP
-				       | SOS_KSLAB_CREATE_ZERO);
-  if (! cache_thread)
-    return -SOS_ENOMEM;
-
   /* Allocate a new thread structure for the current running thread */
   myself = (struct sos_thread*) sos_kmem_cache_alloc(cache_thread,
 						     SOS_KSLAB_ALLOC_ATOMIC);
   if (! myself)
-    return -SOS_ENOMEM;
+    return NULL;
 
   /* Initialize the thread attributes */
-  strzcpy(myself->name, "[kinit]", SOS_THR_MAX_NAMELEN);
+  strzcpy(myself->name, name, SOS_THR_MAX_NAMELEN);
   myself->state           = SOS_THR_CREATED;
-  myself->kernel_stack_base_addr = init_thread_stack_base_addr;
-  myself->kernel_stack_size      = init_thread_stack_size;
+  myself->kernel_stack_base_addr = stack_base_addr;
+  myself->kernel_stack_size      = stack_size;
+  myself->cpu_affinity           = SOS_SCHED_CPU_ALL;
+  myself->sched_cpu              = sos_smp_get_cpu_id();
+  myself->base_priority          = SOS_SCHED_PRIO_DEFAULT;
+  myself->priority               = SOS_SCHED_PRIO_DEFAULT;
+  sos_fpu_state_init(& myself->fpu_state);
 
   /* Do some stack poisoning on the bottom of the stack, if needed */
   sos_cpu_state_prepare_detect_kernel_stack_overflow(myself->cpu_state,
@@ -114,20 +138,226 @@ sos_ret_t sos_thread_subsystem_setup(sos_vaddr_t init_thread_stack_base_addr,
 						     myself->kernel_stack_size);
 
   /* Add the thread in the global list */
-  list_singleton_named(thread_list, myself, gbl_prev, gbl_next);
+  sos_disable_IRQs(flags);
+  if (thread_list == NULL)
+    list_singleton_named(thread_list, myself, gbl_prev, gbl_next);
+  else
+    list_add_tail_named(thread_list, myself, gbl_prev, gbl_next);
+  sos_restore_IRQs(flags);
 
   /* Ok, now pretend that the running thread is ourselves */
   myself->state = SOS_THR_READY;
   _set_current(myself);
 
+  return myself;
+}
+
+
+sos_ret_t sos_thread_subsystem_setup(sos_vaddr_t init_thread_stack_base_addr,
+				     sos_size_t init_thread_stack_size)
+{
+  /* Allocate the cache of threads */
+  cache_thread = sos_kmem_cache_create("thread",
+				       sizeof(struct sos_thread),
+				       2,
+				       0,
+				       SOS_KSLAB_CREATE_MAP
+				       | SOS_KSLAB_CREATE_ZERO);
+  if (! cache_thread)
+    return -SOS_ENOMEM;
+
+  if (! _create_current_thread("[kinit]",
+			       init_thread_stack_base_addr,
+			       init_thread_stack_size))
+    return -SOS_ENOMEM;
+
   return SOS_OK;
 }
 
 
-struct sos_thread *
-sos_create_kernel_thread(const char *name,
-			 sos_kernel_thread_start_routine_t start_func,
-			 void *start_arg)
+sos_ret_t sos_thread_cpu_setup(sos_vaddr_t stack_base_addr,
+			       sos_size_t stack_size)
+{
+  char name[SOS_THR_MAX_NAMELEN];
+  struct sos_thread *myself;
+
+  snprintf(name, sizeof(name), "[idle%d]", (int)sos_smp_get_cpu_id());
+  myself = _create_current_thread(name, stack_base_addr, stack_size);
+  if (! myself)
+    return -SOS_ENOMEM;
+
+  return sos_sched_set_idle_thread(myself);
+}
+
+
+static void delete_thread(struct sos_thread *thr);
+
+
+/**
+ * Helper function to allocate a kernel stack of the given size (a
+ * multiple of the page size) in its own kernel virtual range, above
+ * an unmapped guard page
+ *
+ * @return the address of the guard page, the stack starts one page
+ * above. NULL when out of memory.
+ */
+static sos_vaddr_t _alloc_kernel_stack(sos_size_t stack_size)
+{
+  sos_vaddr_t guard_addr;
+
+  guard_addr = sos_kmem_vmm_alloc(1 + stack_size / SOS_PAGE_SIZE,
+				  SOS_KMEM_VMM_MAP);
+  if (! guard_addr)
+    return (sos_vaddr_t)NULL;
+
+  /* The page stays in the range, so that sos_kmem_vmm_free() releases
+     it with the stack, but without any physical page behind it. Since
+     it lies inside a valid range, the page fault handler has to check
+     for it (see sos_thread_lookup_stack_guard()) before any demand
+     paging */
+  SOS_ASSERT_FATAL(SOS_OK == sos_paging_unmap(guard_addr));
+  return guard_addr;
+}
+
+
+/**
+ * Helper function to release the stack and the structure of a thread
+ * that is not in any list
+ *
+ * The other CPUs may still cache the translations of the stack (the
+ * CPU the thread last ran on, at least). sos_kmem_vmm_free() only
+ * returns once they flushed their TLB (see sos_smp_tlb_shootdown()),
+ * before the range or its physical pages can be handed out again.
+ * This holds for the stacks freed from the pool too.
+ */
+static void _free_thread(struct sos_thread *thr)
+{
+  if (thr->kernel_stack_guard_addr)
+    SOS_ASSERT_FATAL(SOS_OK
+		     == sos_kmem_vmm_free(thr->kernel_stack_guard_addr));
+  memset(thr, 0x0, sizeof(struct sos_thread));
+  sos_kmem_cache_free((sos_vaddr_t) thr);
+}
+
+
+/**
+ * Helper function to get a thread structure with a stack of the
+ * given size from the pool
+ *
+ * @return the thread structure, zeroed except for its stack
+ * parameters, or NULL when there is none in the pool
+ */
+static struct sos_thread *_thread_pool_get(sos_size_t stack_size)
+{
+  struct sos_thread *thr, *found = NULL;
+  sos_ui32_t flags;
+  int nb_thr;
+
+  sos_disable_IRQs(flags);
+  list_foreach_named(thread_pool, thr, nb_thr, gbl_prev, gbl_next)
+    {
+      if (thr->kernel_stack_size == stack_size)
+	{
+	  found = thr;
+	  break;
+	}
+    }
+
+  if (found)
+    {
+      list_delete_named(thread_pool, found, gbl_prev, gbl_next);
+      thread_pool_stats.nb_pooled --;
+      thread_pool_stats.nb_hits ++;
+    }
+  else
+    thread_pool_stats.nb_misses ++;
+  sos_restore_IRQs(flags);
+
+  if (found)
+    strzcpy(found->name, "", SOS_THR_MAX_NAMELEN);
+  return found;
+}
+
+
+/**
+ * Helper function to put the structure of a deleted thread, with its
+ * stack, back in the pool. Frees them when the pool is full.
+ */
+static void _thread_pool_put(struct sos_thread *thr)
+{
+  sos_vaddr_t guard_addr = thr->kernel_stack_guard_addr;
+  sos_vaddr_t base_addr  = thr->kernel_stack_base_addr;
+  sos_size_t  size       = thr->kernel_stack_size;
+  sos_ui32_t  flags;
+
+  /* Only keep the stack, as if the structure had been freshly
+     allocated from the (zeroing) cache */
+  memset(thr, 0x0, sizeof(struct sos_thread));
+  thr->kernel_stack_guard_addr = guard_addr;
+  thr->kernel_stack_base_addr  = base_addr;
+  thr->kernel_stack_size       = size;
+  strzcpy(thr->name, "[pooled]", SOS_THR_MAX_NAMELEN);
+
+  sos_disable_IRQs(flags);
+  if (thread_pool_stats.nb_pooled < thread_pool_high_water)
+    {
+      list_add_head_named(thread_pool, thr, gbl_prev, gbl_next);
+      thread_pool_stats.nb_pooled ++;
+      thr = NULL;
+    }
+  sos_restore_IRQs(flags);
+
+  if (thr)
+    _free_thread(thr);
+}
+
+
+sos_ret_t sos_thread_set_pool_high_water(sos_ui32_t high_water)
+{
+  sos_ui32_t flags;
+
+  sos_disable_IRQs(flags);
+  thread_pool_high_water = high_water;
+  while (thread_pool_stats.nb_pooled > thread_pool_high_water)
+    {
+      struct sos_thread *thr = list_pop_head_named(thread_pool,
+						   gbl_prev, gbl_next);
+      thread_pool_stats.nb_pooled --;
+
+      sos_restore_IRQs(flags);
+      _free_thread(thr);
+      sos_disable_IRQs(flags);
+    }
+  sos_restore_IRQs(flags);
+
+  return SOS_OK;
+}
+
+
+sos_ret_t sos_thread_get_pool_stats(struct sos_thread_pool_stats *stats)
+{
+  sos_ui32_t flags;
+
+  if (! stats)
+    return -SOS_EINVAL;
+
+  sos_disable_IRQs(flags);
+  *stats = thread_pool_stats;
+  sos_restore_IRQs(flags);
+
+  return SOS_OK;
+}
+
+
+/**
+ * Helper function to create a new kernel thread, without marking it
+ * ready
+ */
+static struct sos_thread *
+_create_kernel_thread(const char *name,
+		      sos_kernel_thread_start_routine_t start_func,
+		      void *start_arg,
+		      sos_size_t stack_size)
 {
   __label__ undo_creation;
   sos_ui32_t flags;
@@ -136,22 +366,36 @@ sos_create_kernel_thread(const char *name,
   if (! start_func)
     return NULL;
 
-  /* Allocate a new thread structure for the current running thread */
-  new_thread
-    = (struct sos_thread*) sos_kmem_cache_alloc(cache_thread,
-						SOS_KSLAB_ALLOC_ATOMIC);
+  /* Reuse the structure and the stack of a deleted thread, when
+     possible */
+  stack_size = SOS_PAGE_ALIGN_SUP(stack_size);
+  new_thread = _thread_pool_get(stack_size);
   if (! new_thread)
-    return NULL;
+    {
+      /* Allocate a new thread structure for the current running thread */
+      new_thread
+	= (struct sos_thread*) sos_kmem_cache_alloc(cache_thread,
+						    SOS_KSLAB_ALLOC_ATOMIC);
+      if (! new_thread)
+	return NULL;
+
+      /* Allocate the stack for the new thread */
+      new_thread->kernel_stack_guard_addr = _alloc_kernel_stack(stack_size);
+      if (! new_thread->kernel_stack_guard_addr)
+	goto undo_creation;
+      new_thread->kernel_stack_base_addr
+	= new_thread->kernel_stack_guard_addr + SOS_PAGE_SIZE;
+      new_thread->kernel_stack_size = stack_size;
+    }
 
   /* Initialize the thread attributes */
   strzcpy(new_thread->name, ((name)?name:"[NONAME]"), SOS_THR_MAX_NAMELEN);
   new_thread->state    = SOS_THR_CREATED;
-
-  /* Allocate the stack for the new thread */
-  new_thread->kernel_stack_base_addr = sos_kmalloc(SOS_THREAD_KERNEL_STACK_SIZE, 0);
-  new_thread->kernel_stack_size      = SOS_THREAD_KERNEL_STACK_SIZE;
-  if (! new_thread->kernel_stack_base_addr)
-    goto undo_creation;
+  new_thread->cpu_affinity = SOS_SCHED_CPU_ALL;
+  new_thread->sched_cpu    = sos_smp_get_cpu_id();
+  new_thread->base_priority = SOS_SCHED_PRIO_DEFAULT;
+  new_thread->priority      = SOS_SCHED_PRIO_DEFAULT;
+  sos_fpu_state_init(& new_thread->fpu_state);
 
   /* Initialize the CPU context of the new thread */
   if (SOS_OK
@@ -169,21 +413,77 @@ sos_create_kernel_thread(const char *name,
   list_add_tail_named(thread_list, new_thread, gbl_prev, gbl_next);
   sos_restore_IRQs(flags);
 
-  /* Mark the thread ready */
-  if (SOS_OK != sos_sched_set_ready(new_thread))
-    goto undo_creation;
-
   /* Normal non-erroneous end of function */
   return new_thread;
 
  undo_creation:
-  if (new_thread->kernel_stack_base_addr)
-    sos_kfree((sos_vaddr_t) new_thread->kernel_stack_base_addr);
-  sos_kmem_cache_free((sos_vaddr_t) new_thread);
+  _free_thread(new_thread);
   return NULL;
 }
 
 
+struct sos_thread *
+sos_create_kernel_thread(const char *name,
+			 sos_kernel_thread_start_routine_t start_func,
+			 void *start_arg)
+{
+  return sos_create_kernel_thread_with_stack(name, start_func, start_arg,
+					     SOS_THREAD_KERNEL_STACK_SIZE);
+}
+
+
+struct sos_thread *
+sos_create_kernel_thread_with_stack(const char *name,
+				    sos_kernel_thread_start_routine_t start_func,
+				    void *start_arg,
+				    sos_size_t stack_size)
+{
+  struct sos_thread *new_thread;
+
+  if (stack_size <= 0)
+    return NULL;
+
+  new_thread = _create_kernel_thread(name, start_func, start_arg,
+				     stack_size);
+  if (! new_thread)
+    return NULL;
+
+  /* Mark the thread ready */
+  if (SOS_OK != sos_sched_set_ready(new_thread))
+    {
+      delete_thread(new_thread);
+      return NULL;
+    }
+
+  return new_thread;
+}
+
+
+struct sos_thread *
+sos_create_idle_thread(const char *name,
+		       sos_kernel_thread_start_routine_t start_func,
+		       void *start_arg)
+{
+  struct sos_thread *new_thread;
+
+  new_thread = _create_kernel_thread(name, start_func, start_arg,
+				     SOS_THREAD_KERNEL_STACK_SIZE);
+  if (! new_thread)
+    return NULL;
+
+  /* The idle thread is never in the ready queue: the scheduler elects
+     it when there is nothing else to run on this CPU */
+  new_thread->state = SOS_THR_READY;
+  if (SOS_OK != sos_sched_set_idle_thread(new_thread))
+    {
+      delete_thread(new_thread);
+      return NULL;
+    }
+
+  return new_thread;
+}
+
+
 /** Function called after thr has terminated. Called from inside the context
     of another thread, interrupts disabled */
 static void delete_thread(struct sos_thread *thr)
@@ -194,9 +494,7 @@ static void delete_thread(struct sos_thread *thr)
   list_delete_named(thread_list, thr, gbl_prev, gbl_next);
   sos_restore_IRQs(flags);
 
-  sos_kfree((sos_vaddr_t) thr->kernel_stack_base_addr);
-  memset(thr, 0x0, sizeof(struct sos_thread));
-  sos_kmem_cache_free((sos_vaddr_t) thr);
+  _thread_pool_put(thr);
 }
 
 
@@ -215,25 +513,56 @@ void sos_thread_exit()
   SOS_ASSERT_FATAL(list_is_empty_named(myself->kwaitq_list,
 				       prev_entry_for_thread,
 				       next_entry_for_thread));
+  SOS_ASSERT_FATAL(NULL == myself->kmutex_held_list);
 
   /* Prepare to run the next thread */
   sos_disable_IRQs(flags);
   myself->state = SOS_THR_ZOMBIE;
   next_thread = sos_reschedule(myself, FALSE);
 
-  /* Make sure that the next_thread is valid */
-  sos_cpu_state_detect_kernel_stack_overflow(next_thread->cpu_state,
-					     next_thread->kernel_stack_base_addr,
-					     next_thread->kernel_stack_size);
-
   /* No need for sos_restore_IRQs() here because the IRQ flag will be
      restored to that of the next thread upon context switch */
 
   /* Immediate switch to next thread */
   _set_current(next_thread);
-  sos_cpu_context_exit_to(next_thread->cpu_state,
-			  (sos_cpu_kstate_function_arg1_t*) delete_thread,
-			  (sos_ui32_t) myself);
+  sos_cpu_kstate_exit_to(next_thread->cpu_state,
+			 (sos_cpu_kstate_function_arg1_t*) delete_thread,
+			 (sos_ui32_t) myself);
+}
+
+
+struct sos_thread *sos_thread_lookup_stack_guard(sos_vaddr_t vaddr)
+{
+  struct sos_thread *thr, *found = NULL;
+  sos_ui32_t flags;
+  int nb_thr;
+
+  sos_disable_IRQs(flags);
+  list_foreach_named(thread_list, thr, nb_thr, gbl_prev, gbl_next)
+    {
+      if (thr->kernel_stack_guard_addr
+	  && (vaddr >= thr->kernel_stack_guard_addr)
+	  && (vaddr < thr->kernel_stack_guard_addr + SOS_PAGE_SIZE))
+	{
+	  found = thr;
+	  break;
+	}
+    }
+
+  /* The stacks kept in the pool have their guard page too */
+  if (! found)
+    list_foreach_named(thread_pool, thr, nb_thr, gbl_prev, gbl_next)
+      {
+	if ((vaddr >= thr->kernel_stack_guard_addr)
+	    && (vaddr < thr->kernel_stack_guard_addr + SOS_PAGE_SIZE))
+	  {
+	    found = thr;
+	    break;
+	  }
+      }
+  sos_restore_IRQs(flags);
+
+  return found;
 }
 
 
@@ -275,17 +604,13 @@ static sos_ret_t _switch_to_next_thread(switch_type_t operation)
   /* Avoid context switch if the context does not change */
   if (myself != next_thread)
     {
-      /* Sanity checks for the next thread */
-      sos_cpu_state_detect_kernel_stack_overflow(next_thread->cpu_state,
-						 next_thread->kernel_stack_base_addr,
-						 next_thread->kernel_stack_size);
-
-
       /*
-       * Actual CPU context switch
+       * Actual CPU context switch. No need to check the stack of the
+       * next thread for an overflow: it would have faulted on its
+       * guard page
        */
       _set_current(next_thread);
-      sos_cpu_context_switch(& myself->cpu_state, next_thread->cpu_state);
+      sos_cpu_kstate_switch(& myself->cpu_state, next_thread->cpu_state);
       
       /* Back here ! */
       SOS_ASSERT_FATAL(current_thread == myself);
@@ -301,11 +626,69 @@ static sos_ret_t _switch_to_next_thread(switch_type_t operation)
 }
 
 
+sos_ret_t sos_thread_set_cpu_affinity(struct sos_thread *thr,
+				      sos_ui32_t cpu_mask)
+{
+  sos_ui32_t flags;
+  sos_ret_t retval;
+
+  if (! thr)
+    thr = (struct sos_thread*)current_thread;
+
+  sos_disable_IRQs(flags);
+  retval = sos_sched_set_affinity(thr, cpu_mask);
+  sos_restore_IRQs(flags);
+  if (SOS_OK != retval)
+    return retval;
+
+  /* Move to an allowed CPU */
+  if ((thr == current_thread)
+      && !(cpu_mask & SOS_SCHED_CPU(sos_smp_get_cpu_id())))
+    retval = sos_thread_yield();
+
+  return retval;
+}
+
+
+sos_ret_t sos_thread_set_priority(struct sos_thread *thr,
+				  sos_sched_priority_t priority)
+{
+  sos_ui32_t flags;
+  sos_ret_t retval;
+
+  if (! SOS_SCHED_PRIO_IS_VALID(priority))
+    return -SOS_EINVAL;
+
+  if (! thr)
+    thr = (struct sos_thread*)current_thread;
+
+  sos_disable_IRQs(flags);
+  thr->base_priority = priority;
+  /* The effective priority also depends on the mutexes held */
+  retval = sos_kmutex_update_priority(thr);
+  sos_restore_IRQs(flags);
+
+  return retval;
+}
+
+
+sos_sched_priority_t sos_thread_get_priority(struct sos_thread *thr)
+{
+  if (! thr)
+    thr = (struct sos_thread*)current_thread;
+
+  return thr->priority;
+}
+
+
 sos_ret_t sos_thread_yield()
 {
   sos_ui32_t flags;
   sos_ret_t retval;
 
+  /* Let the other CPUs waiting to enter the kernel do so */
+  sos_bkl_yield();
+
   sos_disable_IRQs(flags);
 
   retval = _switch_to_next_thread(YIELD_MYSELF);
@@ -25,11 +25,15 @@
  */
 
 #include <os/errno.h>
+#include <os/lockdep.h>
+#include <os/physmem.h>
 
 /* Forward declaration */
 struct sos_thread;
+struct sos_kmutex;
 
 #include <hwcore/cpu_context.h>
+#include <hwcore/fpu.h>
 #include <os/sched.h>
 #include <os/kwaitq.h>
 #include <os/time.h>
@@ -84,10 +88,31 @@ struct sos_thread
    */
   struct sos_cpu_state *cpu_state;
 
+  /** x87/SSE context, switched lazily (see hwcore/fpu.h) */
+  struct sos_fpu_state fpu_state;
+
   /* Kernel stack parameters */
   sos_vaddr_t kernel_stack_base_addr;
   sos_size_t  kernel_stack_size;
 
+  /** Unmapped page right below the stack, or 0 for the stacks not
+      allocated by thread.c (bootstrap and AP stacks) */
+  sos_vaddr_t kernel_stack_guard_addr;
+
+  /** CPUs allowed to run the thread (see sched.h) */
+  sos_ui32_t cpu_affinity;
+
+  /** CPU whose ready queue holds the thread, or that last ran it */
+  sos_ui32_t sched_cpu;
+
+  /** Priority given by sos_thread_set_priority() */
+  sos_sched_priority_t base_priority;
+
+  /** Priority used by the scheduler: the base priority, raised while
+      higher priority threads wait for a mutex held by this thread
+      (priority inheritance, see ksynch.c) */
+  sos_sched_priority_t priority;
+
   /* Data specific to each state */
   union
   {
@@ -109,6 +134,22 @@ struct sos_thread
   struct sos_kwaitq_entry *kwaitq_list;
 
 
+  /**
+   * Data used by the kmutex subsystem: the mutexes held by the
+   * thread, and the mutex it is waiting for (if any)
+   */
+  struct sos_kmutex *kmutex_held_list;
+  struct sos_kmutex *kmutex_blocked_on;
+
+
+#ifdef SOS_LOCKDEP
+  /** Classes of the locks held, in the order they were taken (see
+      lockdep.h) */
+  sos_lockdep_class_t lockdep_held[SOS_LOCKDEP_MAX_HELD];
+  sos_ui32_t lockdep_nb_held;
+#endif
+
+
   /**
    * Chaining pointers for global ("gbl") list of threads (debug)
    */
@@ -133,7 +174,24 @@ sos_ret_t sos_thread_subsystem_setup(sos_vaddr_t init_thread_stack_base_addr,
 
 
 /**
- * Create a new kernel thread
+ * Initialize the thread running the boot code of an application
+ * processor (see hwcore/smp.h) so that it can be handled the same way
+ * as an ordinary thread: it becomes the idle thread of this CPU. MUST
+ * be called with the big kernel lock held.
+ */
+sos_ret_t sos_thread_cpu_setup(sos_vaddr_t stack_base_addr,
+			       sos_size_t stack_size);
+
+
+/**
+ * The default size of the stack of a kernel thread
+ */
+#define SOS_THREAD_KERNEL_STACK_SIZE (1*SOS_PAGE_SIZE)
+
+
+/**
+ * Create a new kernel thread, with a stack of
+ * SOS_THREAD_KERNEL_STACK_SIZE bytes
  */
 struct sos_thread *
 sos_create_kernel_thread(const char *name,
@@ -141,6 +199,96 @@ sos_create_kernel_thread(const char *name,
 			 void *start_arg);
 
 
+/**
+ * Create a new kernel thread with a stack of the given size (rounded
+ * up to a number of pages). The stack is allocated in its own kernel
+ * virtual range, above an unmapped guard page: an overflow is caught
+ * by the page fault handler (or the double fault task, when the
+ * overflow is due to the stack pointer itself).
+ */
+struct sos_thread *
+sos_create_kernel_thread_with_stack(const char *name,
+				    sos_kernel_thread_start_routine_t start_func,
+				    void *start_arg,
+				    sos_size_t stack_size);
+
+
+/**
+ * The default maximum number of deleted threads whose structure and
+ * stack are kept for the next thread creations (see
+ * sos_thread_set_pool_high_water())
+ */
+#define SOS_THREAD_POOL_HIGH_WATER 16
+
+
+/**
+ * Statistics of the pool of deleted threads
+ */
+struct sos_thread_pool_stats
+{
+  sos_ui32_t nb_pooled; /**< Structures and stacks currently kept */
+  sos_ui32_t nb_hits;   /**< Creations that reused one of them */
+  sos_ui32_t nb_misses; /**< Creations that had to allocate them */
+};
+
+
+/**
+ * Change the maximum number of deleted threads whose structure and
+ * stack are kept in a pool, ready to be reused by the next thread
+ * creations with the same stack size. The excess is freed at once; 0
+ * disables the pool.
+ */
+sos_ret_t sos_thread_set_pool_high_water(sos_ui32_t high_water);
+
+
+/**
+ * Get the statistics of the pool of deleted threads
+ */
+sos_ret_t sos_thread_get_pool_stats(struct sos_thread_pool_stats *stats);
+
+
+/**
+ * Create the idle thread of the current CPU: it is never in the ready
+ * queue, the scheduler elects it when there is nothing else to run
+ * (see sched.h). Its start routine MUST NOT block nor return.
+ */
+struct sos_thread *
+sos_create_idle_thread(const char *name,
+		       sos_kernel_thread_start_routine_t start_func,
+		       void *start_arg);
+
+
+/**
+ * Restrict the CPUs allowed to run the given thread (NULL for the
+ * current thread), see sched.h. When the current CPU is not allowed
+ * anymore, the current thread moves at once to an allowed one.
+ *
+ * @param cpu_mask Combination of SOS_SCHED_CPU() masks
+ */
+sos_ret_t sos_thread_set_cpu_affinity(struct sos_thread *thr,
+				      sos_ui32_t cpu_mask);
+
+
+/**
+ * Change the base priority of the given thread (NULL for the current
+ * thread), see sched.h. While the thread holds a mutex that higher
+ * priority threads are waiting for, it keeps running with their
+ * priority. A thread is created with SOS_SCHED_PRIO_DEFAULT.
+ *
+ * @note Since there is no preemption, the change is taken into
+ * account at the next reschedule
+ */
+sos_ret_t sos_thread_set_priority(struct sos_thread *thr,
+				  sos_sched_priority_t priority);
+
+
+/**
+ * @return the priority of the given thread (NULL for the current
+ * thread) used by the scheduler, ie including the inherited one
+ */
+sos_sched_priority_t sos_thread_get_priority(struct sos_thread *thr);
+
+
 /**
  * Terminate the execution of the current thread. For kernel threads,
  * it is called by default when the start routine returns.
@@ -149,8 +297,16 @@ void sos_thread_exit() __attribute__((noreturn));
 
 
 /**
- * Get the identifier of the thread currently running on CPU. Trivial
- * function.
+ * @return the thread whose stack guard page contains the given
+ * address, or NULL. For the page fault handler: an access to a
+ * guard page means a kernel stack overflow.
+ */
+struct sos_thread *sos_thread_lookup_stack_guard(sos_vaddr_t vaddr);
+
+
+/**
+ * Get the identifier of the thread currently running on the current
+ * CPU. Trivial function.
  */
 struct sos_thread *sos_thread_get_current();
 
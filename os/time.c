@@ -19,7 +19,11 @@
 #include <os/assert.h>
 #include <lib/klibc.h>
 #include <hwcore/irq.h>
+#include <hwcore/spinlock.h>
+#include <hwcore/tsc.h>
 #include <os/list.h>
+#include <os/ksynch.h>
+#include <os/softirq.h>
 
 #include "time.h"
 
@@ -31,14 +35,55 @@
 
 
 /**
- * The list of timeout actions waiting for a timeout. The timeout
- * actions are stored in the list in increasing initial timeout
- * order. Actually, the "timeout" field won't reflect this initial
- * timeout: for each element in the list, it stores the timeout
- * _difference_ between the timeout action and the previous in the
- * list.
+ * The timeout actions are stored in a hierarchical timer wheel
+ * indexed by the tick count, so that adding/removing an action is
+ * O(1), and that a timer tick only looks at the bucket of the actions
+ * expiring at that tick.
+ *
+ * The root level has 1 bucket per tick for the next 256 ticks. Each
+ * upper level has 64 buckets, each one covering 64 times the range of
+ * a bucket of the level below. Once every 256 ticks, the upper level
+ * bucket for the next 256 ticks is "cascaded" (ie its actions are
+ * re-inserted into the lower levels), and so on for the levels
+ * above. Actions further than the range of the wheel (2^26 ticks,
+ * ~7.7 days at 100Hz) are queued at the far end of the wheel and
+ * re-inserted when they get there.
+ */
+#define TMO_WHEEL_ROOT_BITS  8
+#define TMO_WHEEL_ROOT_SIZE  (1UL << TMO_WHEEL_ROOT_BITS)
+#define TMO_WHEEL_ROOT_MASK  (TMO_WHEEL_ROOT_SIZE - 1)
+#define TMO_WHEEL_LVL_BITS   6
+#define TMO_WHEEL_LVL_SIZE   (1UL << TMO_WHEEL_LVL_BITS)
+#define TMO_WHEEL_LVL_MASK   (TMO_WHEEL_LVL_SIZE - 1)
+#define TMO_WHEEL_NB_LVL     3
+#define TMO_WHEEL_LVL_SHIFT(lvl) \
+  (TMO_WHEEL_ROOT_BITS + (lvl)*TMO_WHEEL_LVL_BITS)
+#define TMO_WHEEL_MAX_DELTA \
+  ((1UL << TMO_WHEEL_LVL_SHIFT(TMO_WHEEL_NB_LVL)) - 1)
+
+static struct sos_timeout_action *tmo_wheel_root[TMO_WHEEL_ROOT_SIZE];
+static struct sos_timeout_action
+  *tmo_wheel_lvl[TMO_WHEEL_NB_LVL][TMO_WHEEL_LVL_SIZE];
+
+
+/**
+ * Number of timer ticks since boot, ie index of the current tick in
+ * the timer wheel
  */
-static struct sos_timeout_action *timeout_action_list;
+static sos_ui32_t tmo_wheel_tick;
+
+
+/**
+ * Number of timer ticks not yet processed by the timer softirq, ie
+ * not yet reflected in tmo_wheel_tick
+ */
+static sos_ui32_t tmo_ticks_pending;
+
+
+/**
+ * Statistics of the timeout actions
+ */
+static struct sos_time_stats time_stats;
 
 
 /**
@@ -53,12 +98,33 @@ static struct sos_time tick_resolution;
  * @note No 'volatile' here because the tick value is NEVER modified
  * while in any of the functions below: it is modified only out of
  * these functions by the IRQ timer handler because these functions
- * are protected against timer IRQ and are "one shot" (no busy waiting
- * for a change in the tick's value).
+ * hold the time_lock, or retry with the time_seqlock, and are "one
+ * shot" (no busy waiting for a change in the tick's value).
  */
 static struct sos_time last_tick_time;
 
 
+/**
+ * Value of the CPU cycle counter at the last timer tick
+ */
+static sos_ui64_t last_tick_tsc;
+
+
+/**
+ * Protects the timer wheel and the time variables above, against the
+ * other CPUs and the timer IRQ
+ */
+static struct sos_spinlock time_lock;
+
+
+/**
+ * Lets sos_time_get_now() and friends read the time variables above
+ * without the time_lock. Updated with the time_lock held and the IRQs
+ * disabled
+ */
+static struct sos_kseqlock time_seqlock;
+
+
 sos_ret_t sos_time_inc(struct sos_time *dest,
 		       const struct sos_time *to_add)
 {
@@ -125,24 +191,41 @@ sos_bool_t sos_time_is_zero(const struct sos_time *tm)
 }
 
 
+static void time_softirq(void);
+
+
 sos_ret_t sos_time_subsysem_setup(const struct sos_time *initial_resolution)
 {
-  timeout_action_list = NULL;
+  /* The timer wheel only handles sub-second resolutions */
+  if ((initial_resolution->sec != 0) || (initial_resolution->nanosec == 0))
+    return -SOS_EINVAL;
+
+  sos_spin_init(& time_lock, "time");
+  sos_kseqlock_init(& time_seqlock);
+  memset(tmo_wheel_root, 0x0, sizeof(tmo_wheel_root));
+  memset(tmo_wheel_lvl, 0x0, sizeof(tmo_wheel_lvl));
+  tmo_wheel_tick = 0;
+  tmo_ticks_pending = 0;
+  memset(& time_stats, 0x0, sizeof(time_stats));
   last_tick_time = (struct sos_time) { .sec = 0, .nanosec = 0 };
+  last_tick_tsc  = sos_tsc_read();
   memcpy(& tick_resolution, initial_resolution, sizeof(struct sos_time));
 
-  return SOS_OK;
+  return sos_softirq_set_routine(SOS_SOFTIRQ_TIMER, time_softirq);
 }
 
 
 sos_ret_t sos_time_get_tick_resolution(struct sos_time *resolution)
 {
-  sos_ui32_t flags;
-  sos_disable_IRQs(flags);
+  sos_ui32_t seq;
 
-  memcpy(resolution, & tick_resolution, sizeof(struct sos_time));
+  do
+    {
+      seq = sos_kseqlock_read_begin(& time_seqlock);
+      memcpy(resolution, & tick_resolution, sizeof(struct sos_time));
+    }
+  while (sos_kseqlock_read_retry(& time_seqlock, seq));
 
-  sos_restore_IRQs(flags);
   return SOS_OK; 
 }
 
@@ -151,9 +234,15 @@ sos_ret_t sos_time_set_tick_resolution(const struct sos_time *resolution)
 {
   sos_ui32_t flags;
 
-  sos_disable_IRQs(flags);
+  /* The timer wheel only handles sub-second resolutions */
+  if ((resolution->sec != 0) || (resolution->nanosec == 0))
+    return -SOS_EINVAL;
+
+  sos_spin_lock_irqsave(& time_lock, flags);
+  sos_kseqlock_write_begin(& time_seqlock);
   memcpy(& tick_resolution, resolution, sizeof(struct sos_time));
-  sos_restore_IRQs(flags);
+  sos_kseqlock_write_end(& time_seqlock);
+  sos_spin_unlock_irqrestore(& time_lock, flags);
 
   return SOS_OK;
 }
@@ -161,19 +250,133 @@ sos_ret_t sos_time_set_tick_resolution(const struct sos_time *resolution)
 
 sos_ret_t sos_time_get_now(struct sos_time *now)
 {
-  sos_ui32_t flags;
-  sos_disable_IRQs(flags);
+  sos_ui32_t seq;
 
-  memcpy(now, & last_tick_time, sizeof(struct sos_time));
+  do
+    {
+      seq = sos_kseqlock_read_begin(& time_seqlock);
+      memcpy(now, & last_tick_time, sizeof(struct sos_time));
+    }
+  while (sos_kseqlock_read_retry(& time_seqlock, seq));
 
-  sos_restore_IRQs(flags);
   return SOS_OK;  
 }
 
 
+sos_ret_t sos_time_get_now_precise(struct sos_time *now)
+{
+  struct sos_time elapsed;
+  sos_ui64_t tick_tsc, elapsed_ns;
+  sos_ui32_t seq, resolution_ns;
+
+  do
+    {
+      seq = sos_kseqlock_read_begin(& time_seqlock);
+      memcpy(now, & last_tick_time, sizeof(struct sos_time));
+      tick_tsc      = last_tick_tsc;
+      resolution_ns = tick_resolution.nanosec;
+    }
+  while (sos_kseqlock_read_retry(& time_seqlock, seq));
+
+  elapsed_ns = sos_tsc_cycles_to_ns(sos_tsc_read() - tick_tsc);
+
+  /* Don't go beyond the next tick, even if it is late */
+  if (elapsed_ns >= resolution_ns)
+    elapsed_ns = resolution_ns - 1;
+
+  elapsed = (struct sos_time) { .sec = 0, .nanosec = elapsed_ns };
+  sos_time_inc(now, & elapsed);
+  return SOS_OK;
+}
+
+
 /**
- * Helper routine to add the action in the list. MUST be called with
- * interrupts disabled !
+ * Helper routine to compute the number of ticks (>= 1) from the
+ * current tick to the first tick not before the given date. Dates
+ * beyond the range of the timer wheel are clamped to the wheel
+ * range. MUST be called with the time_lock held !
+ */
+static sos_ui32_t _ticks_until(const struct sos_time *date)
+{
+  struct sos_time delta;
+  sos_ui32_t ticks_per_sec, nb_ticks;
+
+  if (sos_time_cmp(date, & last_tick_time) <= 0)
+    return 1;
+
+  memcpy(& delta, date, sizeof(struct sos_time));
+  sos_time_dec(& delta, & last_tick_time);
+
+  /* Might be under-estimated when the resolution does not divide 1s:
+     sos_time_do_tick() re-inserts the actions fired too early */
+  ticks_per_sec = NS_IN_SEC / tick_resolution.nanosec;
+  if (delta.sec >= TMO_WHEEL_MAX_DELTA / ticks_per_sec)
+    return TMO_WHEEL_MAX_DELTA;
+
+  nb_ticks  = delta.sec * ticks_per_sec;
+  nb_ticks += (delta.nanosec + tick_resolution.nanosec - 1)
+	      / tick_resolution.nanosec;
+  if (nb_ticks < 1)
+    nb_ticks = 1;
+  else if (nb_ticks > TMO_WHEEL_MAX_DELTA)
+    nb_ticks = TMO_WHEEL_MAX_DELTA;
+
+  return nb_ticks;
+}
+
+
+/**
+ * Helper routine to queue the action in the timer wheel bucket
+ * corresponding to the given expiry tick. MUST be called with the
+ * time_lock held !
+ */
+static void _wheel_insert(struct sos_timeout_action *act,
+			  sos_ui32_t expires)
+{
+  sos_ui32_t delta = expires - tmo_wheel_tick;
+  struct sos_timeout_action **bucket;
+
+  if (delta < TMO_WHEEL_ROOT_SIZE)
+    bucket = & tmo_wheel_root[expires & TMO_WHEEL_ROOT_MASK];
+  else
+    {
+      int lvl;
+
+      /* Beyond the wheel range: queue it at the far end of the wheel */
+      if (delta > TMO_WHEEL_MAX_DELTA)
+	expires = tmo_wheel_tick + TMO_WHEEL_MAX_DELTA;
+
+      for (lvl = 0 ; lvl < TMO_WHEEL_NB_LVL - 1 ; lvl ++)
+	if (delta < (1UL << TMO_WHEEL_LVL_SHIFT(lvl + 1)))
+	  break;
+
+      bucket = & tmo_wheel_lvl[lvl][(expires >> TMO_WHEEL_LVL_SHIFT(lvl))
+				    & TMO_WHEEL_LVL_MASK];
+    }
+
+  act->tmo_expires = expires;
+  act->tmo_bucket  = bucket;
+  list_add_tail_named(*bucket, act, tmo_prev, tmo_next);
+}
+
+
+/**
+ * Helper routine to re-insert all the actions of an upper level
+ * bucket into the lower levels of the wheel. MUST be called with the
+ * time_lock held !
+ */
+static void _wheel_cascade(struct sos_timeout_action **bucket)
+{
+  struct sos_timeout_action *act;
+
+  list_collapse_named(*bucket, act, tmo_prev, tmo_next)
+    _wheel_insert(act, act->tmo_expires);
+}
+
+
+/**
+ * Helper routine to add the action in the timer wheel. MUST be called
+ * with the time_lock held !
  */
 static sos_ret_t _add_action(struct sos_timeout_action *act,
 			     const struct sos_time *due_date,
@@ -181,9 +384,6 @@ static sos_ret_t _add_action(struct sos_timeout_action *act,
 			     sos_timeout_routine_t *routine,
 			     void *routine_data)
 {
-  struct sos_timeout_action *other, *insert_before;
-  int nb_act;
-
   /* Delay must be specified */
   if (due_date == NULL)
     return -SOS_EINVAL;
@@ -223,28 +423,8 @@ static sos_ret_t _add_action(struct sos_timeout_action *act,
   act->routine      = routine;
   act->routine_data = routine_data;
 
-  /* Find the right place in the list of the timeout action. */
-  insert_before = NULL;
-  list_foreach_forward_named(timeout_action_list,
-			     other, nb_act,
-			     tmo_prev, tmo_next)
-    {
-      if (sos_time_cmp(& act->timeout, & other->timeout) < 0)
-	{
-	  insert_before = other;
-	  break;
-	}
-
-      /* Loop over to next timeout */
-    }
-
-  /* Now insert the action in the list */
-  if (insert_before != NULL)
-    list_insert_before_named(timeout_action_list, insert_before, act,
-			    tmo_prev, tmo_next);
-  else
-    list_add_tail_named(timeout_action_list, act,
-			tmo_prev, tmo_next);
+  /* Queue the action in the timer wheel */
+  _wheel_insert(act, tmo_wheel_tick + _ticks_until(& act->timeout));
 
   return SOS_OK;  
 }
@@ -259,9 +439,9 @@ sos_time_register_action_relative(struct sos_timeout_action *act,
   sos_ui32_t flags;
   sos_ret_t retval;
 
-  sos_disable_IRQs(flags);
+  sos_spin_lock_irqsave(& time_lock, flags);
   retval = _add_action(act, delay, TRUE, routine, routine_data);
-  sos_restore_IRQs(flags);
+  sos_spin_unlock_irqrestore(& time_lock, flags);
 
   return retval;
 }
@@ -276,17 +456,17 @@ sos_time_register_action_absolute(struct sos_timeout_action *act,
   sos_ui32_t flags;
   sos_ret_t retval;
 
-  sos_disable_IRQs(flags);
+  sos_spin_lock_irqsave(& time_lock, flags);
   retval = _add_action(act, date, FALSE, routine, routine_data);
-  sos_restore_IRQs(flags);
+  sos_spin_unlock_irqrestore(& time_lock, flags);
 
   return retval;
 }
 
 
 /**
- * Helper routine to remove the action from the list. MUST be called
- * with interrupts disabled !
+ * Helper routine to remove the action from the timer wheel. MUST be
+ * called with the time_lock held !
  */
 static sos_ret_t _remove_action(struct sos_timeout_action *act)
 {
@@ -300,10 +480,11 @@ static sos_ret_t _remove_action(struct sos_timeout_action *act)
   else
     sos_time_dec(& act->timeout, & last_tick_time);
 
-  /* Actually remove the action from the list */
-  list_delete_named(timeout_action_list, act,
+  /* Actually remove the action from its wheel bucket */
+  list_delete_named(*act->tmo_bucket, act,
 		    tmo_prev, tmo_next);
   act->tmo_prev = act->tmo_next = NULL;
+  act->tmo_bucket = NULL;
 
   return SOS_OK;  
 }
@@ -314,9 +495,9 @@ sos_ret_t sos_time_unregister_action(struct sos_timeout_action *act)
   sos_ret_t retval;
   sos_ui32_t flags;
 
-  sos_disable_IRQs(flags);
+  sos_spin_lock_irqsave(& time_lock, flags);
   retval = _remove_action(act);
-  sos_restore_IRQs(flags);
+  sos_spin_unlock_irqrestore(& time_lock, flags);
 
   return SOS_OK;  
 }
@@ -325,31 +506,115 @@ sos_ret_t sos_time_unregister_action(struct sos_timeout_action *act)
 sos_ret_t sos_time_do_tick()
 {
   sos_ui32_t flags;
-  
-  sos_disable_IRQs(flags);
+
+  sos_spin_lock_irqsave(& time_lock, flags);
 
   /* Update kernel time */
+  sos_kseqlock_write_begin(& time_seqlock);
   sos_time_inc(& last_tick_time, & tick_resolution);
+  last_tick_tsc = sos_tsc_read();
+  sos_kseqlock_write_end(& time_seqlock);
+
+  /* The timer wheel is moved forward by the timer softirq */
+  tmo_ticks_pending ++;
+
+  sos_spin_unlock_irqrestore(& time_lock, flags);
+
+  return sos_softirq_raise(SOS_SOFTIRQ_TIMER);
+}
+
+
+/**
+ * Timer softirq: moves the timer wheel forward by the ticks elapsed
+ * since its last run, calling the expired actions. The IRQs are
+ * enabled again between two actions.
+ */
+static void time_softirq(void)
+{
+  struct sos_timeout_action **bucket;
+  sos_ui32_t flags, idx;
 
-  while (! list_is_empty_named(timeout_action_list, tmo_prev, tmo_next))
+  sos_spin_lock_irqsave(& time_lock, flags);
+
+  while (tmo_ticks_pending > 0)
     {
-      struct sos_timeout_action *act;
-      act = list_get_head_named(timeout_action_list, tmo_prev, tmo_next);
+      tmo_ticks_pending --;
+      tmo_wheel_tick ++;
 
-      /* Did we go too far in the actions' list ? */
-      if (sos_time_cmp(& last_tick_time, & act->timeout) < 0)
+      /* Once every 256 ticks, cascade the upper level buckets covering
+	 the next ticks down into the lower levels */
+      idx = tmo_wheel_tick & TMO_WHEEL_ROOT_MASK;
+      if (0 == idx)
 	{
-	  /* Yes: No need to look further. */
-	  break;
+	  int lvl;
+	  for (lvl = 0 ; lvl < TMO_WHEEL_NB_LVL ; lvl ++)
+	    {
+	      sos_ui32_t slot = (tmo_wheel_tick >> TMO_WHEEL_LVL_SHIFT(lvl))
+				 & TMO_WHEEL_LVL_MASK;
+	      _wheel_cascade(& tmo_wheel_lvl[lvl][slot]);
+
+	      /* The level above has to be cascaded only when this level
+		 wrapped around */
+	      if (slot != 0)
+		break;
+	    }
 	}
 
-      /* Remove the action from the list */
-      _remove_action(act);
-
-      /* Call the action's routine */
-      act->routine(act);
+      /* Call the actions of the bucket for this tick */
+      bucket = & tmo_wheel_root[idx];
+      while (! list_is_empty_named(*bucket, tmo_prev, tmo_next))
+	{
+	  struct sos_timeout_action *act;
+	  sos_ui64_t cycles;
+
+	  act = list_get_head_named(*bucket, tmo_prev, tmo_next);
+
+	  /* Was the action clamped to the wheel range or queued with an
+	     under-estimated number of ticks ? */
+	  if (sos_time_cmp(& last_tick_time, & act->timeout) < 0)
+	    {
+	      /* Yes: queue it again further in the wheel */
+	      list_delete_named(*bucket, act, tmo_prev, tmo_next);
+	      _wheel_insert(act, tmo_wheel_tick
+			    + _ticks_until(& act->timeout));
+	      continue;
+	    }
+
+	  /* Remove the action from the wheel */
+	  _remove_action(act);
+
+	  /* Call the action's routine, which may register actions
+	     again: without the lock, but still with IRQs disabled */
+	  sos_spin_unlock(& time_lock);
+	  cycles = sos_tsc_read();
+	  act->routine(act);
+	  cycles = sos_tsc_read() - cycles;
+
+	  /* Let the pending IRQs in before the next action */
+	  sos_restore_IRQs(flags);
+	  sos_spin_lock_irqsave(& time_lock, flags);
+
+	  time_stats.nb_actions ++;
+	  time_stats.total_action_cycles += cycles;
+	  if (cycles > time_stats.max_action_cycles)
+	    time_stats.max_action_cycles = cycles;
+	}
     }
 
-  sos_restore_IRQs(flags);
+  sos_spin_unlock_irqrestore(& time_lock, flags);
+}
+
+
+sos_ret_t sos_time_get_stats(struct sos_time_stats *stats)
+{
+  sos_ui32_t flags;
+
+  if (! stats)
+    return -SOS_EINVAL;
+
+  sos_spin_lock_irqsave(& time_lock, flags);
+  *stats = time_stats;
+  sos_spin_unlock_irqrestore(& time_lock, flags);
+
   return SOS_OK;
 }
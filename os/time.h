@@ -64,7 +64,8 @@ sos_bool_t sos_time_is_zero(const struct sos_time *tm);
  * Initialize kernel time subsystem.
  *
  * @param initial_resolution The initial time resolution. MUST be
- * consistent with that of the hardware timer
+ * consistent with that of the hardware timer, and MUST be non-zero
+ * and smaller than 1 second
  */
 sos_ret_t sos_time_subsysem_setup(const struct sos_time *initial_resolution);
 
@@ -80,7 +81,8 @@ sos_ret_t sos_time_get_tick_resolution(struct sos_time *resolution);
  * Change the value of the interval between 2 time ticks. Must be
  * called each time the hardware timer is reconfigured.
  *
- * @note MUST be consistent with that of the hardware timer
+ * @note MUST be consistent with that of the hardware timer, and MUST
+ * be non-zero and smaller than 1 second
  */
 sos_ret_t sos_time_set_tick_resolution(const struct sos_time *resolution);
 
@@ -93,6 +95,16 @@ sos_ret_t sos_time_set_tick_resolution(const struct sos_time *resolution);
 sos_ret_t sos_time_get_now(struct sos_time *now);
 
 
+/**
+ * Same as sos_time_get_now(), but with the time elapsed since the
+ * last tick interpolated from the CPU cycle counter (see
+ * hwcore/tsc.h). Always smaller than the time of the next tick, so
+ * that the returned time is monotonic. Same as sos_time_get_now() when
+ * there is no usable TSC.
+ */
+sos_ret_t sos_time_get_now_precise(struct sos_time *now);
+
+
 
 /* =======================================================================
  * Routines to schedule future execution of routines: "timeout" actions
@@ -102,7 +114,8 @@ sos_ret_t sos_time_get_now(struct sos_time *now);
 struct sos_timeout_action;
 
 /**
- * Prototype of a timeout routine. Called with IRQ disabled !
+ * Prototype of a timeout routine. Called with IRQ disabled, from the timer
+ * softirq (see softirq.h) !
  */
 typedef void (sos_timeout_routine_t)(struct sos_timeout_action *);
 
@@ -134,6 +147,14 @@ struct sos_timeout_action
    */
   struct sos_time           timeout;
 
+  /** PRIVATE: Tick count at which the action is due in the timer
+      wheel (might be earlier than the real due date for actions
+      beyond the range of the wheel) */
+  sos_ui32_t                tmo_expires;
+
+  /** PRIVATE: The timer wheel bucket the action is queued in */
+  struct sos_timeout_action **tmo_bucket;
+
   /** PRIVATE: To chain the timeout actions */
   struct sos_timeout_action *tmo_prev, *tmo_next;
 };
@@ -212,11 +233,39 @@ sos_ret_t sos_time_unregister_action(struct sos_timeout_action *act);
 
 
 /**
- * Timer IRQ callback. Call and remove expired actions from the list.
+ * Timer IRQ callback. Updates the kernel time and raises the timer
+ * softirq (see softirq.h), which calls and removes the expired
+ * actions from the timer wheel on exit from the IRQ handler, with the
+ * IRQs enabled between two actions. Only the wheel bucket of each
+ * elapsed tick is looked at (plus the upper level buckets to
+ * cascade, once every 256 ticks). The routines of the actions are
+ * called without the time subsystem lock held, so that they may
+ * register actions again.
  *
  * @note The use of this function is RESERVED (to timer IRQ)
  */
 sos_ret_t sos_time_do_tick();
 
 
+/**
+ * Statistics of the timeout actions
+ */
+struct sos_time_stats
+{
+  /** Number of routines called */
+  sos_count_t nb_actions;
+
+  /** Cycles spent in the routines (see tsc.h), ie with the IRQs
+      disabled */
+  sos_ui64_t  total_action_cycles;
+  sos_ui64_t  max_action_cycles;
+};
+
+
+/**
+ * Get the statistics of the timeout actions
+ */
+sos_ret_t sos_time_get_stats(struct sos_time_stats *stats);
+
+
 #endif /* _SOS_TIME_H_ */
@@ -38,6 +38,7 @@ typedef unsigned int       sos_size_t;
 typedef unsigned int       sos_count_t;
  
 /** Low-level sizes */
+typedef unsigned long long int sos_ui64_t; /* 64b unsigned */
 typedef unsigned long int  sos_ui32_t; /* 32b unsigned */
 typedef unsigned short int sos_ui16_t; /* 16b unsigned */
 typedef unsigned char      sos_ui8_t;  /* 8b unsigned */
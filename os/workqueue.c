@@ -0,0 +1,270 @@
+/* Copyright (C) 2026  AbdAllah MEZITI
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+   USA. 
+*/
+
+#include <hwcore/irq.h>
+#include <hwcore/smp.h>
+#include <hwcore/tsc.h>
+#include <lib/klibc.h>
+#include <os/assert.h>
+#include <os/list.h>
+#include <os/kmem_slab.h>
+#include <os/kwaitq.h>
+#include <os/thread.h>
+
+#include "workqueue.h"
+
+
+/**
+ * A unit of work, allocated by sos_work_submit*() and released once
+ * its routine returned
+ */
+struct sos_work
+{
+  sos_work_routine_t *routine;
+  void               *arg;
+
+  /** The CPU whose workers run the work */
+  sos_ui32_t cpu;
+
+  /** Date of the queuing for the workers, to compute the latency */
+  sos_ui64_t queued_tsc;
+
+  /** For the delayed works */
+  struct sos_timeout_action delay_action;
+
+  /** To chain the works waiting for a worker */
+  struct sos_work *prev, *next;
+};
+
+
+/**
+ * The works waiting for the workers of each CPU. Protected by the BKL
+ * and by disabling the IRQs
+ */
+static struct workqueue_cpu
+{
+  /** Works waiting for a worker, in FIFO order */
+  struct sos_work *pending;
+
+  /** The idle workers of the CPU */
+  struct sos_kwaitq idle_workers;
+} workqueue_cpu[SOS_SMP_MAX_CPUS];
+
+
+/** The cache of struct sos_work */
+static struct sos_kslab_cache *cache_work;
+
+/** Protected by the BKL and by disabling the IRQs */
+static struct sos_workqueue_stats workqueue_stats;
+
+/** Per-CPU depth, to compute workqueue_stats.max_depth */
+static sos_count_t workqueue_depth[SOS_SMP_MAX_CPUS];
+
+/** TRUE once the workers are started */
+static sos_bool_t workqueue_ready = FALSE;
+
+
+/**
+ * The loop of the worker threads: run the works of the CPU, and wait
+ * for more when there is none
+ */
+static void workqueue_worker(void *arg)
+{
+  struct workqueue_cpu *wq = (struct workqueue_cpu*) arg;
+  sos_ui32_t cpu = wq - workqueue_cpu;
+
+  while (1)
+    {
+      struct sos_work *work;
+      sos_ui64_t latency;
+      sos_ui32_t flags;
+
+      sos_disable_IRQs(flags);
+      while (list_is_empty(wq->pending))
+	sos_kwaitq_wait_exclusive(& wq->idle_workers, NULL);
+
+      work = list_pop_head(wq->pending);
+      workqueue_depth[cpu] --;
+      workqueue_stats.depth --;
+
+      latency = sos_tsc_read() - work->queued_tsc;
+      workqueue_stats.total_latency_cycles += latency;
+      if (latency > workqueue_stats.max_latency_cycles)
+	workqueue_stats.max_latency_cycles = latency;
+      sos_restore_IRQs(flags);
+
+      work->routine(work->arg);
+      sos_kmem_cache_free((sos_vaddr_t) work);
+
+      sos_disable_IRQs(flags);
+      workqueue_stats.nb_done ++;
+      sos_restore_IRQs(flags);
+    }
+}
+
+
+sos_ret_t sos_workqueue_subsystem_setup(void)
+{
+  sos_ui32_t cpu;
+  int i;
+
+  cache_work = sos_kmem_cache_create("work",
+				     sizeof(struct sos_work),
+				     1,
+				     0,
+				     SOS_KSLAB_CREATE_MAP);
+  if (! cache_work)
+    return -SOS_ENOMEM;
+
+  memset(& workqueue_stats, 0x0, sizeof(workqueue_stats));
+  for (cpu = 0 ; cpu < sos_smp_get_nb_cpus() ; cpu ++)
+    {
+      struct workqueue_cpu *wq = & workqueue_cpu[cpu];
+
+      list_init(wq->pending);
+      SOS_ASSERT_FATAL(SOS_OK == sos_kwaitq_init(& wq->idle_workers,
+						 "workqueue"));
+
+      for (i = 0 ; i < SOS_WORKQUEUE_NB_WORKERS ; i ++)
+	{
+	  char name[SOS_THR_MAX_NAMELEN];
+	  struct sos_thread *worker;
+
+	  snprintf(name, sizeof(name), "[work%d/%d]", (int)cpu, i);
+	  worker = sos_create_kernel_thread(name, workqueue_worker, wq);
+	  if (! worker)
+	    return -SOS_ENOMEM;
+	  SOS_ASSERT_FATAL(SOS_OK
+			   == sos_thread_set_cpu_affinity(worker,
+							  SOS_SCHED_CPU(cpu)));
+	}
+    }
+
+  workqueue_ready = TRUE;
+  return SOS_OK;
+}
+
+
+/**
+ * Helper function to hand over the work to the workers of its
+ * CPU. Called with IRQs disabled.
+ */
+static void work_queue(struct sos_work *work)
+{
+  struct workqueue_cpu *wq = & workqueue_cpu[work->cpu];
+
+  work->queued_tsc = sos_tsc_read();
+  list_add_tail(wq->pending, work);
+
+  workqueue_stats.nb_submitted ++;
+  workqueue_stats.depth ++;
+  workqueue_depth[work->cpu] ++;
+  if (workqueue_depth[work->cpu] > workqueue_stats.max_depth)
+    workqueue_stats.max_depth = workqueue_depth[work->cpu];
+
+  /* A busy worker will find the work anyway once it is done */
+  sos_kwaitq_wakeup(& wq->idle_workers, 1, SOS_OK);
+}
+
+
+/** Timeout routine of the delayed works (called with IRQs disabled) */
+static void work_delay_expired(struct sos_timeout_action *act)
+{
+  work_queue((struct sos_work*) act->routine_data);
+}
+
+
+/**
+ * Helper function to allocate a work for the current CPU
+ */
+static struct sos_work *work_alloc(sos_work_routine_t *routine, void *arg)
+{
+  struct sos_work *work;
+
+  work = (struct sos_work*) sos_kmem_cache_alloc(cache_work,
+						 SOS_KSLAB_ALLOC_ATOMIC);
+  if (! work)
+    return NULL;
+
+  work->routine = routine;
+  work->arg     = arg;
+  work->cpu     = sos_smp_get_cpu_id();
+  return work;
+}
+
+
+sos_ret_t sos_work_submit(sos_work_routine_t *routine, void *arg)
+{
+  struct sos_work *work;
+  sos_ui32_t flags;
+
+  if (! routine)
+    return -SOS_EINVAL;
+  if (! workqueue_ready)
+    return -SOS_EBUSY;
+
+  work = work_alloc(routine, arg);
+  if (! work)
+    return -SOS_ENOMEM;
+
+  sos_disable_IRQs(flags);
+  work_queue(work);
+  sos_restore_IRQs(flags);
+
+  return SOS_OK;
+}
+
+
+sos_ret_t sos_work_submit_delayed(sos_work_routine_t *routine, void *arg,
+				  const struct sos_time *delay)
+{
+  struct sos_work *work;
+  sos_ret_t retval;
+
+  if (! routine || ! delay)
+    return -SOS_EINVAL;
+  if (! workqueue_ready)
+    return -SOS_EBUSY;
+
+  work = work_alloc(routine, arg);
+  if (! work)
+    return -SOS_ENOMEM;
+
+  sos_time_init_action(& work->delay_action);
+  retval = sos_time_register_action_relative(& work->delay_action, delay,
+					     work_delay_expired, work);
+  if (SOS_OK != retval)
+    sos_kmem_cache_free((sos_vaddr_t) work);
+
+  return retval;
+}
+
+
+sos_ret_t sos_workqueue_get_stats(struct sos_workqueue_stats *stats)
+{
+  sos_ui32_t flags;
+
+  if (! stats)
+    return -SOS_EINVAL;
+
+  sos_disable_IRQs(flags);
+  *stats = workqueue_stats;
+  sos_restore_IRQs(flags);
+
+  return SOS_OK;
+}
@@ -0,0 +1,104 @@
+/* Copyright (C) 2026  AbdAllah MEZITI
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+   
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+   USA. 
+*/
+#ifndef _SOS_WORKQUEUE_H_
+#define _SOS_WORKQUEUE_H_
+
+/**
+ * @file workqueue.h
+ *
+ * Kernel workqueue: short units of background work are handed over to
+ * a fixed pool of worker threads on each CPU, instead of creating a
+ * kernel thread for each of them. A work is run by the workers of the
+ * CPU it was submitted on, in FIFO order. Delayed works are first
+ * queued in the timeout list (see time.h).
+ *
+ * The work routines run in thread context: they may block, but a
+ * blocked routine keeps one of the workers of its CPU busy.
+ */
+
+#include <os/types.h>
+#include <os/errno.h>
+#include <os/time.h>
+
+
+/**
+ * The number of worker threads per CPU
+ */
+#define SOS_WORKQUEUE_NB_WORKERS 2
+
+
+/**
+ * The routine of a work, called with the argument given to
+ * sos_work_submit()
+ */
+typedef void (sos_work_routine_t)(void *arg);
+
+
+/** Statistics of the workqueue */
+struct sos_workqueue_stats
+{
+  /** Works submitted (delayed ones once their delay expired) */
+  sos_count_t nb_submitted;
+
+  /** Works whose routine returned */
+  sos_count_t nb_done;
+
+  /** Works currently waiting for a worker, on all the CPUs */
+  sos_count_t depth;
+
+  /** Highest number of works waiting for a worker on a CPU */
+  sos_count_t max_depth;
+
+  /** Cycles between the queuing of the works and the start of their
+      routine (see tsc.h) */
+  sos_ui64_t  total_latency_cycles;
+  sos_ui64_t  max_latency_cycles;
+};
+
+
+/**
+ * Start the workers of all the CPUs online. To be called once the APs
+ * are started (see smp.h)
+ */
+sos_ret_t sos_workqueue_subsystem_setup(void);
+
+
+/**
+ * Queue a call to routine(arg) on the current CPU
+ *
+ * @note May be called from IRQ handlers
+ */
+sos_ret_t sos_work_submit(sos_work_routine_t *routine, void *arg);
+
+
+/**
+ * Queue a call to routine(arg) on the current CPU once the given
+ * delay expired (see sos_time_register_action_relative())
+ *
+ * @note May be called from IRQ handlers
+ */
+sos_ret_t sos_work_submit_delayed(sos_work_routine_t *routine, void *arg,
+				  const struct sos_time *delay);
+
+
+/**
+ * Get the statistics of the workqueue
+ */
+sos_ret_t sos_workqueue_get_stats(struct sos_workqueue_stats *stats);
+
+#endif /* _SOS_WORKQUEUE_H_ */